@@ -9,8 +9,10 @@
 
 #include <vector>
 #include <memory>
+#include <optional>
 
 #include "DatabaseQuery.h"
+#include "SessionPool.h"
 #include "Drawing.h"
 #include "Logger.h"
 #include "DrawingComponentManager.h"
@@ -56,8 +58,10 @@ public:
     /// <param name="user">The username for the connection.</param>
     /// <param name="password">The password for the user specified by the username.</param>
     /// <param name="host">The server to connect to, where the database is located.</param>
+    /// <param name="minSessions">The number of pooled sessions to keep open at all times.</param>
+    /// <param name="maxSessions">The maximum number of pooled sessions open at once, i.e. the number of queries which may run concurrently.</param>
     DatabaseManager(const std::string &database, const std::string &user, const std::string &password,
-        const std::string &host = "localhost");
+        const std::string &host = "localhost", unsigned minSessions = 1, unsigned maxSessions = 8);
 
     /// <summary>
     /// Reads details for a compression schema from the database, such as the maximum mat_id.
@@ -90,13 +94,29 @@ public:
     /// <returns>The full details about the requested drawing from the database.</returns>
     Drawing *executeDrawingQuery(const DrawingRequest &query);
 
+    /// <summary>
+    /// Executes a data retrieval query for several drawings at once, in a single query to the database.
+    /// </summary>
+    /// <param name="query">A request object containing the identifiers of the drawings.</param>
+    /// <returns>The full details about each requested drawing, in the order they were requested. Drawings which
+    /// could not be found have a load warning set. If the query failed, the list is empty.</returns>
+    std::vector<Drawing> executeDrawingBatchQuery(const DrawingBatchRequest &query);
+
+    /// <summary>
+    /// Reads the fields the search index holds for each drawing, as laid out by DrawingSearchIndex::rowQueryString.
+    /// </summary>
+    /// <param name="drawingNumbers">The drawing numbers to read, or nothing to read every drawing.</param>
+    /// <returns>The rows of the query, or nothing if the query failed.</returns>
+    std::optional<std::vector<mysqlx::Row>> searchIndexRows(
+        const std::optional<std::vector<std::string>> &drawingNumbers = std::nullopt);
+
     /// <summary>
     /// Sources all columns and all rows for a particular table.
     /// </summary>
     /// <param name="tableName">The string name of the table we wish to source.</param>
     /// <param name="orderBy">An optional string to order the results from the query.</param>
     /// <returns>The rows from the table.</returns>
-    mysqlx::SqlResult sourceTable(const std::string& tableName, const std::string& orderBy = std::string());
+    std::vector<mysqlx::Row> sourceTable(const std::string& tableName, const std::string& orderBy = std::string());
 
     /// <summary>
     /// Sources multiple tables that are right joined together.
@@ -106,7 +126,7 @@ public:
     /// <param name="common">The name of the field to join upon</param>
     /// <param name="orderBy">An ordering for the returned table</param>
     /// <returns>The rows from the combined table</returns>
-    mysqlx::SqlResult sourceMultipleTable(const std::string& leftTable, const std::string& rightTable, const std::string& common, const std::string& orderBy = std::string());
+    std::vector<mysqlx::Row> sourceMultipleTable(const std::string& leftTable, const std::string& rightTable, const std::string& common, const std::string& orderBy = std::string());
     
     /// <summary>
     /// Sources multiple tables that are right joined together.
@@ -116,7 +136,7 @@ public:
     /// <param name="commons">A pair of strings, joining the left table on the first common and the second table on the second's.</param>
     /// <param name="orderBy">An ordering for the returned table</param>
     /// <returns>The rows from the combined table</returns>
-    mysqlx::SqlResult sourceMultipleTable(const std::string& leftTable, const std::string& rightTable, std::tuple<std::string, std::string> commons, const std::string& orderBy = std::string());
+    std::vector<mysqlx::Row> sourceMultipleTable(const std::string& leftTable, const std::string& rightTable, std::tuple<std::string, std::string> commons, const std::string& orderBy = std::string());
 
     /// <summary>
     /// Inserts a drawing into the database based upon the passed in DrawingInsert object, which contains
@@ -183,6 +203,12 @@ public:
     /// <returns>Whether or not the server is currently connected to the database</returns>
     bool connected() const;
 
+    /// <summary>
+    /// Getter for a snapshot of the session pool's metrics
+    /// </summary>
+    /// <returns>The session pool's current metrics</returns>
+    SessionPool::Metrics sessionPoolMetrics();
+
     /// <summary>
     /// Sets the output error stream to an arbitrary ostream
     /// </summary>
@@ -190,9 +216,10 @@ public:
     //void setErrorStream(std::ostream &stream = std::cerr);
 
 private:
-    // A session object for use during the lifetime of the DatabaseManager object.
-    // This allows the manager to interact with the database.
-    mysqlx::Session sess;
+    // A pool of sessions for use during the lifetime of the DatabaseManager object.
+    // Each operation checks out its own session, so request worker threads can query
+    // the database concurrently.
+    SessionPool sessionPool;
     // The cached username, password and database name for reconnecting if necessary.
     std::string username, password;
     std::string database;
@@ -203,6 +230,19 @@ private:
     // Flag indicating whether or not the database is currently connected.
     bool isConnected;
 
+    // Runs a read only operation on a pooled session. If it fails because the connection was lost,
+    // the broken session is discarded and the operation is retried once on a fresh session.
+    template<typename Operation>
+    auto readWithRetry(Operation &&operation);
+
+    // Builds a query which fetches everything about each drawing matching a condition on the drawings table (d),
+    // as one row per drawing. Every table with more than one row per drawing is aggregated into a JSON array, so
+    // a drawing is loaded in a single round trip.
+    std::string drawingDetailsQueryString(const std::string &condition) const;
+
+    // Assembles a drawing from a row of the drawing details query
+    static Drawing *drawingFromRow(const mysqlx::Row &row);
+
     // Logs an error, e, to the errStream. If safe is set to false, the error will terminate the program.
     //void logError(const mysqlx::Error &e, unsigned lineNumber = -1, bool safe = true);
 
@@ -210,5 +250,20 @@ private:
     //std::string timestamp() const;
 };
 
+template<typename Operation>
+auto DatabaseManager::readWithRetry(Operation &&operation) {
+    try {
+        SessionPool::Lease session = sessionPool.checkout();
+        return operation(*session);
+    } catch (mysqlx::Error &e) {
+        if (!SessionPool::isConnectionError(e)) {
+            throw;
+        }
+        Logger::logError(std::string("Lost connection to database, retrying: ") + e.what(), __LINE__, __FILE__);
+    }
+
+    SessionPool::Lease session = sessionPool.checkout();
+    return operation(*session);
+}
 
 #endif //DATABASE_MANAGER_DATABASEMANAGER_H
@@ -10,8 +10,10 @@
 #include <chrono>
 #include <cstring>
 #include <iomanip>
+#include <memory>
 #include <nlohmann/json.hpp>
 #include <optional>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
@@ -22,6 +24,10 @@
 // Simple macro for returning the minumum of two values
 #define MIN(a, b) (((a) < (b)) ? (a) : (b))
 
+// The most drawings a single DrawingBatchRequest may ask for. Larger requests
+// are rejected, so larger batches should be split across requests.
+#define DRAWING_BATCH_LIMIT 256
+
 /// <summary>
 /// ValueRange
 /// A range of some type of value, such as an integer or a date
@@ -187,6 +193,15 @@ class CORE_API DatabaseSearchQuery : public DatabaseQuery {
   /// with.</returns>
   static DatabaseSearchQuery &deserialise(void *&&data);
 
+  /// <summary>
+  /// Deserialise this object from a data buffer, without taking ownership of
+  /// the buffer
+  /// </summary>
+  /// <param name="data">The buffer to read this object from.</param>
+  /// <returns>A newly constructed query object equivalent to the one the buffer
+  /// was created with.</returns>
+  static DatabaseSearchQuery &deserialise(const void *data);
+
   /// <summary>
   /// Constructs an SQL query string from the search parameters defined in this
   /// object's attributes
@@ -388,6 +403,15 @@ class CORE_API DrawingRequest : public DatabaseQuery {
   /// was created with.</returns>
   static DrawingRequest &deserialise(void *&&data);
 
+  /// <summary>
+  /// Deserialise this object from a data buffer, without taking ownership of
+  /// the buffer
+  /// </summary>
+  /// <param name="data">The buffer to read this object from.</param>
+  /// <returns>A newly constructed query object equivalent to the one the buffer
+  /// was created with.</returns>
+  static DrawingRequest &deserialise(const void *data);
+
   /// <summary>
   /// The database index for the drawing this query is concerned with
   /// </summary>
@@ -411,6 +435,68 @@ class CORE_API DrawingRequest : public DatabaseQuery {
   std::optional<Drawing> drawingData;
 };
 
+/// <summary>
+/// DrawingBatchRequest
+/// Inherits from DatabaseQuery. This type of query requests all the
+/// information about several drawings at once, so that opening a batch of
+/// drawings costs a single request and a single database query rather than
+/// one of each per drawing. It is sent with the matIDs of the drawings, and
+/// the server returns it with drawingData holding one drawing for each matID
+/// it loaded, in the same order.
+/// </summary>
+class CORE_API DrawingBatchRequest : public DatabaseQuery {
+ public:
+  /// <summary>
+  /// Serialise this object into the target buffer
+  /// </summary>
+  /// <param name="target">The buffer to write this serialises object
+  /// into.</param>
+  void serialise(void *target) const override;
+
+  /// <summary>
+  /// Get the serialised size of this object.
+  /// This size will be how many bytes this object will occupy in the buffer.
+  /// </summary>
+  /// <returns>The size the object will occupy.</returns>
+  unsigned int serialisedSize() const override;
+
+  /// <summary>
+  /// Deserialise this object from the data buffer. Throws
+  /// std::invalid_argument if the buffer is malformed, or asks for more than
+  /// DRAWING_BATCH_LIMIT drawings.
+  /// </summary>
+  /// <param name="data">The buffer to read this object from, as a rvalue
+  /// reference to indicate this object takes ownership of the buffer.</param>
+  /// <param name="size">The size of the buffer.</param>
+  /// <returns>A newly constructed query object equivalent to the one the buffer
+  /// was created with.</returns>
+  static DrawingBatchRequest &deserialise(void *&&data, unsigned size);
+
+  /// <summary>
+  /// Deserialise this object from a data buffer, without taking ownership of
+  /// the buffer. Throws std::invalid_argument if the buffer is malformed, or
+  /// asks for more than DRAWING_BATCH_LIMIT drawings.
+  /// </summary>
+  /// <param name="data">The buffer to read this object from.</param>
+  /// <param name="size">The size of the buffer.</param>
+  /// <returns>A newly constructed query object equivalent to the one the buffer
+  /// was created with.</returns>
+  static DrawingBatchRequest &deserialise(const void *data, unsigned size);
+
+  /// <summary>
+  /// The database indices of the drawings this query is concerned with. There
+  /// may be at most DRAWING_BATCH_LIMIT of them.
+  /// </summary>
+  std::vector<unsigned> matIDs;
+
+  /// <summary>
+  /// An optional list of the drawings. This is empty in a request. In a
+  /// response, it holds a drawing for each matID, in the same order. A
+  /// drawing which could not be loaded has the LOAD_FAILED warning set.
+  /// </summary>
+  std::optional<std::vector<Drawing>> drawingData;
+};
+
 /// <summary>
 /// DrawingInsert
 /// Inherits from DatabaseQuery. This type of query is for inserting a new
@@ -491,6 +577,15 @@ class CORE_API DrawingInsert : public DatabaseQuery {
   /// was created with.</returns>
   static DrawingInsert &deserialise(void *&&data);
 
+  /// <summary>
+  /// Deserialise this object from a data buffer, without taking ownership of
+  /// the buffer
+  /// </summary>
+  /// <param name="data">The buffer to read this object from.</param>
+  /// <returns>A newly constructed query object equivalent to the one the buffer
+  /// was created with.</returns>
+  static DrawingInsert &deserialise(const void *data);
+
   /// <summary>
   /// Sets the force of the inserts. True means that, if a drawing exists, the
   /// existing drawing will be deleted completely, and the new insert will take
@@ -1229,6 +1324,15 @@ class CORE_API ComponentInsert : public DatabaseQuery {
   /// object equivalent to the one the buffer was created with.</returns>
   static ComponentInsert &deserialise(void *&&data);
 
+  /// <summary>
+  /// Deserialise this object from a data buffer, without taking ownership of
+  /// the buffer
+  /// </summary>
+  /// <param name="data">The buffer to read this object from.</param>
+  /// <returns>A newly constructed query object equivalent to the one the buffer
+  /// was created with.</returns>
+  static ComponentInsert &deserialise(const void *data);
+
   /// <summary>
   /// Sets the data for the component to be added to the database
   /// </summary>
@@ -1359,6 +1463,15 @@ class CORE_API DatabaseBackup : DatabaseQuery {
   /// object equivalent to the one the buffer was created with.</returns>
   static DatabaseBackup &deserialise(void *&&data);
 
+  /// <summary>
+  /// Deserialise this object from a data buffer, without taking ownership of
+  /// the buffer
+  /// </summary>
+  /// <param name="data">The buffer to read this object from.</param>
+  /// <returns>A newly constructed query object equivalent to the one the buffer
+  /// was created with.</returns>
+  static DatabaseBackup &deserialise(const void *data);
+
   /// <summary>
   /// The response code for this object. Defaults to None indicating that the
   /// object represents a reques.
@@ -1424,6 +1537,15 @@ class CORE_API NextDrawing : DatabaseQuery {
   /// object equivalent to the one the buffer was created with.</returns>
   static NextDrawing &deserialise(void *&&data);
 
+  /// <summary>
+  /// Deserialise this object from a data buffer, without taking ownership of
+  /// the buffer
+  /// </summary>
+  /// <param name="data">The buffer to read this object from.</param>
+  /// <returns>A newly constructed query object equivalent to the one the buffer
+  /// was created with.</returns>
+  static NextDrawing &deserialise(const void *data);
+
   /// <summary>
   /// Realisation of the DrawingType. Defaults to automatic, but should probably
   /// be set explictitly.
@@ -8,9 +8,15 @@
 #include "DatabaseQuery.h"
 #include "../networking/Server.h"
 #include "DrawingComponentManager.h"
+#include "DrawingResponseCache.h"
+#include "SearchResultCache.h"
+#include "DrawingSearchIndex.h"
 
 #include "../../packer.h"
 #include <map>
+#include <mutex>
+#include <shared_mutex>
+#include <functional>
 #include <mysqlx/devapi/result.h>
 
 /// <summary>
@@ -36,8 +42,39 @@ public:
 	/// a response for the server to return to them.</param>
 	/// <param name="message">The message data itself, as a rvalue reference to indicate transfer
 	/// of ownership..</param>
-	/// <param name="messageSize">The length (in bytes) of the message data received.</param>
-	void onMessageReceived(Server &caller, const ClientHandle &clientHandle, void*&& message, unsigned int messageSize) override;
+	void onMessageReceived(Server &caller, const ClientHandle &clientHandle, MessageBuffer &&message) override;
+
+	/// <summary>
+	/// Writes the hit rate and memory use of the drawing and search caches, and the size of the search index.
+	/// </summary>
+	/// <param name="out">The stream to write the statistics to.</param>
+	void writeStats(std::ostream &out) override;
+
+	/// <summary>
+	/// Checks the search index against the database, by searching for every drawing with both and comparing the
+	/// results, so the index can be checked against a live database.
+	/// </summary>
+	/// <param name="caller">A reference to the server running the check.</param>
+	/// <param name="out">The stream to write any differences to.</param>
+	void runChecks(Server &caller, std::ostream &out) override;
+
+	/// <summary>
+	/// Starts loading the search index in the background, so it is ready before the first search. Searches go to
+	/// the database until it has loaded.
+	/// </summary>
+	/// <param name="dbManager">The database to load the index from. Must outlive this handler.</param>
+	void loadSearchIndex(DatabaseManager &dbManager);
+
+	/// <summary>
+	/// Checks whether a request only reads from the database, so the server may handle it in parallel with the
+	/// client's other read only requests. Only searches, drawing details and next drawing numbers qualify.
+	/// Everything else either writes, or changes state the client's later requests depend on (rebuilding a
+	/// source table reassigns the component handles in drawing responses), so it is handled in order.
+	/// </summary>
+	/// <param name="message">The request.</param>
+	/// <param name="messageSize">The size of the request.</param>
+	/// <returns>True if the request only reads.</returns>
+	bool isReadOnly(const void *message, unsigned messageSize) override;
 
 	/// <summary>
 	/// The filepath to create backups under. Should be set in the server's meta file.
@@ -71,6 +108,30 @@ private:
 	// The dirty flag for the compression schema. True if the compression schema needs to be updated the next time
 	// the getter is called
 	bool schemaDirty = true;
+	// Guards the compression schema and its dirty flag, as requests are handled on multiple worker threads
+	std::mutex schemaMutex;
+
+	// Serialised responses for the drawings opened most recently, so opening them again skips the database
+	DrawingResponseCache drawingCache;
+	// Responses to the searches made most recently, so repeating them skips the database
+	SearchResultCache searchCache;
+	// Every drawing's searchable fields, so searches which miss the cache still skip the database
+	DrawingSearchIndex searchIndex;
+
+	// Guards the DrawingComponentManager source tables. Rebuilding a table takes this exclusively, whereas reading
+	// the tables (sending them, or resolving components while reading or writing drawings) takes it shared.
+	std::shared_mutex sourceDataMutex;
+
+	/// <summary>
+	/// Sends the source table for a component type to a client, first rebuilding it if it is dirty.
+	/// The table is only rebuilt by one worker at a time; any others wait and then send the rebuilt table.
+	/// </summary>
+	/// <typeparam name="T">The component type whose source table should be sent.</typeparam>
+	/// <param name="caller">The server to send the table through.</param>
+	/// <param name="clientHandle">The client to send the table to.</param>
+	/// <param name="rebuild">A function which rebuilds the source table (and any tables it depends on).</param>
+	template<typename T>
+	void sendSourceTable(Server &caller, const ClientHandle &clientHandle, const std::function<void()> &rebuild);
 
 	/// <summary>
 	/// TableSourceData
@@ -316,7 +377,7 @@ private:
 	/// </summary>
 	/// <param name="data">The data buffer to read the request type from.</param>
 	/// <returns>The request type from the buffer.</returns>
-	static RequestType getDeserialiseType(void *data);
+	static RequestType getDeserialiseType(const void *data);
 
 	/// <summary>
 	/// Creates source data for the specified type for the DrawingComponentManager.
@@ -326,7 +387,7 @@ private:
 	/// <typeparam name="T">The type for which to create the source data.</typeparam>
 	/// <param name="sourceRows">The row sources from the correct MySQL table.</param>
 	template<typename T> requires std::is_base_of_v<DatabaseRequestHandler::TableSourceData, T>
-	void createSourceData(mysqlx::SqlResult sourceRows) const;
+	void createSourceData(const std::vector<mysqlx::Row> &sourceRows);
 
 	/// <summary>
 	/// Constructs one or more data elements of a given type from a single MySQL row.
@@ -343,7 +404,7 @@ private:
 	/// <param name="sizeValue">The amount of space the element(s) added will occupy in a buffer, so we know how big of a buffer to 
 	/// construct.</param>
 	template<typename T> requires std::is_base_of_v<DatabaseRequestHandler::TableSourceData, T>
-	void constructDataElements(mysqlx::SqlResult sourceRow, unsigned &handle, std::vector<T> &elements, unsigned &sizeValue) const;
+	void constructDataElements(const std::vector<mysqlx::Row> &sourceRows, unsigned &handle, std::vector<T> &elements, unsigned &sizeValue) const;
 
 	/// <summary>
 	/// Writes a single element to the buffer.
@@ -367,9 +428,41 @@ private:
 	constexpr RequestType getRequestType() const;
 };
 
+template<typename T>
+void DatabaseRequestHandler::sendSourceTable(Server &caller, const ClientHandle &clientHandle,
+											 const std::function<void()> &rebuild) {
+	// The table is copied while the lock is held, and only sent once it is released. Sending can block on a slow
+	// client, which would otherwise hold up every request that reads or rebuilds the source tables.
+	auto copySourceData = []() {
+		unsigned char *sourceData = (unsigned char *)DrawingComponentManager<T>::rawSourceData();
+		return std::vector<unsigned char>(sourceData, sourceData + DrawingComponentManager<T>::rawSourceDataSize());
+	};
+
+	std::vector<unsigned char> sourceData;
+	bool copied = false;
+	{
+		std::shared_lock<std::shared_mutex> sourceDataLock(sourceDataMutex);
+		if (!DrawingComponentManager<T>::dirty()) {
+			sourceData = copySourceData();
+			copied = true;
+		}
+	}
+
+	if (!copied) {
+		std::unique_lock<std::shared_mutex> sourceDataLock(sourceDataMutex);
+		// Another worker may have rebuilt the table while we were waiting for the lock
+		if (DrawingComponentManager<T>::dirty()) {
+			rebuild();
+		}
+		sourceData = copySourceData();
+	}
+
+	caller.addMessageToSendQueue(clientHandle, sourceData.data(), sourceData.size());
+}
+
 // Creates all the source data for a given set of rows
 template<typename T> requires std::is_base_of_v<DatabaseRequestHandler::TableSourceData, T>
-void DatabaseRequestHandler::createSourceData(mysqlx::SqlResult sourceRows) const {
+void DatabaseRequestHandler::createSourceData(const std::vector<mysqlx::Row> &sourceRows) {
 	// We statically assert that this is being used on a valid type. If there is an attempt to call this function on a type which does not derive
 	// from TableSourceData, there will be a compiler error.
 	static_assert(std::is_base_of<TableSourceData, T>::value, "Create Source Data can only be called with templates deriving TableSourceData.");
@@ -389,7 +482,7 @@ void DatabaseRequestHandler::createSourceData(mysqlx::SqlResult sourceRows) cons
 
 	// We loop through each row in the source
 		// For each, we construct the data element(s). This is added to the elements list from inside this function.
-	constructDataElements<T>(std::move(sourceRows), handle, elements, bufferSize);
+	constructDataElements<T>(sourceRows, handle, elements, bufferSize);
 
 	// Next we create the source data buffer with the size we have calculated.
 	void *sourceBuffer = malloc(bufferSize);
@@ -421,6 +514,11 @@ void DatabaseRequestHandler::createSourceData(mysqlx::SqlResult sourceRows) cons
 	// Finally, once the buffer has been constructed, we send the buffer to the DrawingComponentManager of the correct type.
 	// This is where we use the T::ComponentType which will be the "true" type for each data type above. (e.g. ProductData -> Product)
 	DrawingComponentManager<typename T::ComponentType>::sourceComponentTable(std::move(sourceBuffer), bufferSize + 4);
+
+	// The handles may have changed, so any cached drawings or searches could now refer to the wrong components
+	drawingCache.clear();
+	searchCache.clear();
+	searchIndex.invalidateHandles();
 }
 
 
@@ -27,7 +27,17 @@ public:
     /// <param name="message">A bytestream of the raw (decrypted) message data. The client handles the decryption.
     /// It is a rvalue reference to indicate the transfer of ownership.</param>
     /// <param name="messageSize">The size of the message bytestream.</param>
-    void onMessageReceived(void*&& message, unsigned int messageSize) override;
+    /// <param name="requestID">The ID of the request the message answers, if any. Responses to requests made
+    /// with Client::request never reach the handler.</param>
+    void onMessageReceived(void*&& message, unsigned int messageSize, RequestID requestID) override;
+
+    /// <summary>
+    /// Checks whether the server may broadcast messages of a type. The source tables are broadcast when a
+    /// component is added, and the next drawing numbers when a drawing is inserted.
+    /// </summary>
+    /// <param name="messageType">The type at the start of the message.</param>
+    /// <returns>True if messages of the type may be broadcasts.</returns>
+    bool isBroadcastType(uint32 messageType) override;
 
     /// <summary>
     /// Sets a function to move a buffer into to, with the results from a search.
@@ -0,0 +1,143 @@
+#ifndef DATABASE_MANAGER_DRAWINGRESPONSECACHE_H
+#define DATABASE_MANAGER_DRAWINGRESPONSECACHE_H
+
+#include <list>
+#include <mutex>
+#include <vector>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+// The most bytes of serialised drawings held at once. Past this, the drawings which have gone unopened longest are
+// dropped.
+#define DRAWING_CACHE_CAPACITY (64u * 1024u * 1024u)
+
+/// <summary>
+/// DrawingResponseCache
+/// A thread safe, least recently used cache of serialised DRAWING_DETAILS responses, keyed by the matID of the drawing.
+/// A drawing which is already cached can be sent without going to the database or serialising it again. The cache is
+/// bounded by the number of bytes it holds rather than the number of drawings, as drawings vary widely in size.
+/// </summary>
+class DrawingResponseCache {
+public:
+    /// <summary>
+    /// A value which changes whenever anything is invalidated. Responses built while it was unchanged are still up to
+    /// date.
+    /// </summary>
+    typedef unsigned long long Generation;
+
+    /// <summary>
+    /// Metrics
+    /// A snapshot of the cache's counters.
+    /// </summary>
+    struct Metrics {
+        /// <summary>
+        /// The number of lookups which found the drawing.
+        /// </summary>
+        unsigned long long hits = 0;
+        /// <summary>
+        /// The number of lookups which didn't find the drawing.
+        /// </summary>
+        unsigned long long misses = 0;
+        /// <summary>
+        /// The number of drawings dropped to make space for others.
+        /// </summary>
+        unsigned long long evictions = 0;
+        /// <summary>
+        /// The number of drawings dropped because they changed, or the components they refer to did.
+        /// </summary>
+        unsigned long long invalidations = 0;
+        /// <summary>
+        /// The number of drawings currently held.
+        /// </summary>
+        size_t entries = 0;
+        /// <summary>
+        /// The number of bytes of responses currently held.
+        /// </summary>
+        size_t bytes = 0;
+        /// <summary>
+        /// The most bytes the cache will hold.
+        /// </summary>
+        size_t capacity = 0;
+    };
+
+    /// <summary>
+    /// Constructs an empty cache.
+    /// </summary>
+    /// <param name="capacity">The most bytes of responses held at once.</param>
+    explicit DrawingResponseCache(size_t capacity = DRAWING_CACHE_CAPACITY);
+
+    DrawingResponseCache(const DrawingResponseCache &) = delete;
+
+    DrawingResponseCache &operator=(const DrawingResponseCache &) = delete;
+
+    /// <summary>
+    /// Looks up the response for a drawing, making it the last to be evicted.
+    /// </summary>
+    /// <param name="matID">The matID of the drawing.</param>
+    /// <returns>The serialised response, or nullptr if it isn't cached. The response stays valid while it is held, even
+    /// if it is evicted in the meantime.</returns>
+    std::shared_ptr<const std::vector<unsigned char>> find(unsigned matID);
+
+    /// <summary>
+    /// Getter for the current generation. This should be read before the drawing is read from the database, and passed
+    /// back when its response is inserted.
+    /// </summary>
+    /// <returns>The current generation.</returns>
+    Generation generation();
+
+    /// <summary>
+    /// Adds the response for a drawing, evicting the drawings unused for longest until it fits. The response is dropped
+    /// if anything was invalidated since the given generation, as it may have been built from the old drawing.
+    /// </summary>
+    /// <param name="matID">The matID of the drawing.</param>
+    /// <param name="drawingNumber">The drawing number of the drawing, for invalidating it.</param>
+    /// <param name="response">The serialised response.</param>
+    /// <param name="readGeneration">The generation read before the drawing was read from the database.</param>
+    void insert(unsigned matID, const std::string &drawingNumber, std::vector<unsigned char> &&response,
+                Generation readGeneration);
+
+    /// <summary>
+    /// Drops the response for a drawing number, for when the drawing is replaced.
+    /// </summary>
+    /// <param name="drawingNumber">The drawing number.</param>
+    void invalidate(const std::string &drawingNumber);
+
+    /// <summary>
+    /// Drops every response. Responses refer to components by their handles, so they go out of date whenever a source
+    /// table is rebuilt.
+    /// </summary>
+    void clear();
+
+    /// <summary>
+    /// Getter for a snapshot of the cache's metrics.
+    /// </summary>
+    /// <returns>The current metrics.</returns>
+    Metrics metrics();
+
+private:
+    struct Entry {
+        std::shared_ptr<const std::vector<unsigned char>> response;
+        std::string drawingNumber;
+        // The drawing's place in the usage order
+        std::list<unsigned>::iterator usage;
+    };
+
+    std::unordered_map<unsigned, Entry> entries;
+    // The matID of each cached drawing by its drawing number
+    std::unordered_map<std::string, unsigned> drawingNumbers;
+    // MatIDs from least to most recently used
+    std::list<unsigned> usageOrder;
+
+    size_t capacity;
+    Generation currentGeneration = 0;
+
+    Metrics counters;
+
+    std::mutex cacheMutex;
+
+    // Removes an entry. Must be called with the cache locked.
+    void erase(std::unordered_map<unsigned, Entry>::iterator entry);
+};
+
+#endif //DATABASE_MANAGER_DRAWINGRESPONSECACHE_H
@@ -0,0 +1,235 @@
+#ifndef DATABASE_MANAGER_DRAWINGSEARCHINDEX_H
+#define DATABASE_MANAGER_DRAWINGSEARCHINDEX_H
+
+#include <mysqlx/xdevapi.h>
+
+#include <atomic>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <optional>
+#include <ostream>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <unordered_map>
+
+#include "DatabaseQuery.h"
+#include "../networking/WorkerPool.h"
+
+class DatabaseManager;
+
+// The number of drawings each thread scans in a search. Searches over fewer drawings than this run on the calling
+// thread alone, as handing part of the scan to a worker would cost more than the scan.
+#define SEARCH_INDEX_CHUNK_ROWS 16384
+
+// The worker pool key the index is loaded under. Scans use keys above it.
+#define SEARCH_INDEX_LOAD_KEY 0
+
+/// <summary>
+/// DrawingSearchIndex
+/// An in memory copy of everything a DatabaseSearchQuery can filter on, for every drawing, so searches are answered
+/// without going to the database. Each field is held in its own array (one element per drawing), so each filter is a
+/// tight loop over a single array which the compiler can vectorise, and large searches are split across threads. The
+/// drawings are kept in the order searches return them, so the results need no sorting. The index is loaded from the
+/// database in the background, and kept up to date as drawings are inserted. Thread safe.
+/// </summary>
+class DrawingSearchIndex {
+public:
+    /// <summary>
+    /// Constructs an empty index, and starts the workers it loads and scans on.
+    /// </summary>
+    DrawingSearchIndex();
+
+    DrawingSearchIndex(const DrawingSearchIndex &) = delete;
+
+    DrawingSearchIndex &operator=(const DrawingSearchIndex &) = delete;
+
+    /// <summary>
+    /// Runs a search. The Aperture and Material source tables must be built, and must not be rebuilt while this is
+    /// running.
+    /// </summary>
+    /// <param name="dbManager">The database to load the index from in the background, if it isn't loaded.</param>
+    /// <param name="query">The search to run.</param>
+    /// <returns>The summaries of every matching drawing, in the same order as the database search would return them, or
+    /// nothing if the index hasn't finished loading, in which case the database should be searched instead.</returns>
+    std::optional<std::vector<DrawingSummary>> search(DatabaseManager &dbManager, const DatabaseSearchQuery &query);
+
+    /// <summary>
+    /// Starts loading the index in the background, if it isn't loaded or loading already. Searches are answered by the
+    /// database until it has loaded.
+    /// </summary>
+    /// <param name="dbManager">The database to load the index from. Must outlive the index.</param>
+    void startLoading(DatabaseManager &dbManager);
+
+    /// <summary>
+    /// Reloads a drawing from the database, for when it has been inserted or replaced. Updates which arrive together
+    /// are read from the database and merged into the index as a single batch, and this returns once the batch holding
+    /// the drawing has been applied. If the index is loading, the drawing is read again once the load finishes. The
+    /// same requirements on the source tables apply as for searching.
+    /// </summary>
+    /// <param name="dbManager">The database to reload the drawing from.</param>
+    /// <param name="drawingNumber">The drawing number of the drawing.</param>
+    void update(DatabaseManager &dbManager, const std::string &drawingNumber);
+
+    /// <summary>
+    /// Checks the index against the database, by searching for every drawing with both and comparing the summaries.
+    /// The same requirements on the source tables apply as for searching.
+    /// </summary>
+    /// <param name="dbManager">The database to compare against.</param>
+    /// <param name="out">The stream to write the differences to.</param>
+    /// <returns>True if the index matched the database.</returns>
+    bool verify(DatabaseManager &dbManager, std::ostream &out);
+
+    /// <summary>
+    /// Marks the component handles in the summaries as out of date, for when a source table has been rebuilt. They are
+    /// looked up again before the next search.
+    /// </summary>
+    void invalidateHandles();
+
+    /// <summary>
+    /// Getter for the number of drawings in the index.
+    /// </summary>
+    /// <returns>The number of drawings, or 0 if the index hasn't been loaded yet.</returns>
+    size_t size();
+
+    /// <summary>
+    /// Builds the query which reads the index's fields for each drawing, with {0} in place of the database name.
+    /// </summary>
+    /// <param name="drawingCount">The number of drawing numbers bound to the query, to read only those drawings, or 0
+    /// to read every drawing.</param>
+    /// <returns>The query string.</returns>
+    static std::string rowQueryString(size_t drawingCount);
+
+private:
+    // One drawing, as read from the database, before it is split into the columns
+    struct Row;
+
+    // The fields searches filter on. Element i of each array belongs to the i'th drawing in the order searches return
+    // them. Up to two of each kind of lap and side iron are held per drawing, and the counts are exact.
+    std::vector<std::string> sortKeys;
+    // Upper case, as searches on them are case insensitive
+    std::vector<std::string> drawingNumbers;
+    std::vector<float> widths, lengths;
+    std::vector<unsigned> productIDs;
+    std::vector<uint8_t> barCounts;
+    std::vector<unsigned> apertureIDs;
+    std::vector<uint8_t> thicknessCounts;
+    std::vector<unsigned> thicknessIDs[2];
+    // As YYYYMMDD
+    std::vector<uint32_t> dates;
+    std::vector<uint8_t> sideIronCounts;
+    std::vector<unsigned> sideIronIDs[2];
+    std::vector<uint8_t> sideIronTypes[2];
+    std::vector<unsigned> sideIronLengths[2];
+    std::vector<uint8_t> sidelapCounts, overlapCounts;
+    std::vector<float> sidelapWidths[2], overlapWidths[2];
+    std::vector<uint8_t> sidelapAttachments[2], overlapAttachments[2];
+    // Drawings without a machine template have 0 here and never match a search on the machine
+    std::vector<uint8_t> hasTemplate;
+    std::vector<unsigned> machineIDs, deckIDs, manufacturerIDs;
+    std::vector<uint8_t> quantitiesOnDeck;
+    // Upper case, as searches on them are case insensitive
+    std::vector<std::string> positions;
+
+    // The summary of each drawing, as sent back to the client, and the extra apertures it refers to
+    std::vector<DrawingSummary> summaries;
+    std::vector<std::vector<unsigned>> extraApertureIDs;
+    // Whether every component a drawing's summary refers to exists. Drawings which don't are never returned.
+    std::vector<uint8_t> resolved;
+
+    // Each manufacturer's name (in upper case) numbered from 1, so they can be compared as integers
+    std::unordered_map<std::string, unsigned> manufacturers;
+
+    enum class LoadState {
+        UNLOADED,
+        LOADING,
+        LOADED
+    };
+
+    // Only changed with the index locked exclusively, but read without the lock to check whether it needs taking
+    std::atomic<LoadState> loadState = LoadState::UNLOADED;
+    std::atomic<bool> handlesStale = false;
+
+    // Searches hold this shared, and anything which changes the index holds it exclusively
+    std::shared_mutex indexMutex;
+
+    // The drawings updated while the index was loading, which the load may have read before they changed. They are
+    // read again once it has finished.
+    std::vector<std::string> updatesDuringLoad;
+
+    // Updates waiting for the next batch. They are numbered by the batch they will be applied in, and one updating
+    // thread applies batches until none are left, while any others wait for the batch holding their drawing.
+    std::mutex updateMutex;
+    std::condition_variable updateApplied;
+    std::vector<std::string> queuedUpdates;
+    bool applyingUpdates = false;
+    unsigned long long nextUpdateBatch = 1, appliedUpdateBatch = 0;
+
+    // Keys for the scans handed to the workers
+    std::atomic<unsigned long long> nextScanKey = SEARCH_INDEX_LOAD_KEY + 1;
+
+    // Starts loading the index on a worker. Must be called with the index locked exclusively.
+    void beginLoad(DatabaseManager &dbManager);
+
+    // Reads every drawing from the database into the index, then reads again any drawings updated while it did
+    void load(DatabaseManager &dbManager);
+
+    // Reads drawings from the database. Returns false if they couldn't be read.
+    static bool readRows(DatabaseManager &dbManager, const std::optional<std::vector<std::string>> &drawingNumbers,
+                         std::vector<Row> &rows);
+
+    // Reads a row of the index query into a row of the index. Returns false, having logged why, if the drawing can't be
+    // searched.
+    static bool readRow(const mysqlx::Row &source, Row &row);
+
+    // Reads a batch of updated drawings from the database and merges them into the index
+    void applyUpdates(DatabaseManager &dbManager, std::vector<std::string> &&updatedNumbers);
+
+    // The handle of each component by its ID
+    struct ComponentHandles {
+        std::unordered_map<unsigned, unsigned> apertures, materials;
+    };
+
+    // Reads the handles of the components summaries refer to from their managers
+    static ComponentHandles componentHandles();
+
+    // Sets the component handles in a drawing's summary from the IDs of the components. Returns false if any of the
+    // components don't exist.
+    bool resolveHandles(size_t position, const ComponentHandles &handles);
+
+    // Looks up the component handles of every summary again. Must be called with the index locked exclusively.
+    void refreshHandles();
+
+    // Calls a function with each of the index's per drawing arrays
+    template <typename Function>
+    void forEachColumn(Function function);
+
+    // Adds a drawing to the end of the index, out of order. Must be called with the index locked exclusively.
+    void append(Row &&row);
+
+    // Rearranges the drawings so that the i'th is the one which was at order[i]. Drawings not in the order are
+    // dropped. Must be called with the index locked exclusively.
+    void reorder(const std::vector<size_t> &order);
+
+    // Replaces the drawings with the given numbers with the rows read for them, in a single pass over the index. The
+    // new rows' handles are resolved if handles are given, and left for the next refresh otherwise. Must be called
+    // with the index locked exclusively.
+    void merge(const std::vector<std::string> &updatedNumbers, std::vector<Row> &&rows,
+               const ComponentHandles *handles);
+
+    // Finds the drawings which match a query among those in [begin, end), in order
+    std::vector<unsigned> scan(const DatabaseSearchQuery &query, size_t begin, size_t end) const;
+
+    // The key searches are ordered by (descending). Drawing numbers with a single letter prefix, such as A34, are
+    // ordered as if they had a leading 0, so they come after those with two, such as EA34.
+    static std::string sortKey(const std::string &drawingNumber);
+
+    // The manufacturer number of a name, or 0 if it isn't known
+    unsigned manufacturerID(const std::string &name) const;
+
+    // Loads the index and runs scans. Declared last, so it is stopped before anything its tasks use is destroyed.
+    WorkerPool workers;
+};
+
+#endif //DATABASE_MANAGER_DRAWINGSEARCHINDEX_H
@@ -94,7 +94,12 @@ enum class RequestType {
     /// <summary>
     /// Requests the server to update its straps, which leads to a broadcast of the newly updated straps table.
     /// </summary>
-    SOURCE_STRAPS_TABLE
+    SOURCE_STRAPS_TABLE,
+    /// <summary>
+    /// Requests the details of several drawings at once. Sends a DrawingBatchRequest across to the server, and the
+    /// server sends every requested drawing back to the requesting client in a single response.
+    /// </summary>
+    DRAWING_DETAILS_BATCH
 };
 
 /// <summary>
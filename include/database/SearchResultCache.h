@@ -0,0 +1,148 @@
+#ifndef DATABASE_MANAGER_SEARCHRESULTCACHE_H
+#define DATABASE_MANAGER_SEARCHRESULTCACHE_H
+
+#include <list>
+#include <mutex>
+#include <chrono>
+#include <vector>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+// The most bytes of search results held at once. Past this, the searches which have gone unrepeated longest are
+// dropped.
+#define SEARCH_CACHE_CAPACITY (16u * 1024u * 1024u)
+// How long a search result is kept for. Every insert clears the cache anyway; this bounds how long a result can miss
+// changes made to the database by anything other than this server.
+#define SEARCH_CACHE_TTL_S 300
+
+/// <summary>
+/// SearchResultCache
+/// A thread safe, least recently used cache of DRAWING_SEARCH_QUERY responses, keyed by the serialised search query.
+/// The responses are held as sent, with the summaries already compressed, so a repeated search is answered without
+/// going to the database at all. The cache is bounded by the number of bytes it holds, and results expire after a fixed
+/// lifetime.
+/// </summary>
+class SearchResultCache {
+public:
+    /// <summary>
+    /// A value which changes whenever the cache is cleared. Results found while it was unchanged are still up to date.
+    /// </summary>
+    typedef unsigned long long Generation;
+
+    /// <summary>
+    /// Metrics
+    /// A snapshot of the cache's counters.
+    /// </summary>
+    struct Metrics {
+        /// <summary>
+        /// The number of searches answered from the cache.
+        /// </summary>
+        unsigned long long hits = 0;
+        /// <summary>
+        /// The number of searches which weren't cached, or whose result had expired.
+        /// </summary>
+        unsigned long long misses = 0;
+        /// <summary>
+        /// The number of results dropped to make space for others.
+        /// </summary>
+        unsigned long long evictions = 0;
+        /// <summary>
+        /// The number of results dropped because they expired.
+        /// </summary>
+        unsigned long long expirations = 0;
+        /// <summary>
+        /// The number of results dropped because the drawings changed.
+        /// </summary>
+        unsigned long long invalidations = 0;
+        /// <summary>
+        /// The number of results currently held.
+        /// </summary>
+        size_t entries = 0;
+        /// <summary>
+        /// The number of bytes of results currently held, including their keys.
+        /// </summary>
+        size_t bytes = 0;
+        /// <summary>
+        /// The most bytes the cache will hold.
+        /// </summary>
+        size_t capacity = 0;
+    };
+
+    /// <summary>
+    /// Constructs an empty cache.
+    /// </summary>
+    /// <param name="capacity">The most bytes of results held at once.</param>
+    /// <param name="lifetime">How long a result is kept for.</param>
+    explicit SearchResultCache(size_t capacity = SEARCH_CACHE_CAPACITY,
+                               std::chrono::seconds lifetime = std::chrono::seconds(SEARCH_CACHE_TTL_S));
+
+    SearchResultCache(const SearchResultCache &) = delete;
+
+    SearchResultCache &operator=(const SearchResultCache &) = delete;
+
+    /// <summary>
+    /// Looks up the response to a search, making it the last to be evicted.
+    /// </summary>
+    /// <param name="query">The serialised search query.</param>
+    /// <returns>The response, or nullptr if it isn't cached or has expired. The response stays valid while it is held,
+    /// even if it is evicted in the meantime.</returns>
+    std::shared_ptr<const std::vector<unsigned char>> find(const std::string &query);
+
+    /// <summary>
+    /// Getter for the current generation. This should be read before the search is run, and passed back when its
+    /// response is inserted.
+    /// </summary>
+    /// <returns>The current generation.</returns>
+    Generation generation();
+
+    /// <summary>
+    /// Adds the response to a search, evicting the searches unrepeated for longest until it fits. The response is
+    /// dropped if the cache was cleared since the given generation, as it may be missing a change.
+    /// </summary>
+    /// <param name="query">The serialised search query.</param>
+    /// <param name="response">The response to the search.</param>
+    /// <param name="readGeneration">The generation read before the search was run.</param>
+    void insert(const std::string &query, std::vector<unsigned char> &&response, Generation readGeneration);
+
+    /// <summary>
+    /// Drops every result. Any change to the drawings could change the result of any search, and the results refer to
+    /// components by their handles, so this is called whenever a drawing is inserted or a source table is rebuilt.
+    /// </summary>
+    void clear();
+
+    /// <summary>
+    /// Getter for a snapshot of the cache's metrics.
+    /// </summary>
+    /// <returns>The current metrics.</returns>
+    Metrics metrics();
+
+private:
+    struct Entry {
+        std::shared_ptr<const std::vector<unsigned char>> response;
+        std::chrono::steady_clock::time_point expiry;
+        // The query's place in the usage order
+        std::list<std::string>::iterator usage;
+    };
+
+    // Keyed by the query bytes themselves, so two queries whose hashes collide are never confused
+    std::unordered_map<std::string, Entry> entries;
+    // Queries from least to most recently used
+    std::list<std::string> usageOrder;
+
+    size_t capacity;
+    std::chrono::seconds lifetime;
+    Generation currentGeneration = 0;
+
+    Metrics counters;
+
+    std::mutex cacheMutex;
+
+    // Removes an entry. Must be called with the cache locked.
+    void erase(std::unordered_map<std::string, Entry>::iterator entry);
+
+    // The number of bytes an entry takes up
+    static size_t entrySize(const std::string &query, const std::vector<unsigned char> &response);
+};
+
+#endif //DATABASE_MANAGER_SEARCHRESULTCACHE_H
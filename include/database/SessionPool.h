@@ -0,0 +1,203 @@
+#ifndef DATABASE_MANAGER_SESSIONPOOL_H
+#define DATABASE_MANAGER_SESSIONPOOL_H
+
+#include <mysqlx/xdevapi.h>
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <thread>
+#include <condition_variable>
+
+/// <summary>
+/// SessionPool
+/// A bounded pool of MySQL sessions built on a pooling mysqlx::Client. Sessions are checked out for the duration of a
+/// single operation (or transaction) through a Lease, which returns the session to the pool when it goes out of scope.
+/// This lets multiple request handlers query the database concurrently, each on their own connection. Sessions which
+/// fail are closed rather than returned, so the next checkout reconnects. Sessions which sit idle are periodically
+/// pinged by a background thread, so dead connections are found off the request path.
+/// </summary>
+class SessionPool {
+public:
+    /// <summary>
+    /// Metrics
+    /// A snapshot of the pool's counters.
+    /// </summary>
+    struct Metrics {
+        /// <summary>
+        /// The number of sessions currently checked out.
+        /// </summary>
+        unsigned activeSessions = 0;
+        /// <summary>
+        /// The number of open sessions waiting in the pool.
+        /// </summary>
+        unsigned idleSessions = 0;
+        /// <summary>
+        /// The total number of successful checkouts.
+        /// </summary>
+        unsigned long long checkouts = 0;
+        /// <summary>
+        /// The number of checkouts which failed, either by timing out or failing to open a session.
+        /// </summary>
+        unsigned long long failedCheckouts = 0;
+        /// <summary>
+        /// The number of sessions closed because they failed, either while checked out or during a keepalive.
+        /// </summary>
+        unsigned long long discardedSessions = 0;
+        /// <summary>
+        /// The number of keepalive pings sent to idle sessions.
+        /// </summary>
+        unsigned long long keepalivePings = 0;
+        /// <summary>
+        /// The total time (in milliseconds) spent waiting for a session to become available.
+        /// </summary>
+        double totalWaitMs = 0;
+        /// <summary>
+        /// The longest time (in milliseconds) a single checkout waited for a session.
+        /// </summary>
+        double maxWaitMs = 0;
+    };
+
+    /// <summary>
+    /// Lease
+    /// Exclusive use of a pooled session. The session is returned to the pool on destruction, unless the lease is
+    /// destroyed while an exception is propagating, in which case the session may be broken or part way through a
+    /// transaction, so it is closed instead.
+    /// </summary>
+    class Lease {
+        friend class SessionPool;
+
+    public:
+        Lease(Lease &&other) noexcept;
+
+        Lease(const Lease &) = delete;
+
+        Lease &operator=(const Lease &) = delete;
+
+        /// <summary>
+        /// Returns the session to the pool.
+        /// </summary>
+        ~Lease();
+
+        /// <summary>
+        /// Access the leased session.
+        /// </summary>
+        /// <returns>The session.</returns>
+        mysqlx::Session &operator*();
+
+        /// <summary>
+        /// Access the leased session.
+        /// </summary>
+        /// <returns>A pointer to the session.</returns>
+        mysqlx::Session *operator->();
+
+        /// <summary>
+        /// Marks the session as unusable, so it is closed rather than returned to the pool.
+        /// </summary>
+        void discard();
+
+    private:
+        Lease(SessionPool &pool, std::unique_ptr<mysqlx::Session> &&session);
+
+        SessionPool *pool;
+        std::unique_ptr<mysqlx::Session> session;
+        bool discarded = false;
+        int uncaughtExceptions;
+    };
+
+    /// <summary>
+    /// Constructs the pool and opens the minimum number of sessions.
+    /// </summary>
+    /// <param name="host">The server the database is located on.</param>
+    /// <param name="port">The X protocol port of the server.</param>
+    /// <param name="user">The username for the connections.</param>
+    /// <param name="password">The password for the user.</param>
+    /// <param name="minSessions">The number of sessions to open up front and keep open.</param>
+    /// <param name="maxSessions">The maximum number of sessions open at once.</param>
+    /// <param name="checkoutTimeout">How long a checkout waits for a session when the pool is exhausted.</param>
+    /// <param name="keepaliveInterval">How long a session may sit idle before it is pinged to keep it alive.</param>
+    SessionPool(const std::string &host, unsigned port, const std::string &user, const std::string &password,
+                unsigned minSessions, unsigned maxSessions, std::chrono::milliseconds checkoutTimeout,
+                std::chrono::milliseconds keepaliveInterval);
+
+    /// <summary>
+    /// Stops the keepalive thread and closes every idle session and the client.
+    /// </summary>
+    ~SessionPool();
+
+    SessionPool(const SessionPool &) = delete;
+
+    SessionPool &operator=(const SessionPool &) = delete;
+
+    /// <summary>
+    /// Checks out a session, waiting up to the checkout timeout if every session is in use. Throws a mysqlx::Error if
+    /// no session could be obtained.
+    /// </summary>
+    /// <returns>A lease on the session.</returns>
+    Lease checkout();
+
+    /// <summary>
+    /// Closes every idle session and the client. Sessions which are still checked out are closed when they are
+    /// returned.
+    /// </summary>
+    void close();
+
+    /// <summary>
+    /// Getter for a snapshot of the pool's metrics.
+    /// </summary>
+    /// <returns>The current metrics.</returns>
+    Metrics metrics();
+
+    /// <summary>
+    /// Checks whether an error was caused by the connection to the server being lost (as opposed to, for example, an
+    /// error in the SQL itself), in which case the operation may succeed on a new session. Errors are classified by
+    /// their MySQL client, server or socket error code, so an error with no code is never treated as a lost connection.
+    /// </summary>
+    /// <param name="error">The error thrown by the connector.</param>
+    /// <returns>True if the error indicates a lost or refused connection.</returns>
+    static bool isConnectionError(const mysqlx::Error &error);
+
+private:
+    // Reads the category and code of the error from the connector's description of it. Returns false if the
+    // description doesn't carry a code
+    static bool errorCode(const mysqlx::Error &error, std::string &category, long &code);
+
+    // An open session waiting in the pool, along with when it was returned
+    struct IdleSession {
+        std::unique_ptr<mysqlx::Session> session;
+        std::chrono::steady_clock::time_point idleSince;
+    };
+
+    mysqlx::Client client;
+
+    unsigned minSessions, maxSessions;
+    std::chrono::milliseconds checkoutTimeout, keepaliveInterval;
+
+    // Open sessions not currently checked out, with the most recently returned at the back
+    std::vector<IdleSession> idleSessions;
+    // The number of sessions currently checked out
+    unsigned activeSessions = 0;
+
+    bool closed = false;
+
+    Metrics counters;
+
+    std::mutex poolMutex;
+    std::condition_variable sessionAvailable;
+    std::condition_variable keepaliveCondition;
+
+    std::thread keepaliveThread;
+
+    // Returns a session from a lease, closing it if discarded
+    void release(std::unique_ptr<mysqlx::Session> &&session, bool discard);
+
+    // Closes a session, ignoring any errors as the session may already be broken
+    static void closeSession(mysqlx::Session &session);
+
+    // Periodically pings sessions which have been idle for the keepalive interval, and tops the pool back up to the
+    // minimum size, until the pool is closed
+    void keepaliveLoop();
+};
+
+#endif //DATABASE_MANAGER_SESSIONPOOL_H
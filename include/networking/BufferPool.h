@@ -0,0 +1,62 @@
+#ifndef DATABASE_MANAGER_BUFFERPOOL_H
+#define DATABASE_MANAGER_BUFFERPOOL_H
+
+#include <cstddef>
+
+// The smallest and largest pooled buffer sizes. Each size class is double the last, so there are 18 classes from 128B
+// up to 16MB (MAX_MESSAGE_LENGTH). Larger buffers are allocated directly.
+#define BUFFER_POOL_MIN_SIZE 128u
+#define BUFFER_POOL_SIZE_CLASSES 18u
+
+// The most bytes of free buffers kept in each size class. At least one buffer is always kept, so the largest classes
+// can hold a little more than this.
+#define BUFFER_POOL_CLASS_LIMIT (4u * 1024u * 1024u)
+
+/// <summary>
+/// BufferPool
+/// A process wide, thread safe pool of message buffers, grouped into power of two size classes. Released buffers are
+/// kept on their size class's free list, so the buffers of messages which are constantly being created and destroyed
+/// are reused rather than going back to the allocator each time.
+/// </summary>
+class BufferPool {
+public:
+    /// <summary>
+    /// Counters
+    /// Process wide totals for the buffers handed out by the pool.
+    /// </summary>
+    struct Counters {
+        /// <summary>
+        /// The number of buffers reused from a free list.
+        /// </summary>
+        unsigned long long hits;
+        /// <summary>
+        /// The number of buffers which had to be newly allocated.
+        /// </summary>
+        unsigned long long misses;
+        /// <summary>
+        /// The number of bytes of free buffers currently held by the pool.
+        /// </summary>
+        size_t bytesHeld;
+    };
+
+    /// <summary>
+    /// Gets a buffer of at least the given size, reusing a free one if there is one.
+    /// </summary>
+    /// <param name="size">The number of bytes required.</param>
+    /// <returns>The buffer, which must be returned with release rather than freed.</returns>
+    static void *acquire(size_t size);
+
+    /// <summary>
+    /// Returns a buffer from acquire to the pool, or frees it if its size class already holds enough.
+    /// </summary>
+    /// <param name="buffer">The buffer to return. May be nullptr, in which case nothing happens.</param>
+    static void release(void *buffer);
+
+    /// <summary>
+    /// Takes a snapshot of the pool's counters.
+    /// </summary>
+    /// <returns>A snapshot of the counters.</returns>
+    static Counters counters();
+};
+
+#endif //DATABASE_MANAGER_BUFFERPOOL_H
@@ -9,16 +9,34 @@
 #include <thread>
 #include <mutex>
 #include <queue>
+#include <optional>
+#include <atomic>
+#include <map>
+#include <future>
+#include <memory>
+#include <functional>
+#include <stdexcept>
+#include <type_traits>
 
 #include <encrypt.h>
 #include <authenticate.h>
 
 #include "TCPSocket.h"
+#include "MPSCQueue.h"
+#include "Compression.h"
+#include "MessageBuffer.h"
 #include "../../guard.h"
 
 #define CLIENT_APPLICATION_ID "e89163c2-86fd-4675-ad9e-0d0e7632b9a8"
 #define REDIRECT_URL "http://localhost:5000/login/authorize"
 
+// The most messages which can be waiting to be sent by the client loop at once
+#define SEND_QUEUE_CAPACITY 256
+// How long a request waits for its response by default before it fails
+#define REQUEST_TIMEOUT_MS 30000
+// A request timeout which never expires. The request only fails if it is cancelled or the client disconnects.
+#define NO_REQUEST_TIMEOUT 0
+
 /// <summary> 
 /// ClientResponseHandler
 /// A pure virtual class for setting up any response handling for the client.
@@ -31,7 +49,92 @@ public:
     /// <param name="message">The message to be processed. It is a rvalue reference
     /// to indicate a transfer of ownership.</param>
     /// <param name="messageSize">The size of the message.</param>
-    virtual void onMessageReceived(void*&&message, unsigned messageSize) = 0;
+    /// <param name="requestID">The ID of the request the message answers, or NO_REQUEST_ID if it doesn't
+    /// answer one (or the connection doesn't tag requests).</param>
+    virtual void onMessageReceived(void*&&message, unsigned messageSize, RequestID requestID) = 0;
+
+    /// <summary>
+    /// Checks whether the server may send messages of a type without being asked, as a broadcast. On a connection
+    /// which doesn't tag requests, such messages can't be told apart from responses, so they are always passed to
+    /// onMessageReceived and never complete a request made with Client::request. No type is broadcast by default.
+    /// </summary>
+    /// <param name="messageType">The type at the start of the message.</param>
+    /// <returns>True if messages of the type may be broadcasts.</returns>
+    virtual bool isBroadcastType(uint32 messageType) { return false; }
+};
+
+/// <summary>
+/// SessionResumption
+/// Everything a client needs to resume its session on a new connection: the ticket the server issued and the
+/// session key of the connection it was issued on. Anyone holding both can resume the session, so it should be
+/// stored as carefully as a repeat token.
+/// </summary>
+struct SessionResumption {
+    /// <summary>
+    /// The ticket issued by the server.
+    /// </summary>
+    ResumptionTicket ticket;
+    /// <summary>
+    /// The key the client proves it was issued the ticket with.
+    /// </summary>
+    AESKey sessionKey;
+};
+
+/// <summary>
+/// RequestError
+/// The error a request made with Client::request fails with when it gets no response.
+/// </summary>
+class RequestError : public std::runtime_error {
+public:
+    /// <summary>
+    /// Why the request got no response.
+    /// </summary>
+    enum class Reason {
+        /// <summary>
+        /// No response arrived before the request's timeout.
+        /// </summary>
+        TIMED_OUT,
+        /// <summary>
+        /// The request was cancelled.
+        /// </summary>
+        CANCELLED,
+        /// <summary>
+        /// The client disconnected while the request was waiting.
+        /// </summary>
+        DISCONNECTED
+    };
+
+    /// <summary>
+    /// Constructs the error for a reason.
+    /// </summary>
+    /// <param name="reason">Why the request failed.</param>
+    explicit RequestError(Reason reason);
+
+    /// <summary>
+    /// Getter for why the request failed.
+    /// </summary>
+    /// <returns>The reason.</returns>
+    Reason reason() const;
+
+private:
+    Reason failureReason;
+};
+
+/// <summary>
+/// PendingResponse
+/// A request which has been sent, and the response it will be answered with.
+/// </summary>
+template<typename T>
+struct PendingResponse {
+    /// <summary>
+    /// The ID of the request, for cancelling it.
+    /// </summary>
+    RequestID requestID;
+    /// <summary>
+    /// The response. Getting it throws a RequestError if the request times out, is cancelled or is
+    /// disconnected.
+    /// </summary>
+    std::future<T> response;
 };
 
 /// <summary> 
@@ -64,7 +167,11 @@ public:
         /// <summary>
         /// The repeat token was invalid.
         /// </summary>
-        INVALID_REPEAT_TOKEN
+        INVALID_REPEAT_TOKEN,
+        /// <summary>
+        /// The resumption ticket was invalid or had expired.
+        /// </summary>
+        INVALID_RESUMPTION_TICKET
     };
 
     /// <summary>
@@ -102,6 +209,24 @@ public:
     /// <param name="repeatToken">The repeat token to reverify with.</param>
     /// <returns></returns>
     ConnectionStatus connectWithToken(const std::string &ipAddress, unsigned port, uint256 repeatToken);
+
+    /// <summary>
+    /// Connects to the server by resuming an earlier session, which takes a single round trip and no RSA. If this
+    /// fails the connection is closed, and the client should connect another way.
+    /// </summary>
+    /// <param name="ipAddress">The IP of the server.</param>
+    /// <param name="port">The port of the server.</param>
+    /// <param name="resumption">The session to resume, from sessionResumption.</param>
+    /// <returns>Returns whether the connection was successful.</returns>
+    ConnectionStatus resumeSession(const std::string &ipAddress, unsigned port, const SessionResumption &resumption);
+
+    /// <summary>
+    /// Getter for what is needed to resume the current session on a later connection. Each one can only be used
+    /// once, and a new one is issued whenever the client connects.
+    /// </summary>
+    /// <returns>The session resumption, or nothing if the server didn't issue a ticket.</returns>
+    std::optional<SessionResumption> sessionResumption() const;
+
     /// <summary>
     /// Disconnects from the server.
     /// </summary>
@@ -122,13 +247,103 @@ public:
     /// </summary>
     /// <param name="message">The meassage to be sent.</param>
     /// <param name="messageLength">The length of the message.</param>
-    void addMessageToSendQueue(const void *message, unsigned messageLength);
+    /// <returns>The ID the message was sent with, which the responses to it will carry, or NO_REQUEST_ID if
+    /// the connection doesn't tag requests.</returns>
+    RequestID addMessageToSendQueue(const void *message, unsigned messageLength);
+
+    /// <summary>
+    /// Adds a message to be sent ASAP to the server with an ID from newRequestID. This allows a handler for
+    /// the response to be set up before the request is sent.
+    /// </summary>
+    /// <param name="message">The meassage to be sent.</param>
+    /// <param name="messageLength">The length of the message.</param>
+    /// <param name="requestID">The ID to send the message with.</param>
+    void addMessageToSendQueue(const void *message, unsigned messageLength, RequestID requestID);
 
     /// <summary>
     /// Adds a message to be sent ASAP to the server, in the form of a string.
     /// </summary>
     /// <param name="message">The message to send.</param>
-    void addMessageToSendQueue(const std::string &message);
+    /// <returns>The ID the message was sent with.</returns>
+    RequestID addMessageToSendQueue(const std::string &message);
+
+    /// <summary>
+    /// Takes the next request ID for this connection. The server may handle tagged requests in any order, so
+    /// their responses must be matched up by ID rather than by the order they arrive in.
+    /// </summary>
+    /// <returns>A new ID, or NO_REQUEST_ID if the connection doesn't tag requests.</returns>
+    RequestID newRequestID();
+
+    /// <summary>
+    /// Sends a request, and waits for its response without blocking. Any number of requests may be waiting at
+    /// once. If the connection tags requests, each response is matched to its request by ID. Otherwise, the
+    /// response is taken to be the first message of the same type which arrives for the oldest request waiting,
+    /// which is only reliable for types the server never sends unprompted.
+    /// The response is not passed on to the response handler.
+    /// </summary>
+    /// <param name="message">The request, which must start with its type.</param>
+    /// <param name="messageLength">The length of the request.</param>
+    /// <param name="timeout">How long to wait for the response, or NO_REQUEST_TIMEOUT to wait for as long as
+    /// the connection lasts.</param>
+    /// <returns>The request's ID, and the response, which owns the message received.</returns>
+    PendingResponse<MessageBuffer> request(const void *message, unsigned messageLength,
+                                           std::chrono::milliseconds timeout = std::chrono::milliseconds(REQUEST_TIMEOUT_MS));
+
+    /// <summary>
+    /// Sends a request, and calls a function once it completes. The function is called exactly once, from the
+    /// client loop (or the thread which cancels the request or disconnects), so should hand any work for the UI
+    /// back to the UI thread.
+    /// </summary>
+    /// <param name="message">The request, which must start with its type.</param>
+    /// <param name="messageLength">The length of the request.</param>
+    /// <param name="onCompletion">The function to call with the response. Getting the response throws a
+    /// RequestError if the request failed.</param>
+    /// <param name="timeout">How long to wait for the response, or NO_REQUEST_TIMEOUT to wait for as long as
+    /// the connection lasts.</param>
+    /// <returns>The request's ID, for cancelling it.</returns>
+    RequestID request(const void *message, unsigned messageLength,
+                      const std::function<void(std::future<MessageBuffer> &&)> &onCompletion,
+                      std::chrono::milliseconds timeout = std::chrono::milliseconds(REQUEST_TIMEOUT_MS));
+
+    /// <summary>
+    /// Sends a query, and waits for the response to be sent back as the same type of query.
+    /// </summary>
+    /// <typeparam name="T">The query type, which must serialise with createBuffer and have a static
+    /// deserialise from a const buffer.</typeparam>
+    /// <param name="query">The query to send.</param>
+    /// <param name="timeout">How long to wait for the response, or NO_REQUEST_TIMEOUT to wait for as long as
+    /// the connection lasts.</param>
+    /// <returns>The request's ID, and the decoded response.</returns>
+    template<typename T>
+    PendingResponse<T> request(const T &query,
+                               std::chrono::milliseconds timeout = std::chrono::milliseconds(REQUEST_TIMEOUT_MS));
+
+    /// <summary>
+    /// Sends a query, and calls a function with the decoded response once it completes.
+    /// </summary>
+    /// <typeparam name="T">The query type.</typeparam>
+    /// <param name="query">The query to send.</param>
+    /// <param name="onCompletion">The function to call with the response, as for the untyped request.</param>
+    /// <param name="timeout">How long to wait for the response, or NO_REQUEST_TIMEOUT to wait for as long as
+    /// the connection lasts.</param>
+    /// <returns>The request's ID, for cancelling it.</returns>
+    template<typename T>
+    RequestID request(const T &query, const std::type_identity_t<std::function<void(std::future<T> &&)>> &onCompletion,
+                      std::chrono::milliseconds timeout = std::chrono::milliseconds(REQUEST_TIMEOUT_MS));
+
+    /// <summary>
+    /// Cancels a request which is still waiting for its response. The request fails with CANCELLED, and its
+    /// response is discarded if it still arrives.
+    /// </summary>
+    /// <param name="requestID">The ID of the request.</param>
+    /// <returns>True if the request was cancelled, false if it had already completed.</returns>
+    bool cancelRequest(RequestID requestID);
+
+    /// <summary>
+    /// Getter for the number of requests waiting for their responses.
+    /// </summary>
+    /// <returns>The number of requests.</returns>
+    size_t pendingRequestCount();
 
     /// <summary>
     /// Requests a repeat token from the server.
@@ -160,6 +375,20 @@ public:
     /// <returns>True if the client has full access, false otherwise.</returns>
     bool hasFullAccess() const;
 
+    /// <summary>
+    /// Sets whether the client asks the server to compress large messages. Takes effect from the next connection,
+    /// and only if the server offers compression.
+    /// </summary>
+    /// <param name="enabled">Whether to ask for compression.</param>
+    void setCompressionEnabled(bool enabled);
+
+    /// <summary>
+    /// Sets whether the client asks the server for resumption tickets. Takes effect from the next connection,
+    /// and only if the server issues them.
+    /// </summary>
+    /// <param name="enabled">Whether to ask for resumption tickets.</param>
+    void setSessionResumptionEnabled(bool enabled);
+
 private:
     // The RSA key for establishing a secure and authenticated connection with the server
     RSAKeyPair clientKey;
@@ -178,15 +407,42 @@ private:
     // The session token provided by the server for this communication to verify this client is still who they claim
     uint64 sessionToken{};
 
+    // Whether to ask for compression when connecting, and whether this connection uses it
+    bool compressionEnabled = true;
+    bool compression = false;
+
+    // Whether to ask for a resumption ticket when connecting, and the one issued on this connection
+    bool resumptionEnabled = true;
+    std::optional<SessionResumption> resumption;
+
+    // Whether this connection tags each request with an ID, and the next ID to use
+    bool requestIDs = false;
+    std::atomic<RequestID> nextRequestID = 1;
+
+    // A request waiting for its response. It is completed with either the response or an error. A request which
+    // has been cancelled or has timed out is kept without its completion function until its response arrives, so
+    // the response is dropped rather than being taken for the response to a later request (on a connection which
+    // doesn't tag requests) or passed to the response handler.
+    struct PendingRequest {
+        uint32 responseType;
+        std::chrono::steady_clock::time_point deadline;
+        std::function<void(MessageBuffer &&, std::exception_ptr)> complete;
+    };
+
+    // The requests waiting for responses, by ID. IDs increase, so on a connection which doesn't tag requests the
+    // first matching request is the oldest. Requests are added from any thread and completed by the client loop.
+    std::map<RequestID, PendingRequest> pendingRequests;
+    std::mutex pendingRequestsMutex;
+
     // The thread containing the client server loop
     std::thread clientLoopThread;
 
     // Flag to determine if the client loop is currently active
     bool clientLoopRunning = false;
 
-    // A queue of messages to be sent to the server from this client
-    std::queue<NetworkMessage *> sendQueue;
-    std::mutex sendQueueMutex;
+    // A queue of messages to be sent to the server from this client. Any thread may add to it, and the client
+    // loop sends from it. Messages are held by value so queueing one doesn't allocate.
+    MPSCQueue<EncryptedNetworkMessage> sendQueue = MPSCQueue<EncryptedNetworkMessage>(SEND_QUEUE_CAPACITY);
 
     ClientResponseHandler *responseHandler = nullptr;
 
@@ -196,9 +452,89 @@ private:
     // Internal function to manage the client loop
     void clientLoop();
 
+    // Once the server has accepted us, receives our resumption ticket if we asked for one, then switches to the
+    // negotiated wire format and features
+    void finishConnecting(ConnectionResponse response, WireFormat wireFormat, uint8 features);
+
+    // Takes the next ID from the counter, whether or not the connection tags requests
+    RequestID allocateRequestID();
+
+    // Sends a request, once it is waiting for its response
+    RequestID sendRequest(const void *message, unsigned messageLength,
+                          std::function<void(MessageBuffer &&, std::exception_ptr)> &&complete,
+                          std::chrono::milliseconds timeout);
+
+    // Completes the request a received message answers, taking ownership of the message if it does
+    bool completeRequest(RequestID requestID, void *message, unsigned messageSize);
+
+    // Fails every request which has passed its deadline
+    void expireRequests(std::chrono::steady_clock::time_point now);
+
+    // Fails every waiting request with the same reason
+    void failRequests(RequestError::Reason reason);
+
+    // Decodes a typed response into a promise
+    template<typename T>
+    static void fulfil(std::promise<T> &promise, MessageBuffer &&response, std::exception_ptr error);
+
     // Stores the clients access level
     ClientAccess access;
 };
 
+template<typename T>
+PendingResponse<T> Client::request(const T &query, std::chrono::milliseconds timeout) {
+    std::shared_ptr<std::promise<T>> promise = std::make_shared<std::promise<T>>();
+    std::future<T> response = promise->get_future();
+
+    unsigned size;
+    void *buffer = query.createBuffer(size);
+    RequestID requestID = sendRequest(buffer, size, [promise](MessageBuffer &&message, std::exception_ptr error) {
+        fulfil(*promise, std::move(message), error);
+    }, timeout);
+    free(buffer);
+
+    return {requestID, std::move(response)};
+}
+
+template<typename T>
+RequestID Client::request(const T &query,
+                          const std::type_identity_t<std::function<void(std::future<T> &&)>> &onCompletion,
+                          std::chrono::milliseconds timeout) {
+    unsigned size;
+    void *buffer = query.createBuffer(size);
+    RequestID requestID = sendRequest(buffer, size, [onCompletion](MessageBuffer &&message, std::exception_ptr error) {
+        std::promise<T> promise;
+        fulfil(promise, std::move(message), error);
+        onCompletion(promise.get_future());
+    }, timeout);
+    free(buffer);
+
+    return requestID;
+}
+
+template<typename T>
+void Client::fulfil(std::promise<T> &promise, MessageBuffer &&response, std::exception_ptr error) {
+    if (error) {
+        promise.set_exception(error);
+        return;
+    }
+
+    // Queries deserialise onto the heap, so move the response out and free the original. Queries which check
+    // their buffer against its size are given it.
+    try {
+        T *decodedQuery;
+        if constexpr (requires { T::deserialise((const void *) response.data(), response.size()); }) {
+            decodedQuery = &T::deserialise((const void *) response.data(), response.size());
+        } else {
+            decodedQuery = &T::deserialise((const void *) response.data());
+        }
+        T &decoded = *decodedQuery;
+        T value = std::move(decoded);
+        delete &decoded;
+        promise.set_value(std::move(value));
+    } catch (...) {
+        promise.set_exception(std::current_exception());
+    }
+}
 
 #endif //DATABASE_CLIENT_CLIENT_H
@@ -0,0 +1,35 @@
+#ifndef DATABASE_MANAGER_COMPRESSION_H
+#define DATABASE_MANAGER_COMPRESSION_H
+
+#include <vector>
+
+#include <encrypt.h>
+
+// Messages smaller than this aren't worth compressing
+#define COMPRESSION_THRESHOLD 1024u
+
+// Favour speed over ratio, as messages are compressed on the request threads as they are sent
+#define COMPRESSION_LEVEL 1
+
+/// <summary>
+/// Compresses a message payload with zlib, ready for encrypting. The result starts with the uncompressed size, so it
+/// can be decompressed without knowing the size up front.
+/// </summary>
+/// <param name="data">The payload to compress.</param>
+/// <param name="size">The size of the payload.</param>
+/// <param name="compressed">Output for the compressed payload.</param>
+/// <returns>True if the payload was compressed, false if it was below COMPRESSION_THRESHOLD or compressing it wouldn't
+/// have made it any smaller, in which case it should be sent as it is.</returns>
+bool compressPayload(const void *data, uint32 size, std::vector<uint8> &compressed);
+
+/// <summary>
+/// Decompresses a payload produced by compressPayload.
+/// </summary>
+/// <param name="data">The compressed payload.</param>
+/// <param name="size">The size of the compressed payload.</param>
+/// <param name="decompressedSize">Output for the size of the decompressed payload.</param>
+/// <returns>The decompressed payload, allocated with malloc and owned by the caller, or nullptr if the payload is
+/// invalid.</returns>
+void *decompressPayload(const void *data, uint32 size, uint32 &decompressedSize);
+
+#endif //DATABASE_MANAGER_COMPRESSION_H
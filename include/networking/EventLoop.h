@@ -0,0 +1,115 @@
+#ifndef DATABASE_MANAGER_EVENTLOOP_H
+#define DATABASE_MANAGER_EVENTLOOP_H
+
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+
+#include "TCPSocket.h"
+
+/// <summary>
+/// EventLoop
+/// A small readiness reactor for the server. Sockets are registered with a key and a set of interest flags, and a
+/// single thread blocks in wait() until at least one of them is ready, the timeout elapses or another thread calls
+/// wake(). On Linux this is backed by epoll with an eventfd for waking; on other platforms (i.e. Windows) it falls back
+/// to (WSA)poll with a loopback wake socket. Registration is level triggered, so a socket which still has unread data
+/// will be reported again on the next call to wait().
+/// </summary>
+class EventLoop {
+public:
+    /// <summary>
+    /// The readiness flags which can be requested and reported.
+    /// </summary>
+    enum EventFlags { EVENT_READABLE = 0x01u, EVENT_WRITABLE = 0x02u, EVENT_HANGUP = 0x04u };
+
+    /// <summary>
+    /// Event
+    /// A single readiness notification returned from wait().
+    /// </summary>
+    struct Event {
+        /// <summary>
+        /// The key the socket was registered with.
+        /// </summary>
+        unsigned long long key;
+
+        /// <summary>
+        /// A combination of EventFlags describing the readiness.
+        /// </summary>
+        unsigned events;
+    };
+
+    /// <summary>
+    /// Creates the underlying poller and the wake channel.
+    /// </summary>
+    EventLoop();
+
+    /// <summary>
+    /// Closes the underlying poller and the wake channel.
+    /// </summary>
+    ~EventLoop();
+
+    EventLoop(const EventLoop &) = delete;
+
+    EventLoop &operator=(const EventLoop &) = delete;
+
+    /// <summary>
+    /// Registers a socket with this loop. Must only be called from the thread running the loop.
+    /// </summary>
+    /// <param name="socket">The socket to watch.</param>
+    /// <param name="key">The key which will be reported in events for this socket.</param>
+    /// <param name="interest">The EventFlags to watch for.</param>
+    /// <returns>True if the socket was registered successfully.</returns>
+    bool add(const TCPSocket &socket, unsigned long long key, unsigned interest = EVENT_READABLE);
+
+    /// <summary>
+    /// Changes the interest flags for an already registered socket.
+    /// </summary>
+    /// <param name="socket">The socket to modify.</param>
+    /// <param name="key">The key which will be reported in events for this socket.</param>
+    /// <param name="interest">The new EventFlags to watch for.</param>
+    /// <returns>True if the registration was updated successfully.</returns>
+    bool modify(const TCPSocket &socket, unsigned long long key, unsigned interest);
+
+    /// <summary>
+    /// Removes a socket from this loop. This must be called before the socket is closed.
+    /// </summary>
+    /// <param name="socket">The socket to stop watching.</param>
+    void remove(const TCPSocket &socket);
+
+    /// <summary>
+    /// Blocks until a registered socket is ready, the loop is woken or the timeout elapses.
+    /// </summary>
+    /// <param name="events">Output vector which is cleared and filled with the ready events.</param>
+    /// <param name="timeoutMs">The maximum time to wait in milliseconds. Negative waits indefinitely.</param>
+    /// <returns>True if the loop was woken by wake() since the last call.</returns>
+    bool wait(std::vector<Event> &events, int timeoutMs);
+
+    /// <summary>
+    /// Wakes the thread blocked in wait(). Safe to call from any thread, and repeated calls before the loop wakes are
+    /// coalesced into a single wake up.
+    /// </summary>
+    void wake();
+
+private:
+#ifdef _WIN32
+    SOCKET wakeSocket = INVALID_SOCKET;
+#elif defined(__linux__)
+    int epollFd = -1;
+    int wakeFd = -1;
+#else
+    int wakePipe[2] = {-1, -1};
+#endif
+
+#ifndef __linux__
+    // Registered sockets for the poll fallback, mapped to their key and interest flags
+    std::unordered_map<NativeSocketHandle, std::pair<unsigned long long, unsigned>> registered;
+#endif
+
+    std::atomic<bool> wakePending = false;
+
+    // Reads everything from the wake channel so it stops reporting as readable
+    void drainWake();
+};
+
+#endif //DATABASE_MANAGER_EVENTLOOP_H
@@ -0,0 +1,130 @@
+#ifndef DATABASE_MANAGER_MPSCQUEUE_H
+#define DATABASE_MANAGER_MPSCQUEUE_H
+
+#include <atomic>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+
+/// <summary>
+/// MPSCQueue
+/// A bounded, lock free queue which any number of threads can push to, but only a single thread may pop from. Each slot
+/// carries a sequence number which tells producers whether it is free and the consumer whether it has been filled, so
+/// producers only contend with each other on a single atomic counter and never wait on the consumer.
+/// </summary>
+template <typename T>
+class MPSCQueue {
+public:
+    /// <summary>
+    /// Constructs an empty queue.
+    /// </summary>
+    /// <param name="capacity">The most items the queue can hold. Rounded up to a power of two.</param>
+    explicit MPSCQueue(size_t capacity);
+
+    MPSCQueue(const MPSCQueue &) = delete;
+
+    MPSCQueue &operator=(const MPSCQueue &) = delete;
+
+    /// <summary>
+    /// Adds an item to the back of the queue. Safe to call from any thread.
+    /// </summary>
+    /// <param name="item">The item to add. Only moved from if the push succeeds.</param>
+    /// <returns>True if the item was added, false if the queue is full.</returns>
+    bool tryPush(T &&item);
+
+    /// <summary>
+    /// Removes the item at the front of the queue. Must only be called from the consumer thread.
+    /// </summary>
+    /// <param name="item">Output for the removed item.</param>
+    /// <returns>True if an item was removed, false if the queue is empty (or the next item is still being
+    /// pushed).</returns>
+    bool tryPop(T &item);
+
+    /// <summary>
+    /// Getter for the most items the queue can hold.
+    /// </summary>
+    /// <returns>The capacity of the queue.</returns>
+    size_t capacity() const;
+
+private:
+    struct Slot {
+        // Equal to the position a producer may write this slot at, or one past the position once it is filled
+        std::atomic<size_t> sequence;
+        T item;
+    };
+
+    std::unique_ptr<Slot[]> slots;
+    size_t mask;
+
+    // Kept on separate cache lines so producers and the consumer don't invalidate each other's counters
+    alignas(64) std::atomic<size_t> pushPosition = 0;
+    alignas(64) size_t popPosition = 0;
+};
+
+template <typename T>
+MPSCQueue<T>::MPSCQueue(size_t capacity) {
+    size_t size = 2;
+    while (size < capacity) {
+        size <<= 1u;
+    }
+
+    slots = std::make_unique<Slot[]>(size);
+    mask = size - 1;
+
+    for (size_t i = 0; i < size; i++) {
+        slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+template <typename T>
+bool MPSCQueue<T>::tryPush(T &&item) {
+    size_t position = pushPosition.load(std::memory_order_relaxed);
+    Slot *slot;
+
+    while (true) {
+        slot = &slots[position & mask];
+        size_t sequence = slot->sequence.load(std::memory_order_acquire);
+        intptr_t difference = (intptr_t) sequence - (intptr_t) position;
+
+        if (difference == 0) {
+            // The slot is free, so try to claim it. If another producer got there first, position is updated and we try
+            // the next slot
+            if (pushPosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (difference < 0) {
+            // The consumer hasn't yet emptied this slot from the last time round, so the queue is full
+            return false;
+        } else {
+            position = pushPosition.load(std::memory_order_relaxed);
+        }
+    }
+
+    slot->item = std::move(item);
+    slot->sequence.store(position + 1, std::memory_order_release);
+
+    return true;
+}
+
+template <typename T>
+bool MPSCQueue<T>::tryPop(T &item) {
+    Slot &slot = slots[popPosition & mask];
+
+    if (slot.sequence.load(std::memory_order_acquire) != popPosition + 1) {
+        return false;
+    }
+
+    item = std::move(slot.item);
+    // Hand the slot back to producers for when the queue next wraps around to it
+    slot.sequence.store(popPosition + mask + 1, std::memory_order_release);
+    popPosition++;
+
+    return true;
+}
+
+template <typename T>
+size_t MPSCQueue<T>::capacity() const {
+    return mask + 1;
+}
+
+#endif //DATABASE_MANAGER_MPSCQUEUE_H
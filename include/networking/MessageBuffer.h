@@ -0,0 +1,65 @@
+#ifndef DATABASE_MANAGER_MESSAGEBUFFER_H
+#define DATABASE_MANAGER_MESSAGEBUFFER_H
+
+#include <encrypt.h>
+
+/// <summary>
+/// MessageBuffer
+/// Owns a received message buffer and exposes a view of part of it, so a message can be handed on without copying it
+/// out of the buffer it was decrypted into (for example, to skip over the session token at its start). The buffer is
+/// freed when the MessageBuffer is destroyed. MessageBuffers can be moved but not copied, so there is only ever a
+/// single owner.
+/// </summary>
+class MessageBuffer {
+public:
+    /// <summary>
+    /// Constructs an empty message buffer.
+    /// </summary>
+    MessageBuffer();
+
+    /// <summary>
+    /// Takes ownership of a buffer allocated with malloc.
+    /// </summary>
+    /// <param name="allocation">The buffer to take ownership of.</param>
+    /// <param name="offset">The offset into the buffer at which the view starts.</param>
+    /// <param name="size">The size of the view.</param>
+    MessageBuffer(void *allocation, unsigned offset, unsigned size);
+
+    MessageBuffer(const MessageBuffer &) = delete;
+
+    MessageBuffer(MessageBuffer &&other) noexcept;
+
+    /// <summary>
+    /// Destructor which frees the buffer.
+    /// </summary>
+    ~MessageBuffer();
+
+    MessageBuffer &operator=(const MessageBuffer &) = delete;
+
+    MessageBuffer &operator=(MessageBuffer &&other) noexcept;
+
+    /// <summary>
+    /// Getter for the start of the view.
+    /// </summary>
+    /// <returns>A pointer to the message data, or nullptr if the buffer is empty.</returns>
+    const uint8 *data() const;
+
+    /// <summary>
+    /// Getter for the size of the view.
+    /// </summary>
+    /// <returns>The size of the message data in bytes.</returns>
+    unsigned size() const;
+
+    /// <summary>
+    /// Gives up ownership of the buffer without freeing it.
+    /// </summary>
+    /// <returns>The buffer originally allocated, which the caller is now responsible for freeing.</returns>
+    void *release();
+
+private:
+    void *allocation = nullptr;
+    unsigned offset = 0;
+    unsigned viewSize = 0;
+};
+
+#endif //DATABASE_MANAGER_MESSAGEBUFFER_H
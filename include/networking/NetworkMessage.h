@@ -9,21 +9,86 @@
 
 #include <encrypt.h>
 
+#include "BufferPool.h"
+
 #define PADDED_SIZE(s, p) ((((s) / (p)) + (((s) % (p)) != 0)) * (p))
 #define BUFFER_PADDED_SIZE(s) PADDED_SIZE(s, BUFFER_CHUNK_SIZE)
 
 #define BUFFER_CHUNK_SIZE 128u
 #define AES_CHUNK_SIZE 16u
 #define MAX_MESSAGE_LENGTH 16777216
-
-/* Message Structure:
+#define FRAME_HEADER_SIZE sizeof(uint32)
+#define FRAME_HEADER_SIZE_V2 (sizeof(uint8) + sizeof(uint8) + sizeof(uint32))
+
+// Written by the server after the session token in step 4 of the handshake, followed by the newest WireFormat
+// it supports and a byte of WIRE_FEATURE flags. Older servers leave these bytes empty.
+#define WIRE_FORMAT_ADVERT_MAGIC 0x45524957u
+#define WIRE_FEATURE_COMPRESSION 0x01u
+#define WIRE_FEATURE_RESUMPTION 0x02u
+#define WIRE_FEATURE_REQUEST_IDS 0x04u
+
+// A client which has chosen a newer WireFormat than V1 says so in the upper bits of the AuthMode it sends, along
+// with any features it wants to use. Only a server which advertised the format will ever see these bits set.
+#define AUTH_MODE_MASK 0xFFFFu
+#define AUTH_MODE_WIRE_FORMAT_SHIFT 16u
+#define AUTH_MODE_WIRE_FORMAT_MASK 0xFFu
+#define AUTH_MODE_FEATURES_SHIFT 24u
+
+// Frame flags, only carried by formats newer than V1
+// The payload was compressed with compressPayload before it was encrypted
+#define FRAME_FLAG_COMPRESSED 0x01u
+
+/* Message Structure (V1):
+ * HEADER:
+ * Message Protocol (8 bit)
+ * Message Size (24 bit)
+ * PAYLOAD:
+ * Data of size Message Size
+ * PADDING:
+ * Up to a multiple of BUFFER_CHUNK_SIZE
+ *
+ * Message Structure (V2):
  * HEADER:
- * Message Protocol (16 bit)
- * Message Size (16 bit)
+ * Message Protocol (8 bit)
+ * Frame Flags (8 bit)
+ * Message Size (32 bit)
  * PAYLOAD:
  * Data of size Message Size
+ *
+ * AES messages carry the initialisation vector (64 bit) before the data, and the data is padded to a multiple of
+ * AES_CHUNK_SIZE, in both formats.
+ *
+ * On a connection using WIRE_FEATURE_REQUEST_IDS, each request the client sends starts with its session token
+ * and then a RequestID, and each message the server sends starts with the RequestID of the request it answers
+ * (or NO_REQUEST_ID if it doesn't answer one).
  */
 
+/// <summary>
+/// Identifies a request on a connection, so the client can match up the responses to it when it has more
+/// than one request in flight.
+/// </summary>
+typedef uint32 RequestID;
+
+// The ID of messages which aren't, or don't answer, a tagged request
+#define NO_REQUEST_ID 0u
+
+/// <summary>
+/// Enum of the frame formats which can be used on a connection. Every connection starts out using V1, and
+/// switches to the newest format both ends support once the client has authenticated.
+/// </summary>
+enum class WireFormat : uint8 {
+    /// <summary>
+    /// A 4 byte header with a 24 bit size. Every frame is padded to a multiple of BUFFER_CHUNK_SIZE.
+    /// </summary>
+    V1 = 1,
+    /// <summary>
+    /// A 6 byte header with a flags byte and a 32 bit size. Frames are sent at their exact length.
+    /// </summary>
+    V2 = 2
+};
+
+#define LATEST_WIRE_FORMAT WireFormat::V2
+
 /// <summary>
 /// Enum of all message protocols.
 /// </summary>
@@ -55,7 +120,11 @@ enum class MessageProtocol {
     /// <summary>
     /// This message was a heartbeat.
     /// </summary>
-    HEARTBEAT
+    HEARTBEAT,
+    /// <summary>
+    /// A message carrying a ResumptionTicket.
+    /// </summary>
+    RESUME_MESSAGE
 };
 
 /// <summary>
@@ -146,6 +215,23 @@ enum class ClientAccess {
     LIMITED
 };
 
+/// <summary>
+/// ResumptionTicket
+/// Issued by the server to a client which asked for WIRE_FEATURE_RESUMPTION once it has authenticated, so it can
+/// reconnect without repeating the key exchange. The ID is only meaningful to the server which issued it, which
+/// only accepts it from a client that can prove it knows the session key of the connection it was issued on.
+/// </summary>
+struct ResumptionTicket {
+    /// <summary>
+    /// The random ID the server knows the ticket by.
+    /// </summary>
+    uint256 id;
+    /// <summary>
+    /// When the ticket expires, in seconds since the UNIX epoch by the server's clock.
+    /// </summary>
+    uint64 expiry;
+};
+
 /// <summary>
 /// NetworkMessage
 /// An individual network message.
@@ -171,11 +257,24 @@ struct NetworkMessage {
     /// <param name="protocol">Tge protocol the message was sent with.</param>
     NetworkMessage(const std::string &message, MessageProtocol protocol);
 
+    /// <summary>
+    /// Move constructor, which takes the other message's buffer.
+    /// </summary>
+    /// <param name="other">The message to move from. Left empty.</param>
+    NetworkMessage(NetworkMessage &&other) noexcept;
+
     /// <summary>
     /// Default destructor.
     /// </summary>
     virtual ~NetworkMessage();
 
+    /// <summary>
+    /// Move assignment, which returns this message's buffer to the pool and takes the other message's buffer.
+    /// </summary>
+    /// <param name="other">The message to move from. Left empty.</param>
+    /// <returns>This message.</returns>
+    NetworkMessage &operator=(NetworkMessage &&other) noexcept;
+
     // Returns a padded data stream containing the relevant header and payload. Padded to a multiple of BUFFER_CHUNK_SIZE
 
     /// <summary>
@@ -197,13 +296,45 @@ struct NetworkMessage {
     /// </summary>
     void clear();
 
+    /// <summary>
+    /// Returns the number of bytes which follow the header in the data stream, not including any padding.
+    /// </summary>
+    /// <returns>Payload size.</returns>
+    virtual uint32 payloadSize() const;
+
+    /// <summary>
+    /// Writes the header for this message in the given wire format. The payload follows the V1 header
+    /// in the data stream, so a frame in another format is this header followed by payloadSize() bytes
+    /// from dataStream() + FRAME_HEADER_SIZE.
+    /// </summary>
+    /// <param name="header">The buffer to write to, which must hold headerSize(format) bytes.</param>
+    /// <param name="format">The wire format to write the header in.</param>
+    void writeHeader(uint8 *header, WireFormat format) const;
+
     /// <summary>
     /// Decodes this message into an instance variable.
     /// </summary>
     /// <param name="buffer">The buffer the message is decoded from.</param>
     /// <param name="bufferSize">Size of the buffer.</param>
+    /// <param name="format">The wire format the frame was sent in.</param>
     /// <returns>Status code of decode.</returns>
-    virtual DecodeStatus decode(uint8 *buffer, uint32 bufferSize);
+    virtual DecodeStatus decode(uint8 *buffer, uint32 bufferSize, WireFormat format = WireFormat::V1);
+
+    /// <summary>
+    /// Getter for the size of a frame header in the given wire format.
+    /// </summary>
+    /// <param name="format">The wire format.</param>
+    /// <returns>The header size in bytes.</returns>
+    static uint32 headerSize(WireFormat format);
+
+    /// <summary>
+    /// Calculates the total size on the wire of the frame which starts with the given header, including the header,
+    /// any initialisation vector and the padding.
+    /// </summary>
+    /// <param name="header">The first headerSize(format) bytes of the frame.</param>
+    /// <param name="format">The wire format the frame was sent in.</param>
+    /// <returns>The size of the frame in bytes, or 0 if the header is invalid.</returns>
+    static uint32 frameSize(const uint8 *header, WireFormat format = WireFormat::V1);
 
     /// <summary>
     /// Gets the decoded message from this object.
@@ -234,6 +365,19 @@ struct NetworkMessage {
     /// <returns>Message's protocol.</returns>
     MessageProtocol protocol() const;
 
+    /// <summary>
+    /// Returns the flags byte sent in the frame header. Always 0 for messages received in the V1 format.
+    /// </summary>
+    /// <returns>Message's frame flags.</returns>
+    uint8 frameFlags() const;
+
+    /// <summary>
+    /// Sets the flags byte to send in the frame header. The flags are dropped if the message is sent in the V1
+    /// format, so must only be set for connections using a newer format.
+    /// </summary>
+    /// <param name="flags">The frame flags.</param>
+    void setFrameFlags(uint8 flags);
+
 protected:
     /// <summary>
     /// Enum of the messages status.
@@ -261,22 +405,35 @@ protected:
     unsigned char messageStateFlags = 0x00u;
 
     /// <summary>
-    /// Message data buffer.
+    /// Message data buffer, acquired from the BufferPool.
     /// </summary>
     void *messageData = nullptr;
     /// <summary>
     /// Size of the \ref messageData buffer.
     /// </summary>
-    uint32 messageSize;
+    uint32 messageSize = 0;
     /// <summary>
     /// the protocol used by \ref messageData.
     /// </summary>
-    MessageProtocol _protocol;
+    MessageProtocol _protocol{};
+
+    /// <summary>
+    /// The flags byte from the frame header.
+    /// </summary>
+    uint8 _frameFlags = 0;
 
     /// <summary>
     /// How much of the message is left to read.
     /// </summary>
     uint32 readLeft = 0;
+
+    /// <summary>
+    /// Reads the protocol, size and flags from a frame header.
+    /// </summary>
+    /// <param name="buffer">The buffer starting with the header.</param>
+    /// <param name="format">The wire format the frame was sent in.</param>
+    /// <returns>The size of the header, i.e. the index of the first payload byte.</returns>
+    uint32 readHeader(const uint8 *buffer, WireFormat format);
 };
 
 /// <summary>
@@ -304,32 +461,61 @@ struct EncryptedNetworkMessage : public NetworkMessage {
     /// <param name="encryptionKey">Key to encrypt the message.</param>
     EncryptedNetworkMessage(const std::string &message, AESKey encryptionKey);
 
+    /// <summary>
+    /// Move constructor, which takes the other message's buffer.
+    /// </summary>
+    /// <param name="other">The message to move from. Left empty.</param>
+    EncryptedNetworkMessage(EncryptedNetworkMessage &&other) noexcept = default;
+
     /// <summary>
     /// Default destructor.
     /// </summary>
     ~EncryptedNetworkMessage() = default;
 
+    /// <summary>
+    /// Move assignment, which returns this message's buffer to the pool and takes the other message's buffer.
+    /// </summary>
+    /// <param name="other">The message to move from. Left empty.</param>
+    /// <returns>This message.</returns>
+    EncryptedNetworkMessage &operator=(EncryptedNetworkMessage &&other) noexcept = default;
+
     /// <summary>
     /// Size of the buffer, including padding.
     /// </summary>
     /// <returns></returns>
     uint32 dataStreamSize() const override;
 
+    /// <summary>
+    /// Size of the initialisation vector and encrypted data, which follow the header.
+    /// </summary>
+    /// <returns>Payload size.</returns>
+    uint32 payloadSize() const override;
+
     /// <summary>
     /// Decodes a message from the buffer into a instance variable.
     /// </summary>
     /// <param name="buffer">Buffer to decrypt message from.</param>
     /// <param name="bufferSize">The size of the buffer.</param>
+    /// <param name="format">The wire format the frame was sent in.</param>
     /// <returns>Status code of decode.</returns>
-    DecodeStatus decode(uint8 *buffer, uint32 bufferSize) override;
+    DecodeStatus decode(uint8 *buffer, uint32 bufferSize, WireFormat format = WireFormat::V1) override;
 
     /// <summary>
-    /// Decrypts the data with a given key.
+    /// Decrypts the data with a given key. The decrypted message is getMessageSize() bytes long, so this must
+    /// not be used for messages which may be compressed.
     /// </summary>
     /// <param name="decryptionKey">Key to decrypt data with.</param>
     /// <returns>Buffer with decrypted message.</returns>
     const void *decryptMessageData(AESKey decryptionKey) const;
 
+    /// <summary>
+    /// Decrypts the data with a given key, and decompresses it if the frame was flagged as compressed.
+    /// </summary>
+    /// <param name="decryptionKey">Key to decrypt data with.</param>
+    /// <param name="decryptedSize">Output for the size of the decrypted message.</param>
+    /// <returns>Buffer with decrypted message, or nullptr if it couldn't be decompressed.</returns>
+    const void *decryptMessageData(AESKey decryptionKey, uint32 &decryptedSize) const;
+
 private:
     uint64 initialisationVector = 0;
 };
@@ -0,0 +1,119 @@
+#ifndef DATABASE_MANAGER_REPEATTOKENSTORE_H
+#define DATABASE_MANAGER_REPEATTOKENSTORE_H
+
+#include <string>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <filesystem>
+#include <unordered_map>
+
+#include <encrypt.h>
+
+#include "NetworkMessage.h"
+
+// How long a repeat token lasts since it was issued or last used, so a user who connects regularly never has to log
+// back in
+#define REPEAT_TOKEN_LIFETIME_S (30ull * 24ull * 60ull * 60ull)
+// The most repeat tokens held at once. Past this, the tokens which have gone unused longest are dropped.
+#define REPEAT_TOKEN_LIMIT 65536
+
+/// <summary>
+/// RepeatTokenStore
+/// A thread safe store of the repeat tokens issued to clients, and who each was issued to. Tokens expire once they go
+/// unused for their lifetime, and the store holds a bounded number of them. It can be kept in a file, so the tokens
+/// survive a restart of the server.
+/// </summary>
+class RepeatTokenStore {
+public:
+    /// <summary>
+    /// Constructs an empty store.
+    /// </summary>
+    /// <param name="capacity">The most tokens held at once.</param>
+    /// <param name="lifetimeSeconds">How long a token lasts without being used.</param>
+    explicit RepeatTokenStore(size_t capacity = REPEAT_TOKEN_LIMIT,
+                              unsigned long long lifetimeSeconds = REPEAT_TOKEN_LIFETIME_S);
+
+    /// <summary>
+    /// Adds a token, dropping the token unused for longest if the store is full.
+    /// </summary>
+    /// <param name="token">The token.</param>
+    /// <param name="email">The email of the user the token was issued to.</param>
+    /// <param name="access">The access level of the user.</param>
+    void insert(const uint256 &token, const std::string &email, ClientAccess access);
+
+    /// <summary>
+    /// Looks up who a token was issued to. Finding a token counts as using it, so restarts its lifetime.
+    /// </summary>
+    /// <param name="token">The token.</param>
+    /// <returns>The email and access level the token was issued with, or nothing if the token is unknown or has
+    /// expired.</returns>
+    std::optional<std::pair<std::string, ClientAccess>> find(const uint256 &token);
+
+    /// <summary>
+    /// Removes every token which has expired. Called periodically so expired tokens don't take up space until the store
+    /// fills.
+    /// </summary>
+    /// <returns>The number of tokens removed.</returns>
+    size_t expire();
+
+    /// <summary>
+    /// Getter for the number of tokens held, including any which have expired since the last call to expire.
+    /// </summary>
+    /// <returns>The number of tokens.</returns>
+    size_t size();
+
+    /// <summary>
+    /// Keeps the store in a file. Any unexpired tokens already in the file are loaded, and flush writes the store back
+    /// to it. The tokens grant access to the server, so the file should be protected like a key file.
+    /// </summary>
+    /// <param name="path">The file to keep the store in. It need not exist yet.</param>
+    /// <returns>True if the file was loaded or doesn't exist, false if it was unreadable, in which case the store is
+    /// left empty and the file is replaced on the next flush.</returns>
+    bool setPersistencePath(const std::filesystem::path &path);
+
+    /// <summary>
+    /// Writes the store to its file, if it has one and has changed since it was last written. The file is replaced in a
+    /// single rename, so a crash while writing leaves the old file intact.
+    /// </summary>
+    /// <returns>False if writing the file failed, true otherwise. A failed write is tried again on the next
+    /// flush.</returns>
+    bool flush();
+
+private:
+    struct Entry {
+        std::string email;
+        ClientAccess access;
+        // Seconds since the UNIX epoch, so it means the same after a restart
+        unsigned long long expiry;
+        // The token's place in the usage order
+        std::list<uint256>::iterator usage;
+    };
+
+    // The tokens are random, so any part of one makes a good hash
+    struct TokenHash {
+        size_t operator()(const uint256 &token) const;
+    };
+
+    struct TokenEqual {
+        bool operator()(const uint256 &a, const uint256 &b) const;
+    };
+
+    std::unordered_map<uint256, Entry, TokenHash, TokenEqual> tokens;
+    // Tokens from least to most recently used. As every token has the same lifetime, this is also the order they expire
+    // in.
+    std::list<uint256> usageOrder;
+
+    size_t capacity;
+    unsigned long long lifetimeSeconds;
+
+    std::optional<std::filesystem::path> persistencePath;
+    bool dirty = false;
+
+    std::mutex storeMutex;
+
+    // Adds a token with the given expiry. Must be called with the store locked.
+    void insertLocked(const uint256 &token, const std::string &email, ClientAccess access, unsigned long long expiry);
+};
+
+#endif //DATABASE_MANAGER_REPEATTOKENSTORE_H
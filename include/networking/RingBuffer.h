@@ -0,0 +1,109 @@
+#ifndef DATABASE_MANAGER_RINGBUFFER_H
+#define DATABASE_MANAGER_RINGBUFFER_H
+
+#include <vector>
+#include <cstddef>
+
+/// <summary>
+/// RingBuffer
+/// A growable circular byte buffer used to receive from and send to a socket. Bytes are written directly into free
+/// space in the buffer (e.g. by recv) and read back out in order, so any number of frames can be received in a single
+/// read and parsed incrementally without losing the bytes of a frame which has only partly arrived. Similarly, a frame
+/// which was only partly sent stays buffered until the socket can take the rest. No memory is allocated until the first
+/// write.
+/// </summary>
+class RingBuffer {
+public:
+    /// <summary>
+    /// Constructs an empty ring buffer.
+    /// </summary>
+    /// <param name="initialCapacity">The capacity allocated on first use, and returned to once the buffer empties after
+    /// growing.</param>
+    explicit RingBuffer(size_t initialCapacity);
+
+    /// <summary>
+    /// Getter for the number of bytes which have been written and not yet consumed.
+    /// </summary>
+    /// <returns>The number of buffered bytes.</returns>
+    size_t size() const;
+
+    /// <summary>
+    /// Getter for the current capacity of the buffer.
+    /// </summary>
+    /// <returns>The capacity in bytes.</returns>
+    size_t capacity() const;
+
+    /// <summary>
+    /// Gets the next contiguous region of free space in the buffer, growing the buffer if it is full. Once data has
+    /// been written into the region, commit must be called with the number of bytes written.
+    /// </summary>
+    /// <param name="length">Output for the length of the region.</param>
+    /// <returns>A pointer to the start of the free region.</returns>
+    unsigned char *writeRegion(size_t &length);
+
+    /// <summary>
+    /// Marks bytes written into the region returned from writeRegion as buffered.
+    /// </summary>
+    /// <param name="length">The number of bytes written.</param>
+    void commit(size_t length);
+
+    /// <summary>
+    /// Copies bytes into the end of the buffer, growing it if necessary.
+    /// </summary>
+    /// <param name="data">The bytes to append.</param>
+    /// <param name="length">The number of bytes to append.</param>
+    void append(const void *data, size_t length);
+
+    /// <summary>
+    /// Gets the next contiguous region of buffered bytes, which may be fewer than size() if the bytes wrap around the
+    /// end of the buffer. Used for writing the buffer out (e.g. with send) without rearranging it.
+    /// </summary>
+    /// <param name="length">Output for the length of the region.</param>
+    /// <returns>A pointer to the start of the region.</returns>
+    const unsigned char *readRegion(size_t &length) const;
+
+    /// <summary>
+    /// Copies buffered bytes out without consuming them.
+    /// </summary>
+    /// <param name="destination">The buffer to copy into.</param>
+    /// <param name="length">The number of bytes to copy. Must be no more than size().</param>
+    void copy(void *destination, size_t length) const;
+
+    /// <summary>
+    /// Gets a pointer to the next buffered bytes as one contiguous block without consuming them. If the bytes wrap
+    /// around the end of the buffer, the buffer is first rearranged so they don't.
+    /// </summary>
+    /// <param name="length">The number of bytes required. Must be no more than size().</param>
+    /// <returns>A pointer to the bytes, valid until the buffer is next modified.</returns>
+    const unsigned char *peek(size_t length);
+
+    /// <summary>
+    /// Discards buffered bytes from the front of the buffer.
+    /// </summary>
+    /// <param name="length">The number of bytes to discard. Must be no more than size().</param>
+    void consume(size_t length);
+
+    /// <summary>
+    /// Ensures the buffer can hold at least the given number of bytes in total.
+    /// </summary>
+    /// <param name="length">The number of bytes the buffer must be able to hold.</param>
+    void reserve(size_t length);
+
+    /// <summary>
+    /// Discards every buffered byte.
+    /// </summary>
+    void clear();
+
+private:
+    std::vector<unsigned char> storage;
+
+    size_t initialCapacity;
+
+    // The index of the first buffered byte and the number of buffered bytes
+    size_t head = 0, count = 0;
+
+    // Moves the buffered bytes to the start of the storage so they are contiguous
+    void linearise();
+};
+
+#endif //DATABASE_MANAGER_RINGBUFFER_H
@@ -13,25 +13,60 @@
 #include <unordered_map>
 #include <map>
 #include <queue>
+#include <deque>
+#include <functional>
+#include <shared_mutex>
+#include <mutex>
+#include <memory>
+#include <condition_variable>
+#include <atomic>
+#include <random>
+#include <ostream>
 
 #include <encrypt.h>
 #include <authenticate.h>
 
 #include "TCPSocket.h"
+#include "MPSCQueue.h"
+#include "EventLoop.h"
+#include "WorkerPool.h"
+#include "Compression.h"
+#include "MessageBuffer.h"
+#include "RepeatTokenStore.h"
+#include "TimerWheel.h"
+#include "SlotMap.h"
 #include "../database/DatabaseManager.h"
 #include "../database/Drawing.h"
+#include "../database/RequestType.h"
 #include "../database/Logger.h"
 #include "../../guard.h"
 
 #define CLIENT_APPLICATION_ID "e89163c2-86fd-4675-ad9e-0d0e7632b9a8"
 
+// The most messages which can be waiting in a single client's send queue at once
+#define CLIENT_SEND_QUEUE_CAPACITY 1024
+
+// How long each stage of the key exchange waits for the client before giving up
+#define HANDSHAKE_STAGE_TIMEOUT_MS 10000
+// The most accepted clients which can be waiting for a handshake worker. Any more are disconnected straight away.
+#define HANDSHAKE_QUEUE_LIMIT 64
+// How long a client which has completed the key exchange has to authenticate. Generous, as logging in through
+// the browser is interactive.
+#define AUTHENTICATION_TIMEOUT_S 300
+
+// How long a resumption ticket can be used for after it is issued
+#define RESUMPTION_TICKET_LIFETIME_S (8u * 60u * 60u)
+// The most resumption tickets held at once. Past this, the tickets closest to expiring are dropped.
+#define RESUMPTION_TICKET_LIMIT 4096
+
 static std::string getNonBlockingInput();
 
 class Server;
 
 /// <summary>
 /// ClientHandle
-/// Keeps track of individual clients through handles.
+/// Keeps track of individual clients through handles. The handle a request is handled with also carries the ID
+/// of the request, so any message sent to the client with it is tagged as the response to that request.
 /// </summary>
 struct ClientHandle {
     friend class Server;
@@ -40,10 +75,26 @@ struct ClientHandle {
     /// Constructs a new client with a specified ID.
     /// </summary>
     /// <param name="id">ID of client.</param>
-    ClientHandle(unsigned id);
+    ClientHandle(unsigned long long id);
 
 private:
-    unsigned clientID;
+    // The client's handle in the server's slot map, which never matches a later client
+    unsigned long long clientID;
+    // The request being handled, if the client tags its requests
+    RequestID requestID = NO_REQUEST_ID;
+};
+
+// Keeps a client's tagged requests in order while letting its read only requests run in parallel. Shared with the
+// request tasks, as they may finish after the client has gone. Guarded by its mutex.
+struct RequestOrder {
+    std::mutex mutex;
+    // Read only requests which were handed out on their own keys and haven't finished
+    unsigned runningReads = 0;
+    // Requests which aren't read only, and haven't finished. While there are any, every request from the client is
+    // handled on the client's own key, in order.
+    unsigned pendingWrites = 0;
+    // Requests waiting for the read only requests before them to finish
+    std::deque<std::function<void()>> held;
 };
 
 /// <summary>
@@ -61,7 +112,7 @@ struct ClientData {
     /// <param name="sessionKey">The session key.</param>
     /// <param name="sessionToken">The session token.</param>
     /// <param name="authNonce">The clients authNonce.</param>
-    ClientData(unsigned handleID, const TCPSocket &socket, const AESKey &sessionKey, uint64 sessionToken, uint64 authNonce);
+    ClientData(unsigned long long handleID, const TCPSocket &socket, const AESKey &sessionKey, uint64 sessionToken, uint64 authNonce);
 
     /// <summary>
     /// Stores the client's users' email.
@@ -84,6 +135,39 @@ private:
     AESKey clientSessionKey;
     uint64 clientSessionToken;
     uint64 clientAuthNonce;
+
+    // Whether this client has completed authentication. Only changed with the clients lock held, as other
+    // threads look for authenticated clients to broadcast to.
+    bool authenticated = false;
+
+    // Messages waiting to be sent to this client. Any thread may add to it, and the server loop moves the
+    // messages into the client's socket. Messages are held by value so queueing one doesn't allocate.
+    MPSCQueue<EncryptedNetworkMessage> sendQueue = MPSCQueue<EncryptedNetworkMessage>(CLIENT_SEND_QUEUE_CAPACITY);
+
+    // The bytes of the messages in the send queue, and the bytes the socket has been given but hasn't yet sent.
+    // Together these make up the client's send backlog.
+    std::atomic<size_t> queuedSendBytes = 0, socketSendBytes = 0;
+
+    // Whether the event loop is watching this client's socket for space to write
+    bool writeInterest = false;
+
+    // Whether large messages to this client are compressed. Negotiated during authentication.
+    bool compression = false;
+
+    // Whether this client tags its requests with IDs, and expects every message to carry one. Negotiated during
+    // authentication.
+    bool requestIDs = false;
+
+    // The order of this client's requests, when it tags them
+    std::shared_ptr<RequestOrder> requestOrder = std::make_shared<RequestOrder>();
+
+    // The client's next heartbeat, and when it must have responded to the last one by (or, before it has
+    // authenticated, when it must have authenticated by)
+    TimerWheel::TimerID heartbeatTimer = TimerWheel::NO_TIMER;
+    TimerWheel::TimerID timeoutTimer = TimerWheel::NO_TIMER;
+
+    // Gets the total number of bytes waiting to be sent to this client
+    size_t sendBacklog() const;
 };
 
 /// <summary>
@@ -98,9 +182,34 @@ public:
     /// <param name="caller">A reference to the server that called this function.</param>
     /// <param name="clientHandle">The handle of the client that made the initial request.</param>
     /// <param name="message">The message from the client, as a rvalue reference to indicate
-    /// transfer of ownership.</param>
-    /// <param name="messageSize">The size of the message.</param>
-    virtual void onMessageReceived(Server &caller, const ClientHandle &clientHandle, void*&& message, unsigned messageSize) = 0;
+    /// transfer of ownership. It views the buffer the message was decrypted into, so is not a
+    /// separate allocation.</param>
+    virtual void onMessageReceived(Server &caller, const ClientHandle &clientHandle, MessageBuffer &&message) = 0;
+
+    /// <summary>
+    /// Writes any statistics the handler keeps, for the server's "handler stats" command. Writes nothing by
+    /// default.
+    /// </summary>
+    /// <param name="out">The stream to write the statistics to.</param>
+    virtual void writeStats(std::ostream &out) {}
+
+    /// <summary>
+    /// Runs any self checks the handler has, for the server's "handler check" command. Does nothing by default.
+    /// </summary>
+    /// <param name="caller">A reference to the server running the check.</param>
+    /// <param name="out">The stream to write the results to.</param>
+    virtual void runChecks(Server &caller, std::ostream &out) {}
+
+    /// <summary>
+    /// Checks whether a request only reads, so that handling it can't change what any other request sees. For
+    /// clients which tag their requests, read only requests may be handled in parallel with each other and complete
+    /// out of order. Any other request waits for every request before it, and every request after it waits for it.
+    /// Nothing is read only by default, so each client's requests are handled one at a time in order.
+    /// </summary>
+    /// <param name="message">The request, as it will be passed to onMessageReceived.</param>
+    /// <param name="messageSize">The size of the request.</param>
+    /// <returns>True if the request only reads.</returns>
+    virtual bool isReadOnly(const void *message, unsigned messageSize) { return false; }
 };
 
 /// <summary>
@@ -108,10 +217,46 @@ public:
 ///</summary>
 class Server {
 public:
+    /// <summary>
+    /// HandshakeMetrics
+    /// Totals for the key exchanges run by the handshake workers.
+    /// </summary>
+    struct HandshakeMetrics {
+        /// <summary>
+        /// The number of accepted clients currently waiting for a handshake worker.
+        /// </summary>
+        size_t queuedHandshakes = 0;
+        /// <summary>
+        /// The most clients which have been waiting for a handshake worker at once.
+        /// </summary>
+        size_t maxQueuedHandshakes = 0;
+        /// <summary>
+        /// The number of clients disconnected because the handshake queue was full.
+        /// </summary>
+        unsigned long long rejectedHandshakes = 0;
+        /// <summary>
+        /// The number of handshakes which completed.
+        /// </summary>
+        unsigned long long completedHandshakes = 0;
+        /// <summary>
+        /// The number of handshakes which failed or timed out.
+        /// </summary>
+        unsigned long long failedHandshakes = 0;
+        /// <summary>
+        /// The total time from accepting to finishing a handshake, including time spent queued.
+        /// </summary>
+        double totalLatencyMs = 0;
+        /// <summary>
+        /// The longest time from accepting to finishing a handshake.
+        /// </summary>
+        double maxLatencyMs = 0;
+    };
+
     /// <summary>
     /// Constructs a new server.
     /// </summary>
-    /// <param name="refreshRate">How often the server should check for new messages (in Hz).</param>
+    /// <param name="refreshRate">The rate of the server's heartbeat clock (in Hz). Messages are handled as soon
+    /// as they arrive; this only determines how often heartbeats are sent alongside the heart beat cycles.</param>
     /// <param name="serverKey">The server's RSA key.</param>
     /// <param name="serverSignature">The signature of the server.</param>
     Server(float refreshRate, RSAKeyPair serverKey, DigitalSignatureKeyPair serverSignature);
@@ -140,7 +285,9 @@ public:
     void closeServer();
 
     /// <summary>
-    /// Adds a message to be sent ASAP.
+    /// Adds a message to be sent ASAP. If the client already has more than CLIENT_SEND_HIGH_WATER_MARK bytes
+    /// waiting to be sent, this blocks until the server has sent some of them, so a slow client can't make the
+    /// server buffer without limit.
     /// </summary>
     /// <param name="clientHandle">The client to send the message to.</param>
     /// <param name="message">The message as a buffer.</param>
@@ -155,7 +302,9 @@ public:
     void addMessageToSendQueue(const ClientHandle &clientHandle, const std::string &message);
 
     /// <summary>
-    /// Broadcast a message to all clients connected to this server.
+    /// Broadcast a message to all clients connected to this server. The message is copied, then compressed and
+    /// encrypted for each client on the broadcast workers, so this returns without waiting for it to be queued. Each
+    /// client receives its broadcasts in the order they were made.
     /// </summary>
     /// <param name="message">The message to be broadcasted as a buffer.</param>
     /// <param name="messageLength">The size of the buffer.</param>
@@ -211,13 +360,63 @@ public:
     void changelogMessage(const ClientHandle &clientHandle, const std::string &message);
 
     /// <summary>
-    /// Sets how many loops are completed by the server loop before sending another heartbeat.
+    /// Sets how many cycles of the heartbeat clock (at the refresh rate) pass before sending another heartbeat.
     /// </summary>
     /// <param name="cycles">The number of cycles per heartbeat.</param>
     void setHeartBeatCycles(int cycles);
 
     /// <summary>
-    /// Getter for the database mananger.
+    /// Sets how many worker threads run the key exchange with newly accepted clients. This bounds how much CPU
+    /// is spent on RSA when many clients connect at once. Must be called before the server is started.
+    /// </summary>
+    /// <param name="threads">The number of handshake worker threads. If 0, one is used per hardware thread.</param>
+    void setHandshakeWorkerThreads(unsigned threads);
+
+    /// <summary>
+    /// Takes a snapshot of the handshake metrics. Safe to call from any thread.
+    /// </summary>
+    /// <returns>The handshake metrics.</returns>
+    HandshakeMetrics handshakeMetrics();
+
+    /// <summary>
+    /// Sets how many worker threads handle client requests. Requests from a single client are always
+    /// handled in order, but requests from different clients are handled in parallel.
+    /// Must be called before the server is started.
+    /// </summary>
+    /// <param name="threads">The number of request worker threads. If 0, one is used per hardware thread.</param>
+    void setRequestWorkerThreads(unsigned threads);
+
+    /// <summary>
+    /// Sets the bounds of the database session pool, i.e. how many database queries can run concurrently.
+    /// Must be called before connecting to the database server.
+    /// </summary>
+    /// <param name="minSessions">The number of sessions kept open at all times.</param>
+    /// <param name="maxSessions">The maximum number of sessions open at once.</param>
+    void setDatabaseSessionPoolSize(unsigned minSessions, unsigned maxSessions);
+
+    /// <summary>
+    /// Sets whether the server offers compression of large messages to clients. Only affects clients which
+    /// connect afterwards, and only those which use a wire format newer than V1 and ask for compression.
+    /// </summary>
+    /// <param name="enabled">Whether to offer compression.</param>
+    void setCompressionEnabled(bool enabled);
+
+    /// <summary>
+    /// Sets whether the server issues resumption tickets to clients which ask for them, letting them reconnect
+    /// without repeating the key exchange. Tickets which have already been issued can still be used.
+    /// </summary>
+    /// <param name="enabled">Whether to issue resumption tickets.</param>
+    void setSessionResumptionEnabled(bool enabled);
+
+    /// <summary>
+    /// Keeps the repeat tokens issued to clients in a file, so they survive a restart of the server. Any tokens
+    /// already in the file are loaded.
+    /// </summary>
+    /// <param name="path">The file to keep the repeat tokens in.</param>
+    void setRepeatTokenStorePath(const std::filesystem::path &path);
+
+    /// <summary>
+    /// Getter for the database mananger. Safe to call from request worker threads.
     /// </summary>
     /// <returns>The database manager.</returns>
     DatabaseManager &databaseManager();
@@ -230,23 +429,109 @@ private:
     // The server's TCP socket
     TCPSocket serverSocket;
 
-    // The refresh rate of the server (Hz) - giving this a higher value minimises CPU usage but reduces responsiveness
+    // The refresh rate of the server's heartbeat clock (Hz). The heartbeat interval is heartBeatCycles / refreshRate
     float refreshRate;
 
     int heartBeatCycles = 128;
 
-    // A list of all the clients which are connected, but haven't yet authenticated themselves
-    std::vector<ClientData *> waitingClients;
-
-    // A list of all the currently connected and authenticated clients
-    std::vector<ClientData *> connectedClients;
-
-    std::unordered_map<unsigned, ClientData *> handleMap;
-
-    std::map<uint256, std::pair<std::string, ClientAccess>> repeatTokenMap;
-
-    std::queue<std::pair<unsigned, NetworkMessage *>> sendQueue;
-    std::mutex sendQueueMutex;
+    // The reactor which wakes the server loop when a socket is ready or there is work queued from another thread
+    EventLoop eventLoop;
+
+    // The kinds of timer the server loop schedules. Client timers are keyed by the client's handle ID.
+    enum class ServerTimer : unsigned {
+        HEARTBEAT,
+        HEARTBEAT_TIMEOUT,
+        AUTHENTICATION_DEADLINE,
+        TOKEN_SWEEP
+    };
+
+    // The server loop's timers. Only the server loop may use them.
+    TimerWheel timers;
+    std::chrono::steady_clock::duration heartbeatInterval{};
+    // Offsets each client's heartbeats from the others', so they aren't all sent at once
+    std::minstd_rand heartbeatJitter;
+
+    // The worker threads which run the key exchange with newly accepted clients
+    WorkerPool handshakePool;
+    unsigned handshakeWorkerThreads = 2;
+    unsigned long long nextHandshakeKey = 0;
+
+    HandshakeMetrics handshakeStats;
+    std::mutex handshakeMetricsMutex;
+
+    // Clients which have completed the key exchange on a handshake worker, but have not yet been adopted
+    // by the server loop
+    std::vector<ClientData *> acceptedClients;
+    std::mutex acceptedClientsMutex;
+
+    // Clients which hit their read budget with messages still buffered, to be revisited on the next pass
+    std::vector<unsigned long long> pendingReadClients;
+    // The number of times a client hit its read budget
+    unsigned long long readBudgetHits = 0;
+
+    // Threads sending to a client whose send backlog is over the high water mark (or whose send queue is full)
+    // wait on this until the server loop has sent some of it
+    std::mutex sendSpaceMutex;
+    std::condition_variable sendSpaceCondition;
+    std::atomic<unsigned> sendSpaceWaiters = 0;
+    // The number of times a sender had to wait for a client's send backlog to drain
+    std::atomic<unsigned long long> backpressureWaits = 0;
+
+    // The thread running the server loop, which never waits for send space as it is the one sending
+    std::thread::id loopThreadID;
+    std::atomic<bool> loopRunning = false;
+
+    // Whether compression is offered to clients as they connect
+    std::atomic<bool> compressionEnabled = true;
+
+    // Compression totals for the messages of each request type which were large enough to try compressing
+    struct CompressionStats {
+        unsigned long long messages = 0, compressedMessages = 0;
+        unsigned long long bytesIn = 0, bytesOut = 0;
+        unsigned long long compressNanoseconds = 0;
+    };
+    std::map<RequestType, CompressionStats> compressionStats;
+    std::mutex compressionStatsMutex;
+
+    // The worker threads which run the request handler, keyed by client so each client's requests stay in order
+    WorkerPool requestPool;
+    unsigned requestWorkerThreads = 4;
+
+    // The worker threads which compress and encrypt broadcasts. Each client is always handled by the same strand, so
+    // its broadcasts stay in order. Started with as many threads as the request pool.
+    WorkerPool broadcastPool;
+
+    // Guards the clients, and whether each has authenticated. Only the server loop modifies these, so it takes
+    // an exclusive lock to do so and can read them without locking; any other thread must take a shared lock to
+    // read them.
+    std::shared_mutex clientsMutex;
+
+    // Every connected client, whether or not it has authenticated yet, by its handle. The clients are owned by
+    // the map, and removing one is what deletes it.
+    SlotMap<ClientData> clients;
+
+    // Expired tokens are removed every REPEAT_TOKEN_SWEEP_INTERVAL_S by the server loop, which also writes the
+    // store to its file if it has one
+    RepeatTokenStore repeatTokens;
+
+    // Whether resumption tickets are issued to clients as they authenticate
+    std::atomic<bool> resumptionEnabled = true;
+
+    // The sessions which can be resumed, keyed by the ID of the ticket issued for them. Each is resumed by proving
+    // knowledge of the key of the connection it was issued on, and can only be resumed once.
+    struct ResumableSession {
+        AESKey sessionKey;
+        std::string email;
+        ClientAccess access;
+        uint64 expiry;
+        // This session's entry in resumableSessionExpiries
+        std::multimap<uint64, uint256>::iterator expiryEntry;
+    };
+    std::map<uint256, ResumableSession> resumableSessions;
+    // The ticket IDs of the resumable sessions ordered by when they expire, so expired tickets and the tickets closest
+    // to expiring are found without scanning every session
+    std::multimap<uint64, uint256> resumableSessionExpiries;
+    std::mutex resumableSessionsMutex;
 
     ServerRequestHandler *requestHandler = nullptr;
 
@@ -256,12 +541,99 @@ private:
 
     DatabaseManager *dbManager = nullptr;
     std::string databaseHost, databaseUsername, databasePassword, databaseSchema;
+    unsigned databaseMinSessions = 1, databaseMaxSessions = 8;
+
+    // Queues a newly accepted client for a handshake worker, or disconnects it if the queue is full. Must only be
+    // called from the server loop.
+    void queueHandshake(TCPSocket &&clientSocket);
+
+    // Runs the key exchange with a new client and hands it to the server loop. Returns true if the exchange
+    // completed; if not, the socket has been closed.
+    bool acceptClient(TCPSocket& clientSocket);
+
+    // Resumes the session of a client which sent a resumption ticket in place of its public key, and hands it to the
+    // server loop already authenticated. Returns true if the session was resumed; if not, the socket has been closed.
+    bool resumeClient(TCPSocket &clientSocket);
 
-    // Accepts a new client into the server
-    void acceptClient(TCPSocket& clientSocket);
+    // Records a session as resumable and sends the client its ticket. The session key is the key of the connection
+    // the ticket is sent on.
+    void issueResumptionTicket(TCPSocket &clientSocket, const AESKey &sessionKey, const std::string &email,
+                               ClientAccess access);
+
+    // Removes the resumable session for a ticket. Returns false if there was none. The resumable sessions lock must be
+    // held.
+    bool eraseResumableSession(const uint256 &ticketID);
+
+    // Removes every resumable session which expires at or before the given time. The resumable sessions lock must be
+    // held.
+    void eraseExpiredResumableSessions(uint64 now);
 
     // Attempt to authenticate a client. Returns true if the client attempts to authenticate; not if it is successful
     bool tryAuthenticateClient(ClientData &clientData);
+
+    // Hands a tagged request to the request workers, holding it back behind any requests it must not overtake. Must
+    // only be called from the server loop.
+    void submitOrderedRequest(const ClientData &client, std::function<void()> &&request, bool readOnly,
+                              unsigned long long requestKey);
+
+    // Moves any clients handed over from accept threads into the waiting clients and registers them with the
+    // event loop. Must only be called from the server loop.
+    void adoptAcceptedClients();
+
+    // Receives and handles every message already available from an authenticated client, up to the per pass
+    // read budget. Returns false if the client disconnected or timed out, in which case it has already been removed.
+    bool drainClientMessages(ClientData &client);
+
+    // Receives and handles a single message from an authenticated client, adding its size to bytesRead. Returns
+    // the socket code; if the client disconnected or timed out, it has already been removed.
+    TCPSocketCode receiveClientMessage(ClientData &client, unsigned &bytesRead);
+
+    // Removes expired repeat tokens and resumption tickets, and writes the repeat tokens to their file. Run on a
+    // timer every REPEAT_TOKEN_SWEEP_INTERVAL_S.
+    void sweepTokens();
+
+    // Schedules a newly authenticated client's heartbeats, starting at a random point in the first interval
+    void startHeartbeats(ClientData &client);
+
+    // Handles a timer which has fired. Must only be called from the server loop.
+    void handleTimer(const TimerWheel::Timer &timer);
+
+    // Removes a client from the event loop and every client list, closes its socket and frees it
+    void disconnectClient(ClientData *client);
+
+    // Moves every message currently in the clients' send queues into their sockets and sends as much as each
+    // socket will take
+    void flushSendQueue();
+
+    // Moves every message in a client's send queue into its socket, without sending. Must only be called from
+    // the server loop. Returns true if there were any messages.
+    bool moveQueuedMessages(ClientData &client);
+
+    // Sends as much of a client's buffered data as its socket will take. Returns false if the socket has died,
+    // in which case the client has already been removed.
+    bool flushClient(ClientData &client);
+
+    // Updates the client's record of its unsent bytes, and watches its socket for space to write if there are any
+    void trackPendingSend(ClientData &client);
+
+    // Compresses a payload if it is large enough, recording the compression stats for the request type of the
+    // message in it. Returns true if it was compressed; if not, the payload should be sent as it is.
+    bool compressMessage(RequestType type, const void *payload, unsigned payloadSize,
+                         std::vector<uint8> &compressed);
+
+    // Encrypts a message under a client's session key, first tagging it with the request ID if the client tags
+    // requests, and compressing it if compression is set and the message is large enough
+    EncryptedNetworkMessage encodeMessage(const AESKey &sessionKey, bool compression, bool requestIDs,
+                                          RequestID requestID, const void *message, unsigned messageLength);
+
+    // Encrypts a message for a client and adds it to the client's send queue
+    void deliverMessage(const ClientHandle &clientHandle, const void *message, unsigned messageLength,
+                        bool applyBackpressure);
+
+    // Adds an encrypted message to a client's send queue. If applyBackpressure is set, waits while the client's
+    // send backlog is over the high water mark; either way, waits while the queue is full.
+    void enqueueMessage(const ClientHandle &clientHandle, EncryptedNetworkMessage &&encrypted,
+                        bool applyBackpressure);
 };
 
 
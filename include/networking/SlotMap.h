@@ -0,0 +1,180 @@
+#ifndef DATABASE_MANAGER_SLOTMAP_H
+#define DATABASE_MANAGER_SLOTMAP_H
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+/// <summary>
+/// SlotMap
+/// An owning container which hands out a stable handle for each item. Inserting, looking up and erasing an item are
+/// O(1), and the live items are kept packed together so iterating over them touches no gaps. Each slot's generation
+/// changes whenever its item is erased, so a handle to an item which has gone never finds the item which later takes
+/// its slot. Not thread safe.
+/// </summary>
+template <typename T>
+class SlotMap {
+public:
+    typedef unsigned long long Handle;
+
+    /// <summary>
+    /// A handle which never refers to an item.
+    /// </summary>
+    static constexpr Handle NO_HANDLE = 0;
+
+    typedef typename std::vector<T *>::const_iterator const_iterator;
+
+    SlotMap() = default;
+
+    SlotMap(const SlotMap &) = delete;
+
+    SlotMap &operator=(const SlotMap &) = delete;
+
+    /// <summary>
+    /// Destructor, which deletes every item still in the map.
+    /// </summary>
+    ~SlotMap();
+
+    /// <summary>
+    /// Adds an item, taking ownership of it.
+    /// </summary>
+    /// <param name="item">The item, which must have been allocated with new.</param>
+    /// <returns>The handle of the item.</returns>
+    Handle insert(T *item);
+
+    /// <summary>
+    /// Looks up an item by its handle.
+    /// </summary>
+    /// <param name="handle">The handle of the item.</param>
+    /// <returns>The item, or nullptr if it has been erased.</returns>
+    T *get(Handle handle) const;
+
+    /// <summary>
+    /// Removes and deletes an item. The last item takes its place, so the order of iteration changes.
+    /// </summary>
+    /// <param name="handle">The handle of the item.</param>
+    /// <returns>True if the item was erased, false if it had already gone.</returns>
+    bool erase(Handle handle);
+
+    /// <summary>
+    /// Getter for the number of items.
+    /// </summary>
+    /// <returns>The number of items.</returns>
+    size_t size() const;
+
+    /// <summary>
+    /// Iterators over the items, in no particular order. Invalidated by inserting or erasing.
+    /// </summary>
+    const_iterator begin() const;
+
+    const_iterator end() const;
+
+private:
+    static constexpr uint32_t NO_SLOT = ~0u;
+
+    struct Slot {
+        uint32_t generation;
+        // The position of the slot's item in the items, or the next free slot if it has no item
+        uint32_t index;
+    };
+
+    std::vector<Slot> slots;
+    uint32_t freeSlots = NO_SLOT;
+
+    // The items, packed together, and the slot each belongs to
+    std::vector<T *> items;
+    std::vector<uint32_t> itemSlots;
+
+    // Finds the slot a handle refers to, or NO_SLOT if its item has gone
+    uint32_t find(Handle handle) const;
+};
+
+template <typename T>
+SlotMap<T>::~SlotMap() {
+    for (T *item : items) {
+        delete item;
+    }
+}
+
+template <typename T>
+typename SlotMap<T>::Handle SlotMap<T>::insert(T *item) {
+    uint32_t slot;
+    if (freeSlots != NO_SLOT) {
+        slot = freeSlots;
+        freeSlots = slots[slot].index;
+    } else {
+        slot = slots.size();
+        slots.push_back({1, 0});
+    }
+
+    slots[slot].index = items.size();
+    items.push_back(item);
+    itemSlots.push_back(slot);
+
+    return ((Handle) slots[slot].generation << 32u) | slot;
+}
+
+template <typename T>
+T *SlotMap<T>::get(Handle handle) const {
+    uint32_t slot = find(handle);
+    return slot == NO_SLOT ? nullptr : items[slots[slot].index];
+}
+
+template <typename T>
+bool SlotMap<T>::erase(Handle handle) {
+    uint32_t slot = find(handle);
+    if (slot == NO_SLOT) {
+        return false;
+    }
+
+    uint32_t index = slots[slot].index;
+    T *item = items[index];
+
+    // Move the last item into the gap
+    items[index] = items.back();
+    itemSlots[index] = itemSlots.back();
+    slots[itemSlots[index]].index = index;
+    items.pop_back();
+    itemSlots.pop_back();
+
+    // Generation 0 is skipped, so no handle is ever NO_HANDLE
+    if (++slots[slot].generation == 0) {
+        slots[slot].generation = 1;
+    }
+    slots[slot].index = freeSlots;
+    freeSlots = slot;
+
+    delete item;
+    return true;
+}
+
+template <typename T>
+size_t SlotMap<T>::size() const {
+    return items.size();
+}
+
+template <typename T>
+typename SlotMap<T>::const_iterator SlotMap<T>::begin() const {
+    return items.begin();
+}
+
+template <typename T>
+typename SlotMap<T>::const_iterator SlotMap<T>::end() const {
+    return items.end();
+}
+
+template <typename T>
+uint32_t SlotMap<T>::find(Handle handle) const {
+    uint32_t slot = (uint32_t) handle;
+    uint32_t generation = (uint32_t) (handle >> 32u);
+
+    // A free slot already has the generation its next item will have, so check the slot really holds an item
+    if (handle == NO_HANDLE || slot >= slots.size() || slots[slot].generation != generation ||
+        slots[slot].index >= items.size() || itemSlots[slots[slot].index] != slot) {
+        return NO_SLOT;
+    }
+
+    return slot;
+}
+
+#endif //DATABASE_MANAGER_SLOTMAP_H
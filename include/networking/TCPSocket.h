@@ -22,14 +22,28 @@
 #include <future>
 
 #include "NetworkMessage.h"
+#include "RingBuffer.h"
 #include "../../guard.h"
 
 #define BACKLOG_QUEUE_SIZE 8
 
+// The initial size of each socket's receive buffer, and so the most read by a single recv call
+// unless the buffer has grown to fit a larger frame
+#define RECEIVE_BUFFER_SIZE 65536
+
+// The initial size of each socket's send buffer, which holds whatever the socket couldn't take immediately
+#define SEND_BUFFER_SIZE 65536
+
 #ifdef _WIN32
 #define sock_errno WSAGetLastError()
 #endif
 
+#ifdef _WIN32
+typedef SOCKET NativeSocketHandle;
+#else
+typedef int NativeSocketHandle;
+#endif
+
 /// <summary>
 /// Enum for all TCP socket codes.
 /// </summary>
@@ -97,7 +111,11 @@ enum TCPSocketCode {
     /// <summary>
     /// The socket has no data.
     /// </summary>
-    S_NO_DATA
+    S_NO_DATA,
+    /// <summary>
+    /// The socket couldn't take all the data it was sent, so the rest is buffered until it is writable.
+    /// </summary>
+    S_SEND_PENDING
 };
 
 /// <summary>
@@ -121,6 +139,22 @@ bool safeGuardTCPSocketCode(TCPSocketCode code, std::ostream &errorStream = std:
 /// </summary>
 struct TCPSocket {
 public:
+    /// <summary>
+    /// ReceiveCounters
+    /// Process wide totals for the data received by every socket, for measuring how many recv calls
+    /// are needed per byte received.
+    /// </summary>
+    struct ReceiveCounters {
+        /// <summary>
+        /// The number of recv calls made.
+        /// </summary>
+        unsigned long long recvCalls;
+        /// <summary>
+        /// The number of bytes received.
+        /// </summary>
+        unsigned long long bytesReceived;
+    };
+
     /// <summary>
     /// Default Constructor.
     /// </summary>
@@ -168,6 +202,20 @@ public:
     /// <returns></returns>
     TCPSocketCode setNonBlocking();
 
+    /// <summary>
+    /// Sets the socket into a blocking mode.
+    /// </summary>
+    /// <returns></returns>
+    TCPSocketCode setBlocking();
+
+    /// <summary>
+    /// Sets how long a blocking send or receive on this socket waits before giving up. A receive which times out
+    /// returns S_NO_DATA.
+    /// </summary>
+    /// <param name="milliseconds">The timeout in milliseconds. If 0, blocking calls wait indefinitely.</param>
+    /// <returns>SOCKET_SUCCESS, or ERR_SET_SOCKET_OPTIONS if the timeout couldn't be set.</returns>
+    TCPSocketCode setTimeout(unsigned milliseconds);
+
     // Destruction Functions
 
     /// <summary>
@@ -191,20 +239,57 @@ public:
     TCPSocketCode tryAccept(bool callbackAsync = false) const;
 
     /// <summary>
-    /// sends a message through this socket.
+    /// sends a message through this socket. If the socket is non blocking and can't take the whole message,
+    /// whatever is left is kept in the send buffer and sent by a later call to sendMessage or flushSendBuffer.
     /// </summary>
     /// <param name="message">The message to send.</param>
-    /// <returns></returns>
+    /// <returns>SOCKET_SUCCESS if the message was sent or buffered, otherwise an error.</returns>
     TCPSocketCode sendMessage(const NetworkMessage &message);
 
     /// <summary>
-    /// Recieves a message from socket.
+    /// Adds a message to the end of the send buffer without sending anything. flushSendBuffer sends it.
+    /// </summary>
+    /// <param name="message">The message to queue.</param>
+    void queueMessage(const NetworkMessage &message);
+
+    /// <summary>
+    /// Sends as much of the send buffer as the socket will take, picking up from where the last send
+    /// stopped if it only partly completed.
+    /// </summary>
+    /// <returns>SOCKET_SUCCESS if the buffer was emptied, S_SEND_PENDING if the socket would block with data
+    /// still buffered, or an error.</returns>
+    TCPSocketCode flushSendBuffer();
+
+    /// <summary>
+    /// Getter for the number of bytes waiting in the send buffer.
+    /// </summary>
+    /// <returns>The number of unsent bytes.</returns>
+    size_t pendingSendBytes() const;
+
+    /// <summary>
+    /// Recieves a message from socket. As much data as is available is read from the socket at once, and any
+    /// frames after the first are kept in the receive buffer for subsequent calls.
     /// </summary>
     /// <param name="message">Decodes data from socket into message.</param>
     /// <param name="expectedProtocol">Protocol to expect, fails if its not this protocol or a heartbeat.</param>
     /// <returns>Status code from recieving message.</returns>
     TCPSocketCode receiveMessage(NetworkMessage &message, MessageProtocol expectedProtocol);
 
+    /// <summary>
+    /// Checks whether a complete frame has already been read from the socket, so receiveMessage can
+    /// return it without reading from the socket.
+    /// </summary>
+    /// <returns>True if a complete (or invalid) frame is buffered, false otherwise.</returns>
+    bool hasBufferedMessage() const;
+
+    /// <summary>
+    /// Reads until a complete frame is buffered, then finds its protocol without receiving it, for when more
+    /// than one kind of message may come next.
+    /// </summary>
+    /// <param name="protocol">Output for the protocol of the next frame.</param>
+    /// <returns>SOCKET_SUCCESS if a frame is buffered, or S_NO_DATA if the socket ran out of data first.</returns>
+    TCPSocketCode peekProtocol(MessageProtocol &protocol);
+
     /// <summary>
     /// Waits for a message, then one is recieved calls recieveMessage.
     /// </summary>
@@ -268,6 +353,43 @@ public:
     /// <param name="timeout">The timeout (in ms).</param>
     void setConnectionTimeout(float timeout);
 
+    /// <summary>
+    /// Getter for how long a heartbeat may go unanswered before the connection is considered dead.
+    /// </summary>
+    /// <returns>The connection timeout in seconds.</returns>
+    float getConnectionTimeout() const;
+
+    /// <summary>
+    /// Getter for the underlying OS socket handle, used for registering this socket with an EventLoop.
+    /// </summary>
+    /// <returns>The native socket handle (file descriptor on POSIX systems).</returns>
+    NativeSocketHandle nativeHandle() const;
+
+    /// <summary>
+    /// Checks whether a heartbeat has been sent and not responded to within the connection timeout.
+    /// </summary>
+    /// <returns>True if the heartbeat has expired, false otherwise.</returns>
+    bool heartbeatExpired() const;
+
+    /// <summary>
+    /// Sets the frame format used for every message sent or received after this call. Both ends of the
+    /// connection must switch at the same point in the stream.
+    /// </summary>
+    /// <param name="format">The wire format to use.</param>
+    void setWireFormat(WireFormat format);
+
+    /// <summary>
+    /// Getter for the frame format this socket currently sends and receives.
+    /// </summary>
+    /// <returns>The wire format in use.</returns>
+    WireFormat wireFormat() const;
+
+    /// <summary>
+    /// Getter for the process wide receive counters.
+    /// </summary>
+    /// <returns>A snapshot of the counters.</returns>
+    static ReceiveCounters receiveCounters();
+
 private:
     enum SocketFlags {
         SOCKET_OPEN = 0x01u,
@@ -294,6 +416,20 @@ private:
 
     float connectionTimeout = 30.0f;
 
+    // Bytes read from the socket which haven't yet been decoded into messages
+    RingBuffer receiveBuffer = RingBuffer(RECEIVE_BUFFER_SIZE);
+
+    // Every connection starts out in V1 until the handshake agrees on a newer format
+    WireFormat format = WireFormat::V1;
+
+    // Bytes which have been queued for sending but which the socket hasn't yet taken
+    RingBuffer sendBuffer = RingBuffer(SEND_BUFFER_SIZE);
+
+    // Reads as much as is available from the socket into the receive buffer. Returns S_NO_DATA if nothing was read,
+    // SOCKET_DISCONNECTED if the peer has closed the connection, or ERR_RECEIVE_FAILED (and marks the socket dead) if
+    // the receive failed.
+    TCPSocketCode fillReceiveBuffer();
+
 #ifdef _WIN32
     // Windows Specific
 
@@ -0,0 +1,122 @@
+#ifndef DATABASE_MANAGER_TIMERWHEEL_H
+#define DATABASE_MANAGER_TIMERWHEEL_H
+
+#include <chrono>
+#include <vector>
+#include <cstdint>
+
+// The resolution of the wheel. Timers fire on the first tick at or after their deadline.
+#define TIMER_WHEEL_TICK_MS 100
+// Each level has 64 slots, and each slot of a level spans a whole turn of the level below. With 4 levels and 100ms
+// ticks, the wheel reaches about 19 days ahead; later timers are held at the far end until they are in reach.
+#define TIMER_WHEEL_LEVEL_BITS 6u
+#define TIMER_WHEEL_LEVELS 4u
+
+/// <summary>
+/// TimerWheel
+/// A hierarchical timing wheel. Scheduling and cancelling a timer are O(1), and each timer is moved down a level at
+/// most TIMER_WHEEL_LEVELS - 1 times before it fires, so the cost of firing is O(1) per timer however many are
+/// scheduled. Not thread safe; it is intended to be owned and advanced by a single event loop.
+/// </summary>
+class TimerWheel {
+public:
+    typedef unsigned long long TimerID;
+
+    /// <summary>
+    /// An ID which never refers to a scheduled timer.
+    /// </summary>
+    static constexpr TimerID NO_TIMER = 0;
+
+    /// <summary>
+    /// Timer
+    /// A timer which has fired.
+    /// </summary>
+    struct Timer {
+        /// <summary>
+        /// The key the timer was scheduled with, identifying what it is for.
+        /// </summary>
+        unsigned long long key;
+        /// <summary>
+        /// The kind of timer it was scheduled as.
+        /// </summary>
+        unsigned kind;
+    };
+
+    /// <summary>
+    /// Constructs an empty wheel, starting from now.
+    /// </summary>
+    TimerWheel();
+
+    /// <summary>
+    /// Schedules a timer.
+    /// </summary>
+    /// <param name="deadline">When the timer should fire. Deadlines which have already passed fire on the next
+    /// advance.</param>
+    /// <param name="key">Identifies what the timer is for.</param>
+    /// <param name="kind">The kind of timer, for when a key has more than one.</param>
+    /// <returns>The ID of the timer, for cancelling it.</returns>
+    TimerID schedule(std::chrono::steady_clock::time_point deadline, unsigned long long key, unsigned kind);
+
+    /// <summary>
+    /// Cancels a timer which hasn't yet fired.
+    /// </summary>
+    /// <param name="timer">The ID of the timer. May be NO_TIMER, or a timer which has already fired or been cancelled,
+    /// in which case nothing happens.</param>
+    void cancel(TimerID timer);
+
+    /// <summary>
+    /// Moves the wheel forward to the given time, firing every timer whose deadline has passed.
+    /// </summary>
+    /// <param name="now">The current time.</param>
+    /// <param name="expired">Output for the timers which fired, in the order of their ticks.</param>
+    void advance(std::chrono::steady_clock::time_point now, std::vector<Timer> &expired);
+
+    /// <summary>
+    /// Finds the time the wheel next needs advancing, for bounding how long the event loop waits. This may be earlier
+    /// than the next deadline when the next timer is still on an upper level, but never later.
+    /// </summary>
+    /// <returns>The time the next timer could fire, or the maximum time point if there are no timers.</returns>
+    std::chrono::steady_clock::time_point nextDeadline() const;
+
+    /// <summary>
+    /// Getter for the number of timers scheduled.
+    /// </summary>
+    /// <returns>The number of timers.</returns>
+    size_t size() const;
+
+private:
+    static constexpr uint32_t SLOTS_PER_LEVEL = 1u << TIMER_WHEEL_LEVEL_BITS;
+    static constexpr uint32_t NO_NODE = ~0u;
+
+    // Timers are kept in a pool of nodes, linked into the list of the slot they are in. A node's generation changes
+    // whenever it is freed, so IDs of timers which have gone don't match the node's next timer.
+    struct Node {
+        unsigned long long key;
+        unsigned kind;
+        uint64_t expiryTick;
+        uint32_t generation;
+        uint32_t slot;
+        uint32_t previous, next;
+    };
+
+    std::vector<Node> nodes;
+    uint32_t freeNodes = NO_NODE;
+    size_t timerCount = 0;
+
+    // The head node of each slot's list, level by level
+    std::vector<uint32_t> slots;
+
+    std::chrono::steady_clock::time_point startTime;
+    uint64_t currentTick = 0;
+
+    // Links a node into the slot for its expiry tick, relative to the current tick
+    void place(uint32_t node);
+
+    // Unlinks a node from its slot
+    void unlink(uint32_t node);
+
+    // Moves every timer in a slot of an upper level down to the levels below
+    void cascade(uint32_t level);
+};
+
+#endif //DATABASE_MANAGER_TIMERWHEEL_H
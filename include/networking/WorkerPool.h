@@ -0,0 +1,85 @@
+#ifndef DATABASE_MANAGER_WORKERPOOL_H
+#define DATABASE_MANAGER_WORKERPOOL_H
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <unordered_map>
+
+/// <summary>
+/// WorkerPool
+/// A fixed size pool of worker threads which run tasks submitted under a key. Tasks which share a key run one at a time
+/// in the order they were submitted (so a single client's requests are handled in order), whereas tasks with different
+/// keys may run in parallel on different threads.
+/// </summary>
+class WorkerPool {
+public:
+    /// <summary>
+    /// Constructs an idle pool. No threads are created until start is called.
+    /// </summary>
+    WorkerPool() = default;
+
+    /// <summary>
+    /// Destructor which stops the pool and joins all the worker threads.
+    /// </summary>
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool &) = delete;
+
+    WorkerPool &operator=(const WorkerPool &) = delete;
+
+    /// <summary>
+    /// Starts the worker threads. Has no effect if the pool is already running.
+    /// </summary>
+    /// <param name="threadCount">The number of worker threads to create. If 0, one is created per hardware
+    /// thread.</param>
+    void start(unsigned threadCount);
+
+    /// <summary>
+    /// Stops the pool. Any tasks which have already been submitted are finished before the workers exit.
+    /// </summary>
+    void stop();
+
+    /// <summary>
+    /// Submits a task to the pool. Safe to call from any thread, including from within a task.
+    /// </summary>
+    /// <param name="key">The ordering key. Tasks with the same key never run concurrently and run in submission
+    /// order.</param>
+    /// <param name="task">The task to run.</param>
+    void submit(unsigned long long key, std::function<void()> task);
+
+    /// <summary>
+    /// Getter for the number of tasks which have been submitted but not yet started.
+    /// </summary>
+    /// <returns>The number of queued tasks.</returns>
+    size_t queuedTasks();
+
+    /// <summary>
+    /// Getter for the number of worker threads in the pool.
+    /// </summary>
+    /// <returns>The number of worker threads.</returns>
+    size_t threadCount() const;
+
+private:
+    std::vector<std::thread> workers;
+
+    // The pending tasks for each key which currently has work, either queued or running
+    std::unordered_map<unsigned long long, std::deque<std::function<void()>>> strands;
+    // Keys which have pending tasks and are not currently held by a worker
+    std::deque<unsigned long long> readyKeys;
+
+    size_t pendingTasks = 0;
+
+    std::mutex poolMutex;
+    std::condition_variable poolCondition;
+
+    bool running = false;
+
+    // The loop each worker thread runs until the pool is stopped
+    void workerLoop();
+};
+
+#endif //DATABASE_MANAGER_WORKERPOOL_H
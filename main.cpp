@@ -476,6 +476,12 @@ void runServer(std::filesystem::path metaFilePath, const std::string &user,
   std::string dbPassword;
   dbPasswordFile >> dbPassword;*/
 
+  if (meta.find("databaseMinSessions") != meta.end() &&
+      meta.find("databaseMaxSessions") != meta.end()) {
+    s.setDatabaseSessionPoolSize(meta["databaseMinSessions"].get<unsigned>(),
+                                 meta["databaseMaxSessions"].get<unsigned>());
+  }
+
   if (!dev) {
     s.connectToDatabaseServer("screen_mat_database", "db-server-user",
                               databasePassword, "scs.local");
@@ -491,9 +497,34 @@ void runServer(std::filesystem::path metaFilePath, const std::string &user,
 
   s.setRequestHandler(handler);
 
+  // Load the search index while the server starts, rather than on the first
+  // search
+  handler.loadSearchIndex(s.databaseManager());
+
   // Send a heartbeat approximately every minute
   s.setHeartBeatCycles(1024);
 
+  if (meta.find("requestWorkerThreads") != meta.end()) {
+    s.setRequestWorkerThreads(meta["requestWorkerThreads"].get<unsigned>());
+  }
+
+  if (meta.find("handshakeWorkerThreads") != meta.end()) {
+    s.setHandshakeWorkerThreads(
+        meta["handshakeWorkerThreads"].get<unsigned>());
+  }
+
+  if (meta.find("compressMessages") != meta.end()) {
+    s.setCompressionEnabled(meta["compressMessages"].get<bool>());
+  }
+
+  if (meta.find("resumeSessions") != meta.end()) {
+    s.setSessionResumptionEnabled(meta["resumeSessions"].get<bool>());
+  }
+
+  if (meta.find("repeatTokenStorePath") != meta.end()) {
+    s.setRepeatTokenStorePath(meta["repeatTokenStorePath"].get<std::string>());
+  }
+
   // Start running the server - this will enter a loop and return when the
   // server is closed
   s.startServer();
@@ -4,12 +4,26 @@
 
 #include "../../include/database/DatabaseManager.h"
 
+#include "../../include/database/DrawingSearchIndex.h"
+
+#include <unordered_map>
+
+// How long a request waits for a pooled session before giving up
+#define SESSION_CHECKOUT_TIMEOUT_MS 10000
+
+// How long a pooled session may sit idle before it is pinged, so the server
+// doesn't drop it and dead connections are noticed off the request path
+#define SESSION_KEEPALIVE_INTERVAL_MS 300000
+
 // Constructor taking the connection information
 DatabaseManager::DatabaseManager(const std::string &database,
                                  const std::string &user,
                                  const std::string &password,
-                                 const std::string &host)
-   : sess(host, 33060, user, password) {
+                                 const std::string &host,
+                                 unsigned minSessions, unsigned maxSessions)
+    : sessionPool(host, 33060, user, password, minSessions, maxSessions,
+                  std::chrono::milliseconds(SESSION_CHECKOUT_TIMEOUT_MS),
+                  std::chrono::milliseconds(SESSION_KEEPALIVE_INTERVAL_MS)) {
   this->username = user;
   this->password = password;
   this->database = database;
@@ -25,65 +39,69 @@ void DatabaseManager::getCompressionSchemaDetails(
     unsigned char &maxDrawingLength, unsigned char &maxExtraApertureCount) {
   // Wrapped in a try statement to catch any MySQL errors.
   try {
-    // Select the maximum mat_id from the drawings table
-    maxMatID = sess.sql("SELECT MAX(mat_id) FROM " + database + ".drawings")
-                   .execute()
-                   .fetchOne()[0];
-
-    // Select the maximum width from the drawings table
-    maxWidth = sess.sql("SELECT MAX(width) FROM " + database + ".drawings")
-                   .execute()
-                   .fetchOne()[0];
-
-    // Select the maximum length from the drawings table
-    maxLength = sess.sql("SELECT MAX(length) FROM " + database + ".drawings")
-                    .execute()
-                    .fetchOne()[0];
-
-    // Select the maximum overlap/sidelap size from the union of the overlaps
-    // and sidelaps tables
-    maxLapSize =
-        sess.sql("SELECT MAX(width) FROM (SELECT width FROM " + database +
-                 ".sidelaps "
-                 "UNION SELECT width FROM " +
-                 database + ".overlaps) AS laps")
-            .execute()
-            .fetchOne()[0];
-
-    maxBarSpacingCount =
-        sess.sql(
-                "SELECT MAX(spacing_count) FROM (SELECT COUNT(MAT_ID) AS "
-                "spacing_count FROM " +
-                database + ".bar_spacings GROUP BY mat_id) AS mat_spacings")
-            .execute()
-            .fetchOne()[0]
-            .get<unsigned>();
-
-    maxBarSpacing =
-        sess.sql("SELECT MAX(bar_spacing) FROM " + database + ".bar_spacings")
-            .execute()
-            .fetchOne()[0];
-
-    // Select the length of the longest drawing number from the drawings table
-    maxDrawingLength = sess.sql("SELECT MAX(LENGTH(drawing_number)) FROM " +
-                                database + ".drawings")
-                           .execute()
-                           .fetchOne()[0]
-                           .get<unsigned>();
-
-    mysqlx::Value r =
-        sess.sql(
-                "SELECT MAX(count.c) FROM (SELECT COUNT(aperture_id) AS c "
-                "FROM " +
-                database + ".extra_apertures GROUP BY mat_id) AS count")
-            .execute()
-            .fetchOne()[0];
-    if (r.isNull()) {
-      maxExtraApertureCount = 0;
-    } else {
-      maxExtraApertureCount = r.get<unsigned>();
-    }
+    // Reads are safe to repeat, so they are retried on a fresh session if
+    // the connection was lost
+    readWithRetry([&](mysqlx::Session &sess) -> void {
+      // Select the maximum mat_id from the drawings table
+      maxMatID = sess.sql("SELECT MAX(mat_id) FROM " + database + ".drawings")
+                     .execute()
+                     .fetchOne()[0];
+
+      // Select the maximum width from the drawings table
+      maxWidth = sess.sql("SELECT MAX(width) FROM " + database + ".drawings")
+                     .execute()
+                     .fetchOne()[0];
+
+      // Select the maximum length from the drawings table
+      maxLength = sess.sql("SELECT MAX(length) FROM " + database + ".drawings")
+                      .execute()
+                      .fetchOne()[0];
+
+      // Select the maximum overlap/sidelap size from the union of the overlaps
+      // and sidelaps tables
+      maxLapSize =
+          sess.sql("SELECT MAX(width) FROM (SELECT width FROM " + database +
+                   ".sidelaps "
+                   "UNION SELECT width FROM " +
+                   database + ".overlaps) AS laps")
+              .execute()
+              .fetchOne()[0];
+
+      maxBarSpacingCount =
+          sess.sql(
+                  "SELECT MAX(spacing_count) FROM (SELECT COUNT(MAT_ID) AS "
+                  "spacing_count FROM " +
+                  database + ".bar_spacings GROUP BY mat_id) AS mat_spacings")
+              .execute()
+              .fetchOne()[0]
+              .get<unsigned>();
+
+      maxBarSpacing =
+          sess.sql("SELECT MAX(bar_spacing) FROM " + database + ".bar_spacings")
+              .execute()
+              .fetchOne()[0];
+
+      // Select the length of the longest drawing number from the drawings table
+      maxDrawingLength = sess.sql("SELECT MAX(LENGTH(drawing_number)) FROM " +
+                                  database + ".drawings")
+                             .execute()
+                             .fetchOne()[0]
+                             .get<unsigned>();
+
+      mysqlx::Value r =
+          sess.sql(
+                  "SELECT MAX(count.c) FROM (SELECT COUNT(aperture_id) AS c "
+                  "FROM " +
+                  database + ".extra_apertures GROUP BY mat_id) AS count")
+              .execute()
+              .fetchOne()[0];
+      if (r.isNull()) {
+        maxExtraApertureCount = 0;
+      } else {
+        maxExtraApertureCount = r.get<unsigned>();
+      }
 
+    });
   } catch (mysqlx::Error &e) {
     // If there was an error, print it to the console and exit the program.
     // This error is fatal - if we are unable to create a compression schema,
@@ -96,12 +114,18 @@ std::vector<DrawingSummary> DatabaseManager::executeSearchQuery(
     const DatabaseSearchQuery &query) {
   // Wrapped in a try statement to catch any MySQL errors.
   try {
-    // First, get the SQL query string from the query object.
-    // Then, execute this query (returning a RowResult set).
-    // Then, call the static DatabaseSearchQuery method to convert each row into
-    // a summary object. Finally, return this list of summaries
-    std::string s = Format::format(query.toSQLQueryString(), database);
-    return DatabaseSearchQuery::getQueryResultSummaries(sess.sql(s).execute());
+    // Reads are safe to repeat, so they are retried on a fresh session if
+    // the connection was lost
+    return readWithRetry(
+        [&](mysqlx::Session &sess) -> std::vector<DrawingSummary> {
+      // First, get the SQL query string from the query object. Then, execute
+      // this query (returning a RowResult set). Then, call the static
+      // DatabaseSearchQuery method to convert each row into a summary object.
+      // Finally, return this list of summaries
+      std::string s = Format::format(query.toSQLQueryString(), database);
+      return DatabaseSearchQuery::getQueryResultSummaries(
+          sess.sql(s).execute());
+    });
   } catch (mysqlx::Error &e) {
     // If there was an error, print it to the console.
     // This is not considered a fatal error; if there was an error simply return
@@ -112,555 +136,561 @@ std::vector<DrawingSummary> DatabaseManager::executeSearchQuery(
   }
 }
 
-Drawing *DatabaseManager::executeDrawingQuery(const DrawingRequest &query) {
-  // Wrapped in a try statement to catch any MySQL errors.
-  try {
-    // Construct an empty drawing object on the heap, as we will be returning
-    // this
-    Drawing *drawing = new Drawing();
-    drawing->setAsDefault();
-
-    // Declare a string stream for queries to the database.
-    std::stringstream queryString;
-
-    // MySQL query for selecting all the data from the drawings table and other
-    // associated tables which will only contain at most one row (i.e. apertures
-    // and machine templates).
-    queryString << "SELECT d.drawing_number AS drawing_number, d.product_id AS "
-                   "product_id, d.width AS width, "
-                << std::endl;
-    queryString << "d.length AS length, d.tension_type AS tension_type, "
-                   "UNIX_TIMESTAMP(d.drawing_date) AS drawing_date, "
-                << std::endl;
-    queryString << "d.rebated, d.hyperlink AS hyperlink, d.notes AS notes, "
-                << std::endl;
-    queryString << "mt.machine_id AS machine_id, mt.quantity_on_deck AS "
-                   "quantity_on_deck, mt.position AS position, "
-                << std::endl;
-    queryString << "mt.deck_id AS deck_id, " << std::endl;
-    queryString << "mal.aperture_id AS aperture_id" << std::endl;
-    queryString << "FROM " << database << ".drawings AS d " << std::endl;
-    queryString << "INNER JOIN " << database
-                << ".machine_templates AS mt ON d.template_id=mt.template_id"
-                << std::endl;
-    queryString << "INNER JOIN " << database
-                << ".mat_aperture_link AS mal ON d.mat_id=mal.mat_id"
-                << std::endl;
-    queryString << "WHERE d.mat_id=" << query.matID << std::endl;
-
-    // Execute this query string and read the first row. This should never
-    // return more than one row as the mat_id is a unique key in the database.
-    mysqlx::Row drawingResults =
-        sess.sql(queryString.str()).execute().fetchOne();
-
-    // If the results were not null, there was a matching drawing.
-    if (!drawingResults.isNull()) {
-      // Read in all the information from the query into the drawing object
-      drawing->setDrawingNumber(drawingResults[0].get<std::string>());
-      drawing->setProduct(DrawingComponentManager<Product>::findComponentByID(
-          drawingResults[1]));
-      drawing->setWidth(drawingResults[2]);
-      drawing->setLength(drawingResults[3]);
-      drawing->setTensionType((drawingResults[4].get<std::string>() == "Side")
-                                  ? Drawing::SIDE
-                                  : Drawing::END);
-      drawing->setDate(Date::parse(drawingResults[5].get<int>()));
-      drawing->setRebated(drawingResults[6].get<bool>());
-      drawing->setHyperlink(drawingResults[7].get<std::string>());
-      drawing->setNotes(drawingResults[8].get<std::string>());
-      drawing->setMachine(DrawingComponentManager<Machine>::findComponentByID(
-          drawingResults[9]));
-      drawing->setQuantityOnDeck(drawingResults[10].get<int>());
-      drawing->setMachinePosition(drawingResults[11].get<std::string>());
-      drawing->setMachineDeck(
-          DrawingComponentManager<MachineDeck>::findComponentByID(
-              drawingResults[12]));
-
-      // It may be the case that the physical aperture is able to be rotated.
-      // This is internally represented in the manager as two separate Aperture
-      // objects, both with the same componentID. For this reason, we must
-      // search for all apertures with the matching component ID to select the
-      // correct one.
-      Aperture matchingAperture =
-          DrawingComponentManager<Aperture>::findComponentByID(
-              drawingResults[13]);
-      drawing->setAperture(matchingAperture);
-    } else {
-      // If the drawing we read from the database was null, print a safe error
-      // to the console and set a load warning on the drawing, indicating that
-      // we failed to load the drawing.
-      lockLog {
-        *ss << "Failed to load drawing with mat_id: " +
-                                      std::to_string(query.matID);
-        Logger::logError();
-      }
-      drawing->setLoadWarning(Drawing::LoadWarning::LOAD_FAILED);
-      // Return the drawing. If we could not gather the critical information,
-      // there is no point in gathering any more data.
-      return drawing;
-    }
+// The columns of the drawing details query, in order
+enum DrawingDetailsColumn : unsigned {
+  MAT_ID,
+  DRAWING_NUMBER,
+  PRODUCT_ID,
+  WIDTH,
+  LENGTH,
+  TENSION_TYPE,
+  DRAWING_DATE,
+  REBATED,
+  HYPERLINK,
+  NOTES,
+  MACHINE_ID,
+  QUANTITY_ON_DECK,
+  POSITION,
+  DECK_ID,
+  APERTURE_ID,
+  MATERIALS,
+  BARS,
+  BACKING_STRIP_ID,
+  SIDE_IRONS,
+  LAPS,
+  PRESS_HYPERLINKS,
+  IMPACT_PADS,
+  BLANK_SPACES,
+  EXTRA_APERTURES,
+  DAM_BARS,
+  CENTRE_HOLES,
+  DEFLECTORS,
+  DIVERTORS
+};
+
+// Copies the rows the drawing details query aggregates into a JSON array,
+// ordered by their first element. JSON_ARRAYAGG doesn't preserve any order,
+// so tables where the order matters carry their index as the first element.
+static std::vector<mysqlx::Value> orderedRows(const mysqlx::Value &rows) {
+  std::vector<mysqlx::Value> ordered;
+  for (const mysqlx::Value &row : rows) {
+    ordered.push_back(row);
+  }
+  std::sort(ordered.begin(), ordered.end(),
+            [](const mysqlx::Value &a, const mysqlx::Value &b) {
+              return a[0].get<int>() < b[0].get<int>();
+            });
+  return ordered;
+}
+
+// Reads a number from a JSON row. MySQL hands back FLOAT columns as doubles
+// once they are in JSON.
+static float jsonFloat(const mysqlx::Value &value) {
+  return (float)value.get<double>();
+}
 
-    // Get all the matching materials for this drawing. There may be more than
-    // one material, so this is done in a separate query.
-    mysqlx::RowResult materials = sess.getSchema(database)
-                                      .getTable("thickness")
-                                      .select("material_thickness_id")
-                                      .where("mat_id=:matID")
-                                      .bind("matID", query.matID)
-                                      .execute();
-
-    // Get the first material
-    mysqlx::Row topMaterial = materials.fetchOne();
-    if (!topMaterial.isNull()) {
-      // If the top material existed in the database, get the material ID from
-      // the component manager
+std::string DatabaseManager::drawingDetailsQueryString(
+    const std::string &condition) const {
+  std::stringstream queryString;
+
+  // Everything in the drawings table and the tables with at most one row per
+  // drawing (i.e. apertures and machine templates) is selected directly.
+  queryString << "SELECT d.mat_id AS mat_id, "
+                 "d.drawing_number AS drawing_number, "
+                 "d.product_id AS product_id, d.width AS width, "
+              << std::endl;
+  queryString << "d.length AS length, d.tension_type AS tension_type, "
+                 "UNIX_TIMESTAMP(d.drawing_date) AS drawing_date, "
+              << std::endl;
+  queryString << "d.rebated, d.hyperlink AS hyperlink, d.notes AS notes, "
+              << std::endl;
+  queryString << "mt.machine_id AS machine_id, mt.quantity_on_deck AS "
+                 "quantity_on_deck, mt.position AS position, "
+              << std::endl;
+  queryString << "mt.deck_id AS deck_id, " << std::endl;
+  queryString << "mal.aperture_id AS aperture_id, " << std::endl;
+
+  // The rows of every other table are aggregated into a JSON array each, so
+  // the whole drawing comes back as a single row in a single round trip.
+  auto aggregate = [&](const std::string &row, const std::string &from,
+                       const std::string &name) {
+    queryString << "COALESCE((SELECT JSON_ARRAYAGG(" << row << ") FROM "
+                << from << " WHERE x.mat_id=d.mat_id), JSON_ARRAY()) AS "
+                << name;
+  };
+
+  // JSON_ARRAYAGG can't take an ORDER BY, so the materials are concatenated
+  // in the order they were inserted instead. The top layer is inserted first,
+  // so this keeps it first, as the separate materials query used to return.
+  queryString << "COALESCE((SELECT CAST(CONCAT('[', GROUP_CONCAT("
+                 "JSON_ARRAY(x.thickness_id, x.material_thickness_id) "
+                 "ORDER BY x.thickness_id), ']') AS JSON) FROM "
+              << database
+              << ".thickness AS x WHERE x.mat_id=d.mat_id), JSON_ARRAY()) "
+                 "AS materials";
+  queryString << ", " << std::endl;
+  aggregate("JSON_ARRAY(x.bar_index, x.bar_spacing, x.bar_width)",
+            database + ".bar_spacings AS x", "bars");
+  queryString << ", " << std::endl;
+  queryString << "(SELECT x.backing_strip_id FROM " << database
+              << ".mat_backing_strip_link AS x WHERE x.mat_id=d.mat_id "
+                 "LIMIT 1) AS backing_strip_id, "
+              << std::endl;
+  aggregate("JSON_ARRAY(x.side_iron_index, x.side_iron_id, x.bar_width, "
+            "x.inverted, x.cut_down, x.fixed_end, x.feed_end, "
+            "x.hook_orientation, x.strap_id)",
+            database + ".mat_side_iron_link AS x", "side_irons");
+  queryString << ", " << std::endl;
+  aggregate("JSON_ARRAY(x.type, x.mat_side, x.width, x.attachment_type, "
+            "x.material_id)",
+            "(SELECT mat_id, 'S' AS type, mat_side, width, attachment_type, "
+            "material_id FROM " +
+                database +
+                ".sidelaps UNION SELECT mat_id, 'O' AS type, mat_side, "
+                "width, attachment_type, material_id FROM " +
+                database + ".overlaps) AS x",
+            "laps");
+  queryString << ", " << std::endl;
+  aggregate("x.hyperlink", database + ".punch_program_pdfs AS x",
+            "press_hyperlinks");
+  queryString << ", " << std::endl;
+  aggregate("JSON_ARRAY(x.material_id, x.aperture_id, x.width, x.length, "
+            "x.x_coord, x.y_coord)",
+            database + ".impact_pads AS x", "impact_pads");
+  queryString << ", " << std::endl;
+  aggregate("JSON_ARRAY(x.width, x.length, x.x_coord, x.y_coord)",
+            database + ".blank_spaces AS x", "blank_spaces");
+  queryString << ", " << std::endl;
+  aggregate("JSON_ARRAY(x.width, x.length, x.x_coord, x.y_coord, "
+            "x.aperture_id)",
+            database + ".extra_apertures AS x", "extra_apertures");
+  queryString << ", " << std::endl;
+  aggregate("JSON_ARRAY(x.width, x.length, x.x_coord, x.y_coord, "
+            "x.material_id)",
+            database + ".dam_bars AS x", "dam_bars");
+  queryString << ", " << std::endl;
+  aggregate("JSON_ARRAY(x.x_coord, x.y_coord, x.aperture_id)",
+            database + ".centre_holes AS x", "centre_holes");
+  queryString << ", " << std::endl;
+  aggregate("JSON_ARRAY(x.material_id, x.size, x.x_coord, x.y_coord)",
+            database + ".deflectors AS x", "deflectors");
+  queryString << ", " << std::endl;
+  aggregate("JSON_ARRAY(x.material_id, x.width, x.length, x.mat_side, "
+            "x.y_coord)",
+            database + ".divertors AS x", "divertors");
+  queryString << std::endl;
+
+  queryString << "FROM " << database << ".drawings AS d " << std::endl;
+  queryString << "INNER JOIN " << database
+              << ".machine_templates AS mt ON d.template_id=mt.template_id"
+              << std::endl;
+  queryString << "INNER JOIN " << database
+              << ".mat_aperture_link AS mal ON d.mat_id=mal.mat_id"
+              << std::endl;
+  queryString << "WHERE " << condition << std::endl;
+
+  return queryString.str();
+}
+
+Drawing *DatabaseManager::drawingFromRow(const mysqlx::Row &row) {
+  // Construct an empty drawing object on the heap, as we will be returning
+  // this
+  Drawing *drawing = new Drawing();
+  drawing->setAsDefault();
+
+  // Read in all the information from the drawings table into the drawing
+  // object
+  drawing->setDrawingNumber(row[DRAWING_NUMBER].get<std::string>());
+  drawing->setProduct(
+      DrawingComponentManager<Product>::findComponentByID(row[PRODUCT_ID]));
+  drawing->setWidth(row[WIDTH]);
+  drawing->setLength(row[LENGTH]);
+  drawing->setTensionType((row[TENSION_TYPE].get<std::string>() == "Side")
+                              ? Drawing::SIDE
+                              : Drawing::END);
+  drawing->setDate(Date::parse(row[DRAWING_DATE].get<int>()));
+  drawing->setRebated(row[REBATED].get<bool>());
+  drawing->setHyperlink(row[HYPERLINK].get<std::string>());
+  drawing->setNotes(row[NOTES].get<std::string>());
+  drawing->setMachine(
+      DrawingComponentManager<Machine>::findComponentByID(row[MACHINE_ID]));
+  drawing->setQuantityOnDeck(row[QUANTITY_ON_DECK].get<int>());
+  drawing->setMachinePosition(row[POSITION].get<std::string>());
+  drawing->setMachineDeck(
+      DrawingComponentManager<MachineDeck>::findComponentByID(row[DECK_ID]));
+
+  // It may be the case that the physical aperture is able to be rotated.
+  // This is internally represented in the manager as two separate
+  // Aperture objects, both with the same componentID. For this reason, we
+  // must search for all apertures with the matching component ID to
+  // select the correct one.
+  Aperture matchingAperture =
+      DrawingComponentManager<Aperture>::findComponentByID(row[APERTURE_ID]);
+  drawing->setAperture(matchingAperture);
+
+  // There may be more than one material. The query returns them in the
+  // order they were inserted, so the top material comes first.
+  std::vector<mysqlx::Value> materials;
+  for (const mysqlx::Value &material : row[MATERIALS]) {
+    materials.push_back(material);
+  }
+  if (!materials.empty()) {
+    drawing->setMaterial(Drawing::MaterialLayer::TOP,
+                         DrawingComponentManager<Material>::findComponentByID(
+                             materials[0][1].get<unsigned>()));
+
+    // Check if there is a second material for this drawing
+    if (materials.size() > 1) {
       drawing->setMaterial(
-          Drawing::MaterialLayer::TOP,
-          DrawingComponentManager<Material>::findComponentByID(topMaterial[0]));
-
-      // Check if there is a second material for this drawing
-      mysqlx::Row bottomMaterial = materials.fetchOne();
-      if (!bottomMaterial.isNull()) {
-        // Get the material ID and set this material in the drawing object
-        drawing->setMaterial(
-            Drawing::MaterialLayer::BOTTOM,
-            DrawingComponentManager<Material>::findComponentByID(
-                bottomMaterial[0]));
-      }
-    } else {
-      // If we didn't find a material, this is an error. All drawings should
-      // have a material.
-      Logger::logError("Missing material for drawing: " +
-                       drawing->drawingNumber());
-      // Set a load warning for the drawing that the material was missing
-      drawing->setLoadWarning(Drawing::LoadWarning::MISSING_MATERIAL_DETECTED);
+          Drawing::MaterialLayer::BOTTOM,
+          DrawingComponentManager<Material>::findComponentByID(
+              materials[1][1].get<unsigned>()));
     }
+  } else {
+    // If we didn't find a material, this is an error. All drawings should
+    // have a material.
+    Logger::logError("Missing material for drawing: " +
+                     drawing->drawingNumber());
+    // Set a load warning for the drawing that the material was missing
+    drawing->setLoadWarning(Drawing::LoadWarning::MISSING_MATERIAL_DETECTED);
+  }
+
+  std::vector<float> barSpacings, barWidths;
+
+  for (const mysqlx::Value &bar : orderedRows(row[BARS])) {
+    // For each bar, add to the barSpacings and barWidths vectors
+    barSpacings.push_back(jsonFloat(bar[1]));
+    barWidths.push_back(jsonFloat(bar[2]));
+  }
+
+  // get the backing strip
+  if (!row[BACKING_STRIP_ID].isNull()) {
+    drawing->setBackingStrip(
+        DrawingComponentManager<BackingStrip>::findComponentByID(
+            row[BACKING_STRIP_ID]));
+  } else {
+    drawing->setLoadWarning(
+        Drawing::LoadWarning::INVALID_BACKING_STRIP_DETECTED);
+  }
 
-    // Read each bar and its corresponding spacing from the database for this
-    // drawing
-    mysqlx::RowResult bars = sess.getSchema(database)
-                                 .getTable("bar_spacings")
-                                 .select("bar_spacing", "bar_width")
-                                 .where("mat_id=:matID")
-                                 .orderBy("bar_index ASC")
-                                 .bind("matID", query.matID)
-                                 .execute();
-
-    std::vector<float> barSpacings, barWidths;
-
-    for (const mysqlx::Row &row : bars) {
-      // For each bar, add to the barSpacings and barWidths vectors
-      barSpacings.push_back(row[0]);
-      barWidths.push_back(row[1]);
+  std::vector<mysqlx::Value> sideIrons = orderedRows(row[SIDE_IRONS]);
+
+  // If the left (first) side iron exists
+  if (!sideIrons.empty()) {
+    const mysqlx::Value &leftSideIron = sideIrons[0];
+    // Insert the bar spacing from this database read to the barWidths
+    // vector
+    barWidths.insert(barWidths.begin(), jsonFloat(leftSideIron[2]));
+    // Set the left side iron in the drawing object to the side iron from
+    // the database
+    drawing->setSideIron(Drawing::Side::LEFT,
+                         DrawingComponentManager<SideIron>::findComponentByID(
+                             leftSideIron[1].get<unsigned>()));
+    // Set whether this side iron is inverted
+    drawing->setSideIronInverted(Drawing::LEFT, leftSideIron[3].get<bool>());
+    // Set whether this side iron is cut down
+    drawing->setSideIronCutDown(Drawing::LEFT, leftSideIron[4].get<bool>());
+    if (!leftSideIron[5].isNull()) {
+      drawing->setSideIronEnding(Drawing::LEFT,
+                                 (Drawing::Ending)leftSideIron[5].get<int>());
     }
 
-    // get the backing strip
-    mysqlx::RowResult backingStrips = sess.getSchema(database)
-                                          .getTable("mat_backing_strip_link")
-                                          .select("backing_strip_id")
-                                          .where("mat_id=:matID")
-                                          .bind("matID", query.matID)
-                                          .execute();
-    mysqlx::Row backingStrip = backingStrips.fetchOne();
-    if (!backingStrip.isNull()) {
-      drawing->setBackingStrip(
-          DrawingComponentManager<BackingStrip>::findComponentByID(
-              backingStrip[0]));
-    } else {
-      drawing->setLoadWarning(
-          Drawing::LoadWarning::INVALID_BACKING_STRIP_DETECTED);
+    if (!leftSideIron[6].isNull() && leftSideIron[6].get<bool>()) {
+      drawing->setSideIronFeed(Drawing::LEFT);
     }
-    // Get the side irons associated with this drawing
-    mysqlx::RowResult sideIrons =
-        sess.getSchema(database)
-            .getTable("mat_side_iron_link")
-            .select("side_iron_id", "bar_width", "inverted", "cut_down",
-                    "fixed_end", "feed_end", "hook_orientation", "strap_id")
-            .where("mat_id=:matID")
-            .orderBy("side_iron_index ASC")
-            .bind("matID", query.matID)
-            .execute();
-
-    // Get the left (first) side iron
-    mysqlx::Row leftSideIron = sideIrons.fetchOne();
-
-    // If the side iron exists
-    if (!leftSideIron.isNull()) {
-      // Insert the bar spacing from this database read to the barWidths vector
-      barWidths.insert(barWidths.begin(), leftSideIron[1]);
-      // Set the left side iron in the drawing object to the side iron from the
-      // database
-      drawing->setSideIron(Drawing::Side::LEFT,
-                           DrawingComponentManager<SideIron>::findComponentByID(
-                               leftSideIron[0]));
+    if (!leftSideIron[7].isNull())
+      drawing->setSideIronHookOrientation(
+          Drawing::LEFT, (Drawing::HookOrientation)leftSideIron[7].get<int>());
+
+    if (!leftSideIron[8].isNull())
+      drawing->setSideIronStrap(
+          Drawing::LEFT, DrawingComponentManager<Strap>::findComponentByID(
+                             leftSideIron[8].get<unsigned>()));
+
+    // If the right (second) side iron exists
+    if (sideIrons.size() > 1) {
+      const mysqlx::Value &rightSideIron = sideIrons[1];
+      // Insert the bar spacing for this right hand bar to the barWidths
+      // vector
+      barWidths.push_back(jsonFloat(rightSideIron[2]));
+      // Set the right side iron in the drawing object to the side iron from
+      // the database
+      drawing->setSideIron(
+          Drawing::Side::RIGHT,
+          DrawingComponentManager<SideIron>::findComponentByID(
+              rightSideIron[1].get<unsigned>()));
       // Set whether this side iron is inverted
-      drawing->setSideIronInverted(Drawing::LEFT, leftSideIron[2].get<bool>());
-      // Set whether this side iron is cut down
-      drawing->setSideIronCutDown(Drawing::LEFT, leftSideIron[3].get<bool>());
-      if (!leftSideIron[4].isNull()) {
-        drawing->setSideIronEnding(Drawing::LEFT,
-                                   (Drawing::Ending)leftSideIron[4].get<int>());
-      }
+      drawing->setSideIronInverted(Drawing::RIGHT,
+                                   rightSideIron[3].get<bool>());
 
-      if (!leftSideIron[5].isNull() && leftSideIron[5].get<bool>()) {
-        drawing->setSideIronFeed(Drawing::LEFT);
+      if (!rightSideIron[5].isNull()) {
+        drawing->setSideIronEnding(
+            Drawing::RIGHT, (Drawing::Ending)rightSideIron[5].get<int>());
       }
-      if (!leftSideIron[6].isNull())
-        drawing->setSideIronHookOrientation(
-            Drawing::LEFT,
-            (Drawing::HookOrientation)leftSideIron[6].get<int>());
 
-      if (!leftSideIron[7].isNull())
-        drawing->setSideIronStrap(
-            Drawing::LEFT, DrawingComponentManager<Strap>::findComponentByID(
-                               leftSideIron[7].get<unsigned>()));
-      // Get the right (second) side iron
-      mysqlx::Row rightSideIron = sideIrons.fetchOne();
-      // If the side iron exists
-      if (!rightSideIron.isNull()) {
-        // Insert the bar spacing for this right hand bar to the barWidths
-        // vector
-        barWidths.push_back(rightSideIron[1]);
-        // Set the right side iron in the drawing object to the side iron from
-        // the database
-        drawing->setSideIron(
-            Drawing::Side::RIGHT,
-            DrawingComponentManager<SideIron>::findComponentByID(
-                rightSideIron[0]));
-        // Set whether this side iron is inverted
-        drawing->setSideIronInverted(Drawing::RIGHT,
-                                     rightSideIron[2].get<bool>());
-
-        if (!rightSideIron[4].isNull()) {
-          drawing->setSideIronEnding(
-              Drawing::RIGHT, (Drawing::Ending)rightSideIron[4].get<int>());
-        }
-
-        if (!rightSideIron[5].isNull() && rightSideIron[5].get<bool>()) {
-          drawing->setSideIronFeed(Drawing::RIGHT);
-        }
-        if (!rightSideIron[6].isNull())
-          drawing->setSideIronHookOrientation(
-              Drawing::RIGHT,
-              (Drawing::HookOrientation)rightSideIron[6].get<int>());
+      if (!rightSideIron[6].isNull() && rightSideIron[6].get<bool>()) {
+        drawing->setSideIronFeed(Drawing::RIGHT);
+      }
       if (!rightSideIron[7].isNull())
+        drawing->setSideIronHookOrientation(
+            Drawing::RIGHT,
+            (Drawing::HookOrientation)rightSideIron[7].get<int>());
+      if (!rightSideIron[8].isNull())
         drawing->setSideIronStrap(
             Drawing::RIGHT, DrawingComponentManager<Strap>::findComponentByID(
-                               rightSideIron[7].get<unsigned>()));
-      } else {
-        // If this side iron was missing, set the associated bar spacing to 0
-        // and send a load warning that there were missing side irons.
-        Logger::logError("Missing right side iron for drawing: " +
-                         drawing->drawingNumber());
-        barWidths.push_back(0);
-        drawing->setLoadWarning(
-            Drawing::LoadWarning::MISSING_SIDE_IRONS_DETECTED);
-      }
+                                rightSideIron[8].get<unsigned>()));
     } else {
-      // If this side iron was missing, set the associated bar spacing to 0 and
-      // send a load warning that there were missing side irons.
-      Logger::logError("Missing side irons for drawing: " +
+      // If this side iron was missing, set the associated bar spacing to 0
+      // and send a load warning that there were missing side irons.
+      Logger::logError("Missing right side iron for drawing: " +
                        drawing->drawingNumber());
-      barWidths.insert(barWidths.begin(), 0);
       barWidths.push_back(0);
       drawing->setLoadWarning(
           Drawing::LoadWarning::MISSING_SIDE_IRONS_DETECTED);
     }
+  } else {
+    // If this side iron was missing, set the associated bar spacing to 0
+    // and send a load warning that there were missing side irons.
+    Logger::logError("Missing side irons for drawing: " +
+                     drawing->drawingNumber());
+    barWidths.insert(barWidths.begin(), 0);
+    barWidths.push_back(0);
+    drawing->setLoadWarning(Drawing::LoadWarning::MISSING_SIDE_IRONS_DETECTED);
+  }
 
-    // Add the final bar width to the barSpacings list. This is calculated by
-    // the total width minus each bar spacing stored in the database
-    barSpacings.push_back(
-        drawing->width() -
-        std::accumulate(barSpacings.begin(), barSpacings.end(), 0.0f));
-
-    // Set the barSpacings and barWidths constructed into the drawing object
-    drawing->setBars(barSpacings, barWidths);
-
-    // Reset the query string
-    queryString.str(std::string());
-
-    // SQL query for selecting each sidelap and overlap from the database
-    queryString
-        << "SELECT 'S' AS type, mat_side, width, attachment_type, material_id "
-        << std::endl;
-    queryString << "FROM " << database
-                << ".sidelaps WHERE mat_id=" << query.matID << std::endl;
-    queryString << "UNION SELECT 'O' AS type, mat_side, width, "
-                   "attachment_type, material_id "
-                << std::endl;
-    queryString << "FROM " << database
-                << ".overlaps WHERE mat_id=" << query.matID << std::endl;
-
-    // Execute this query
-    mysqlx::RowResult laps = sess.sql(queryString.str()).execute();
-
-    // Loop through each lap the database returned
-    for (const mysqlx::Row &lap : laps) {
-      // Enum variable to store how this lap is attached (Integral or Bonded)
-      LapAttachment attachment;
-      if (lap[3].isNull()) {
-        // If the attachmentString wasn't valid, indicate that there was an
-        // error with the lap.
-        Logger::logError("Invalid drawing discovered (invalid lap side): " +
-                         drawing->drawingNumber());
-        // Set a load warning.
-        drawing->setLoadWarning(Drawing::LoadWarning::INVALID_LAPS_DETECTED);
-        // Continue - this lap is invalid so we just ignore it. The user will be
-        // notified that there was an error
-        continue;
-      }
-      // This data is encoded by a MySQL enum which returns a string in the
-      // query
-      std::string attachmentString = lap[3].get<std::string>();
-      // If the attachmentString is the string "Bonded", set that this is a
-      // bonded lap. Otherwise set it to be Integral.
-      if (attachmentString == "Bonded") {
-        attachment = LapAttachment::BONDED;
-      } else if (attachmentString == "Integral") {
-        attachment = LapAttachment::INTEGRAL;
-      } else {
-        // If the attachmentString wasn't valid, indicate that there was an
-        // error with the attachment.
-        Logger::logError(
-            "Invalid drawing discovered (invalid lap attachment): " +
-            drawing->drawingNumber());
-        // Set a load warning.
-        drawing->setLoadWarning(Drawing::LoadWarning::INVALID_LAPS_DETECTED);
-        // Continue - this lap is invalid so we just ignore it. The user will be
-        // notified that there was an error
-        continue;
-      }
+  // Add the final bar width to the barSpacings list. This is calculated by
+  // the total width minus each bar spacing stored in the database
+  barSpacings.push_back(
+      drawing->width() -
+      std::accumulate(barSpacings.begin(), barSpacings.end(), 0.0f));
+
+  // Set the barSpacings and barWidths constructed into the drawing object
+  drawing->setBars(barSpacings, barWidths);
+
+  // Loop through each lap the database returned
+  for (const mysqlx::Value &lap : row[LAPS]) {
+    // Enum variable to store how this lap is attached (Integral or Bonded)
+    LapAttachment attachment;
+    if (lap[3].isNull()) {
+      // If the attachmentString wasn't valid, indicate that there was an
+      // error with the lap.
+      Logger::logError("Invalid drawing discovered (invalid lap side): " +
+                       drawing->drawingNumber());
+      // Set a load warning.
+      drawing->setLoadWarning(Drawing::LoadWarning::INVALID_LAPS_DETECTED);
+      // Continue - this lap is invalid so we just ignore it. The user will
+      // be notified that there was an error
+      continue;
+    }
+    // This data is encoded by a MySQL enum which returns a string in the
+    // query
+    std::string attachmentString = lap[3].get<std::string>();
+    // If the attachmentString is the string "Bonded", set that this is a
+    // bonded lap. Otherwise set it to be Integral.
+    if (attachmentString == "Bonded") {
+      attachment = LapAttachment::BONDED;
+    } else if (attachmentString == "Integral") {
+      attachment = LapAttachment::INTEGRAL;
+    } else {
+      // If the attachmentString wasn't valid, indicate that there was an
+      // error with the attachment.
+      Logger::logError("Invalid drawing discovered (invalid lap attachment): " +
+                       drawing->drawingNumber());
+      // Set a load warning.
+      drawing->setLoadWarning(Drawing::LoadWarning::INVALID_LAPS_DETECTED);
+      // Continue - this lap is invalid so we just ignore it. The user will
+      // be notified that there was an error
+      continue;
+    }
 
-      // Next we find out which lap we are looking at. This depends on the side
-      // value in the table, the tension type of the mat and whether it was a
-      // sidelap or overlap
-      Drawing::Side side;
-      if (lap[1].isNull()) {
-        // If the side is null, indicate that there was an error with the lap.
-        Logger::logError("Invalid drawing discovered (invalid lap side): " +
-                         drawing->drawingNumber());
-        // Set a load warning.
-        drawing->setLoadWarning(Drawing::LoadWarning::INVALID_LAPS_DETECTED);
-        // Continue - this lap is invalid so we just ignore it. The user will be
-        // notified that there was an error
-        continue;
-      }
-      std::string sideString = lap[1].get<std::string>();
-      if (sideString == "Left") {
-        side = Drawing::Side::LEFT;
-      } else if (sideString == "Right") {
-        side = Drawing::Side::RIGHT;
-      } else {
-        // If the sideString wasn't valid, indicate that there was an error with
-        // the lap.
-        Logger::logError("Invalid drawing discovered (invalid lap side) " +
-                         drawing->drawingNumber());
-        // Set a load warning.
-        drawing->setLoadWarning(Drawing::LoadWarning::INVALID_LAPS_DETECTED);
-        // Continue - this lap is invalid so we just ignore it. The user will be
-        // notified that there was an error
-        continue;
-      }
+    // Next we find out which lap we are looking at. This depends on the
+    // side value in the table, the tension type of the mat and whether it
+    // was a sidelap or overlap
+    Drawing::Side side;
+    if (lap[1].isNull()) {
+      // If the side is null, indicate that there was an error with the lap.
+      Logger::logError("Invalid drawing discovered (invalid lap side): " +
+                       drawing->drawingNumber());
+      // Set a load warning.
+      drawing->setLoadWarning(Drawing::LoadWarning::INVALID_LAPS_DETECTED);
+      // Continue - this lap is invalid so we just ignore it. The user will
+      // be notified that there was an error
+      continue;
+    }
+    std::string sideString = lap[1].get<std::string>();
+    if (sideString == "Left") {
+      side = Drawing::Side::LEFT;
+    } else if (sideString == "Right") {
+      side = Drawing::Side::RIGHT;
+    } else {
+      // If the sideString wasn't valid, indicate that there was an error
+      // with the lap.
+      Logger::logError("Invalid drawing discovered (invalid lap side) " +
+                       drawing->drawingNumber());
+      // Set a load warning.
+      drawing->setLoadWarning(Drawing::LoadWarning::INVALID_LAPS_DETECTED);
+      // Continue - this lap is invalid so we just ignore it. The user will
+      // be notified that there was an error
+      continue;
+    }
 
-      // Set either the sidelap or overlap corresponding to this lap, depending
-      // on which table the lap came from. We add the width of the lap, the
-      // attachment type and the material.
-      if (lap[0].get<std::string>() == "S") {
-        drawing->setSidelap(
-            side,
-            Drawing::Lap(
-                lap[2], attachment,
-                DrawingComponentManager<Material>::findComponentByID(lap[4])));
-      } else {
-        drawing->setOverlap(
-            side,
-            Drawing::Lap(
-                lap[2], attachment,
-                DrawingComponentManager<Material>::findComponentByID(lap[4])));
-      }
+    // Set either the sidelap or overlap corresponding to this lap,
+    // depending on which table the lap came from. We add the width of the
+    // lap, the attachment type and the material.
+    Drawing::Lap drawingLap(
+        jsonFloat(lap[2]), attachment,
+        DrawingComponentManager<Material>::findComponentByID(
+            lap[4].get<unsigned>()));
+    if (lap[0].get<std::string>() == "S") {
+      drawing->setSidelap(side, drawingLap);
+    } else {
+      drawing->setOverlap(side, drawingLap);
     }
+  }
 
-    // Get all of the press drawing links from the database (if any)
-    std::vector<mysqlx::Row> pressHyperlinkRows =
-        sess.getSchema(database)
-            .getTable("punch_program_pdfs")
-            .select("hyperlink")
-            .where("mat_id=:matID")
-            .bind("matID", query.matID)
-            .execute()
-            .fetchAll();
+  // Set the press drawing hyperlinks in the drawing object (this may well
+  // be empty)
+  std::vector<std::filesystem::path> pressHyperlinks;
+  for (const mysqlx::Value &hyperlink : row[PRESS_HYPERLINKS]) {
+    pressHyperlinks.push_back(hyperlink.get<std::string>());
+  }
+  drawing->setPressDrawingHyperlinks(pressHyperlinks);
 
-    // Declare a vector for the press hyperlinks and reserve the space for it
-    std::vector<std::filesystem::path> pressHyperlinks;
-    pressHyperlinks.resize(pressHyperlinkRows.size());
+  // Impact Pads
+  for (const mysqlx::Value &values : row[IMPACT_PADS]) {
+    Drawing::ImpactPad pad;
+    pad.setMaterial(DrawingComponentManager<Material>::findComponentByID(
+        values[0].get<unsigned>()));
 
-    // Map from the rows to the press hyperlinks list with a functional adapter
-    std::transform(pressHyperlinkRows.begin(), pressHyperlinkRows.end(),
-                   pressHyperlinks.begin(), [](const mysqlx::Row &row) {
-                     return row[0].get<std::string>();
-                   });
+    Aperture matchingAperture =
+        DrawingComponentManager<Aperture>::findComponentByID(
+            values[1].get<unsigned>());
+    pad.setAperture(matchingAperture);
 
-    // Set the press drawing hyperlinks in the drawing object (this may well be
-    // empty)
-    drawing->setPressDrawingHyperlinks(pressHyperlinks);
+    pad.width = jsonFloat(values[2]);
+    pad.length = jsonFloat(values[3]);
+    pad.pos.x = jsonFloat(values[4]);
+    pad.pos.y = jsonFloat(values[5]);
 
-    // Impact Pads
-    mysqlx::RowResult impactPadResults =
-        sess.getSchema(database)
-            .getTable("impact_pads")
-            .select("material_id", "aperture_id", "width", "length", "x_coord",
-                    "y_coord")
-            .where("mat_id=:matID")
-            .bind("matID", query.matID)
-            .execute();
-
-    for (const mysqlx::Row &row : impactPadResults) {
-      Drawing::ImpactPad pad;
-      pad.setMaterial(
-          DrawingComponentManager<Material>::findComponentByID(row[0]));
-
-      Aperture matchingAperture =
-          DrawingComponentManager<Aperture>::findComponentByID(row[1]);
-      pad.setAperture(matchingAperture);
-
-      pad.width = row[2].get<float>();
-      pad.length = row[3].get<float>();
-      pad.pos.x = row[4].get<float>();
-      pad.pos.y = row[5].get<float>();
-
-      drawing->addImpactPad(pad);
-    }
+    drawing->addImpactPad(pad);
+  }
 
-    // Blank Spaces
-    mysqlx::RowResult blankSpaceResults =
-        sess.getSchema(database)
-            .getTable("blank_spaces")
-            .select("width", "length", "x_coord", "y_coord")
-            .where("mat_id=:matID")
-            .bind("matID", query.matID)
-            .execute();
+  // Blank Spaces
+  for (const mysqlx::Value &values : row[BLANK_SPACES]) {
+    Drawing::BlankSpace space;
 
-    for (const mysqlx::Row &row : blankSpaceResults) {
-      Drawing::BlankSpace space;
+    space.width = jsonFloat(values[0]);
+    space.length = jsonFloat(values[1]);
+    space.pos.x = jsonFloat(values[2]);
+    space.pos.y = jsonFloat(values[3]);
 
-      space.width = row[0].get<float>();
-      space.length = row[1].get<float>();
-      space.pos.x = row[2].get<float>();
-      space.pos.y = row[3].get<float>();
+    drawing->addBlankSpace(space);
+  }
 
-      drawing->addBlankSpace(space);
-    }
+  // Extra Apertures
+  for (const mysqlx::Value &values : row[EXTRA_APERTURES]) {
+    Drawing::ExtraAperture aperture;
 
-    // Extra Apertures
-    mysqlx::RowResult extraApertureResult =
-        sess.getSchema(database)
-            .getTable("extra_apertures")
-            .select("width", "length", "x_coord", "y_coord", "aperture_id")
-            .where("mat_id=:matID")
-            .bind("matID", query.matID)
-            .execute();
-
-    for (const mysqlx::Row &row : extraApertureResult) {
-      Drawing::ExtraAperture aperture;
-
-      aperture.width = row[0].get<float>();
-      aperture.length = row[1].get<float>();
-      aperture.pos.x = row[2].get<float>();
-      aperture.pos.y = row[3].get<float>();
-      aperture.setAperture(DrawingComponentManager<Aperture>::findComponentByID(
-          row[4].get<unsigned>()));
-
-      drawing->addExtraAperture(aperture);
-    }
+    aperture.width = jsonFloat(values[0]);
+    aperture.length = jsonFloat(values[1]);
+    aperture.pos.x = jsonFloat(values[2]);
+    aperture.pos.y = jsonFloat(values[3]);
+    aperture.setAperture(DrawingComponentManager<Aperture>::findComponentByID(
+        values[4].get<unsigned>()));
 
-    // Dam Bars
-    mysqlx::RowResult damBarResults =
-        sess.getSchema(database)
-            .getTable("dam_bars")
-            .select("width", "length", "x_coord", "y_coord", "material_id")
-            .where("mat_id=:matID")
-            .bind("matID", query.matID)
-            .execute();
-
-    for (const mysqlx::Row &row : damBarResults) {
-      Drawing::DamBar bar;
-
-      bar.width = row[0].get<float>();
-      bar.length = row[1].get<float>();
-      bar.pos.x = row[2].get<float>();
-      bar.pos.y = row[3].get<float>();
-      bar.setMaterial(
-          DrawingComponentManager<Material>::findComponentByID(row[4]));
-
-      drawing->addDamBar(bar);
-    }
+    drawing->addExtraAperture(aperture);
+  }
 
-    // Center Holes
-    mysqlx::RowResult centreHoleResults =
-        sess.getSchema(database)
-            .getTable("centre_holes")
-            .select("x_coord", "y_coord", "aperture_id")
-            .where("mat_id=:matID")
-            .bind("matID", query.matID)
-            .execute();
-
-    for (const mysqlx::Row &row : centreHoleResults) {
-      Drawing::CentreHole hole;
-      hole.pos.x = row[0].get<float>();
-      hole.pos.y = row[1].get<float>();
-      hole.setAperture(DrawingComponentManager<Aperture>::findComponentByID(
-          row[2].get<unsigned>()));
-
-      drawing->addCentreHole(hole);
-    }
+  // Dam Bars
+  for (const mysqlx::Value &values : row[DAM_BARS]) {
+    Drawing::DamBar bar;
 
-    // Deflectors
-    mysqlx::RowResult deflectorResults =
-        sess.getSchema(database)
-            .getTable("deflectors")
-            .select("material_id", "size", "x_coord", "y_coord")
-            .where("mat_id=:matID")
-            .bind("matID", query.matID)
-            .execute();
-
-    for (const mysqlx::Row &row : deflectorResults) {
-      Drawing::Deflector deflector;
-      deflector.setMaterial(
-          DrawingComponentManager<Material>::findComponentByID(row[0]));
-      deflector.size = row[1].get<float>();
-      deflector.pos.x = row[2].get<float>();
-      deflector.pos.y = row[3].get<float>();
-
-      drawing->addDeflector(deflector);
-    }
+    bar.width = jsonFloat(values[0]);
+    bar.length = jsonFloat(values[1]);
+    bar.pos.x = jsonFloat(values[2]);
+    bar.pos.y = jsonFloat(values[3]);
+    bar.setMaterial(DrawingComponentManager<Material>::findComponentByID(
+        values[4].get<unsigned>()));
 
-    // Divertors
-    mysqlx::RowResult divertorResults =
-        sess.getSchema(database)
-            .getTable("divertors")
-            .select("material_id", "width", "length", "mat_side", "y_coord")
-            .where("mat_id=:matID")
-            .bind("matID", query.matID)
-            .execute();
-
-    for (const mysqlx::Row &row : divertorResults) {
-      Drawing::Divertor divertor;
-      divertor.setMaterial(
-          DrawingComponentManager<Material>::findComponentByID(row[0]));
-      divertor.width = row[1].get<float>();
-      divertor.length = row[2].get<float>();
-      if (row[3].get<std::string>() == "Left") {
-        divertor.side = Drawing::LEFT;
-      } else {
-        divertor.side = Drawing::RIGHT;
-      }
-      divertor.verticalPosition = row[4].get<float>();
+    drawing->addDamBar(bar);
+  }
 
-      drawing->addDivertor(divertor);
+  // Center Holes
+  for (const mysqlx::Value &values : row[CENTRE_HOLES]) {
+    Drawing::CentreHole hole;
+    hole.pos.x = jsonFloat(values[0]);
+    hole.pos.y = jsonFloat(values[1]);
+    hole.setAperture(DrawingComponentManager<Aperture>::findComponentByID(
+        values[2].get<unsigned>()));
+
+    drawing->addCentreHole(hole);
+  }
+
+  // Deflectors
+  for (const mysqlx::Value &values : row[DEFLECTORS]) {
+    Drawing::Deflector deflector;
+    deflector.setMaterial(DrawingComponentManager<Material>::findComponentByID(
+        values[0].get<unsigned>()));
+    deflector.size = jsonFloat(values[1]);
+    deflector.pos.x = jsonFloat(values[2]);
+    deflector.pos.y = jsonFloat(values[3]);
+
+    drawing->addDeflector(deflector);
+  }
+
+  // Divertors
+  for (const mysqlx::Value &values : row[DIVERTORS]) {
+    Drawing::Divertor divertor;
+    divertor.setMaterial(DrawingComponentManager<Material>::findComponentByID(
+        values[0].get<unsigned>()));
+    divertor.width = jsonFloat(values[1]);
+    divertor.length = jsonFloat(values[2]);
+    if (values[3].get<std::string>() == "Left") {
+      divertor.side = Drawing::LEFT;
+    } else {
+      divertor.side = Drawing::RIGHT;
     }
+    divertor.verticalPosition = jsonFloat(values[4]);
+
+    drawing->addDivertor(divertor);
+  }
+
+  // Return the constructed drawing
+  return drawing;
+}
 
-    // Return the constructed drawing
-    return drawing;
+Drawing *DatabaseManager::executeDrawingQuery(const DrawingRequest &query) {
+  // Wrapped in a try statement to catch any MySQL errors.
+  try {
+    // Reads are safe to repeat, so they are retried on a fresh session if
+    // the connection was lost
+    return readWithRetry([&](mysqlx::Session &sess) -> Drawing * {
+      // Execute the query and read the first row. This should never return
+      // more than one row as the mat_id is a unique key in the database.
+      mysqlx::Row drawingResults =
+          sess.sql(drawingDetailsQueryString("d.mat_id=" +
+                                             std::to_string(query.matID)))
+              .execute()
+              .fetchOne();
+
+      // If the results were not null, there was a matching drawing.
+      if (!drawingResults.isNull()) {
+        return drawingFromRow(drawingResults);
+      }
+
+      // If the drawing we read from the database was null, print a safe error
+      // to the console and set a load warning on the drawing, indicating that
+      // we failed to load the drawing.
+      lockLog {
+        *ss << "Failed to load drawing with mat_id: " +
+                   std::to_string(query.matID);
+        Logger::logError();
+      }
+      Drawing *drawing = new Drawing();
+      drawing->setAsDefault();
+      drawing->setLoadWarning(Drawing::LoadWarning::LOAD_FAILED);
+      return drawing;
+    });
   } catch (mysqlx::Error &e) {
     // If there was an error, print it to the console.
     // This is not considered a fatal error; if there was an error we just
@@ -670,16 +700,116 @@ Drawing *DatabaseManager::executeDrawingQuery(const DrawingRequest &query) {
   }
 }
 
-mysqlx::SqlResult DatabaseManager::sourceTable(
-    const std::string &tableName,
-                                               const std::string &orderBy) {
+std::vector<Drawing> DatabaseManager::executeDrawingBatchQuery(
+    const DrawingBatchRequest &query) {
+  if (query.matIDs.empty()) {
+    return {};
+  }
+
+  // Every drawing is selected in one query, with a set based condition on the
+  // mat_id
+  std::stringstream condition;
+  condition << "d.mat_id IN (";
+  for (unsigned i = 0; i < query.matIDs.size(); i++) {
+    condition << (i == 0 ? "" : ",") << query.matIDs[i];
+  }
+  condition << ")";
+
+  // Wrapped in a try statement to catch any MySQL errors.
+  try {
+    // Reads are safe to repeat, so they are retried on a fresh session if
+    // the connection was lost
+    return readWithRetry([&](mysqlx::Session &sess) -> std::vector<Drawing> {
+      mysqlx::RowResult rows =
+          sess.sql(drawingDetailsQueryString(condition.str())).execute();
+
+      // The rows come back in no particular order, so are matched up to the
+      // requested matIDs afterwards
+      std::unordered_map<unsigned, std::unique_ptr<Drawing>> loaded;
+      for (const mysqlx::Row &row : rows) {
+        loaded[row[MAT_ID].get<unsigned>()].reset(drawingFromRow(row));
+      }
+
+      std::vector<Drawing> drawings;
+      drawings.reserve(query.matIDs.size());
+      for (unsigned matID : query.matIDs) {
+        std::unordered_map<unsigned, std::unique_ptr<Drawing>>::iterator it =
+            loaded.find(matID);
+        if (it != loaded.end()) {
+          drawings.emplace_back(*it->second);
+        } else {
+          // Set a load warning on any drawing which wasn't found, in the same
+          // way as for a single drawing
+          lockLog {
+            *ss << "Failed to load drawing with mat_id: " +
+                       std::to_string(matID);
+            Logger::logError();
+          }
+          Drawing &drawing = drawings.emplace_back();
+          drawing.setAsDefault();
+          drawing.setLoadWarning(Drawing::LoadWarning::LOAD_FAILED);
+        }
+      }
+
+      return drawings;
+    });
+  } catch (mysqlx::Error &e) {
+    // If there was an error, print it to the console.
+    // This is not considered a fatal error; if there was an error we just
+    // return an empty set
+    Logger::logError(e.what(), __LINE__, __FILE__);
+    return {};
+  }
+}
+
+std::optional<std::vector<mysqlx::Row>> DatabaseManager::searchIndexRows(
+    const std::optional<std::vector<std::string>> &drawingNumbers) {
+  if (drawingNumbers.has_value() && drawingNumbers->empty()) {
+    return std::vector<mysqlx::Row>();
+  }
+  std::string query = Format::format(
+      DrawingSearchIndex::rowQueryString(
+          drawingNumbers.has_value() ? drawingNumbers->size() : 0),
+      database);
+
   // Wrapped in a try statement to catch any MySQL errors.
   try {
-            return sess
-        .sql("SELECT * FROM " + database + "." + tableName +
-             (orderBy.empty() ? "" : " ORDER BY " + orderBy))
-                .execute();
-    } catch (mysqlx::Error &e) {
+    // Reads are safe to repeat, so they are retried on a fresh session if
+    // the connection was lost
+    return readWithRetry(
+        [&](mysqlx::Session &sess) -> std::vector<mysqlx::Row> {
+          mysqlx::SqlStatement statement = sess.sql(query);
+          if (drawingNumbers.has_value()) {
+            for (const std::string &drawingNumber : *drawingNumbers) {
+              statement.bind(drawingNumber);
+            }
+          }
+          return statement.execute().fetchAll();
+        });
+  } catch (mysqlx::Error &e) {
+    // Not fatal, as searches fall back to querying the database
+    Logger::logError(e.what(), __LINE__, __FILE__);
+    return std::nullopt;
+  }
+}
+
+std::vector<mysqlx::Row> DatabaseManager::sourceTable(
+    const std::string &tableName, const std::string &orderBy) {
+  // Wrapped in a try statement to catch any MySQL errors.
+  try {
+    // Reads are safe to repeat, so they are retried on a fresh session if
+    // the connection was lost
+    return readWithRetry(
+        [&](mysqlx::Session &sess) -> std::vector<mysqlx::Row> {
+      // The rows are fetched while the session is held, so the caller can read
+      // them after other requests have started using the session
+      return sess
+          .sql("SELECT * FROM " + database + "." + tableName +
+               (orderBy.empty() ? "" : " ORDER BY " + orderBy))
+          .execute()
+          .fetchAll();
+    });
+  } catch (mysqlx::Error &e) {
     // If there was an error, print it to the console.
     // This is not considered a fatal error; if there was an error we just
     // return an empty row set
@@ -688,18 +818,23 @@ mysqlx::SqlResult DatabaseManager::sourceTable(
   }
 }
 
-mysqlx::SqlResult DatabaseManager::sourceMultipleTable(
+std::vector<mysqlx::Row> DatabaseManager::sourceMultipleTable(
     const std::string &leftTable, const std::string &rightTable,
     std::tuple<std::string, std::string> commons, const std::string &orderBy) {
   // Wrapped in a try statement to catch any MySQL errors.
   try {
-    std::stringstream ss;
-    ss << "SELECT * FROM " << database << "." << leftTable << " RIGHT JOIN "
-       << database << "." << rightTable << " ON ";
-    ss << database << "." << leftTable << "." << std::get<0>(commons) << " = "
-       << database << "." << rightTable << "." << std::get<1>(commons)
-       << (orderBy.empty() ? "" : " ORDER BY " + orderBy) << std::endl;
-    return sess.sql(ss.str()).execute();
+    // Reads are safe to repeat, so they are retried on a fresh session if
+    // the connection was lost
+    return readWithRetry(
+        [&](mysqlx::Session &sess) -> std::vector<mysqlx::Row> {
+      std::stringstream ss;
+      ss << "SELECT * FROM " << database << "." << leftTable << " RIGHT JOIN "
+         << database << "." << rightTable << " ON ";
+      ss << database << "." << leftTable << "." << std::get<0>(commons) << " = "
+         << database << "." << rightTable << "." << std::get<1>(commons)
+         << (orderBy.empty() ? "" : " ORDER BY " + orderBy) << std::endl;
+      return sess.sql(ss.str()).execute().fetchAll();
+    });
   } catch (mysqlx::Error &e) {
     // If there was an error, print it to the console.
     // This is not considered a fatal error; if there was an error we just
@@ -709,7 +844,7 @@ mysqlx::SqlResult DatabaseManager::sourceMultipleTable(
   }
 }
 
-mysqlx::SqlResult DatabaseManager::sourceMultipleTable(
+std::vector<mysqlx::Row> DatabaseManager::sourceMultipleTable(
     const std::string &leftTable, const std::string &rightTable,
     const std::string &common, const std::string &orderBy) {
   return sourceMultipleTable(leftTable, rightTable, {common, common});
@@ -718,6 +853,10 @@ mysqlx::SqlResult DatabaseManager::sourceMultipleTable(
 bool DatabaseManager::insertDrawing(const DrawingInsert &insert) {
   // Wrapped in a try statement to catch any MySQL errors.
   try {
+    // Check out a session from the pool for the duration of this call
+    SessionPool::Lease session = sessionPool.checkout();
+    mysqlx::Session &sess = *session;
+
     // The drawing data in the insert object is an optional, so if it unset,
     // there is no drawing to insert into the database. Therefore, we just
     // return false indicating the insertion failed.
@@ -875,8 +1014,9 @@ bool DatabaseManager::insertDrawing(const DrawingInsert &insert) {
     // If there was an error, print it to the console.
     // This is not considered a fatal error; if there was an error we just
     // return that insertion failed
+    // The transaction is rolled back as the session is discarded by the pool
+    // rather than returned to it.
     Logger::logError(e.what(), __LINE__, __FILE__);
-    sess.rollback();
     return false;
   }
 }
@@ -885,21 +1025,25 @@ DatabaseManager::DrawingExistsResponse DatabaseManager::drawingExists(
     const std::string &drawingNumber) {
   // Wrapped in a try statement to catch any MySQL errors.
   try {
-    // Search the database for a drawing with the drawingNumber passed in. If
-    // the result is not null, return that the drawing exists. Otherwise, return
-    // that the drawing does not exist.
-    if (!sess.getSchema(database)
-             .getTable("drawings")
-             .select("mat_id")
-             .where("drawing_number=:drawingNumber")
-             .bind("drawingNumber", drawingNumber)
-             .execute()
-             .fetchOne()
-             .isNull()) {
-      return DrawingExistsResponse::EXISTS;
-    } else {
-      return DrawingExistsResponse::NOT_EXISTS;
-    }
+    // Reads are safe to repeat, so they are retried on a fresh session if
+    // the connection was lost
+    return readWithRetry([&](mysqlx::Session &sess) -> DrawingExistsResponse {
+      // Search the database for a drawing with the drawingNumber passed in. If
+      // the result is not null, return that the drawing exists. Otherwise,
+      // return that the drawing does not exist.
+      if (!sess.getSchema(database)
+               .getTable("drawings")
+               .select("mat_id")
+               .where("drawing_number=:drawingNumber")
+               .bind("drawingNumber", drawingNumber)
+               .execute()
+               .fetchOne()
+               .isNull()) {
+        return DrawingExistsResponse::EXISTS;
+      } else {
+        return DrawingExistsResponse::NOT_EXISTS;
+      }
+    });
   } catch (mysqlx::Error &e) {
     // If there was an error, print it to the console.
     // This is not considered a fatal error; if there was an error we just
@@ -912,6 +1056,10 @@ DatabaseManager::DrawingExistsResponse DatabaseManager::drawingExists(
 bool DatabaseManager::insertComponent(const ComponentInsert &insert) {
   // Wrapped in a try statement to catch any MySQL errors.
   try {
+    // Check out a session from the pool for the duration of this call
+    SessionPool::Lease session = sessionPool.checkout();
+    mysqlx::Session &sess = *session;
+
     // Get the insert query string from the insert object. This string will be
     // empty if there is nothing to insert (which likely indicates an error at
     // some stage)
@@ -970,63 +1118,67 @@ bool DatabaseManager::createBackup(
 std::string DatabaseManager::nextAutomaticDrawingNumber() {
   // Wrapped in a try statement to catch any MySQL errors.
   try {
-    std::string sqlQuery =
-        "SELECT drawing_number FROM " + database +
-        ".drawings "
-        "ORDER BY IF(drawing_number REGEXP '^[A-Z][0-9]{2,}[A-Z]?$', "
-        "CONCAT('0', drawing_number), drawing_number) DESC LIMIT 1;";
+    // Reads are safe to repeat, so they are retried on a fresh session if
+    // the connection was lost
+    return readWithRetry([&](mysqlx::Session &sess) -> std::string {
+      std::string sqlQuery =
+          "SELECT drawing_number FROM " + database +
+          ".drawings "
+          "ORDER BY IF(drawing_number REGEXP '^[A-Z][0-9]{2,}[A-Z]?$', "
+          "CONCAT('0', drawing_number), drawing_number) DESC LIMIT 1;";
 
-    mysqlx::Row row = sess.sql(sqlQuery).execute().fetchOne();
+      mysqlx::Row row = sess.sql(sqlQuery).execute().fetchOne();
 
-    if (!row.isNull()) {
-      std::string latest = row[0].get<std::string>();
+      if (!row.isNull()) {
+        std::string latest = row[0].get<std::string>();
 
-      std::string charSection, numberSection;
+        std::string charSection, numberSection;
 
-      unsigned index = 0;
+        unsigned index = 0;
 
-      while (index < latest.size()) {
-        if (std::isalpha(latest.at(index))) {
-          charSection += latest.at(index++);
-        } else {
-          break;
+        while (index < latest.size()) {
+          if (std::isalpha(latest.at(index))) {
+            charSection += latest.at(index++);
+          } else {
+            break;
+          }
         }
-      }
-      while (index < latest.size()) {
-        if (std::isdigit(latest.at(index))) {
-          numberSection += latest.at(index++);
-        } else {
-          break;
+        while (index < latest.size()) {
+          if (std::isdigit(latest.at(index))) {
+            numberSection += latest.at(index++);
+          } else {
+            break;
+          }
         }
-      }
 
-      unsigned char number = std::stoi(numberSection);
+        unsigned char number = std::stoi(numberSection);
 
-      std::stringstream next;
+        std::stringstream next;
 
-      if (number == 99) {
-        index = charSection.size() - 1;
-        while (index >= 0) {
-          char c = charSection[index];
-          if (c == 'Z') {
-            charSection[index--] = 'A';
-          } else {
-            charSection[index]++;
-            break;
+        if (number == 99) {
+          index = charSection.size() - 1;
+          while (index >= 0) {
+            char c = charSection[index];
+            if (c == 'Z') {
+              charSection[index--] = 'A';
+            } else {
+              charSection[index]++;
+              break;
+            }
           }
+          number = 0;
         }
-        number = 0;
-      }
 
-      next << charSection << number + 1;
+        next << charSection << number + 1;
 
-      return next.str();
-    }
+        return next.str();
+      }
 
-    Logger::logError("Failed to find next automatic drawing number.");
+      Logger::logError("Failed to find next automatic drawing number.");
 
-    return std::string();
+      return std::string();
 
+    });
   } catch (mysqlx::Error &e) {
     // If there was an error, print it to the console.
     // This is not considered a fatal error
@@ -1038,49 +1190,54 @@ std::string DatabaseManager::nextAutomaticDrawingNumber() {
 std::string DatabaseManager::nextManualDrawingNumber() {
   // Wrapped in a try statement to catch any MySQL errors.
   try {
-    std::string sqlQuery =
-        "SELECT drawing_number FROM " + database +
-        ".drawings "
-        "WHERE drawing_number LIKE 'M%' "
-        "ORDER BY CAST(SUBSTRING(drawing_number, 2) AS UNSIGNED) DESC LIMIT 1;";
+    // Reads are safe to repeat, so they are retried on a fresh session if
+    // the connection was lost
+    return readWithRetry([&](mysqlx::Session &sess) -> std::string {
+      std::string sqlQuery =
+          "SELECT drawing_number FROM " + database +
+          ".drawings "
+          "WHERE drawing_number LIKE 'M%' "
+          "ORDER BY CAST(SUBSTRING(drawing_number, 2) AS UNSIGNED) DESC "
+          "LIMIT 1;";
 
-    mysqlx::SqlResult test = sess.sql(sqlQuery).execute();
-    mysqlx::Row row = test.fetchOne();
+      mysqlx::SqlResult test = sess.sql(sqlQuery).execute();
+      mysqlx::Row row = test.fetchOne();
 
-    if (!row.isNull()) {
-      std::string latest = row[0].get<std::string>();
+      if (!row.isNull()) {
+        std::string latest = row[0].get<std::string>();
 
-      std::string charSection, numberSection;
+        std::string charSection, numberSection;
 
-      unsigned index = 0;
+        unsigned index = 0;
 
-      while (index < latest.size()) {
-        if (std::isalpha(latest.at(index))) {
-          charSection += latest.at(index++);
-        } else {
-          break;
+        while (index < latest.size()) {
+          if (std::isalpha(latest.at(index))) {
+            charSection += latest.at(index++);
+          } else {
+            break;
+          }
         }
-      }
-      while (index < latest.size()) {
-        if (std::isdigit(latest.at(index))) {
-          numberSection += latest.at(index++);
-        } else {
-          break;
+        while (index < latest.size()) {
+          if (std::isdigit(latest.at(index))) {
+            numberSection += latest.at(index++);
+          } else {
+            break;
+          }
         }
-      }
 
-      unsigned number = std::stoi(numberSection);
+        unsigned number = std::stoi(numberSection);
 
-      std::stringstream next;
+        std::stringstream next;
 
-      next << charSection << number + 1;
+        next << charSection << number + 1;
 
-      return next.str();
-    }
+        return next.str();
+      }
 
-    Logger::logError("Failed to find next manual drawing number.");
+      Logger::logError("Failed to find next manual drawing number.");
 
-    return std::string();
+      return std::string();
+    });
   } catch (mysqlx::Error &e) {
     // If there was an error, print it to the console.
     // This is not considered a fatal error
@@ -1092,8 +1249,8 @@ std::string DatabaseManager::nextManualDrawingNumber() {
 void DatabaseManager::closeConnection() {
   // Wrapped in a try statement to catch any MySQL errors.
   try {
-    // Close the session
-    sess.close();
+    // Close every pooled session
+    sessionPool.close();
     isConnected = false;
   } catch (mysqlx::Error &e) {
     // If there was an error, print it to the console.
@@ -1107,12 +1264,16 @@ void DatabaseManager::closeConnection() {
 bool DatabaseManager::testConnection() {
   // Wrapped in a try statement to catch any MySQL errors.
   try {
+    // Check out a session from the pool for the duration of this call
+    SessionPool::Lease session = sessionPool.checkout();
+    mysqlx::Session &sess = *session;
+
     // Get whether this simple SQL statement returns data or not
     bool success = sess.sql("SELECT 1").execute().hasData();
 
-    // If we were unsuccessful, close th connection
+    // If we were unsuccessful, don't return the session to the pool
     if (!success) {
-      closeConnection();
+      session.discard();
     }
     // Return whether we were successful or not. If this query does not return
     // data, the connection is broken.
@@ -1120,9 +1281,9 @@ bool DatabaseManager::testConnection() {
   } catch (mysqlx::Error &e) {
     // If there was an error, this indicates that the connection was broken, as
     // the simple SQL statement above should never fail. We print the error to
-    // the console
+    // the console. The broken session is discarded by the pool, so the next
+    // checkout opens a fresh connection.
     Logger::logError(e.what(), __LINE__, __FILE__);
-    closeConnection();
     return false;
   }
   return false;
@@ -1130,6 +1291,10 @@ bool DatabaseManager::testConnection() {
 
 bool DatabaseManager::connected() const { return isConnected; }
 
+SessionPool::Metrics DatabaseManager::sessionPoolMetrics() {
+  return sessionPool.metrics();
+}
+
 // void DatabaseManager::setErrorStream(std::ostream &stream) {
 //	errStream = &stream;
 // }
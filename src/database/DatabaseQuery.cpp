@@ -307,7 +307,7 @@ unsigned DatabaseSearchQuery::serialisedSize() const {
 }
 
 // Reconstructs a DatabaseSearchQuery object from the data buffer
-DatabaseSearchQuery &DatabaseSearchQuery::deserialise(void *&&data) {
+DatabaseSearchQuery &DatabaseSearchQuery::deserialise(const void *data) {
   // First we create an empty query object on the heap for returning once
   // we have given it its values
   DatabaseSearchQuery *query = new DatabaseSearchQuery();
@@ -501,11 +501,16 @@ DatabaseSearchQuery &DatabaseSearchQuery::deserialise(void *&&data) {
     query->machineDeck = std::nullopt;
   }
 
-  free(data);
   // Return the constructed query
   return *query;
 }
 
+DatabaseSearchQuery &DatabaseSearchQuery::deserialise(void *&&data) {
+  DatabaseSearchQuery &query = deserialise((const void *)data);
+  free(data);
+  return query;
+}
+
 // Method to return a flag system containing whether the query contains each
 // possible search parameter.
 unsigned DatabaseSearchQuery::getSearchParameters() const {
@@ -1165,7 +1170,7 @@ unsigned int DrawingRequest::serialisedSize() const {
 }
 
 // Deserialses a DrawingRequest from a data buffer
-DrawingRequest &DrawingRequest::deserialise(void *&&data) {
+DrawingRequest &DrawingRequest::deserialise(const void *data) {
   // First we construct the request object to return
   DrawingRequest *drawingRequest = new DrawingRequest();
 
@@ -1193,10 +1198,139 @@ DrawingRequest &DrawingRequest::deserialise(void *&&data) {
     drawingRequest->drawingData = std::nullopt;
   }
 
-  free(data);
   return *drawingRequest;
 }
 
+DrawingRequest &DrawingRequest::deserialise(void *&&data) {
+  DrawingRequest &drawingRequest = deserialise((const void *)data);
+  free(data);
+  return drawingRequest;
+}
+
+// Serialises the drawing batch request into the target buffer
+void DrawingBatchRequest::serialise(void *target) const {
+  // First we convert the target buffer into a buffer of bytes
+  unsigned char *buffer = (unsigned char *)target;
+  // We set the start of the buffer to contain that this is a
+  // DRAWING_DETAILS_BATCH request type
+  *((RequestType *)buffer) = RequestType::DRAWING_DETAILS_BATCH;
+  buffer += sizeof(RequestType);
+
+  // Next we write the number of matIDs, followed by the matIDs themselves
+  *((unsigned *)buffer) = matIDs.size();
+  buffer += sizeof(unsigned);
+  memcpy(buffer, matIDs.data(), matIDs.size() * sizeof(unsigned));
+  buffer += matIDs.size() * sizeof(unsigned);
+
+  // We set a simple boolean which determines whether or not the request
+  // contains drawings or not (i.e. if it is a request or a response)
+  bool hasDrawingData = drawingData.has_value();
+  *buffer++ = hasDrawingData;
+
+  // If we do have drawings, we write each one's size followed by the drawing
+  // itself, serialised by the DrawingSerialiser. One drawing is written for
+  // each matID, so the count is not repeated.
+  if (hasDrawingData) {
+    for (const Drawing &drawing : drawingData.value()) {
+      unsigned drawingSize = DrawingSerialiser::serialisedSize(drawing);
+      *((unsigned *)buffer) = drawingSize;
+      buffer += sizeof(unsigned);
+      DrawingSerialiser::serialise(drawing, buffer);
+      buffer += drawingSize;
+    }
+  }
+}
+
+// Helper function to return the amount of space this object will occupy in a
+// buffer
+unsigned int DrawingBatchRequest::serialisedSize() const {
+  // Returns the size of the header info, the count and the matIDs, the size of
+  // the byte used to determine whether there are drawings, and then the size
+  // of each drawing along with its size.
+  unsigned size = sizeof(RequestType) + sizeof(unsigned) +
+                  matIDs.size() * sizeof(unsigned) + sizeof(unsigned char);
+  if (drawingData.has_value()) {
+    for (const Drawing &drawing : drawingData.value()) {
+      size += sizeof(unsigned) + DrawingSerialiser::serialisedSize(drawing);
+    }
+  }
+  return size;
+}
+
+// Deserialses a DrawingBatchRequest from a data buffer. The buffer comes
+// from the network, so every count and size in it is checked against the
+// size of the buffer before it is used.
+DrawingBatchRequest &DrawingBatchRequest::deserialise(const void *data,
+                                                      unsigned size) {
+  // The fixed size header is the request type, the count and the byte which
+  // determines whether there are drawings
+  if (size < sizeof(RequestType) + sizeof(unsigned) + sizeof(unsigned char)) {
+    throw std::invalid_argument("Drawing batch request is truncated");
+  }
+  const unsigned char *buffer = (const unsigned char *)data;
+  const unsigned char *end = buffer + size;
+
+  // We skip over the request type, as we already know this is a batch request
+  buffer += sizeof(RequestType);
+  unsigned count = *((const unsigned *)buffer);
+  buffer += sizeof(unsigned);
+
+  // The count is checked before anything is allocated for it
+  if (count > DRAWING_BATCH_LIMIT) {
+    throw std::invalid_argument("Drawing batch request has too many drawings");
+  }
+  if ((size_t)count * sizeof(unsigned) + sizeof(unsigned char) >
+      (size_t)(end - buffer)) {
+    throw std::invalid_argument("Drawing batch request is truncated");
+  }
+
+  // First we construct the request object to return
+  std::unique_ptr<DrawingBatchRequest> batchRequest =
+      std::make_unique<DrawingBatchRequest>();
+
+  // We read the matIDs
+  batchRequest->matIDs.resize(count);
+  memcpy(batchRequest->matIDs.data(), buffer, count * sizeof(unsigned));
+  buffer += count * sizeof(unsigned);
+
+  // Next we read the following byte to determine whether there are drawings.
+  bool hasDrawingData = *buffer++;
+
+  if (hasDrawingData) {
+    // If there are drawings in this message, there is one for each matID
+    std::vector<Drawing> drawings;
+    drawings.reserve(count);
+    for (unsigned i = 0; i < count; i++) {
+      if (sizeof(unsigned) > (size_t)(end - buffer)) {
+        throw std::invalid_argument("Drawing batch response is truncated");
+      }
+      unsigned drawingSize = *((const unsigned *)buffer);
+      buffer += sizeof(unsigned);
+      if (drawingSize > (size_t)(end - buffer)) {
+        throw std::invalid_argument("Drawing batch response is truncated");
+      }
+      Drawing &drawing = DrawingSerialiser::deserialise((void *)buffer);
+      drawings.push_back(std::move(drawing));
+      delete &drawing;
+      buffer += drawingSize;
+    }
+    batchRequest->drawingData = std::move(drawings);
+  } else {
+    // Otherwise we set the drawingData to a nullopt, indicating that it is
+    // not present
+    batchRequest->drawingData = std::nullopt;
+  }
+
+  return *batchRequest.release();
+}
+
+DrawingBatchRequest &DrawingBatchRequest::deserialise(void *&&data,
+                                                      unsigned size) {
+  // The buffer is freed even if it turns out to be malformed
+  std::unique_ptr<void, decltype(&free)> buffer(data, &free);
+  return deserialise((const void *)buffer.get(), size);
+}
+
 // Serialises a DrawingInsert query into the target buffer
 void DrawingInsert::serialise(void *target) const {
   // First we cast the target buffer to a byte buffer
@@ -1246,7 +1380,7 @@ unsigned int DrawingInsert::serialisedSize() const {
 }
 
 // Deserialses a DrawingInsert from a data buffer
-DrawingInsert &DrawingInsert::deserialise(void *&&data) {
+DrawingInsert &DrawingInsert::deserialise(const void *data) {
   // First we construct the insert object to return
   DrawingInsert *drawingInsert = new DrawingInsert();
 
@@ -1275,12 +1409,16 @@ DrawingInsert &DrawingInsert::deserialise(void *&&data) {
     drawingInsert->drawingData = std::nullopt;
   }
 
-  free(data);
-
   // Finally we return the reconstruced insert object
   return *drawingInsert;
 }
 
+DrawingInsert &DrawingInsert::deserialise(void *&&data) {
+  DrawingInsert &drawingInsert = deserialise((const void *)data);
+  free(data);
+  return drawingInsert;
+}
+
 // Setter for forcing mode
 void DrawingInsert::setForce(bool val) { force = val; }
 
@@ -2188,7 +2326,7 @@ unsigned int ComponentInsert::serialisedSize() const {
   }
 }
 
-ComponentInsert &ComponentInsert::deserialise(void *&&data) {
+ComponentInsert &ComponentInsert::deserialise(const void *data) {
   ComponentInsert *insert = new ComponentInsert();
 
   unsigned char *buff = (unsigned char *)data + sizeof(RequestType);
@@ -2392,10 +2530,15 @@ ComponentInsert &ComponentInsert::deserialise(void *&&data) {
     }
   }
 
-  free(data);
   return *insert;
 }
 
+ComponentInsert &ComponentInsert::deserialise(void *&&data) {
+  ComponentInsert &componentInsert = deserialise((const void *)data);
+  free(data);
+  return componentInsert;
+}
+
 /// <summary>
 /// Makes this ComponentInsert based upon an ApertureData.
 /// </summary>
@@ -2803,7 +2946,7 @@ unsigned int DatabaseBackup::serialisedSize() const {
          backupName.size();
 }
 
-DatabaseBackup &DatabaseBackup::deserialise(void *&&data) {
+DatabaseBackup &DatabaseBackup::deserialise(const void *data) {
   DatabaseBackup *backup = new DatabaseBackup();
 
   unsigned char *buff = (unsigned char *)data + sizeof(RequestType);
@@ -2814,10 +2957,15 @@ DatabaseBackup &DatabaseBackup::deserialise(void *&&data) {
   unsigned char backupNameSize = *buff++;
   backup->backupName = std::string((const char *)buff, backupNameSize);
 
-  free(data);
   return *backup;
 }
 
+DatabaseBackup &DatabaseBackup::deserialise(void *&&data) {
+  DatabaseBackup &databaseBackup = deserialise((const void *)data);
+  free(data);
+  return databaseBackup;
+}
+
 void NextDrawing::serialise(void *target) const {
   unsigned char *buff = (unsigned char *)target;
 
@@ -2843,7 +2991,7 @@ unsigned int NextDrawing::serialisedSize() const {
               : 0);
 }
 
-NextDrawing &NextDrawing::deserialise(void *&&data) {
+NextDrawing &NextDrawing::deserialise(const void *data) {
   NextDrawing *next = new NextDrawing();
 
   unsigned char *buff = (unsigned char *)data + sizeof(RequestType);
@@ -2860,6 +3008,11 @@ NextDrawing &NextDrawing::deserialise(void *&&data) {
     next->drawingNumber = std::nullopt;
   }
 
-  free(data);
   return *next;
 }
+
+NextDrawing &NextDrawing::deserialise(void *&&data) {
+  NextDrawing &nextDrawing = deserialise((const void *)data);
+  free(data);
+  return nextDrawing;
+}
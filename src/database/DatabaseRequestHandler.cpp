@@ -15,9 +15,10 @@ DatabaseRequestHandler::DatabaseRequestHandler()
 
 void DatabaseRequestHandler::onMessageReceived(Server &caller,
                                                const ClientHandle &clientHandle,
-                                               void *&&message,
-                                               unsigned int messageSize) {
-  switch (getDeserialiseType(message)) {
+                                               MessageBuffer &&message) {
+  // The message buffer is freed once the request has been handled, so the
+  // queries are deserialised from it without taking ownership
+  switch (getDeserialiseType(message.data())) {
     case RequestType::REPEAT_TOKEN_REQUEST:
       caller.sendRepeatToken(clientHandle,
                              (unsigned)RequestType::REPEAT_TOKEN_REQUEST);
@@ -28,18 +29,49 @@ void DatabaseRequestHandler::onMessageReceived(Server &caller,
       break;
     case RequestType::DRAWING_SEARCH_QUERY: {
       DatabaseSearchQuery &query =
-          DatabaseSearchQuery::deserialise(std::move(message));
-      std::vector<DrawingSummary> summaries =
-          caller.databaseManager().executeSearchQuery(query);
-      delete &query;
+          DatabaseSearchQuery::deserialise(message.data());
+
+      // The query is serialised again for the cache key, so the same search
+      // always has the same key however the client laid out its message
+      std::string cacheKey(query.serialisedSize(), '\0');
+      query.serialise(cacheKey.data());
+
+      std::shared_ptr<const std::vector<unsigned char>> cached =
+          searchCache.find(cacheKey);
+      if (cached) {
+        caller.addMessageToSendQueue(clientHandle, cached->data(),
+                                     cached->size());
+        delete &query;
+        break;
+      }
 
+      SearchResultCache::Generation generation = searchCache.generation();
+
+      // The schema may need to rebuild source tables, so it is fetched before
+      // taking the shared source data lock for the search
       DrawingSummaryCompressionSchema summaryCompressionSchema =
           compressionSchema(&caller.databaseManager());
 
-      unsigned char *responseBuffer = (unsigned char *)alloca(
+      std::vector<DrawingSummary> summaries;
+      {
+        std::shared_lock<std::shared_mutex> sourceDataLock(sourceDataMutex);
+        // The index answers the search from memory. The database is only
+        // searched if the index couldn't be loaded.
+        std::optional<std::vector<DrawingSummary>> indexed =
+            searchIndex.search(caller.databaseManager(), query);
+        summaries = indexed.has_value()
+                        ? std::move(*indexed)
+                        : caller.databaseManager().executeSearchQuery(query);
+      }
+      delete &query;
+
+      // Built on the heap rather than the stack, as a broad search can return
+      // every drawing, and the response is kept in the cache
+      std::vector<unsigned char> response(
           sizeof(RequestType) + sizeof(DrawingSummaryCompressionSchema) +
           sizeof(unsigned) +
           summaries.size() * summaryCompressionSchema.maxCompressedSize());
+      unsigned char *responseBuffer = response.data();
 
       unsigned index = 0;
 
@@ -61,17 +93,23 @@ void DatabaseRequestHandler::onMessageReceived(Server &caller,
 
       caller.addMessageToSendQueue(clientHandle, responseBuffer, index);
 
+      response.resize(index);
+      response.shrink_to_fit();
+      searchCache.insert(cacheKey, std::move(response), generation);
+
       break;
     }
     case RequestType::DRAWING_INSERT: {
       DrawingInsert &drawingInsert =
-          DrawingInsert::deserialise(std::move(message));
+          DrawingInsert::deserialise(message.data());
 
       if (drawingInsert.drawingData.has_value()) {
         DrawingInsert response;
 
         response.responseEchoCode = drawingInsert.responseEchoCode;
 
+        std::shared_lock<std::shared_mutex> sourceDataLock(sourceDataMutex);
+
         switch (caller.databaseManager().drawingExists(
             drawingInsert.drawingData->drawingNumber())) {
           case DatabaseManager::DrawingExistsResponse::EXISTS:
@@ -97,8 +135,19 @@ void DatabaseRequestHandler::onMessageReceived(Server &caller,
             break;
         }
 
+        // The index is updated before the search cache is cleared, so no
+        // search can cache a result from the index without the new drawing
+        if (response.insertResponseCode == DrawingInsert::SUCCESS) {
+          searchIndex.update(caller.databaseManager(),
+                             drawingInsert.drawingData->drawingNumber());
+        }
+
+        sourceDataLock.unlock();
+
         if (response.insertResponseCode == DrawingInsert::SUCCESS) {
           setCompressionSchemaDirty();
+          drawingCache.invalidate(drawingInsert.drawingData->drawingNumber());
+          searchCache.clear();
           caller.changelogMessage(
               clientHandle,
               "Added drawing " + drawingInsert.drawingData->drawingNumber());
@@ -135,20 +184,14 @@ void DatabaseRequestHandler::onMessageReceived(Server &caller,
 
       break;
     }
-    case RequestType::SOURCE_PRODUCT_TABLE: {
-      if (DrawingComponentManager<Product>::dirty()) {
+    case RequestType::SOURCE_PRODUCT_TABLE:
+      sendSourceTable<Product>(caller, clientHandle, [&]() {
         createSourceData<ProductData>(
             caller.databaseManager().sourceTable("products"));
-      }
-
-      caller.addMessageToSendQueue(
-          clientHandle, DrawingComponentManager<Product>::rawSourceData(),
-          DrawingComponentManager<Product>::rawSourceDataSize());
-
+      });
       break;
-    }
-    case RequestType::SOURCE_BACKING_STRIPS_TABLE: {
-      if (DrawingComponentManager<BackingStrip>::dirty()) {
+    case RequestType::SOURCE_BACKING_STRIPS_TABLE:
+      sendSourceTable<BackingStrip>(caller, clientHandle, [&]() {
         if (DrawingComponentManager<Material>::dirty()) {
           createSourceData<MaterialData>(
               caller.databaseManager().sourceMultipleTable(
@@ -157,16 +200,10 @@ void DatabaseRequestHandler::onMessageReceived(Server &caller,
 
         createSourceData<BackingStripData>(
             caller.databaseManager().sourceTable("backing_strips"));
-      }
-
-      caller.addMessageToSendQueue(
-          clientHandle, DrawingComponentManager<BackingStrip>::rawSourceData(),
-          DrawingComponentManager<BackingStrip>::rawSourceDataSize());
-
+      });
       break;
-    }
-    case RequestType::SOURCE_APERTURE_TABLE: {
-      if (DrawingComponentManager<Aperture>::dirty()) {
+    case RequestType::SOURCE_APERTURE_TABLE:
+      sendSourceTable<Aperture>(caller, clientHandle, [&]() {
         if (DrawingComponentManager<ApertureShape>::dirty()) {
           createSourceData<ApertureShapeData>(
               caller.databaseManager().sourceTable("aperture_shapes"));
@@ -174,98 +211,57 @@ void DatabaseRequestHandler::onMessageReceived(Server &caller,
 
         createSourceData<ApertureData>(
             caller.databaseManager().sourceTable("apertures"));
-      }
-
-      caller.addMessageToSendQueue(
-          clientHandle, DrawingComponentManager<Aperture>::rawSourceData(),
-          DrawingComponentManager<Aperture>::rawSourceDataSize());
-
+      });
       break;
-    }
-    case RequestType::SOURCE_STRAPS_TABLE: {
-      if (DrawingComponentManager<Strap>::dirty()) {
+    case RequestType::SOURCE_STRAPS_TABLE:
+      sendSourceTable<Strap>(caller, clientHandle, [&]() {
         if (DrawingComponentManager<Material>::dirty()) {
           createSourceData<MaterialData>(
               caller.databaseManager().sourceTable("materials"));
         }
         createSourceData<StrapData>(
             caller.databaseManager().sourceTable("straps"));
-      }
-
-      caller.addMessageToSendQueue(
-          clientHandle, DrawingComponentManager<Strap>::rawSourceData(),
-          DrawingComponentManager<Strap>::rawSourceDataSize());
+      });
       break;
-    }
-    case RequestType::SOURCE_APERTURE_SHAPE_TABLE: {
-      if (DrawingComponentManager<ApertureShape>::dirty()) {
+    case RequestType::SOURCE_APERTURE_SHAPE_TABLE:
+      sendSourceTable<ApertureShape>(caller, clientHandle, [&]() {
         createSourceData<ApertureShapeData>(
             caller.databaseManager().sourceTable("aperture_shapes"));
-      }
-
-      caller.addMessageToSendQueue(
-          clientHandle, DrawingComponentManager<ApertureShape>::rawSourceData(),
-          DrawingComponentManager<ApertureShape>::rawSourceDataSize());
-
+      });
       break;
-    }
-    case RequestType::SOURCE_MATERIAL_TABLE: {
-      if (DrawingComponentManager<Material>::dirty()) {
+    case RequestType::SOURCE_MATERIAL_TABLE:
+      sendSourceTable<Material>(caller, clientHandle, [&]() {
         createSourceData<MaterialData>(
             caller.databaseManager().sourceMultipleTable(
                 "material_prices", "materials", "material_id"));
-      }
-
-      caller.addMessageToSendQueue(
-          clientHandle, DrawingComponentManager<Material>::rawSourceData(),
-          DrawingComponentManager<Material>::rawSourceDataSize());
-
+      });
       break;
-    }
-    case RequestType::SOURCE_EXTRA_PRICES_TABLE: {
-      if (DrawingComponentManager<ExtraPrice>::dirty()) {
+    case RequestType::SOURCE_EXTRA_PRICES_TABLE:
+      sendSourceTable<ExtraPrice>(caller, clientHandle, [&]() {
         createSourceData<ExtraPriceData>(
             caller.databaseManager().sourceTable("extra_prices"));
-      }
-      caller.addMessageToSendQueue(
-          clientHandle, DrawingComponentManager<ExtraPrice>::rawSourceData(),
-          DrawingComponentManager<ExtraPrice>::rawSourceDataSize());
+      });
       break;
-    }
-    case RequestType::SOURCE_LABOUR_TIMES_TABLE: {
-      if (DrawingComponentManager<LabourTime>::dirty()) {
+    case RequestType::SOURCE_LABOUR_TIMES_TABLE:
+      sendSourceTable<LabourTime>(caller, clientHandle, [&]() {
         createSourceData<LabourTimeData>(
             caller.databaseManager().sourceTable("labour_times"));
-      }
-      caller.addMessageToSendQueue(
-          clientHandle, DrawingComponentManager<LabourTime>::rawSourceData(),
-          DrawingComponentManager<LabourTime>::rawSourceDataSize());
+      });
       break;
-    }
-    case RequestType::SOURCE_POWDER_COATING_TABLE: {
-      if (DrawingComponentManager<PowderCoatingPrice>::dirty()) {
+    case RequestType::SOURCE_POWDER_COATING_TABLE:
+      sendSourceTable<PowderCoatingPrice>(caller, clientHandle, [&]() {
         createSourceData<PowderCoatingPriceData>(
             caller.databaseManager().sourceTable("powder_coating_prices"));
-      }
-      caller.addMessageToSendQueue(
-          clientHandle,
-          DrawingComponentManager<PowderCoatingPrice>::rawSourceData(),
-          DrawingComponentManager<PowderCoatingPrice>::rawSourceDataSize());
+      });
       break;
-    }
-    case RequestType::SOURCE_SIDE_IRON_PRICES_TABLE: {
-      if (DrawingComponentManager<SideIronPrice>::dirty()) {
+    case RequestType::SOURCE_SIDE_IRON_PRICES_TABLE:
+      sendSourceTable<SideIronPrice>(caller, clientHandle, [&]() {
         createSourceData<SideIronPriceData>(
             caller.databaseManager().sourceTable("side_iron_prices"));
-      }
-
-      caller.addMessageToSendQueue(
-          clientHandle, DrawingComponentManager<SideIronPrice>::rawSourceData(),
-          DrawingComponentManager<SideIronPrice>::rawSourceDataSize());
+      });
       break;
-    }
-    case RequestType::SOURCE_SIDE_IRON_TABLE: {
-      if (DrawingComponentManager<SideIron>::dirty()) {
+    case RequestType::SOURCE_SIDE_IRON_TABLE:
+      sendSourceTable<SideIron>(caller, clientHandle, [&]() {
         std::stringstream orderBy;
         orderBy << "CASE " << std::endl;
         orderBy << "WHEN drawing_number LIKE 'None' THEN 1 " << std::endl;
@@ -282,40 +278,45 @@ void DatabaseRequestHandler::onMessageReceived(Server &caller,
 
         createSourceData<SideIronData>(
             caller.databaseManager().sourceTable("side_irons", orderBy.str()));
-      }
-
-      caller.addMessageToSendQueue(
-          clientHandle, DrawingComponentManager<SideIron>::rawSourceData(),
-          DrawingComponentManager<SideIron>::rawSourceDataSize());
-
+      });
       break;
-    }
-    case RequestType::SOURCE_MACHINE_TABLE: {
-      if (DrawingComponentManager<Machine>::dirty()) {
+    case RequestType::SOURCE_MACHINE_TABLE:
+      sendSourceTable<Machine>(caller, clientHandle, [&]() {
         createSourceData<MachineData>(caller.databaseManager().sourceTable(
             "machines", "manufacturer<>'None', manufacturer, model"));
-      }
-
-      caller.addMessageToSendQueue(
-          clientHandle, DrawingComponentManager<Machine>::rawSourceData(),
-          DrawingComponentManager<Machine>::rawSourceDataSize());
-
+      });
       break;
-    }
-    case RequestType::SOURCE_MACHINE_DECK_TABLE: {
-      if (DrawingComponentManager<MachineDeck>::dirty()) {
+    case RequestType::SOURCE_MACHINE_DECK_TABLE:
+      sendSourceTable<MachineDeck>(caller, clientHandle, [&]() {
         createSourceData<MachineDeckData>(
             caller.databaseManager().sourceTable("machine_decks"));
-      }
-
-      caller.addMessageToSendQueue(
-          clientHandle, DrawingComponentManager<MachineDeck>::rawSourceData(),
-          DrawingComponentManager<MachineDeck>::rawSourceDataSize());
-
+      });
       break;
-    }
     case RequestType::DRAWING_DETAILS: {
-      DrawingRequest request = DrawingRequest::deserialise(std::move(message));
+      DrawingRequest &request = DrawingRequest::deserialise(message.data());
+
+      std::shared_lock<std::shared_mutex> sourceDataLock(sourceDataMutex);
+
+      // Source tables are only rebuilt under the exclusive lock, so a cached
+      // response can't go out of date while we hold it shared
+      std::shared_ptr<const std::vector<unsigned char>> cached =
+          drawingCache.find(request.matID);
+      if (cached) {
+        sourceDataLock.unlock();
+
+        std::vector<unsigned char> response(*cached);
+        // The echo code follows the request type and matID
+        *((unsigned *)(response.data() + sizeof(RequestType) +
+                       sizeof(unsigned))) = request.responseEchoCode;
+
+        caller.addMessageToSendQueue(clientHandle, response.data(),
+                                     response.size());
+
+        delete &request;
+        break;
+      }
+
+      DrawingResponseCache::Generation generation = drawingCache.generation();
 
       Drawing *returnedDrawing =
           caller.databaseManager().executeDrawingQuery(request);
@@ -326,20 +327,70 @@ void DatabaseRequestHandler::onMessageReceived(Server &caller,
         request.drawingData->setLoadWarning(Drawing::LOAD_FAILED);
       }
 
+      std::vector<unsigned char> response(request.serialisedSize());
+      request.serialise(response.data());
+
+      sourceDataLock.unlock();
+
+      caller.addMessageToSendQueue(clientHandle, response.data(),
+                                   response.size());
+
+      // Drawings which failed to load aren't cached, so they are tried again
+      if (returnedDrawing != nullptr) {
+        drawingCache.insert(request.matID, returnedDrawing->drawingNumber(),
+                            std::move(response), generation);
+      }
+
+      delete returnedDrawing;
+      delete &request;
+
+      break;
+    }
+    case RequestType::DRAWING_DETAILS_BATCH: {
+      // Batches larger than DRAWING_BATCH_LIMIT, or whose counts don't fit
+      // in the message, are rejected before anything is allocated for them,
+      // so a single request can't hold a worker or build a response of
+      // unbounded size
+      DrawingBatchRequest *batchRequest;
+      try {
+        batchRequest =
+            &DrawingBatchRequest::deserialise(message.data(), message.size());
+      } catch (const std::invalid_argument &e) {
+        Logger::logError(e.what(), __LINE__, __FILE__);
+        break;
+      }
+      DrawingBatchRequest &request = *batchRequest;
+
+      std::shared_lock<std::shared_mutex> sourceDataLock(sourceDataMutex);
+
+      std::vector<Drawing> drawings =
+          caller.databaseManager().executeDrawingBatchQuery(request);
+      if (drawings.size() != request.matIDs.size()) {
+        // The query failed, so every drawing failed to load
+        drawings.clear();
+        for (unsigned i = 0; i < request.matIDs.size(); i++) {
+          drawings.emplace_back().setLoadWarning(Drawing::LOAD_FAILED);
+        }
+      }
+      request.drawingData = std::move(drawings);
+
       unsigned bufferSize = request.serialisedSize();
 
       void *responseBuffer = malloc(bufferSize);
       request.serialise(responseBuffer);
 
+      sourceDataLock.unlock();
+
       caller.addMessageToSendQueue(clientHandle, responseBuffer, bufferSize);
 
-      delete returnedDrawing, responseBuffer;
+      delete &request;
+      free(responseBuffer);
 
       break;
     }
     case RequestType::ADD_NEW_COMPONENT: {
       ComponentInsert &insert =
-          ComponentInsert::deserialise(std::move(message));
+          ComponentInsert::deserialise(message.data());
 
       ComponentInsert response;
       response.clearComponentData();
@@ -360,8 +411,13 @@ void DatabaseRequestHandler::onMessageReceived(Server &caller,
         break;
       }
 
+      // The source table is rebuilt while holding the source data lock
+      // exclusively, so no other request reads it half built
+      std::unique_lock<std::shared_mutex> sourceDataLock(sourceDataMutex);
+
       void *sourceData;
       unsigned sourceDataBufferSize;
+      bool sendToCaller = false;
 
       switch (insert.getSourceTableCode()) {
         case RequestType::SOURCE_APERTURE_TABLE: {
@@ -488,23 +544,33 @@ void DatabaseRequestHandler::onMessageReceived(Server &caller,
           sourceDataBufferSize =
               DrawingComponentManager<Strap>::rawSourceDataSize();
 
-          caller.addMessageToSendQueue(
-              clientHandle, DrawingComponentManager<Strap>::rawSourceData(),
-              DrawingComponentManager<Strap>::rawSourceDataSize());
+          sendToCaller = true;
           break;
         }
         default:
           return;
       }
 
-      caller.broadcastMessage(sourceData, sourceDataBufferSize);
+      // The table is copied and the lock released before sending, as sending
+      // can block on a slow client, and would hold up every other request for
+      // the source tables
+      std::vector<unsigned char> sourceDataCopy(
+          (unsigned char *)sourceData,
+          (unsigned char *)sourceData + sourceDataBufferSize);
+      sourceDataLock.unlock();
+
+      if (sendToCaller) {
+        caller.addMessageToSendQueue(clientHandle, sourceDataCopy.data(),
+                                     sourceDataCopy.size());
+      }
+      caller.broadcastMessage(sourceDataCopy.data(), sourceDataCopy.size());
 
       delete &insert;
 
       break;
     }
     case RequestType::GET_NEXT_DRAWING_NUMBER: {
-      NextDrawing &next = NextDrawing::deserialise(std::move(message));
+      NextDrawing &next = NextDrawing::deserialise(message.data());
 
       switch (next.drawingType) {
         case NextDrawing::DrawingType::AUTOMATIC:
@@ -528,7 +594,7 @@ void DatabaseRequestHandler::onMessageReceived(Server &caller,
       break;
     }
     case RequestType::CREATE_DATABASE_BACKUP: {
-      DatabaseBackup &backup = DatabaseBackup::deserialise(std::move(message));
+      DatabaseBackup &backup = DatabaseBackup::deserialise(message.data());
 
       std::filesystem::path backupFile = backupPath / backup.backupName;
       backupFile.replace_extension("sql");
@@ -556,17 +622,82 @@ void DatabaseRequestHandler::onMessageReceived(Server &caller,
   }
 }
 
-RequestType DatabaseRequestHandler::getDeserialiseType(void *data) {
+bool DatabaseRequestHandler::isReadOnly(const void *message,
+                                        unsigned messageSize) {
+  if (messageSize < sizeof(RequestType)) {
+    return false;
+  }
+
+  // Any type added to this list must not write to the database or change
+  // anything a later request could see, as a client's read only requests may
+  // run in any order relative to each other. Filling the caches doesn't count,
+  // as a cached response is the same as one built from the database.
+  switch (getDeserialiseType(message)) {
+    case RequestType::DRAWING_SEARCH_QUERY:
+    case RequestType::DRAWING_DETAILS:
+    case RequestType::DRAWING_DETAILS_BATCH:
+    case RequestType::GET_NEXT_DRAWING_NUMBER:
+      return true;
+    default:
+      return false;
+  }
+}
+
+void DatabaseRequestHandler::writeStats(std::ostream &out) {
+  DrawingResponseCache::Metrics metrics = drawingCache.metrics();
+  unsigned long long lookups = metrics.hits + metrics.misses;
+  out << "Drawing cache hits: " << metrics.hits
+      << ", misses: " << metrics.misses << ", hit rate: "
+      << (lookups ? (double)metrics.hits / lookups : 0) << std::endl;
+  out << "Drawing cache entries: " << metrics.entries
+      << ", KB held: " << metrics.bytes / 1024
+      << ", KB capacity: " << metrics.capacity / 1024 << std::endl;
+  out << "Drawing cache evictions: " << metrics.evictions
+      << ", invalidations: " << metrics.invalidations << std::endl;
+
+  SearchResultCache::Metrics search = searchCache.metrics();
+  lookups = search.hits + search.misses;
+  out << "Search cache hits: " << search.hits << ", misses: " << search.misses
+      << ", hit rate: " << (lookups ? (double)search.hits / lookups : 0)
+      << std::endl;
+  out << "Search cache entries: " << search.entries
+      << ", KB held: " << search.bytes / 1024
+      << ", KB capacity: " << search.capacity / 1024 << std::endl;
+  out << "Search cache evictions: " << search.evictions
+      << ", expirations: " << search.expirations
+      << ", invalidations: " << search.invalidations << std::endl;
+
+  out << "Search index drawings: " << searchIndex.size() << std::endl;
+}
+
+void DatabaseRequestHandler::runChecks(Server &caller, std::ostream &out) {
+  // Both searches need the aperture and material source tables, which
+  // building the compression schema makes sure of
+  compressionSchema(&caller.databaseManager());
+
+  std::shared_lock<std::shared_mutex> sourceDataLock(sourceDataMutex);
+  searchIndex.verify(caller.databaseManager(), out);
+}
+
+void DatabaseRequestHandler::loadSearchIndex(DatabaseManager &dbManager) {
+  searchIndex.startLoading(dbManager);
+}
+
+RequestType DatabaseRequestHandler::getDeserialiseType(const void *data) {
   return *((RequestType *)data);
 }
 
 DrawingSummaryCompressionSchema DatabaseRequestHandler::compressionSchema(
     DatabaseManager *dbManager) {
+  std::lock_guard<std::mutex> schemaLock(schemaMutex);
+
   if (schemaDirty) {
     if (!dbManager) {
       STD_ERROR("Database manager not set up. No connection to database.");
     }
 
+    std::unique_lock<std::shared_mutex> sourceDataLock(sourceDataMutex);
+
     if (DrawingComponentManager<Aperture>::dirty()) {
       if (DrawingComponentManager<ApertureShape>::dirty()) {
         createSourceData<ApertureShapeData>(
@@ -610,7 +741,10 @@ DrawingSummaryCompressionSchema DatabaseRequestHandler::compressionSchema(
   return schema;
 }
 
-void DatabaseRequestHandler::setCompressionSchemaDirty() { schemaDirty = true; }
+void DatabaseRequestHandler::setCompressionSchemaDirty() {
+  std::lock_guard<std::mutex> schemaLock(schemaMutex);
+  schemaDirty = true;
+}
 
 /// <summary>
 /// Constructs DatabaseRequestHandler::ProductData from all rows recieved from
@@ -626,11 +760,10 @@ void DatabaseRequestHandler::setCompressionSchemaDirty() { schemaDirty = true; }
 /// to serialise the elements.</param>
 template <>
 void DatabaseRequestHandler::constructDataElements(
-    mysqlx::SqlResult productRow, unsigned &handle,
+    const std::vector<mysqlx::Row> &productRow, unsigned &handle,
     std::vector<DatabaseRequestHandler::ProductData> &elements,
     unsigned &sizeValue) const {
-  std::vector<mysqlx::Row> rows = productRow.fetchAll();
-  for (mysqlx::Row row : rows) {
+  for (mysqlx::Row row : productRow) {
     if (!row.isNull()) {
       ProductData data;
       data.handle = handle++;
@@ -680,10 +813,10 @@ RequestType DatabaseRequestHandler::getRequestType<
 /// to serialise the elements.</param>
 template <>
 void DatabaseRequestHandler::constructDataElements(
-    mysqlx::SqlResult apertureRow, unsigned &handle,
+    const std::vector<mysqlx::Row> &apertureRow, unsigned &handle,
     std::vector<DatabaseRequestHandler::ApertureData> &elements,
     unsigned &sizeValue) const {
-  for (mysqlx::Row row : apertureRow.fetchAll()) {
+  for (mysqlx::Row row : apertureRow) {
     if (row[6].isNull()) {
       ERROR_RAW_SAFE("Aperture with missing shape ID detected.", std::cerr);
       return;
@@ -759,11 +892,11 @@ RequestType DatabaseRequestHandler::getRequestType<
 /// bytes will be needed to serialise the elements.</param>
 template <>
 void DatabaseRequestHandler::constructDataElements(
-    mysqlx::SqlResult stripRow, unsigned &handle,
+    const std::vector<mysqlx::Row> &stripRow, unsigned &handle,
     std::vector<DatabaseRequestHandler::BackingStripData> &elements,
     unsigned &sizeValue) const {
   // std::vector<mysqlx::Row> rows = stripRow.fetchAll();
-  for (mysqlx::Row row : stripRow.fetchAll()) {
+  for (mysqlx::Row row : stripRow) {
     if (row.isNull()) {
       std::cout << "Null" << std::endl;
       continue;
@@ -811,11 +944,11 @@ RequestType DatabaseRequestHandler::getRequestType<
 /// bytes will be needed to serialise the elements.</param>
 template <>
 void DatabaseRequestHandler::constructDataElements(
-    mysqlx::SqlResult extraPriceRow, unsigned &handle,
+    const std::vector<mysqlx::Row> &extraPriceRow, unsigned &handle,
     std::vector<DatabaseRequestHandler::ExtraPriceData> &elements,
     unsigned &sizeValue) const {
   ExtraPriceData data;
-  for (mysqlx::Row row : extraPriceRow.fetchAll()) {
+  for (mysqlx::Row row : extraPriceRow) {
     if (row.isNull()) {
       std::cout << "Null" << std::endl;
       continue;
@@ -895,10 +1028,10 @@ RequestType DatabaseRequestHandler::getRequestType<
 /// bytes will be needed to serialise the elements.</param>
 template <>
 void DatabaseRequestHandler::constructDataElements(
-    mysqlx::SqlResult labourTimeRow, unsigned &handle,
+    const std::vector<mysqlx::Row> &labourTimeRow, unsigned &handle,
     std::vector<DatabaseRequestHandler::LabourTimeData> &elements,
     unsigned &sizeValue) const {
-  for (mysqlx::Row row : labourTimeRow.fetchAll()) {
+  for (mysqlx::Row row : labourTimeRow) {
     if (row.isNull()) {
       std::cout << "Null" << std::endl;
       continue;
@@ -954,10 +1087,10 @@ RequestType DatabaseRequestHandler::getRequestType<
 /// store the amount of bytes will be needed to serialise the elements.</param>
 template <>
 void DatabaseRequestHandler::constructDataElements(
-    mysqlx::SqlResult apertureShapeRow, unsigned &handle,
+    const std::vector<mysqlx::Row> &apertureShapeRow, unsigned &handle,
     std::vector<DatabaseRequestHandler::ApertureShapeData> &elements,
     unsigned &sizeValue) const {
-  for (mysqlx::Row row : apertureShapeRow.fetchAll()) {
+  for (mysqlx::Row row : apertureShapeRow) {
     if (row.isNull()) {
       std::cout << "Null" << std::endl;
       continue;
@@ -1008,10 +1141,10 @@ RequestType DatabaseRequestHandler::getRequestType<
 /// all of these, to be incremented.</param>
 template <>
 void DatabaseRequestHandler::constructDataElements(
-    mysqlx::SqlResult strapRow, unsigned &handle,
+    const std::vector<mysqlx::Row> &strapRow, unsigned &handle,
     std::vector<DatabaseRequestHandler::StrapData> &elements,
     unsigned &sizeValue) const {
-  for (mysqlx::Row row : strapRow.fetchAll()) {
+  for (mysqlx::Row row : strapRow) {
     if (row.isNull()) {
       std::cout << "Null" << std::endl;
       continue;
@@ -1062,11 +1195,11 @@ RequestType DatabaseRequestHandler::getRequestType<
 /// to serialise the elements.</param>
 template <>
 void DatabaseRequestHandler::constructDataElements(
-    mysqlx::SqlResult materialRow, unsigned &handle,
+    const std::vector<mysqlx::Row> &materialRow, unsigned &handle,
     std::vector<DatabaseRequestHandler::MaterialData> &elements,
     unsigned &sizeValue) const {
   std::map<unsigned, DatabaseRequestHandler::MaterialData> material_ids;
-  for (mysqlx::Row row : materialRow.fetchAll()) {
+  for (mysqlx::Row row : materialRow) {
     if (row.isNull()) {
       std::cout << "Null" << std::endl;
       continue;
@@ -1158,11 +1291,11 @@ RequestType DatabaseRequestHandler::getRequestType<
 /// store the amount of bytes will be needed to serialise the elements.</param>
 template <>
 void DatabaseRequestHandler::constructDataElements(
-    mysqlx::SqlResult sideIronPriceRow, unsigned &handle,
+    const std::vector<mysqlx::Row> &sideIronPriceRow, unsigned &handle,
     std::vector<DatabaseRequestHandler::SideIronPriceData> &elements,
     unsigned &sizeValue) const {
   // for (mysqlx::Row row : sideIronPriceRow) {
-  for (mysqlx::Row row : sideIronPriceRow.fetchAll()) {
+  for (mysqlx::Row row : sideIronPriceRow) {
     if (row.isNull()) {
       std::cout << "Null" << std::endl;
       continue;
@@ -1243,11 +1376,11 @@ RequestType DatabaseRequestHandler::getRequestType<
 
 template <>
 void DatabaseRequestHandler::constructDataElements(
-    mysqlx::SqlResult powderCoatingRow, unsigned &handle,
+    const std::vector<mysqlx::Row> &powderCoatingRow, unsigned &handle,
     std::vector<DatabaseRequestHandler::PowderCoatingPriceData> &elements,
     unsigned &sizeValue) const {
   // for (mysqlx::Row row : powderCoatingRow) {
-  for (mysqlx::Row row : powderCoatingRow.fetchAll()) {
+  for (mysqlx::Row row : powderCoatingRow) {
     if (row.isNull()) {
       std::cout << "Null" << std::endl;
       continue;
@@ -1300,10 +1433,10 @@ RequestType DatabaseRequestHandler::getRequestType<
 /// bytes will be needed to serialise the elements.</param>
 template <>
 void DatabaseRequestHandler::constructDataElements(
-    mysqlx::SqlResult sideIronRow, unsigned &handle,
+    const std::vector<mysqlx::Row> &sideIronRow, unsigned &handle,
     std::vector<DatabaseRequestHandler::SideIronData> &elements,
     unsigned &sizeValue) const {
-  for (mysqlx::Row row : sideIronRow.fetchAll()) {
+  for (mysqlx::Row row : sideIronRow) {
     if (row.isNull()) {
       std::cout << "Null" << std::endl;
       continue;
@@ -1402,10 +1535,10 @@ RequestType DatabaseRequestHandler::getRequestType<
 /// to serialise the elements.</param>
 template <>
 void DatabaseRequestHandler::constructDataElements(
-    mysqlx::SqlResult machineRow, unsigned &handle,
+    const std::vector<mysqlx::Row> &machineRow, unsigned &handle,
     std::vector<DatabaseRequestHandler::MachineData> &elements,
     unsigned &sizeValue) const {
-  for (mysqlx::Row row : machineRow.fetchAll()) {
+  for (mysqlx::Row row : machineRow) {
     if (row.isNull()) {
       std::cout << "Null" << std::endl;
       continue;
@@ -1463,10 +1596,10 @@ RequestType DatabaseRequestHandler::getRequestType<
 
 template <>
 void DatabaseRequestHandler::constructDataElements(
-    mysqlx::SqlResult machineDeckRow, unsigned &handle,
+    const std::vector<mysqlx::Row> &machineDeckRow, unsigned &handle,
     std::vector<DatabaseRequestHandler::MachineDeckData> &elements,
     unsigned &sizeValue) const {
-  for (mysqlx::Row row : machineDeckRow.fetchAll()) {
+  for (mysqlx::Row row : machineDeckRow) {
     if (row.isNull()) {
       std::cout << "Null" << std::endl;
       continue;
@@ -6,7 +6,8 @@
 #include "../../include/database/DrawingComponentManager.h"
 
 void DatabaseResponseHandler::onMessageReceived(void *&&message,
-                                                unsigned int messageSize) {
+                                                unsigned int messageSize,
+                                                RequestID requestID) {
   switch (getDeserialiseType(message)) {
     case RequestType::REPEAT_TOKEN_REQUEST: {
       uint256 token;
@@ -32,6 +33,8 @@ void DatabaseResponseHandler::onMessageReceived(void *&&message,
       if (populateResultsModel) {
         // resultsModel->sourceDataFromBuffer(std::move(message));
         populateResultsModel(std::move(message));
+      } else {
+        free(message);
       }
       break;
     case RequestType::DRAWING_INSERT: {
@@ -98,8 +101,15 @@ void DatabaseResponseHandler::onMessageReceived(void *&&message,
       if (drawingReceivedCallback) {
         drawingReceivedCallback(
             DrawingRequest::deserialise(std::move(message)));
+      } else {
+        free(message);
       }
       break;
+    case RequestType::DRAWING_DETAILS_BATCH:
+      // Batches are only requested through Client::request, so one arriving
+      // here has already been cancelled or timed out
+      free(message);
+      break;
     case RequestType::ADD_NEW_COMPONENT:
       if (addComponentCallback) {
         addComponentCallback(
@@ -121,6 +131,28 @@ void DatabaseResponseHandler::onMessageReceived(void *&&message,
   }
 }
 
+bool DatabaseResponseHandler::isBroadcastType(uint32 messageType) {
+  switch ((RequestType)messageType) {
+    case RequestType::SOURCE_PRODUCT_TABLE:
+    case RequestType::SOURCE_APERTURE_TABLE:
+    case RequestType::SOURCE_APERTURE_SHAPE_TABLE:
+    case RequestType::SOURCE_MATERIAL_TABLE:
+    case RequestType::SOURCE_SIDE_IRON_TABLE:
+    case RequestType::SOURCE_SIDE_IRON_PRICES_TABLE:
+    case RequestType::SOURCE_MACHINE_TABLE:
+    case RequestType::SOURCE_MACHINE_DECK_TABLE:
+    case RequestType::SOURCE_EXTRA_PRICES_TABLE:
+    case RequestType::SOURCE_BACKING_STRIPS_TABLE:
+    case RequestType::SOURCE_LABOUR_TIMES_TABLE:
+    case RequestType::SOURCE_POWDER_COATING_TABLE:
+    case RequestType::SOURCE_STRAPS_TABLE:
+    case RequestType::GET_NEXT_DRAWING_NUMBER:
+      return true;
+    default:
+      return false;
+  }
+}
+
 void DatabaseResponseHandler::setPopulateResultsModel(
     std::function<void(void *&&)> func) {
   populateResultsModel = func;
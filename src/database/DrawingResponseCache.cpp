@@ -0,0 +1,94 @@
+#include "../../include/database/DrawingResponseCache.h"
+
+DrawingResponseCache::DrawingResponseCache(size_t capacity) : capacity(capacity) {
+}
+
+std::shared_ptr<const std::vector<unsigned char>> DrawingResponseCache::find(unsigned matID) {
+    std::lock_guard<std::mutex> guard(cacheMutex);
+
+    std::unordered_map<unsigned, Entry>::iterator it = entries.find(matID);
+    if (it == entries.end()) {
+        counters.misses++;
+        return nullptr;
+    }
+
+    counters.hits++;
+    usageOrder.splice(usageOrder.end(), usageOrder, it->second.usage);
+    return it->second.response;
+}
+
+DrawingResponseCache::Generation DrawingResponseCache::generation() {
+    std::lock_guard<std::mutex> guard(cacheMutex);
+    return currentGeneration;
+}
+
+void DrawingResponseCache::insert(unsigned matID, const std::string &drawingNumber,
+                                  std::vector<unsigned char> &&response, Generation readGeneration) {
+    std::lock_guard<std::mutex> guard(cacheMutex);
+
+    // Something changed while the response was being built, so it may already be out of date
+    if (readGeneration != currentGeneration || response.size() > capacity) {
+        return;
+    }
+
+    std::unordered_map<unsigned, Entry>::iterator it = entries.find(matID);
+    if (it != entries.end()) {
+        erase(it);
+    }
+    // The drawing number may have moved to a new matID since it was cached
+    std::unordered_map<std::string, unsigned>::iterator number = drawingNumbers.find(drawingNumber);
+    if (number != drawingNumbers.end()) {
+        erase(entries.find(number->second));
+    }
+
+    while (counters.bytes + response.size() > capacity) {
+        erase(entries.find(usageOrder.front()));
+        counters.evictions++;
+    }
+
+    counters.bytes += response.size();
+    usageOrder.push_back(matID);
+    drawingNumbers[drawingNumber] = matID;
+    entries[matID] = {std::make_shared<const std::vector<unsigned char>>(std::move(response)), drawingNumber,
+                      std::prev(usageOrder.end())};
+}
+
+void DrawingResponseCache::invalidate(const std::string &drawingNumber) {
+    std::lock_guard<std::mutex> guard(cacheMutex);
+
+    currentGeneration++;
+
+    std::unordered_map<std::string, unsigned>::iterator number = drawingNumbers.find(drawingNumber);
+    if (number != drawingNumbers.end()) {
+        erase(entries.find(number->second));
+        counters.invalidations++;
+    }
+}
+
+void DrawingResponseCache::clear() {
+    std::lock_guard<std::mutex> guard(cacheMutex);
+
+    currentGeneration++;
+
+    counters.invalidations += entries.size();
+    counters.bytes = 0;
+    entries.clear();
+    drawingNumbers.clear();
+    usageOrder.clear();
+}
+
+DrawingResponseCache::Metrics DrawingResponseCache::metrics() {
+    std::lock_guard<std::mutex> guard(cacheMutex);
+
+    Metrics snapshot = counters;
+    snapshot.entries = entries.size();
+    snapshot.capacity = capacity;
+    return snapshot;
+}
+
+void DrawingResponseCache::erase(std::unordered_map<unsigned, Entry>::iterator entry) {
+    counters.bytes -= entry->second.response->size();
+    drawingNumbers.erase(entry->second.drawingNumber);
+    usageOrder.erase(entry->second.usage);
+    entries.erase(entry);
+}
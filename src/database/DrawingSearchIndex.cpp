@@ -0,0 +1,945 @@
+#include "../../include/database/DrawingSearchIndex.h"
+
+#include "../../include/database/DatabaseManager.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <sstream>
+#include <thread>
+#include <type_traits>
+
+// The columns of the index query, in order
+enum SearchIndexColumn : unsigned {
+    MAT_ID,
+    DRAWING_NUMBER,
+    WIDTH,
+    LENGTH,
+    APERTURE_ID,
+    PRODUCT_ID,
+    NUMBER_OF_BARS,
+    DRAWING_DATE,
+    TENSION_TYPE,
+    MACHINE_ID,
+    QUANTITY_ON_DECK,
+    POSITION,
+    DECK_ID,
+    MANUFACTURER,
+    THICKNESSES,
+    LAPS,
+    BAR_SPACINGS,
+    EXTRA_APERTURES,
+    SIDE_IRONS
+};
+
+// Laps are searched by attachment as a number, with 0 for laps whose attachment isn't known, so they never match
+#define LAP_ATTACHMENT_CODE(attachment) (1u + (unsigned) (attachment))
+
+struct DrawingSearchIndex::Row {
+    std::string sortKey, drawingNumber;
+    float width, length;
+    unsigned productID;
+    uint8_t barCount;
+    unsigned apertureID;
+    uint8_t thicknessCount;
+    unsigned thicknessIDs[2];
+    uint32_t date;
+    uint8_t sideIronCount;
+    unsigned sideIronIDs[2];
+    uint8_t sideIronTypes[2];
+    unsigned sideIronLengths[2];
+    uint8_t sidelapCount, overlapCount;
+    float sidelapWidths[2], overlapWidths[2];
+    uint8_t sidelapAttachments[2], overlapAttachments[2];
+    uint8_t hasTemplate;
+    unsigned machineID, deckID, manufacturerID;
+    uint8_t quantityOnDeck;
+    std::string position;
+    // Numbered when the row is added to the index, as the numbers belong to the index
+    std::optional<std::string> manufacturer;
+    DrawingSummary summary;
+    std::vector<unsigned> extraApertureIDs;
+};
+
+static std::string upperCase(std::string text) {
+    std::transform(text.begin(), text.end(), text.begin(), [](unsigned char c) { return std::toupper(c); });
+    return text;
+}
+
+// Copies the rows the index query aggregates into a JSON array, ordered by their first element, as JSON_ARRAYAGG
+// doesn't preserve any order
+static std::vector<mysqlx::Value> orderedRows(const mysqlx::Value &rows) {
+    std::vector<mysqlx::Value> ordered;
+    for (const mysqlx::Value &row : rows) {
+        ordered.push_back(row);
+    }
+    std::sort(ordered.begin(), ordered.end(),
+              [](const mysqlx::Value &a, const mysqlx::Value &b) { return a[0].get<int>() < b[0].get<int>(); });
+    return ordered;
+}
+
+// Reads a number from a JSON row. MySQL hands back FLOAT columns as doubles once they are in JSON.
+static float jsonFloat(const mysqlx::Value &value) {
+    return (float) value.get<double>();
+}
+
+static unsigned lapAttachmentCode(const mysqlx::Value &attachment) {
+    if (attachment.isNull()) {
+        return 0;
+    }
+    std::string name = upperCase(attachment.get<std::string>());
+    if (name == "INTEGRAL") {
+        return LAP_ATTACHMENT_CODE(LapAttachment::INTEGRAL);
+    }
+    if (name == "BONDED") {
+        return LAP_ATTACHMENT_CODE(LapAttachment::BONDED);
+    }
+    return 0;
+}
+
+// Clears the mask of every drawing in [begin, end) which doesn't satisfy the predicate. The loop has no branches on the
+// data, so it can be vectorised for predicates which compare single columns.
+template <typename Predicate>
+static void filter(std::vector<uint8_t> &mask, size_t begin, size_t end, Predicate predicate) {
+    for (size_t i = begin; i < end; i++) {
+        mask[i - begin] &= (uint8_t) predicate(i);
+    }
+}
+
+DrawingSearchIndex::DrawingSearchIndex() {
+    workers.start(0);
+}
+
+std::optional<std::vector<DrawingSummary>> DrawingSearchIndex::search(DatabaseManager &dbManager,
+                                                                      const DatabaseSearchQuery &query) {
+    if (loadState != LoadState::LOADED || handlesStale) {
+        std::unique_lock<std::shared_mutex> indexLock(indexMutex);
+        if (loadState == LoadState::UNLOADED) {
+            beginLoad(dbManager);
+        }
+        if (loadState != LoadState::LOADED) {
+            return std::nullopt;
+        }
+        if (handlesStale) {
+            refreshHandles();
+        }
+    }
+
+    std::shared_lock<std::shared_mutex> indexLock(indexMutex);
+    // A failed update may have started a reload since the check above
+    if (loadState != LoadState::LOADED) {
+        return std::nullopt;
+    }
+
+    size_t rowCount = summaries.size();
+
+    // Split the drawings evenly between the calling thread and the workers, but with no fewer than a chunk's worth of
+    // drawings each
+    size_t chunks = (rowCount + SEARCH_INDEX_CHUNK_ROWS - 1) / SEARCH_INDEX_CHUNK_ROWS;
+    chunks = std::clamp<size_t>(chunks, 1, workers.threadCount() + 1);
+    size_t chunkSize = (rowCount + chunks - 1) / chunks;
+
+    // The chunks are claimed in turn by the calling thread and the workers it hands the scan to, so the calling thread
+    // only waits for chunks which are already being scanned. Workers which start after every chunk has been claimed
+    // have nothing to do.
+    struct ScanChunks {
+        std::atomic<size_t> nextChunk = 0;
+        std::vector<std::vector<unsigned>> matches;
+        size_t finished = 0;
+        std::mutex mutex;
+        std::condition_variable allFinished;
+    };
+    std::shared_ptr<ScanChunks> scanChunks = std::make_shared<ScanChunks>();
+    scanChunks->matches.resize(chunks);
+
+    auto scanRemaining = [this, scanChunks, &query, rowCount, chunkSize]() {
+        for (size_t chunk = scanChunks->nextChunk++; chunk < scanChunks->matches.size();
+             chunk = scanChunks->nextChunk++) {
+            size_t begin = std::min(rowCount, chunk * chunkSize);
+            size_t end = std::min(rowCount, begin + chunkSize);
+            std::vector<unsigned> chunkMatches = scan(query, begin, end);
+
+            std::lock_guard<std::mutex> chunkGuard(scanChunks->mutex);
+            scanChunks->matches[chunk] = std::move(chunkMatches);
+            if (++scanChunks->finished == scanChunks->matches.size()) {
+                scanChunks->allFinished.notify_all();
+            }
+        }
+    };
+    for (size_t helper = 1; helper < chunks; helper++) {
+        workers.submit(nextScanKey++, scanRemaining);
+    }
+    scanRemaining();
+
+    {
+        std::unique_lock<std::mutex> chunkLock(scanChunks->mutex);
+        scanChunks->allFinished.wait(chunkLock,
+                                     [&]() { return scanChunks->finished == scanChunks->matches.size(); });
+    }
+
+    size_t matchCount = 0;
+    for (const std::vector<unsigned> &chunkMatches : scanChunks->matches) {
+        matchCount += chunkMatches.size();
+    }
+
+    std::vector<DrawingSummary> results;
+    results.reserve(matchCount);
+    for (const std::vector<unsigned> &chunkMatches : scanChunks->matches) {
+        for (unsigned position : chunkMatches) {
+            results.push_back(summaries[position]);
+        }
+    }
+
+    return results;
+}
+
+void DrawingSearchIndex::startLoading(DatabaseManager &dbManager) {
+    std::unique_lock<std::shared_mutex> indexLock(indexMutex);
+    if (loadState == LoadState::UNLOADED) {
+        beginLoad(dbManager);
+    }
+}
+
+void DrawingSearchIndex::update(DatabaseManager &dbManager, const std::string &drawingNumber) {
+    std::unique_lock<std::mutex> updateLock(updateMutex);
+    queuedUpdates.push_back(drawingNumber);
+    unsigned long long batch = nextUpdateBatch;
+
+    if (applyingUpdates) {
+        // Another thread is applying updates, and will apply this one in its next batch
+        updateApplied.wait(updateLock, [&]() { return appliedUpdateBatch >= batch; });
+        return;
+    }
+
+    applyingUpdates = true;
+    while (!queuedUpdates.empty()) {
+        std::vector<std::string> updatedNumbers;
+        updatedNumbers.swap(queuedUpdates);
+        unsigned long long applying = nextUpdateBatch++;
+        updateLock.unlock();
+
+        applyUpdates(dbManager, std::move(updatedNumbers));
+
+        updateLock.lock();
+        appliedUpdateBatch = applying;
+        updateApplied.notify_all();
+    }
+    applyingUpdates = false;
+}
+
+bool DrawingSearchIndex::verify(DatabaseManager &dbManager, std::ostream &out) {
+    DatabaseSearchQuery everything;
+    std::optional<std::vector<DrawingSummary>> indexed = search(dbManager, everything);
+    if (!indexed.has_value()) {
+        out << "The search index hasn't finished loading." << std::endl;
+        return false;
+    }
+    std::vector<DrawingSummary> searched = dbManager.executeSearchQuery(everything);
+
+    // Extra apertures aren't returned in any particular order
+    auto extraApertures = [](const DrawingSummary &summary) {
+        std::vector<unsigned> apertures = summary.extraApertures();
+        std::sort(apertures.begin(), apertures.end());
+        return apertures;
+    };
+    auto matches = [&](const DrawingSummary &a, const DrawingSummary &b) {
+        bool same = a.matID == b.matID && a.drawingNumber == b.drawingNumber && a.width() == b.width() &&
+                    a.length() == b.length() && a.apertureHandle == b.apertureHandle &&
+                    a.hasTwoLayers() == b.hasTwoLayers() && a.thicknessHandles[0] == b.thicknessHandles[0] &&
+                    a.barSpacings() == b.barSpacings() && extraApertures(a) == extraApertures(b);
+        if (a.hasTwoLayers() && b.hasTwoLayers()) {
+            same &= a.thicknessHandles[1] == b.thicknessHandles[1];
+        }
+        for (unsigned lap = 0; lap < 4; lap++) {
+            same &= a.lapSize(lap) == b.lapSize(lap);
+        }
+        return same;
+    };
+
+    // Only the first few differences are written, as a broken field would otherwise list every drawing
+    unsigned differences = 0;
+    auto report = [&](const std::string &difference) {
+        if (differences++ < 20) {
+            out << difference << std::endl;
+        }
+    };
+
+    if (indexed->size() != searched.size()) {
+        report("Index has " + std::to_string(indexed->size()) + " drawings, database search has " +
+               std::to_string(searched.size()) + ".");
+    }
+    for (size_t i = 0; i < std::min(indexed->size(), searched.size()); i++) {
+        const DrawingSummary &fromIndex = (*indexed)[i], &fromDatabase = searched[i];
+        if (!matches(fromIndex, fromDatabase)) {
+            report("Result " + std::to_string(i) + ": index has " + fromIndex.drawingNumber + " (" +
+                   fromIndex.summaryString() + "), database search has " + fromDatabase.drawingNumber + " (" +
+                   fromDatabase.summaryString() + ").");
+        }
+    }
+
+    out << "Search index checked against " << searched.size() << " drawings from the database, " << differences
+        << " differences." << std::endl;
+    return differences == 0;
+}
+
+void DrawingSearchIndex::invalidateHandles() {
+    handlesStale = true;
+}
+
+size_t DrawingSearchIndex::size() {
+    std::shared_lock<std::shared_mutex> indexLock(indexMutex);
+    return summaries.size();
+}
+
+std::string DrawingSearchIndex::rowQueryString(size_t drawingCount) {
+    std::stringstream sql;
+
+    sql << "SELECT d.mat_id, d.drawing_number, d.width, d.length, "
+           "mal.aperture_id, d.product_id, d.no_of_bars, "
+           "CAST(DATE_FORMAT(d.drawing_date, '%Y%m%d') AS UNSIGNED), "
+           "d.tension_type, "
+        << std::endl;
+    sql << "mt.machine_id, mt.quantity_on_deck, mt.position, mt.deck_id, "
+           "m.manufacturer, "
+        << std::endl;
+    // The thicknesses, bars and side irons carry their index first, so they can be put back in order
+    sql << "COALESCE((SELECT JSON_ARRAYAGG(JSON_ARRAY(x.thickness_id, "
+           "x.material_thickness_id)) FROM {0}.thickness AS x "
+           "WHERE x.mat_id=d.mat_id), JSON_ARRAY()), "
+        << std::endl;
+    sql << "COALESCE((SELECT JSON_ARRAYAGG(JSON_ARRAY(x.type, x.width, "
+           "x.mat_side, x.attachment_type)) "
+           "FROM (SELECT mat_id, 'S' AS type, width, mat_side, attachment_type "
+           "FROM {0}.sidelaps UNION ALL "
+           "SELECT mat_id, 'O' AS type, width, mat_side, attachment_type "
+           "FROM {0}.overlaps) AS x WHERE x.mat_id=d.mat_id), JSON_ARRAY()), "
+        << std::endl;
+    sql << "COALESCE((SELECT JSON_ARRAYAGG(JSON_ARRAY(x.bar_index, "
+           "x.bar_spacing)) FROM {0}.bar_spacings AS x "
+           "WHERE x.mat_id=d.mat_id), JSON_ARRAY()), "
+        << std::endl;
+    sql << "COALESCE((SELECT JSON_ARRAYAGG(x.aperture_id) "
+           "FROM {0}.extra_apertures AS x WHERE x.mat_id=d.mat_id), "
+           "JSON_ARRAY()), "
+        << std::endl;
+    sql << "COALESCE((SELECT JSON_ARRAYAGG(JSON_ARRAY(x.side_iron_index, "
+           "x.side_iron_id, si.type+0, si.length)) "
+           "FROM {0}.mat_side_iron_link AS x INNER JOIN {0}.side_irons AS si "
+           "ON x.side_iron_id=si.side_iron_id WHERE x.mat_id=d.mat_id), "
+           "JSON_ARRAY())"
+        << std::endl;
+
+    sql << "FROM {0}.drawings AS d" << std::endl;
+    sql << "INNER JOIN {0}.mat_aperture_link AS mal ON d.mat_id=mal.mat_id" << std::endl;
+    sql << "LEFT JOIN {0}.machine_templates AS mt ON "
+           "d.template_id=mt.template_id"
+        << std::endl;
+    sql << "LEFT JOIN {0}.machines AS m ON mt.machine_id=m.machine_id" << std::endl;
+
+    if (drawingCount != 0) {
+        sql << "WHERE d.drawing_number IN (?";
+        for (size_t i = 1; i < drawingCount; i++) {
+            sql << ", ?";
+        }
+        sql << ")" << std::endl;
+    }
+
+    return sql.str();
+}
+
+void DrawingSearchIndex::beginLoad(DatabaseManager &dbManager) {
+    loadState = LoadState::LOADING;
+    updatesDuringLoad.clear();
+    workers.submit(SEARCH_INDEX_LOAD_KEY, [this, &dbManager]() { load(dbManager); });
+}
+
+void DrawingSearchIndex::load(DatabaseManager &dbManager) {
+    // The database is read and the rows sorted without the index locked, so searches and updates carry on meanwhile
+    std::vector<Row> rows;
+    if (!readRows(dbManager, std::nullopt, rows)) {
+        std::unique_lock<std::shared_mutex> indexLock(indexMutex);
+        // The next search tries again
+        loadState = LoadState::UNLOADED;
+        return;
+    }
+    std::stable_sort(rows.begin(), rows.end(), [](const Row &a, const Row &b) { return a.sortKey > b.sortKey; });
+
+    {
+        std::unique_lock<std::shared_mutex> indexLock(indexMutex);
+
+        // Anything left from before a failed update is thrown away
+        forEachColumn([](auto &column) { column.clear(); });
+        manufacturers.clear();
+
+        for (Row &row : rows) {
+            append(std::move(row));
+        }
+    }
+    rows.clear();
+
+    // Drawings updated while the index was loading may have been read before they changed, so they are read again,
+    // until none were updated in the meantime
+    while (true) {
+        std::vector<std::string> updatedNumbers;
+        {
+            std::unique_lock<std::shared_mutex> indexLock(indexMutex);
+            if (updatesDuringLoad.empty()) {
+                // The source tables may not be built yet, so the handles are looked up before the first search
+                handlesStale = true;
+                loadState = LoadState::LOADED;
+                break;
+            }
+            updatedNumbers.swap(updatesDuringLoad);
+        }
+
+        std::sort(updatedNumbers.begin(), updatedNumbers.end());
+        updatedNumbers.erase(std::unique(updatedNumbers.begin(), updatedNumbers.end()), updatedNumbers.end());
+
+        std::vector<Row> updatedRows;
+        bool read = readRows(dbManager, updatedNumbers, updatedRows);
+
+        std::unique_lock<std::shared_mutex> indexLock(indexMutex);
+        if (!read) {
+            loadState = LoadState::UNLOADED;
+            return;
+        }
+        merge(updatedNumbers, std::move(updatedRows), nullptr);
+    }
+
+    lockLog {
+        *ss << "Search index loaded with " << size() << " drawings" << std::endl;
+        Logger::log();
+    }
+}
+
+bool DrawingSearchIndex::readRows(DatabaseManager &dbManager,
+                                  const std::optional<std::vector<std::string>> &drawingNumbers,
+                                  std::vector<Row> &rows) {
+    std::optional<std::vector<mysqlx::Row>> sourceRows = dbManager.searchIndexRows(drawingNumbers);
+    if (!sourceRows.has_value()) {
+        return false;
+    }
+
+    rows.reserve(rows.size() + sourceRows->size());
+    for (const mysqlx::Row &source : *sourceRows) {
+        Row row{};
+        if (readRow(source, row)) {
+            rows.push_back(std::move(row));
+        }
+    }
+    return true;
+}
+
+void DrawingSearchIndex::applyUpdates(DatabaseManager &dbManager, std::vector<std::string> &&updatedNumbers) {
+    std::sort(updatedNumbers.begin(), updatedNumbers.end());
+    updatedNumbers.erase(std::unique(updatedNumbers.begin(), updatedNumbers.end()), updatedNumbers.end());
+
+    // The whole batch is read in one query, before the index is locked
+    std::vector<Row> rows;
+    bool read = readRows(dbManager, updatedNumbers, rows);
+
+    std::unique_lock<std::shared_mutex> indexLock(indexMutex);
+
+    switch (loadState) {
+        case LoadState::UNLOADED:
+            // The drawings will be read when the index is loaded
+            return;
+        case LoadState::LOADING:
+            // The load may have read the drawings before they changed, so they are read again once it finishes
+            updatesDuringLoad.insert(updatesDuringLoad.end(), updatedNumbers.begin(), updatedNumbers.end());
+            return;
+        case LoadState::LOADED:
+            break;
+    }
+
+    if (!read) {
+        // The index can't be brought up to date, so reload it all rather than leave it missing the change. Searches
+        // go to the database until it has reloaded.
+        Logger::logError("Failed to update search index. Reloading index.");
+        beginLoad(dbManager);
+        return;
+    }
+
+    if (handlesStale) {
+        refreshHandles();
+    }
+
+    ComponentHandles handles = componentHandles();
+    merge(updatedNumbers, std::move(rows), &handles);
+}
+
+bool DrawingSearchIndex::readRow(const mysqlx::Row &source, Row &row) {
+    try {
+        row.drawingNumber = source[DRAWING_NUMBER].get<std::string>();
+        row.sortKey = sortKey(row.drawingNumber);
+
+        // As with the database search, drawings without a material are left out
+        std::vector<mysqlx::Value> thicknesses = orderedRows(source[THICKNESSES]);
+        if (thicknesses.empty()) {
+            lockLog {
+                *ss << "Missing material on drawing " << row.drawingNumber << std::endl;
+                Logger::logError();
+            }
+            return false;
+        }
+
+        row.summary.matID = source[MAT_ID].get<int>();
+        row.summary.drawingNumber = row.drawingNumber;
+        row.drawingNumber = upperCase(row.drawingNumber);
+
+        row.width = source[WIDTH].get<float>();
+        row.length = source[LENGTH].get<float>();
+        row.summary.setWidth(row.width);
+        row.summary.setLength(row.length);
+
+        row.apertureID = source[APERTURE_ID].get<int>();
+        if (!source[PRODUCT_ID].isNull()) {
+            row.productID = source[PRODUCT_ID].get<int>();
+        }
+        if (!source[NUMBER_OF_BARS].isNull()) {
+            row.barCount = source[NUMBER_OF_BARS].get<int>();
+        }
+        if (!source[DRAWING_DATE].isNull()) {
+            row.date = source[DRAWING_DATE].get<int>();
+        }
+
+        row.thicknessCount = std::min<size_t>(thicknesses.size(), 255);
+        for (unsigned layer = 0; layer < 2 && layer < thicknesses.size(); layer++) {
+            row.thicknessIDs[layer] = thicknesses[layer][1].get<unsigned>();
+        }
+
+        if (!source[MACHINE_ID].isNull()) {
+            row.hasTemplate = true;
+            row.machineID = source[MACHINE_ID].get<int>();
+            row.quantityOnDeck = source[QUANTITY_ON_DECK].get<int>();
+            row.position = upperCase(source[POSITION].get<std::string>());
+            row.deckID = source[DECK_ID].get<int>();
+            if (!source[MANUFACTURER].isNull()) {
+                row.manufacturer = upperCase(source[MANUFACTURER].get<std::string>());
+            }
+        }
+
+        for (unsigned i = 0; i < 4; i++) {
+            row.summary.setLapSize(i, 0);
+        }
+        bool sideTensioned = source[TENSION_TYPE].get<std::string>() == "Side";
+
+        for (const mysqlx::Value &lap : source[LAPS]) {
+            bool sidelap = lap[0].get<std::string>() == "S";
+            uint8_t &count = sidelap ? row.sidelapCount : row.overlapCount;
+            float *widths = sidelap ? row.sidelapWidths : row.overlapWidths;
+            uint8_t *attachments = sidelap ? row.sidelapAttachments : row.overlapAttachments;
+
+            if (count < 2) {
+                // A lap without a width never matches a search on the width
+                widths[count] = lap[1].isNull() ? NAN : jsonFloat(lap[1]);
+                attachments[count] = lapAttachmentCode(lap[3]);
+            }
+            count = std::min(count + 1, 255);
+
+            // Laps with no side are left out of the summary, as in the database search. Otherwise, the slot for the lap
+            // depends on the side of the mat, the tension type and whether it is a sidelap or overlap.
+            if (lap[2].isNull() || lap[1].isNull()) {
+                continue;
+            }
+            unsigned index = (lap[2].get<std::string>() == "Right");
+            index += 2 * (sideTensioned ? !sidelap : sidelap);
+            row.summary.setLapSize(index, jsonFloat(lap[1]));
+        }
+
+        for (const mysqlx::Value &spacing : orderedRows(source[BAR_SPACINGS])) {
+            row.summary.addSpacing(jsonFloat(spacing[1]));
+        }
+
+        for (const mysqlx::Value &aperture : source[EXTRA_APERTURES]) {
+            row.extraApertureIDs.push_back(aperture.get<unsigned>());
+        }
+
+        std::vector<mysqlx::Value> sideIrons = orderedRows(source[SIDE_IRONS]);
+        row.sideIronCount = std::min<size_t>(sideIrons.size(), 255);
+        for (unsigned side = 0; side < 2 && side < sideIrons.size(); side++) {
+            row.sideIronIDs[side] = sideIrons[side][1].get<unsigned>();
+            if (!sideIrons[side][2].isNull()) {
+                row.sideIronTypes[side] = sideIrons[side][2].get<unsigned>();
+            }
+            if (!sideIrons[side][3].isNull()) {
+                row.sideIronLengths[side] = sideIrons[side][3].get<unsigned>();
+            }
+        }
+    } catch (mysqlx::Error &e) {
+        Logger::logError(e.what(), __LINE__, __FILE__);
+        return false;
+    }
+
+    return true;
+}
+
+DrawingSearchIndex::ComponentHandles DrawingSearchIndex::componentHandles() {
+    // Where more than one component has the same ID (as with apertures which can be rotated), the lowest handle is used
+    ComponentHandles handles;
+    for (unsigned handle : DrawingComponentManager<Aperture>::dataIndexSet()) {
+        handles.apertures.emplace(DrawingComponentManager<Aperture>::getComponentByHandle(handle).componentID(),
+                                  handle);
+    }
+    for (unsigned handle : DrawingComponentManager<Material>::dataIndexSet()) {
+        handles.materials.emplace(DrawingComponentManager<Material>::getComponentByHandle(handle).componentID(),
+                                  handle);
+    }
+    return handles;
+}
+
+bool DrawingSearchIndex::resolveHandles(size_t position, const ComponentHandles &handles) {
+    DrawingSummary &summary = summaries[position];
+    resolved[position] = false;
+
+    std::unordered_map<unsigned, unsigned>::const_iterator aperture = handles.apertures.find(apertureIDs[position]);
+    if (aperture == handles.apertures.end()) {
+        return false;
+    }
+    summary.apertureHandle = aperture->second;
+
+    memset(&summary.thicknessHandles, 0, sizeof(summary.thicknessHandles));
+    for (unsigned layer = 0; layer < 2 && layer < thicknessCounts[position]; layer++) {
+        std::unordered_map<unsigned, unsigned>::const_iterator material =
+            handles.materials.find(thicknessIDs[layer][position]);
+        if (material == handles.materials.end()) {
+            return false;
+        }
+        summary.thicknessHandles[layer] = material->second;
+    }
+
+    summary.clearExtraApertures();
+    for (unsigned apertureID : extraApertureIDs[position]) {
+        aperture = handles.apertures.find(apertureID);
+        if (aperture == handles.apertures.end()) {
+            return false;
+        }
+        summary.addExtraAperture(aperture->second);
+    }
+
+    resolved[position] = true;
+    return true;
+}
+
+void DrawingSearchIndex::refreshHandles() {
+    handlesStale = false;
+    ComponentHandles handles = componentHandles();
+    unsigned unresolved = 0;
+    for (size_t position = 0; position < summaries.size(); position++) {
+        unresolved += !resolveHandles(position, handles);
+    }
+    if (unresolved != 0) {
+        Logger::logError(std::to_string(unresolved) + " drawings refer to missing apertures or materials, so "
+                                                      "will not appear in searches.");
+    }
+}
+
+template <typename Function>
+void DrawingSearchIndex::forEachColumn(Function function) {
+    function(sortKeys);
+    function(drawingNumbers);
+    function(widths);
+    function(lengths);
+    function(productIDs);
+    function(barCounts);
+    function(apertureIDs);
+    function(thicknessCounts);
+    function(dates);
+    function(sideIronCounts);
+    function(sidelapCounts);
+    function(overlapCounts);
+    for (unsigned i = 0; i < 2; i++) {
+        function(thicknessIDs[i]);
+        function(sideIronIDs[i]);
+        function(sideIronTypes[i]);
+        function(sideIronLengths[i]);
+        function(sidelapWidths[i]);
+        function(overlapWidths[i]);
+        function(sidelapAttachments[i]);
+        function(overlapAttachments[i]);
+    }
+    function(hasTemplate);
+    function(machineIDs);
+    function(deckIDs);
+    function(manufacturerIDs);
+    function(quantitiesOnDeck);
+    function(positions);
+    function(summaries);
+    function(extraApertureIDs);
+    function(resolved);
+}
+
+void DrawingSearchIndex::append(Row &&row) {
+    auto place = [](auto &column, auto &&value) { column.push_back(std::forward<decltype(value)>(value)); };
+
+    if (row.manufacturer.has_value()) {
+        row.manufacturerID = manufacturers.emplace(*row.manufacturer, manufacturers.size() + 1).first->second;
+    }
+
+    place(sortKeys, std::move(row.sortKey));
+    place(drawingNumbers, std::move(row.drawingNumber));
+    place(widths, row.width);
+    place(lengths, row.length);
+    place(productIDs, row.productID);
+    place(barCounts, row.barCount);
+    place(apertureIDs, row.apertureID);
+    place(thicknessCounts, row.thicknessCount);
+    place(dates, row.date);
+    place(sideIronCounts, row.sideIronCount);
+    place(sidelapCounts, row.sidelapCount);
+    place(overlapCounts, row.overlapCount);
+    for (unsigned i = 0; i < 2; i++) {
+        place(thicknessIDs[i], row.thicknessIDs[i]);
+        place(sideIronIDs[i], row.sideIronIDs[i]);
+        place(sideIronTypes[i], row.sideIronTypes[i]);
+        place(sideIronLengths[i], row.sideIronLengths[i]);
+        place(sidelapWidths[i], row.sidelapWidths[i]);
+        place(overlapWidths[i], row.overlapWidths[i]);
+        place(sidelapAttachments[i], row.sidelapAttachments[i]);
+        place(overlapAttachments[i], row.overlapAttachments[i]);
+    }
+    place(hasTemplate, row.hasTemplate);
+    place(machineIDs, row.machineID);
+    place(deckIDs, row.deckID);
+    place(manufacturerIDs, row.manufacturerID);
+    place(quantitiesOnDeck, row.quantityOnDeck);
+    place(positions, std::move(row.position));
+    place(summaries, std::move(row.summary));
+    place(extraApertureIDs, std::move(row.extraApertureIDs));
+    // Not searchable until its handles are resolved
+    place(resolved, (uint8_t) false);
+}
+
+void DrawingSearchIndex::reorder(const std::vector<size_t> &order) {
+    forEachColumn([&order](auto &column) {
+        std::remove_reference_t<decltype(column)> reordered;
+        reordered.reserve(order.size());
+        for (size_t position : order) {
+            reordered.push_back(std::move(column[position]));
+        }
+        column.swap(reordered);
+    });
+}
+
+void DrawingSearchIndex::merge(const std::vector<std::string> &updatedNumbers, std::vector<Row> &&rows,
+                               const ComponentHandles *handles) {
+    size_t existingCount = summaries.size();
+
+    // Find the drawings' old rows, if they were already in the index
+    std::vector<uint8_t> replaced(existingCount, false);
+    for (const std::string &drawingNumber : updatedNumbers) {
+        std::string key = sortKey(drawingNumber);
+        std::pair<std::vector<std::string>::iterator, std::vector<std::string>::iterator> existing =
+            std::equal_range(sortKeys.begin(), sortKeys.end(), key, std::greater<>());
+        std::string upperNumber = upperCase(drawingNumber);
+        for (size_t position = existing.first - sortKeys.begin(); position < existing.second - sortKeys.begin();
+             position++) {
+            replaced[position] |= drawingNumbers[position] == upperNumber;
+        }
+    }
+
+    // The new rows go on the end in order, and are then merged with the rows which are kept, in one pass over every
+    // column rather than one per row
+    std::stable_sort(rows.begin(), rows.end(), [](const Row &a, const Row &b) { return a.sortKey > b.sortKey; });
+    for (Row &row : rows) {
+        append(std::move(row));
+    }
+
+    std::vector<size_t> kept, added;
+    kept.reserve(existingCount);
+    for (size_t position = 0; position < existingCount; position++) {
+        if (!replaced[position]) {
+            kept.push_back(position);
+        }
+    }
+    for (size_t position = existingCount; position < summaries.size(); position++) {
+        added.push_back(position);
+    }
+
+    // Rows with the same key as one already in the index go after it
+    std::vector<size_t> order;
+    order.reserve(kept.size() + added.size());
+    std::merge(kept.begin(), kept.end(), added.begin(), added.end(), std::back_inserter(order),
+               [this](size_t a, size_t b) { return sortKeys[a] > sortKeys[b]; });
+    reorder(order);
+
+    if (handles != nullptr) {
+        for (size_t position = 0; position < order.size(); position++) {
+            if (order[position] >= existingCount) {
+                resolveHandles(position, *handles);
+            }
+        }
+    }
+}
+
+std::vector<unsigned> DrawingSearchIndex::scan(const DatabaseSearchQuery &query, size_t begin, size_t end) const {
+    std::vector<uint8_t> mask(resolved.begin() + begin, resolved.begin() + end);
+
+    // Each filter mirrors the condition DatabaseSearchQuery::toSQLQueryString adds for the same parameter. Conditions
+    // are combined with & and | rather than && and ||, so they don't branch.
+    if (query.drawingNumber.has_value()) {
+        std::string prefix = upperCase(*query.drawingNumber);
+        filter(mask, begin, end, [&](size_t i) { return drawingNumbers[i].compare(0, prefix.size(), prefix) == 0; });
+    }
+    if (query.width.has_value()) {
+        float lower = query.width->lowerBound, upper = query.width->upperBound;
+        filter(mask, begin, end, [&](size_t i) { return (widths[i] >= lower) & (widths[i] <= upper); });
+    }
+    if (query.length.has_value()) {
+        float lower = query.length->lowerBound, upper = query.length->upperBound;
+        filter(mask, begin, end, [&](size_t i) { return (lengths[i] >= lower) & (lengths[i] <= upper); });
+    }
+    if (query.productType.has_value()) {
+        unsigned productID = query.productType->componentID();
+        filter(mask, begin, end, [&](size_t i) { return productIDs[i] == productID; });
+    }
+    if (query.numberOfBars.has_value()) {
+        uint8_t bars = *query.numberOfBars;
+        filter(mask, begin, end, [&](size_t i) { return barCounts[i] == bars; });
+    }
+    if (query.aperture.has_value()) {
+        unsigned apertureID = query.aperture->componentID();
+        filter(mask, begin, end, [&](size_t i) { return apertureIDs[i] == apertureID; });
+    }
+    if (query.topThickness.has_value()) {
+        unsigned top = query.topThickness->componentID();
+        if (!query.bottomThickness.has_value()) {
+            // Either layer may match
+            filter(mask, begin, end, [&](size_t i) {
+                return ((thicknessCounts[i] > 0) & (thicknessIDs[0][i] == top)) |
+                       ((thicknessCounts[i] > 1) & (thicknessIDs[1][i] == top));
+            });
+        } else {
+            unsigned bottom = query.bottomThickness->componentID();
+            filter(mask, begin, end, [&](size_t i) {
+                return (thicknessCounts[i] > 1) & (thicknessIDs[0][i] == top) & (thicknessIDs[1][i] == bottom);
+            });
+        }
+    }
+    if (query.dateRange.has_value()) {
+        const Date &lowerDate = query.dateRange->lowerBound, &upperDate = query.dateRange->upperBound;
+        uint32_t lower = lowerDate.year * 10000u + lowerDate.month * 100u + lowerDate.day;
+        uint32_t upper = upperDate.year * 10000u + upperDate.month * 100u + upperDate.day;
+        filter(mask, begin, end, [&](size_t i) { return (dates[i] >= lower) & (dates[i] <= upper); });
+    }
+    if (query.sideIronType.has_value() || query.sideIronLength.has_value()) {
+        // A drawing matches if either of its side irons does
+        auto sideIronMatches = [&](unsigned side, size_t i) {
+            bool matches = sideIronCounts[i] > side;
+            if (query.sideIronType.has_value()) {
+                if (*query.sideIronType == SideIronType::None) {
+                    matches &= sideIronIDs[side][i] == 1;
+                } else {
+                    matches &= sideIronTypes[side][i] == (uint8_t) *query.sideIronType;
+                }
+            }
+            if (query.sideIronLength.has_value()) {
+                matches &= sideIronLengths[side][i] == *query.sideIronLength;
+            }
+            return matches;
+        };
+        filter(mask, begin, end, [&](size_t i) { return sideIronMatches(0, i) | sideIronMatches(1, i); });
+    }
+
+    // Laps are filtered by how many of the drawing's laps match the width and attachment. Only drawings with at least
+    // one matching lap are considered, unless neither is searched on, in which case every lap counts.
+    auto filterLaps = [&](const std::vector<uint8_t> &counts, const std::vector<float> *lapWidths,
+                          const std::vector<uint8_t> *attachments, const std::optional<LapSetting> &mode,
+                          const std::optional<ValueRange<unsigned>> &width,
+                          const std::optional<LapAttachment> &attachment) {
+        if (!mode.has_value() && !width.has_value() && !attachment.has_value()) {
+            return;
+        }
+        bool restricted = width.has_value() || attachment.has_value();
+        float lower = width.has_value() ? width->lowerBound : 0;
+        float upper = width.has_value() ? width->upperBound : 0;
+        uint8_t attachmentCode = attachment.has_value() ? LAP_ATTACHMENT_CODE(*attachment) : 0;
+        unsigned required = mode.has_value() ? (unsigned) *mode : 0;
+
+        auto lapMatches = [&](unsigned lap, size_t i) {
+            bool matches = counts[i] > lap;
+            if (width.has_value()) {
+                matches &= (lapWidths[lap][i] >= lower) & (lapWidths[lap][i] <= upper);
+            }
+            if (attachment.has_value()) {
+                matches &= attachments[lap][i] == attachmentCode;
+            }
+            return matches;
+        };
+
+        filter(mask, begin, end, [&](size_t i) {
+            unsigned matching = restricted ? lapMatches(0, i) + lapMatches(1, i) : counts[i];
+            bool matches = !restricted | (matching > 0);
+            if (mode.has_value()) {
+                matches &= matching == required;
+            }
+            return matches;
+        });
+    };
+    filterLaps(sidelapCounts, sidelapWidths, sidelapAttachments, query.sidelapMode, query.sidelapWidth,
+               query.sidelapAttachment);
+    filterLaps(overlapCounts, overlapWidths, overlapAttachments, query.overlapMode, query.overlapWidth,
+               query.overlapAttachment);
+
+    if (query.machine.has_value() || query.manufacturer.has_value() || query.quantityOnDeck.has_value() ||
+        query.position.has_value() || query.machineDeck.has_value()) {
+        filter(mask, begin, end, [&](size_t i) { return hasTemplate[i]; });
+
+        if (query.machine.has_value()) {
+            unsigned machineID = query.machine->componentID();
+            filter(mask, begin, end, [&](size_t i) { return machineIDs[i] == machineID; });
+        }
+        if (query.manufacturer.has_value()) {
+            // A manufacturer no drawing has never matches, including drawings whose manufacturer isn't known
+            unsigned manufacturer = manufacturerID(upperCase(*query.manufacturer));
+            filter(mask, begin, end,
+                   [&](size_t i) { return (manufacturer != 0) & (manufacturerIDs[i] == manufacturer); });
+        }
+        if (query.quantityOnDeck.has_value()) {
+            uint8_t quantity = *query.quantityOnDeck;
+            filter(mask, begin, end, [&](size_t i) { return quantitiesOnDeck[i] == quantity; });
+        }
+        if (query.position.has_value()) {
+            std::string prefix = upperCase(*query.position);
+            filter(mask, begin, end, [&](size_t i) { return positions[i].compare(0, prefix.size(), prefix) == 0; });
+        }
+        if (query.machineDeck.has_value()) {
+            unsigned deckID = query.machineDeck->componentID();
+            filter(mask, begin, end, [&](size_t i) { return deckIDs[i] == deckID; });
+        }
+    }
+
+    std::vector<unsigned> matches;
+    for (size_t i = begin; i < end; i++) {
+        if (mask[i - begin]) {
+            matches.push_back(i);
+        }
+    }
+    return matches;
+}
+
+std::string DrawingSearchIndex::sortKey(const std::string &drawingNumber) {
+    std::string key = upperCase(drawingNumber);
+
+    // Matches ^[A-Z][0-9]{2,}[A-Z]?$
+    size_t digits = 0;
+    while (1 + digits < key.size() && std::isdigit((unsigned char) key[1 + digits])) {
+        digits++;
+    }
+    bool singleLetter = false;
+    if (!key.empty() && std::isalpha((unsigned char) key[0]) && digits >= 2) {
+        size_t suffix = key.size() - 1 - digits;
+        singleLetter = suffix == 0 || (suffix == 1 && std::isalpha((unsigned char) key.back()));
+    }
+
+    return singleLetter ? "0" + key : key;
+}
+
+unsigned DrawingSearchIndex::manufacturerID(const std::string &name) const {
+    std::unordered_map<std::string, unsigned>::const_iterator manufacturer = manufacturers.find(name);
+    return manufacturer == manufacturers.end() ? 0 : manufacturer->second;
+}
@@ -0,0 +1,96 @@
+#include "../../include/database/SearchResultCache.h"
+
+SearchResultCache::SearchResultCache(size_t capacity, std::chrono::seconds lifetime)
+    : capacity(capacity), lifetime(lifetime) {
+}
+
+std::shared_ptr<const std::vector<unsigned char>> SearchResultCache::find(const std::string &query) {
+    std::lock_guard<std::mutex> guard(cacheMutex);
+
+    std::unordered_map<std::string, Entry>::iterator it = entries.find(query);
+    if (it == entries.end()) {
+        counters.misses++;
+        return nullptr;
+    }
+
+    if (it->second.expiry <= std::chrono::steady_clock::now()) {
+        erase(it);
+        counters.expirations++;
+        counters.misses++;
+        return nullptr;
+    }
+
+    counters.hits++;
+    usageOrder.splice(usageOrder.end(), usageOrder, it->second.usage);
+    return it->second.response;
+}
+
+SearchResultCache::Generation SearchResultCache::generation() {
+    std::lock_guard<std::mutex> guard(cacheMutex);
+    return currentGeneration;
+}
+
+void SearchResultCache::insert(const std::string &query, std::vector<unsigned char> &&response,
+                               Generation readGeneration) {
+    std::lock_guard<std::mutex> guard(cacheMutex);
+
+    size_t size = entrySize(query, response);
+
+    // The drawings changed while the search was running, so its result may already be out of date
+    if (readGeneration != currentGeneration || size > capacity) {
+        return;
+    }
+
+    std::unordered_map<std::string, Entry>::iterator it = entries.find(query);
+    if (it != entries.end()) {
+        erase(it);
+    }
+
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+    while (counters.bytes + size > capacity) {
+        it = entries.find(usageOrder.front());
+        if (it->second.expiry <= now) {
+            counters.expirations++;
+        } else {
+            counters.evictions++;
+        }
+        erase(it);
+    }
+
+    counters.bytes += size;
+    usageOrder.push_back(query);
+    entries[query] = {std::make_shared<const std::vector<unsigned char>>(std::move(response)), now + lifetime,
+                      std::prev(usageOrder.end())};
+}
+
+void SearchResultCache::clear() {
+    std::lock_guard<std::mutex> guard(cacheMutex);
+
+    currentGeneration++;
+
+    counters.invalidations += entries.size();
+    counters.bytes = 0;
+    entries.clear();
+    usageOrder.clear();
+}
+
+SearchResultCache::Metrics SearchResultCache::metrics() {
+    std::lock_guard<std::mutex> guard(cacheMutex);
+
+    Metrics snapshot = counters;
+    snapshot.entries = entries.size();
+    snapshot.capacity = capacity;
+    return snapshot;
+}
+
+void SearchResultCache::erase(std::unordered_map<std::string, Entry>::iterator entry) {
+    counters.bytes -= entrySize(entry->first, *entry->second.response);
+    usageOrder.erase(entry->second.usage);
+    entries.erase(entry);
+}
+
+size_t SearchResultCache::entrySize(const std::string &query, const std::vector<unsigned char> &response) {
+    // The query is held twice: as the key, and in the usage order
+    return 2 * query.size() + response.size();
+}
@@ -0,0 +1,325 @@
+#include "../../include/database/SessionPool.h"
+
+#include <algorithm>
+#include <exception>
+#include <cctype>
+#include <cstdlib>
+#include <iterator>
+
+SessionPool::Lease::Lease(SessionPool &pool, std::unique_ptr<mysqlx::Session> &&session)
+    : pool(&pool), session(std::move(session)) {
+    uncaughtExceptions = std::uncaught_exceptions();
+}
+
+SessionPool::Lease::Lease(Lease &&other) noexcept
+    : pool(other.pool), session(std::move(other.session)), discarded(other.discarded),
+      uncaughtExceptions(other.uncaughtExceptions) {
+    other.pool = nullptr;
+}
+
+SessionPool::Lease::~Lease() {
+    if (!pool || !session) {
+        return;
+    }
+    // If this lease is being destroyed during stack unwinding, whatever was done with the session threw, so it can't be
+    // trusted to be clean (or connected)
+    bool unwinding = std::uncaught_exceptions() > uncaughtExceptions;
+    pool->release(std::move(session), discarded || unwinding);
+}
+
+mysqlx::Session &SessionPool::Lease::operator*() {
+    return *session;
+}
+
+mysqlx::Session *SessionPool::Lease::operator->() {
+    return session.get();
+}
+
+void SessionPool::Lease::discard() {
+    discarded = true;
+}
+
+SessionPool::SessionPool(const std::string &host, unsigned port, const std::string &user, const std::string &password,
+                         unsigned minSessions, unsigned maxSessions, std::chrono::milliseconds checkoutTimeout,
+                         std::chrono::milliseconds keepaliveInterval)
+    : client(mysqlx::SessionOption::HOST, host, mysqlx::SessionOption::PORT, port, mysqlx::SessionOption::USER, user,
+             mysqlx::SessionOption::PWD, password, mysqlx::ClientOption::POOLING, true,
+             mysqlx::ClientOption::POOL_MAX_SIZE, maxSessions, mysqlx::ClientOption::POOL_QUEUE_TIMEOUT,
+             (unsigned) checkoutTimeout.count()),
+      minSessions(std::min(minSessions, maxSessions)), maxSessions(maxSessions), checkoutTimeout(checkoutTimeout),
+      keepaliveInterval(keepaliveInterval) {
+    // Open the minimum number of sessions up front, so the first requests don't pay for the connection handshake
+    for (unsigned i = 0; i < this->minSessions; i++) {
+        idleSessions.push_back(
+            {std::make_unique<mysqlx::Session>(client.getSession()), std::chrono::steady_clock::now()});
+    }
+
+    keepaliveThread = std::thread(&SessionPool::keepaliveLoop, this);
+}
+
+SessionPool::~SessionPool() {
+    close();
+}
+
+SessionPool::Lease SessionPool::checkout() {
+    std::unique_lock<std::mutex> lock(poolMutex);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    // Wait until there is either an idle session, or room to open a new one
+    bool available = sessionAvailable.wait_for(
+        lock, checkoutTimeout, [this]() { return closed || !idleSessions.empty() || activeSessions < maxSessions; });
+
+    double waitMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    counters.totalWaitMs += waitMs;
+    counters.maxWaitMs = std::max(counters.maxWaitMs, waitMs);
+
+    if (closed) {
+        counters.failedCheckouts++;
+        throw mysqlx::Error("Session pool is closed");
+    }
+    if (!available) {
+        counters.failedCheckouts++;
+        throw mysqlx::Error("Timed out waiting for a database session");
+    }
+
+    std::unique_ptr<mysqlx::Session> session;
+
+    if (!idleSessions.empty()) {
+        session = std::move(idleSessions.back().session);
+        idleSessions.pop_back();
+        activeSessions++;
+    } else {
+        // Reserve the slot before opening the session, so the (slow) connection can be made without holding the lock
+        activeSessions++;
+        lock.unlock();
+
+        try {
+            session = std::make_unique<mysqlx::Session>(client.getSession());
+        } catch (mysqlx::Error &) {
+            lock.lock();
+            activeSessions--;
+            counters.failedCheckouts++;
+            lock.unlock();
+            sessionAvailable.notify_one();
+            throw;
+        }
+
+        lock.lock();
+    }
+
+    counters.checkouts++;
+
+    return Lease(*this, std::move(session));
+}
+
+void SessionPool::close() {
+    std::vector<IdleSession> sessions;
+    {
+        std::lock_guard<std::mutex> guard(poolMutex);
+        if (closed) {
+            return;
+        }
+        closed = true;
+        sessions.swap(idleSessions);
+    }
+    sessionAvailable.notify_all();
+    keepaliveCondition.notify_all();
+
+    if (keepaliveThread.joinable()) {
+        keepaliveThread.join();
+    }
+
+    for (IdleSession &idle : sessions) {
+        closeSession(*idle.session);
+    }
+
+    try {
+        client.close();
+    } catch (mysqlx::Error &) {
+    }
+}
+
+SessionPool::Metrics SessionPool::metrics() {
+    std::lock_guard<std::mutex> guard(poolMutex);
+
+    Metrics snapshot = counters;
+    snapshot.activeSessions = activeSessions;
+    snapshot.idleSessions = idleSessions.size();
+    return snapshot;
+}
+
+void SessionPool::release(std::unique_ptr<mysqlx::Session> &&session, bool discard) {
+    {
+        std::lock_guard<std::mutex> guard(poolMutex);
+        activeSessions--;
+
+        if (!discard && !closed) {
+            idleSessions.push_back({std::move(session), std::chrono::steady_clock::now()});
+        } else if (discard) {
+            counters.discardedSessions++;
+        }
+    }
+    sessionAvailable.notify_one();
+
+    // Anything not handed back to the idle list is closed outside the lock
+    if (session) {
+        closeSession(*session);
+    }
+}
+
+void SessionPool::closeSession(mysqlx::Session &session) {
+    try {
+        session.close();
+    } catch (mysqlx::Error &) {
+    }
+}
+
+bool SessionPool::isConnectionError(const mysqlx::Error &error) {
+    // MySQL client errors for a connection which couldn't be made or has gone, and server errors for a session which
+    // the server has ended
+    static const long connectionCodes[] = {
+        2002, // CR_CONNECTION_ERROR
+        2003, // CR_CONN_HOST_ERROR
+        2006, // CR_SERVER_GONE_ERROR
+        2013, // CR_SERVER_LOST
+        2055, // CR_SERVER_LOST_EXTENDED
+        1053, // ER_SERVER_SHUTDOWN
+        1927, // ER_CONNECTION_KILLED
+        3169, // ER_SESSION_WAS_KILLED
+        4031, // ER_CLIENT_INTERACTION_TIMEOUT
+    };
+    // Socket errors, which the connector reports in the generic and system categories
+    static const long socketCodes[] = {
+        32,    // EPIPE
+        103,   // ECONNABORTED
+        104,   // ECONNRESET
+        107,   // ENOTCONN
+        110,   // ETIMEDOUT
+        111,   // ECONNREFUSED
+        10053, // WSAECONNABORTED
+        10054, // WSAECONNRESET
+        10057, // WSAENOTCONN
+        10060, // WSAETIMEDOUT
+        10061, // WSAECONNREFUSED
+    };
+
+    std::string category;
+    long code;
+    if (!errorCode(error, category, code)) {
+        return false;
+    }
+
+    if (category == "generic" || category == "system" || category == "posix") {
+        return std::find(std::begin(socketCodes), std::end(socketCodes), code) != std::end(socketCodes);
+    }
+    return std::find(std::begin(connectionCodes), std::end(connectionCodes), code) != std::end(connectionCodes);
+}
+
+bool SessionPool::errorCode(const mysqlx::Error &error, std::string &category, long &code) {
+    // mysqlx::Error doesn't expose the code of the error it wraps, but the connector always writes it into the
+    // description: server and client errors as "MySQL Error 2013: ...", and errors from its own layers as
+    // "... (category:code)"
+    std::string message = error.what();
+
+    const std::string serverPrefix = "MySQL Error ";
+    size_t serverCode = message.find(serverPrefix);
+    if (serverCode != std::string::npos) {
+        const char *start = message.c_str() + serverCode + serverPrefix.size();
+        char *end;
+        code = std::strtol(start, &end, 10);
+        if (end != start) {
+            category = "mysql";
+            return true;
+        }
+    }
+
+    size_t close = message.rfind(')');
+    size_t colon = message.rfind(':', close);
+    size_t open = message.rfind('(', colon);
+    if (close == std::string::npos || colon == std::string::npos || open == std::string::npos || colon + 1 == close) {
+        return false;
+    }
+    for (size_t i = colon + 1; i < close; i++) {
+        if (!std::isdigit((unsigned char) message[i]) && !(i == colon + 1 && message[i] == '-')) {
+            return false;
+        }
+    }
+    category = message.substr(open + 1, colon - open - 1);
+    code = std::strtol(message.c_str() + colon + 1, nullptr, 10);
+    return true;
+}
+
+void SessionPool::keepaliveLoop() {
+    std::unique_lock<std::mutex> lock(poolMutex);
+
+    while (!closed) {
+        keepaliveCondition.wait_for(lock, keepaliveInterval, [this]() { return closed; });
+        if (closed) {
+            return;
+        }
+
+        // Take every session which has been idle for at least the interval. These are counted as active while they are
+        // out, so the pool doesn't exceed its maximum size.
+        std::chrono::steady_clock::time_point cutoff = std::chrono::steady_clock::now() - keepaliveInterval;
+        std::vector<std::unique_ptr<mysqlx::Session>> stale;
+
+        std::vector<IdleSession>::iterator fresh =
+            std::stable_partition(idleSessions.begin(), idleSessions.end(),
+                                  [&cutoff](const IdleSession &idle) { return idle.idleSince < cutoff; });
+        for (std::vector<IdleSession>::iterator it = idleSessions.begin(); it != fresh; it++) {
+            stale.push_back(std::move(it->session));
+        }
+        idleSessions.erase(idleSessions.begin(), fresh);
+        activeSessions += stale.size();
+
+        // Open enough sessions to bring the pool back up to the minimum, for example after sessions were discarded
+        // because the server went away
+        unsigned missing = 0;
+        if (activeSessions + idleSessions.size() < minSessions) {
+            missing = minSessions - activeSessions - idleSessions.size();
+        }
+        activeSessions += missing;
+
+        lock.unlock();
+
+        std::vector<std::unique_ptr<mysqlx::Session>> alive;
+        unsigned long long pings = stale.size(), discarded = 0;
+
+        for (std::unique_ptr<mysqlx::Session> &session : stale) {
+            try {
+                session->sql("SELECT 1").execute();
+                alive.push_back(std::move(session));
+            } catch (mysqlx::Error &) {
+                closeSession(*session);
+                discarded++;
+            }
+        }
+
+        for (unsigned i = 0; i < missing; i++) {
+            try {
+                alive.push_back(std::make_unique<mysqlx::Session>(client.getSession()));
+            } catch (mysqlx::Error &) {
+                // The server is still unreachable, so try again next interval
+            }
+        }
+
+        lock.lock();
+
+        activeSessions -= stale.size() + missing;
+        counters.keepalivePings += pings;
+        counters.discardedSessions += discarded;
+
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        for (std::unique_ptr<mysqlx::Session> &session : alive) {
+            if (closed) {
+                closeSession(*session);
+            } else {
+                // Pinged sessions go to the front, so recently used ones are still preferred by checkouts
+                idleSessions.insert(idleSessions.begin(), {std::move(session), now});
+            }
+        }
+
+        sessionAvailable.notify_all();
+    }
+}
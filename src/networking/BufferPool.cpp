@@ -0,0 +1,95 @@
+#include "../../include/networking/BufferPool.h"
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <cstdlib>
+#include <cstdint>
+
+// Every buffer is preceded by a header recording its size class, so it can be released without its size. The header is
+// padded to keep the buffer itself 16 byte aligned.
+struct alignas(16) BufferHeader {
+    uint32_t sizeClass;
+};
+
+// The size class recorded for buffers too large to pool
+#define UNPOOLED_SIZE_CLASS BUFFER_POOL_SIZE_CLASSES
+
+struct SizeClass {
+    std::mutex mutex;
+    std::vector<BufferHeader *> freeBuffers;
+};
+
+// Never destroyed, so messages released while other statics are being destroyed at exit still have a pool to return to
+static SizeClass *const sizeClasses = new SizeClass[BUFFER_POOL_SIZE_CLASSES];
+
+// Totals across every size class, reported through BufferPool::counters
+static std::atomic<unsigned long long> poolHits = 0, poolMisses = 0;
+static std::atomic<size_t> poolBytesHeld = 0;
+
+static size_t sizeClassBytes(uint32_t sizeClass) {
+    return (size_t) BUFFER_POOL_MIN_SIZE << sizeClass;
+}
+
+// Finds the smallest size class which fits the size, or UNPOOLED_SIZE_CLASS if none do
+static uint32_t sizeClassFor(size_t size) {
+    uint32_t sizeClass = 0;
+    while (sizeClass < BUFFER_POOL_SIZE_CLASSES && sizeClassBytes(sizeClass) < size) {
+        sizeClass++;
+    }
+    return sizeClass;
+}
+
+void *BufferPool::acquire(size_t size) {
+    uint32_t sizeClass = sizeClassFor(size);
+
+    if (sizeClass != UNPOOLED_SIZE_CLASS) {
+        SizeClass &pooled = sizeClasses[sizeClass];
+        std::lock_guard<std::mutex> guard(pooled.mutex);
+
+        if (!pooled.freeBuffers.empty()) {
+            BufferHeader *header = pooled.freeBuffers.back();
+            pooled.freeBuffers.pop_back();
+
+            poolHits.fetch_add(1, std::memory_order_relaxed);
+            poolBytesHeld.fetch_sub(sizeClassBytes(sizeClass), std::memory_order_relaxed);
+
+            return header + 1;
+        }
+    }
+
+    poolMisses.fetch_add(1, std::memory_order_relaxed);
+
+    size_t allocationSize = sizeClass == UNPOOLED_SIZE_CLASS ? size : sizeClassBytes(sizeClass);
+    BufferHeader *header = (BufferHeader *) malloc(sizeof(BufferHeader) + allocationSize);
+    header->sizeClass = sizeClass;
+
+    return header + 1;
+}
+
+void BufferPool::release(void *buffer) {
+    if (!buffer) {
+        return;
+    }
+
+    BufferHeader *header = (BufferHeader *) buffer - 1;
+
+    if (header->sizeClass != UNPOOLED_SIZE_CLASS) {
+        SizeClass &pooled = sizeClasses[header->sizeClass];
+        size_t bytes = sizeClassBytes(header->sizeClass);
+        std::lock_guard<std::mutex> guard(pooled.mutex);
+
+        if (pooled.freeBuffers.empty() || (pooled.freeBuffers.size() + 1) * bytes <= BUFFER_POOL_CLASS_LIMIT) {
+            pooled.freeBuffers.push_back(header);
+            poolBytesHeld.fetch_add(bytes, std::memory_order_relaxed);
+            return;
+        }
+    }
+
+    free(header);
+}
+
+BufferPool::Counters BufferPool::counters() {
+    return {poolHits.load(std::memory_order_relaxed), poolMisses.load(std::memory_order_relaxed),
+            poolBytesHeld.load(std::memory_order_relaxed)};
+}
@@ -4,6 +4,48 @@
 
 #include "../../include/networking/Client.h"
 
+#include <algorithm>
+
+// Reads the wire format advertised by the server after the session token in
+// step 4 of the handshake, or V1 if the server is too old to advertise one
+static WireFormat advertisedWireFormat(const uint8 *advert) {
+  uint32 magic;
+  memcpy(&magic, advert, sizeof(uint32));
+  if (magic != WIRE_FORMAT_ADVERT_MAGIC) {
+    return WireFormat::V1;
+  }
+
+  // Use the newest format both of us support
+  uint8 format = advert[sizeof(uint32)];
+  return (WireFormat)std::clamp(format, (uint8)WireFormat::V1,
+                                (uint8)LATEST_WIRE_FORMAT);
+}
+
+// Reads the features the server offers alongside its wire format. Features
+// need a format newer than V1, so none are offered with V1.
+static uint8 advertisedFeatures(const uint8 *advert, WireFormat format) {
+  if (format == WireFormat::V1) {
+    return 0;
+  }
+  // Only ask for the features we know about
+  return advert[sizeof(uint32) + sizeof(WireFormat)] &
+         (WIRE_FEATURE_COMPRESSION | WIRE_FEATURE_RESUMPTION |
+          WIRE_FEATURE_REQUEST_IDS);
+}
+
+// Packs the wire format and features we have chosen into the auth mode sent in
+// step 5. Servers which didn't advertise a newer format are sent the plain
+// auth mode.
+static uint32 authModeWithWireFormat(AuthMode mode, WireFormat format,
+                                     uint8 features) {
+  uint32 value = (uint32)mode;
+  if (format != WireFormat::V1) {
+    value |= (uint32)format << AUTH_MODE_WIRE_FORMAT_SHIFT;
+    value |= (uint32)features << AUTH_MODE_FEATURES_SHIFT;
+  }
+  return value;
+}
+
 Client::Client(float refreshRate, RSAKeyPair clientKey,
                DigitalSignatureKeyPair::Public serverSignature) {
   this->refreshRate = refreshRate;
@@ -11,12 +53,34 @@ Client::Client(float refreshRate, RSAKeyPair clientKey,
   this->serverSignature = serverSignature;
 }
 
-Client::~Client() { clientSocket.closeSocket(); }
+RequestError::RequestError(Reason reason)
+    : std::runtime_error(reason == Reason::TIMED_OUT   ? "Request timed out"
+                         : reason == Reason::CANCELLED ? "Request cancelled"
+                                                       : "Client disconnected"),
+      failureReason(reason) {}
+
+RequestError::Reason RequestError::reason() const { return failureReason; }
+
+Client::~Client() {
+  clientSocket.closeSocket();
+}
 
 void Client::heartbeat() { clientSocket.heartbeat(); }
 
 bool Client::hasFullAccess() const { return access == ClientAccess::FULL; }
 
+void Client::setCompressionEnabled(bool enabled) {
+  compressionEnabled = enabled;
+}
+
+void Client::setSessionResumptionEnabled(bool enabled) {
+  resumptionEnabled = enabled;
+}
+
+std::optional<SessionResumption> Client::sessionResumption() const {
+  return resumption;
+}
+
 void Client::initialiseClient() {
   // If we already have a client socket, don't create another
   if (clientSocket.open()) {
@@ -129,6 +193,16 @@ Client::ConnectionStatus Client::connectToServer(
   memcpy(&sessionToken,
          responseData + sizeof(uint32) + sizeof(uint64) + sizeof(AESKey),
          sizeof(uint64));
+  const uint8 *advert = responseData + sizeof(uint32) + sizeof(uint64) +
+                        sizeof(AESKey) + sizeof(uint64);
+  WireFormat wireFormat = advertisedWireFormat(advert);
+  uint8 features = advertisedFeatures(advert, wireFormat);
+  if (!compressionEnabled) {
+    features &= ~WIRE_FEATURE_COMPRESSION;
+  }
+  if (!resumptionEnabled) {
+    features &= ~WIRE_FEATURE_RESUMPTION;
+  }
 
   if (responseChallenge != *challenge) {
     clientSocket.closeSocket();
@@ -151,7 +225,9 @@ Client::ConnectionStatus Client::connectToServer(
   unsigned char *authMessageBuff =
       (unsigned char *)alloca(sizeof(AuthMode) + authToken.size());
 
-  *((AuthMode *)authMessageBuff) = AuthMode::JWT;
+  uint32 authMode =
+      authModeWithWireFormat(AuthMode::JWT, wireFormat, features);
+  memcpy(authMessageBuff, &authMode, sizeof(AuthMode));
   memcpy(authMessageBuff + sizeof(AuthMode), authToken.c_str(),
          authToken.size());
 
@@ -170,11 +246,8 @@ Client::ConnectionStatus Client::connectToServer(
 
       switch (response) {
         case ConnectionResponse::SUCCESS:
-          access = ClientAccess::LIMITED;
-          return ConnectionStatus::SUCCESS;
-          break;
         case ConnectionResponse::SUCCESS_ADMIN:
-          access = ClientAccess::FULL;
+          finishConnecting(response, wireFormat, features);
           return ConnectionStatus::SUCCESS;
         case ConnectionResponse::FAILED:
           return ConnectionStatus::INVALID_JWT;
@@ -275,6 +348,16 @@ Client::ConnectionStatus Client::connectWithToken(const std::string &ipAddress,
   memcpy(&sessionToken,
          responseData + sizeof(uint32) + sizeof(uint64) + sizeof(AESKey),
          sizeof(uint64));
+  const uint8 *advert = responseData + sizeof(uint32) + sizeof(uint64) +
+                        sizeof(AESKey) + sizeof(uint64);
+  WireFormat wireFormat = advertisedWireFormat(advert);
+  uint8 features = advertisedFeatures(advert, wireFormat);
+  if (!compressionEnabled) {
+    features &= ~WIRE_FEATURE_COMPRESSION;
+  }
+  if (!resumptionEnabled) {
+    features &= ~WIRE_FEATURE_RESUMPTION;
+  }
 
   if (responseChallenge != *challenge) {
     clientSocket.closeSocket();
@@ -289,7 +372,9 @@ Client::ConnectionStatus Client::connectWithToken(const std::string &ipAddress,
   unsigned char *authMessageBuff =
       (unsigned char *)alloca(sizeof(AuthMode) + sizeof(uint256));
 
-  *((AuthMode *)authMessageBuff) = AuthMode::REPEAT_TOKEN;
+  uint32 authMode =
+      authModeWithWireFormat(AuthMode::REPEAT_TOKEN, wireFormat, features);
+  memcpy(authMessageBuff, &authMode, sizeof(AuthMode));
   memcpy(authMessageBuff + sizeof(AuthMode), &repeatToken, sizeof(uint256));
 
   EncryptedNetworkMessage authMessage(
@@ -307,10 +392,8 @@ Client::ConnectionStatus Client::connectWithToken(const std::string &ipAddress,
 
       switch (response) {
         case ConnectionResponse::SUCCESS:
-          access = ClientAccess::LIMITED;
-          return ConnectionStatus::SUCCESS;
         case ConnectionResponse::SUCCESS_ADMIN:
-          access = ClientAccess::FULL;
+          finishConnecting(response, wireFormat, features);
           return ConnectionStatus::SUCCESS;
         case ConnectionResponse::FAILED:
           return ConnectionStatus::INVALID_REPEAT_TOKEN;
@@ -321,6 +404,155 @@ Client::ConnectionStatus Client::connectWithToken(const std::string &ipAddress,
   return ConnectionStatus::INVALID_JWT;
 }
 
+Client::ConnectionStatus Client::resumeSession(
+    const std::string &ipAddress, unsigned port,
+    const SessionResumption &resumption) {
+  if (!safeGuardTCPSocketCode(clientSocket.connectToServer(ipAddress, port))) {
+    clientSocket.closeSocket();
+    return ConnectionStatus::NO_CONNECTION;
+  }
+
+  // Protocol description found in the server resumeClient method.
+  //
+  // 1. C -> S: TK, {NC, TK, F}_R
+  //    if TK unknown or expired, or the proof is invalid:
+  //      S -> C: ERROR
+  //      server terminates connection
+  // 2. S -> C: {NC, K, T, response, F}_R, TK'
+  //    if NC invalid:
+  //      client terminates connection
+  //      end
+  // Both communicate with the new AES key K from here, with messages starting
+  // with token
+
+  // 1: Send the ticket, then prove we know the key it was issued with
+  uint64 challenge;
+  CryptoSafeRandom::random(&challenge, sizeof(uint64));
+  WireFormat requestedFormat = LATEST_WIRE_FORMAT;
+  uint8 requestedFeatures = WIRE_FEATURE_REQUEST_IDS;
+  if (compressionEnabled) {
+    requestedFeatures |= WIRE_FEATURE_COMPRESSION;
+  }
+  if (resumptionEnabled) {
+    requestedFeatures |= WIRE_FEATURE_RESUMPTION;
+  }
+
+  // The buffer is padded as the whole of the last AES block is encrypted
+  constexpr uint32 proofSize = sizeof(uint64) + sizeof(uint256) +
+                               sizeof(WireFormat) + sizeof(uint8);
+  uint8 proof[PADDED_SIZE(proofSize, AES_CHUNK_SIZE)]{};
+  memcpy(proof, &challenge, sizeof(uint64));
+  memcpy(proof + sizeof(uint64), &resumption.ticket.id, sizeof(uint256));
+  memcpy(proof + sizeof(uint64) + sizeof(uint256), &requestedFormat,
+         sizeof(WireFormat));
+  memcpy(proof + sizeof(uint64) + sizeof(uint256) + sizeof(WireFormat),
+         &requestedFeatures, sizeof(uint8));
+
+  clientSocket.sendMessage(NetworkMessage(&resumption.ticket,
+                                          sizeof(ResumptionTicket),
+                                          MessageProtocol::RESUME_MESSAGE));
+  clientSocket.sendMessage(
+      EncryptedNetworkMessage(proof, proofSize, resumption.sessionKey));
+
+  // 2: The server either accepts the ticket and sends our new session key, or
+  // tells us it has failed
+  MessageProtocol replyProtocol;
+  EncryptedNetworkMessage responseMessage;
+
+  if (clientSocket.peekProtocol(replyProtocol) != SOCKET_SUCCESS ||
+      replyProtocol != MessageProtocol::AES_MESSAGE ||
+      clientSocket.receiveMessage(responseMessage,
+                                  MessageProtocol::AES_MESSAGE) !=
+          SOCKET_SUCCESS ||
+      responseMessage.error()) {
+    clientSocket.closeSocket();
+    return ConnectionStatus::INVALID_RESUMPTION_TICKET;
+  }
+
+  uint32 responseSize;
+  uint8 *responseData = (uint8 *)responseMessage.decryptMessageData(
+      resumption.sessionKey, responseSize);
+
+  uint64 responseChallenge = 0;
+  ConnectionResponse response = ConnectionResponse::FAILED;
+  WireFormat wireFormat = WireFormat::V1;
+  uint8 features = 0;
+
+  if (responseData != nullptr &&
+      responseSize == sizeof(uint64) + sizeof(AESKey) + sizeof(uint64) +
+                          sizeof(ConnectionResponse) + sizeof(WireFormat) +
+                          sizeof(uint8)) {
+    const uint8 *field = responseData;
+    memcpy(&responseChallenge, field, sizeof(uint64));
+    field += sizeof(uint64);
+    memcpy(&sessionKey, field, sizeof(AESKey));
+    field += sizeof(AESKey);
+    memcpy(&sessionToken, field, sizeof(uint64));
+    field += sizeof(uint64);
+    memcpy(&response, field, sizeof(ConnectionResponse));
+    field += sizeof(ConnectionResponse);
+    memcpy(&wireFormat, field, sizeof(WireFormat));
+    field += sizeof(WireFormat);
+    memcpy(&features, field, sizeof(uint8));
+  }
+  free(responseData);
+
+  if (responseChallenge != challenge) {
+    clientSocket.closeSocket();
+    std::cerr << "ERROR::Client.cpp: Returned challenge from server incorrect. "
+                 "Server failed to authenticate itself."
+              << std::endl;
+    return ConnectionStatus::CREDS_EXCHANGE_FAILED;
+  }
+
+  switch (response) {
+    case ConnectionResponse::SUCCESS:
+    case ConnectionResponse::SUCCESS_ADMIN:
+      // Only use what we asked for, whatever the server says
+      wireFormat = (WireFormat)std::clamp(
+          (uint8)wireFormat, (uint8)WireFormat::V1, (uint8)LATEST_WIRE_FORMAT);
+      features &= requestedFeatures;
+      if (wireFormat == WireFormat::V1) {
+        features = 0;
+      }
+      finishConnecting(response, wireFormat, features);
+      return ConnectionStatus::SUCCESS;
+    case ConnectionResponse::FAILED:
+      break;
+  }
+
+  clientSocket.closeSocket();
+  return ConnectionStatus::INVALID_RESUMPTION_TICKET;
+}
+
+void Client::finishConnecting(ConnectionResponse response,
+                              WireFormat wireFormat, uint8 features) {
+  access = response == ConnectionResponse::SUCCESS_ADMIN
+               ? ClientAccess::FULL
+               : ClientAccess::LIMITED;
+
+  // The ticket is sent straight after the server accepts us, before either of
+  // us switch format. It is tied to the session key of this connection.
+  resumption.reset();
+  if (features & WIRE_FEATURE_RESUMPTION) {
+    NetworkMessage ticketMessage;
+    if (clientSocket.waitForMessage(ticketMessage,
+                                    MessageProtocol::RESUME_MESSAGE) ==
+            SOCKET_SUCCESS &&
+        !ticketMessage.error()) {
+      SessionResumption issued;
+      memcpy(&issued.ticket, ticketMessage.getMessageData(),
+             sizeof(ResumptionTicket));
+      issued.sessionKey = sessionKey;
+      resumption = issued;
+    }
+  }
+
+  clientSocket.setWireFormat(wireFormat);
+  compression = features & WIRE_FEATURE_COMPRESSION;
+  requestIDs = features & WIRE_FEATURE_REQUEST_IDS;
+}
+
 void Client::disconnect() {
   if (clientSocket.connected()) {
     DisconnectCode code = DisconnectCode::CLIENT_EXIT;
@@ -328,6 +560,9 @@ void Client::disconnect() {
         &code, sizeof(DisconnectCode), MessageProtocol::DISCONNECT_MESSAGE));
   }
   clientSocket.closeSocket();
+
+  // Nothing more will arrive, so let everything still waiting know
+  failRequests(RequestError::Reason::DISCONNECTED);
 }
 
 void Client::startClientLoop() {
@@ -360,20 +595,255 @@ void Client::stopClientLoop() {
   clientLoopThread.join();
 }
 
-void Client::addMessageToSendQueue(const void *message,
-                                   unsigned messageLength) {
-  uint8 *sendBuffer = (uint8 *)alloca(sizeof(uint64) + messageLength);
+RequestID Client::addMessageToSendQueue(const void *message,
+                                        unsigned messageLength) {
+  RequestID requestID = newRequestID();
+  addMessageToSendQueue(message, messageLength, requestID);
+  return requestID;
+}
+
+void Client::addMessageToSendQueue(const void *message, unsigned messageLength,
+                                   RequestID requestID) {
+  // Requests start with our session token, then their ID if this connection
+  // tags them
+  unsigned headerSize = sizeof(uint64);
+  if (requestIDs) {
+    headerSize += sizeof(RequestID);
+  }
+
+  uint8 *sendBuffer = (uint8 *)alloca(headerSize + messageLength);
   memcpy(sendBuffer, &sessionToken, sizeof(uint64));
-  memcpy(sendBuffer + sizeof(uint64), message, messageLength);
+  if (requestIDs) {
+    memcpy(sendBuffer + sizeof(uint64), &requestID, sizeof(RequestID));
+  }
+  memcpy(sendBuffer + headerSize, message, messageLength);
+
+  EncryptedNetworkMessage encrypted;
+  std::vector<uint8> compressed;
+  if (compression &&
+      compressPayload(sendBuffer, headerSize + messageLength, compressed)) {
+    encrypted = EncryptedNetworkMessage(compressed.data(), compressed.size(),
+                                        sessionKey);
+    encrypted.setFrameFlags(FRAME_FLAG_COMPRESSED);
+  } else {
+    encrypted = EncryptedNetworkMessage(sendBuffer, headerSize + messageLength,
+                                        sessionKey);
+  }
+
+  // If the queue is full, wait for the client loop to send some of it
+  while (!sendQueue.tryPush(std::move(encrypted))) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+}
+
+RequestID Client::addMessageToSendQueue(const std::string &message) {
+  return addMessageToSendQueue(message.c_str(), message.size());
+}
+
+RequestID Client::newRequestID() {
+  if (!requestIDs) {
+    return NO_REQUEST_ID;
+  }
+
+  return allocateRequestID();
+}
+
+RequestID Client::allocateRequestID() {
+  // Skip NO_REQUEST_ID when the IDs wrap around
+  RequestID requestID;
+  do {
+    requestID = nextRequestID++;
+  } while (requestID == NO_REQUEST_ID);
+
+  return requestID;
+}
+
+PendingResponse<MessageBuffer>
+Client::request(const void *message, unsigned messageLength,
+                std::chrono::milliseconds timeout) {
+  std::shared_ptr<std::promise<MessageBuffer>> promise =
+      std::make_shared<std::promise<MessageBuffer>>();
+  std::future<MessageBuffer> response = promise->get_future();
+
+  RequestID requestID = sendRequest(
+      message, messageLength,
+      [promise](MessageBuffer &&message, std::exception_ptr error) {
+        if (error) {
+          promise->set_exception(error);
+        } else {
+          promise->set_value(std::move(message));
+        }
+      },
+      timeout);
+
+  return {requestID, std::move(response)};
+}
+
+RequestID Client::request(
+    const void *message, unsigned messageLength,
+    const std::function<void(std::future<MessageBuffer> &&)> &onCompletion,
+    std::chrono::milliseconds timeout) {
+  return sendRequest(
+      message, messageLength,
+      [onCompletion](MessageBuffer &&message, std::exception_ptr error) {
+        std::promise<MessageBuffer> promise;
+        if (error) {
+          promise.set_exception(error);
+        } else {
+          promise.set_value(std::move(message));
+        }
+        onCompletion(promise.get_future());
+      },
+      timeout);
+}
+
+bool Client::cancelRequest(RequestID requestID) {
+  PendingRequest cancelled;
+  {
+    std::lock_guard<std::mutex> guard(pendingRequestsMutex);
+    std::map<RequestID, PendingRequest>::iterator it =
+        pendingRequests.find(requestID);
+    if (it == pendingRequests.end()) {
+      return false;
+    }
+    if (!it->second.complete) {
+      // Already cancelled or timed out, and only waiting for its response
+      return false;
+    }
+    // The request keeps its place until its response arrives, so the
+    // response is dropped rather than answering another request
+    cancelled.complete = std::move(it->second.complete);
+    it->second.complete = nullptr;
+  }
+
+  cancelled.complete(MessageBuffer(),
+                     std::make_exception_ptr(
+                         RequestError(RequestError::Reason::CANCELLED)));
+  return true;
+}
+
+size_t Client::pendingRequestCount() {
+  std::lock_guard<std::mutex> guard(pendingRequestsMutex);
+  return std::count_if(
+      pendingRequests.begin(), pendingRequests.end(),
+      [](const auto &request) { return (bool)request.second.complete; });
+}
+
+RequestID Client::sendRequest(
+    const void *message, unsigned messageLength,
+    std::function<void(MessageBuffer &&, std::exception_ptr)> &&complete,
+    std::chrono::milliseconds timeout) {
+  // Responses are sent back with the same type as the request, which is at
+  // the start of every message
+  uint32 responseType = 0;
+  if (messageLength >= sizeof(uint32)) {
+    memcpy(&responseType, message, sizeof(uint32));
+  }
+
+  // Requests on a connection which doesn't tag them still need a local ID,
+  // to be cancelled by and to keep them in order
+  RequestID requestID = allocateRequestID();
+
+  std::chrono::steady_clock::time_point deadline =
+      timeout.count() == NO_REQUEST_TIMEOUT
+          ? std::chrono::steady_clock::time_point::max()
+          : std::chrono::steady_clock::now() + timeout;
+
+  // Wait for the response before sending, so it can't arrive first
+  {
+    std::lock_guard<std::mutex> guard(pendingRequestsMutex);
+    pendingRequests[requestID] = {responseType, deadline, std::move(complete)};
+  }
 
-  sendQueueMutex.lock();
-  sendQueue.push(new EncryptedNetworkMessage(
-      sendBuffer, sizeof(uint64) + messageLength, sessionKey));
-  sendQueueMutex.unlock();
+  addMessageToSendQueue(message, messageLength, requestID);
+
+  return requestID;
 }
 
-void Client::addMessageToSendQueue(const std::string &message) {
-  addMessageToSendQueue(message.c_str(), message.size());
+bool Client::completeRequest(RequestID requestID, void *message,
+                             unsigned messageSize) {
+  PendingRequest completed;
+  {
+    std::lock_guard<std::mutex> guard(pendingRequestsMutex);
+    std::map<RequestID, PendingRequest>::iterator it;
+
+    if (requestIDs) {
+      if (requestID == NO_REQUEST_ID) {
+        return false;
+      }
+      it = pendingRequests.find(requestID);
+    } else {
+      // Without IDs, the best we can do is assume responses of each type come
+      // back in the order their requests were sent
+      uint32 messageType = 0;
+      if (messageSize >= sizeof(uint32)) {
+        memcpy(&messageType, message, sizeof(uint32));
+      }
+      // A broadcast could otherwise be taken for the response to a request
+      // of the same type, and the real response would then answer the next
+      if (responseHandler && responseHandler->isBroadcastType(messageType)) {
+        return false;
+      }
+      it = std::find_if(pendingRequests.begin(), pendingRequests.end(),
+                        [messageType](const auto &request) {
+                          return request.second.responseType == messageType;
+                        });
+    }
+
+    if (it == pendingRequests.end()) {
+      return false;
+    }
+    completed = std::move(it->second);
+    pendingRequests.erase(it);
+  }
+
+  // The response to a request which was cancelled or timed out is dropped
+  if (!completed.complete) {
+    free(message);
+    return true;
+  }
+
+  completed.complete(MessageBuffer(message, 0, messageSize), nullptr);
+  return true;
+}
+
+void Client::expireRequests(std::chrono::steady_clock::time_point now) {
+  std::vector<PendingRequest> expired;
+  {
+    std::lock_guard<std::mutex> guard(pendingRequestsMutex);
+    for (std::map<RequestID, PendingRequest>::iterator it =
+             pendingRequests.begin();
+         it != pendingRequests.end();) {
+      if (it->second.complete && it->second.deadline <= now) {
+        expired.push_back({it->second.responseType, it->second.deadline,
+                           std::move(it->second.complete)});
+        it->second.complete = nullptr;
+      }
+      it++;
+    }
+  }
+
+  for (PendingRequest &request : expired) {
+    request.complete(MessageBuffer(),
+                     std::make_exception_ptr(
+                         RequestError(RequestError::Reason::TIMED_OUT)));
+  }
+}
+
+void Client::failRequests(RequestError::Reason reason) {
+  std::map<RequestID, PendingRequest> failed;
+  {
+    std::lock_guard<std::mutex> guard(pendingRequestsMutex);
+    failed.swap(pendingRequests);
+  }
+
+  for (std::pair<const RequestID, PendingRequest> &request : failed) {
+    if (!request.second.complete) {
+      continue;
+    }
+    request.second.complete(MessageBuffer(),
+                            std::make_exception_ptr(RequestError(reason)));
+  }
 }
 
 void Client::requestRepeatToken(unsigned responseCode) {
@@ -397,14 +867,14 @@ void Client::clientLoop() {
     // Get the start time of this frame
     start = std::chrono::system_clock::now();
 
-    sendQueueMutex.lock();
-    while (!sendQueue.empty()) {
-      NetworkMessage *message = sendQueue.front();
-      clientSocket.sendMessage(*message);
-      sendQueue.pop();
-      delete message;
+    EncryptedNetworkMessage message;
+    while (sendQueue.tryPop(message)) {
+      clientSocket.queueMessage(message);
     }
-    sendQueueMutex.unlock();
+
+    // Send everything queued this frame, along with anything the socket
+    // couldn't take last frame
+    clientSocket.flushSendBuffer();
 
     EncryptedNetworkMessage rMessage;
     if (clientSocket.receiveMessage(rMessage, MessageProtocol::AES_MESSAGE) ==
@@ -412,19 +882,47 @@ void Client::clientLoop() {
       if (!rMessage.error()) {
         // decryptedMessage should not be owned by the client, and ownership
         // should be passed to the response handler
+        uint32 decryptedSize;
         void *&&decryptedMessage =
-            (void *)rMessage.decryptMessageData(sessionKey);
+            (void *)rMessage.decryptMessageData(sessionKey, decryptedSize);
+
+        // Messages on a connection which tags requests start with the ID
+        // of the request they answer. The rest of the message is moved up
+        // over it, so the handler can still free the buffer it is given.
+        RequestID requestID = NO_REQUEST_ID;
+        if (decryptedMessage && requestIDs) {
+          if (decryptedSize < sizeof(RequestID)) {
+            free(decryptedMessage);
+            decryptedMessage = nullptr;
+          } else {
+            memcpy(&requestID, decryptedMessage, sizeof(RequestID));
+            decryptedSize -= sizeof(RequestID);
+            memmove(decryptedMessage,
+                    (uint8 *)decryptedMessage + sizeof(RequestID),
+                    decryptedSize);
+          }
+        }
 
-        if (responseHandler) {
+        if (!decryptedMessage) {
+          std::cerr << "ERROR::Client.cpp: Received a message which could not "
+                       "be decompressed."
+                    << std::endl;
+        } else if (completeRequest(requestID, decryptedMessage,
+                                   decryptedSize)) {
+          // The message answered a request made with request, and has
+          // been handed to whoever is waiting for it
+        } else if (responseHandler) {
           // Obviously moving a pointer is useless, but it indicates transfer of
           // ownership, and that it is now the responsibility of the reciever to
           // free.
           responseHandler->onMessageReceived(std::move(decryptedMessage),
-                                             rMessage.getMessageSize());
+                                             decryptedSize, requestID);
         }
       }
     }
 
+    expireRequests(std::chrono::steady_clock::now());
+
     // If the refresh rate is either negative or 0 it is invalid, so raise an
     // error (otherwise there is the risk of division by 0 or running a while
     // loop at maximum speed causing the process to overload the CPU!)
@@ -0,0 +1,49 @@
+#include "../../include/networking/Compression.h"
+#include "../../include/networking/NetworkMessage.h"
+
+#include <zlib.h>
+
+bool compressPayload(const void *data, uint32 size, std::vector<uint8> &compressed) {
+    if (size < COMPRESSION_THRESHOLD) {
+        return false;
+    }
+
+    uLongf compressedSize = compressBound(size);
+    compressed.resize(sizeof(uint32) + compressedSize);
+    memcpy(compressed.data(), &size, sizeof(uint32));
+
+    if (compress2(compressed.data() + sizeof(uint32), &compressedSize, (const Bytef *) data, size, COMPRESSION_LEVEL) !=
+        Z_OK) {
+        return false;
+    }
+
+    compressed.resize(sizeof(uint32) + compressedSize);
+
+    // Data which is already compressed, or random, can come out larger
+    return compressed.size() < size;
+}
+
+void *decompressPayload(const void *data, uint32 size, uint32 &decompressedSize) {
+    if (size < sizeof(uint32)) {
+        return nullptr;
+    }
+
+    memcpy(&decompressedSize, data, sizeof(uint32));
+
+    // The size comes from the peer, so don't trust it with an unbounded allocation
+    if (decompressedSize > MAX_MESSAGE_LENGTH) {
+        return nullptr;
+    }
+
+    void *decompressed = malloc(decompressedSize);
+    uLongf outputSize = decompressedSize;
+
+    if (uncompress((Bytef *) decompressed, &outputSize, (const Bytef *) data + sizeof(uint32), size - sizeof(uint32)) !=
+            Z_OK ||
+        outputSize != decompressedSize) {
+        free(decompressed);
+        return nullptr;
+    }
+
+    return decompressed;
+}
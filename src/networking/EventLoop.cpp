@@ -0,0 +1,282 @@
+#include "../../include/networking/EventLoop.h"
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#elif !defined(_WIN32)
+#include <poll.h>
+#endif
+
+// The key reserved internally for the wake channel
+#define WAKE_KEY (~0ull)
+
+// The maximum number of events collected from a single epoll_wait
+#define MAX_EPOLL_EVENTS 64
+
+#ifdef __linux__
+
+static unsigned toEpollEvents(unsigned interest) {
+    unsigned events = EPOLLRDHUP;
+    if (interest & EventLoop::EVENT_READABLE) {
+        events |= EPOLLIN;
+    }
+    if (interest & EventLoop::EVENT_WRITABLE) {
+        events |= EPOLLOUT;
+    }
+    return events;
+}
+
+EventLoop::EventLoop() {
+    if ((epollFd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        STD_ERROR("Failed to create epoll instance")
+    }
+    if ((wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+        STD_ERROR("Failed to create wake eventfd")
+    }
+
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.u64 = WAKE_KEY;
+
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &event) < 0) {
+        STD_ERROR("Failed to register wake eventfd")
+    }
+}
+
+EventLoop::~EventLoop() {
+    close(wakeFd);
+    close(epollFd);
+}
+
+bool EventLoop::add(const TCPSocket &socket, unsigned long long key, unsigned interest) {
+    epoll_event event{};
+    event.events = toEpollEvents(interest);
+    event.data.u64 = key;
+
+    return epoll_ctl(epollFd, EPOLL_CTL_ADD, socket.nativeHandle(), &event) == 0;
+}
+
+bool EventLoop::modify(const TCPSocket &socket, unsigned long long key, unsigned interest) {
+    epoll_event event{};
+    event.events = toEpollEvents(interest);
+    event.data.u64 = key;
+
+    return epoll_ctl(epollFd, EPOLL_CTL_MOD, socket.nativeHandle(), &event) == 0;
+}
+
+void EventLoop::remove(const TCPSocket &socket) {
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, socket.nativeHandle(), nullptr);
+}
+
+bool EventLoop::wait(std::vector<Event> &events, int timeoutMs) {
+    epoll_event ready[MAX_EPOLL_EVENTS];
+
+    events.clear();
+
+    int count = epoll_wait(epollFd, ready, MAX_EPOLL_EVENTS, timeoutMs);
+
+    bool woken = false;
+
+    for (int i = 0; i < count; i++) {
+        if (ready[i].data.u64 == WAKE_KEY) {
+            woken = true;
+            continue;
+        }
+
+        unsigned flags = 0;
+        if (ready[i].events & EPOLLIN) {
+            flags |= EVENT_READABLE;
+        }
+        if (ready[i].events & EPOLLOUT) {
+            flags |= EVENT_WRITABLE;
+        }
+        if (ready[i].events & (EPOLLHUP | EPOLLRDHUP | EPOLLERR)) {
+            flags |= EVENT_HANGUP;
+        }
+        events.push_back({ready[i].data.u64, flags});
+    }
+
+    if (woken) {
+        drainWake();
+    }
+
+    return woken;
+}
+
+void EventLoop::wake() {
+    if (wakePending.exchange(true)) {
+        return;
+    }
+    uint64_t one = 1;
+    write(wakeFd, &one, sizeof(uint64_t));
+}
+
+void EventLoop::drainWake() {
+    uint64_t value;
+    read(wakeFd, &value, sizeof(uint64_t));
+    // Only cleared once the channel is empty. Clearing it first would let a wake land in between, have its write
+    // consumed here, and leave the flag set with nothing to read, so every later wake would be skipped. A wake skipped
+    // after the read is still seen, as the loop handles its work after this returns.
+    wakePending = false;
+}
+
+#else
+
+#ifdef _WIN32
+#define poll WSAPoll
+typedef WSAPOLLFD PollDescriptor;
+#else
+typedef pollfd PollDescriptor;
+#endif
+
+EventLoop::EventLoop() {
+#ifdef _WIN32
+    // Windows has no eventfd or pipe which can be polled alongside sockets, so the wake channel is a UDP socket
+    // connected to itself on the loopback interface
+    if ((wakeSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) == INVALID_SOCKET) {
+        SOCK_ERROR_TO("Failed to create wake socket", std::cerr)
+    }
+
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = 0;
+    int addressSize = sizeof(address);
+
+    if (bind(wakeSocket, (SOCKADDR *) &address, sizeof(address)) == SOCKET_ERROR ||
+        getsockname(wakeSocket, (SOCKADDR *) &address, &addressSize) == SOCKET_ERROR ||
+        connect(wakeSocket, (SOCKADDR *) &address, sizeof(address)) == SOCKET_ERROR) {
+        SOCK_ERROR_TO("Failed to connect wake socket", std::cerr)
+    }
+
+    unsigned long nonBlocking = 1;
+    ioctlsocket(wakeSocket, FIONBIO, &nonBlocking);
+#else
+    if (pipe(wakePipe) < 0) {
+        STD_ERROR("Failed to create wake pipe")
+    }
+    fcntl(wakePipe[0], F_SETFL, fcntl(wakePipe[0], F_GETFL) | O_NONBLOCK);
+    fcntl(wakePipe[1], F_SETFL, fcntl(wakePipe[1], F_GETFL) | O_NONBLOCK);
+#endif
+}
+
+EventLoop::~EventLoop() {
+#ifdef _WIN32
+    closesocket(wakeSocket);
+#else
+    close(wakePipe[0]);
+    close(wakePipe[1]);
+#endif
+}
+
+bool EventLoop::add(const TCPSocket &socket, unsigned long long key, unsigned interest) {
+    return registered.emplace(socket.nativeHandle(), std::make_pair(key, interest)).second;
+}
+
+bool EventLoop::modify(const TCPSocket &socket, unsigned long long key, unsigned interest) {
+    auto it = registered.find(socket.nativeHandle());
+    if (it == registered.end()) {
+        return false;
+    }
+    it->second = {key, interest};
+    return true;
+}
+
+void EventLoop::remove(const TCPSocket &socket) {
+    registered.erase(socket.nativeHandle());
+}
+
+bool EventLoop::wait(std::vector<Event> &events, int timeoutMs) {
+    std::vector<PollDescriptor> descriptors;
+    std::vector<unsigned long long> keys;
+    descriptors.reserve(registered.size() + 1);
+    keys.reserve(registered.size() + 1);
+
+    PollDescriptor wakeDescriptor{};
+#ifdef _WIN32
+    wakeDescriptor.fd = wakeSocket;
+#else
+    wakeDescriptor.fd = wakePipe[0];
+#endif
+    wakeDescriptor.events = POLLIN;
+    descriptors.push_back(wakeDescriptor);
+    keys.push_back(WAKE_KEY);
+
+    for (const std::pair<const NativeSocketHandle, std::pair<unsigned long long, unsigned>> &entry : registered) {
+        PollDescriptor descriptor{};
+        descriptor.fd = entry.first;
+        if (entry.second.second & EVENT_READABLE) {
+            descriptor.events |= POLLIN;
+        }
+        if (entry.second.second & EVENT_WRITABLE) {
+            descriptor.events |= POLLOUT;
+        }
+        descriptors.push_back(descriptor);
+        keys.push_back(entry.second.first);
+    }
+
+    events.clear();
+
+    int count = poll(descriptors.data(), descriptors.size(), timeoutMs);
+
+    if (count <= 0) {
+        return false;
+    }
+
+    bool woken = false;
+
+    for (size_t i = 0; i < descriptors.size(); i++) {
+        if (descriptors[i].revents == 0) {
+            continue;
+        }
+        if (keys[i] == WAKE_KEY) {
+            woken = true;
+            continue;
+        }
+
+        unsigned flags = 0;
+        if (descriptors[i].revents & POLLIN) {
+            flags |= EVENT_READABLE;
+        }
+        if (descriptors[i].revents & POLLOUT) {
+            flags |= EVENT_WRITABLE;
+        }
+        if (descriptors[i].revents & (POLLHUP | POLLERR | POLLNVAL)) {
+            flags |= EVENT_HANGUP;
+        }
+        events.push_back({keys[i], flags});
+    }
+
+    if (woken) {
+        drainWake();
+    }
+
+    return woken;
+}
+
+void EventLoop::wake() {
+    if (wakePending.exchange(true)) {
+        return;
+    }
+    char one = 1;
+#ifdef _WIN32
+    send(wakeSocket, &one, sizeof(char), 0);
+#else
+    write(wakePipe[1], &one, sizeof(char));
+#endif
+}
+
+void EventLoop::drainWake() {
+    char buffer[64];
+#ifdef _WIN32
+    while (recv(wakeSocket, buffer, sizeof(buffer), 0) > 0)
+        ;
+#else
+    while (read(wakePipe[0], buffer, sizeof(buffer)) > 0)
+        ;
+#endif
+    // Only cleared once the channel is empty, as in the epoll backend
+    wakePending = false;
+}
+
+#endif
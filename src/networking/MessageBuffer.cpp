@@ -0,0 +1,53 @@
+#include "../../include/networking/MessageBuffer.h"
+
+#include <cstdlib>
+
+MessageBuffer::MessageBuffer() = default;
+
+MessageBuffer::MessageBuffer(void *allocation, unsigned offset, unsigned size)
+    : allocation(allocation), offset(offset), viewSize(size) {
+}
+
+MessageBuffer::MessageBuffer(MessageBuffer &&other) noexcept
+    : allocation(other.allocation), offset(other.offset), viewSize(other.viewSize) {
+    other.allocation = nullptr;
+    other.offset = 0;
+    other.viewSize = 0;
+}
+
+MessageBuffer::~MessageBuffer() {
+    free(allocation);
+}
+
+MessageBuffer &MessageBuffer::operator=(MessageBuffer &&other) noexcept {
+    if (this != &other) {
+        free(allocation);
+
+        allocation = other.allocation;
+        offset = other.offset;
+        viewSize = other.viewSize;
+
+        other.allocation = nullptr;
+        other.offset = 0;
+        other.viewSize = 0;
+    }
+    return *this;
+}
+
+const uint8 *MessageBuffer::data() const {
+    return allocation ? (const uint8 *) allocation + offset : nullptr;
+}
+
+unsigned MessageBuffer::size() const {
+    return viewSize;
+}
+
+void *MessageBuffer::release() {
+    void *buffer = allocation;
+
+    allocation = nullptr;
+    offset = 0;
+    viewSize = 0;
+
+    return buffer;
+}
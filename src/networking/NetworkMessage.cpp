@@ -3,6 +3,7 @@
 //
 
 #include "../../include/networking/NetworkMessage.h"
+#include "../../include/networking/Compression.h"
 
 NetworkMessage::NetworkMessage(const void *messageData, uint32 messageSize, MessageProtocol protocol) {
     if (messageSize > MAX_MESSAGE_LENGTH) {
@@ -10,7 +11,7 @@ NetworkMessage::NetworkMessage(const void *messageData, uint32 messageSize, Mess
         return;
     }
 
-    this->messageData = malloc(BUFFER_PADDED_SIZE(messageSize + sizeof(uint32)));
+    this->messageData = BufferPool::acquire(BUFFER_PADDED_SIZE(messageSize + sizeof(uint32)));
     memcpy((uint8 *) this->messageData, &protocol, sizeof(uint8));
     memcpy(((uint8 *) this->messageData) + sizeof(uint8), &messageSize, sizeof(uint8) + sizeof(uint16));
     memcpy(((uint8 *) this->messageData) + sizeof(uint32), messageData, messageSize);
@@ -27,13 +28,34 @@ NetworkMessage::NetworkMessage(const std::string &message, MessageProtocol proto
 
 }
 
+NetworkMessage::NetworkMessage(NetworkMessage &&other) noexcept {
+    *this = std::move(other);
+}
+
 NetworkMessage::~NetworkMessage() {
     if (messageData) {
-        free(messageData);
+        BufferPool::release(messageData);
         messageData = nullptr;
     }
 }
 
+NetworkMessage &NetworkMessage::operator=(NetworkMessage &&other) noexcept {
+    if (this != &other) {
+        BufferPool::release(messageData);
+
+        messageStateFlags = other.messageStateFlags;
+        messageData = other.messageData;
+        messageSize = other.messageSize;
+        _protocol = other._protocol;
+        _frameFlags = other._frameFlags;
+        readLeft = other.readLeft;
+
+        other.messageStateFlags = 0x00u;
+        other.messageData = nullptr;
+    }
+    return *this;
+}
+
 const void *NetworkMessage::dataStream() const {
     return messageData;
 }
@@ -45,28 +67,60 @@ uint32 NetworkMessage::dataStreamSize() const {
 void NetworkMessage::clear() {
     // Clear the error, dirty and decoding bits
     messageStateFlags = 0x00u;
+    _frameFlags = 0;
 
     // free the memory we currently have stored if we have assigned the pointer
     if (messageData) {
-        free(messageData);
+        BufferPool::release(messageData);
         messageData = nullptr;
     }
 }
 
-DecodeStatus NetworkMessage::decode(uint8 *buffer, uint32 bufferSize) {
+uint32 NetworkMessage::payloadSize() const {
+    return messageSize;
+}
+
+void NetworkMessage::writeHeader(uint8 *header, WireFormat format) const {
+    switch (format) {
+        case WireFormat::V1:
+            memcpy(header, messageData, FRAME_HEADER_SIZE);
+            break;
+        case WireFormat::V2:
+            memcpy(header, &_protocol, sizeof(uint8));
+            memcpy(header + sizeof(uint8), &_frameFlags, sizeof(uint8));
+            memcpy(header + sizeof(uint8) + sizeof(uint8), &messageSize, sizeof(uint32));
+            break;
+    }
+}
+
+uint32 NetworkMessage::readHeader(const uint8 *buffer, WireFormat format) {
+    memset(&this->_protocol, 0, sizeof(MessageProtocol));
+    memcpy(&this->_protocol, buffer, sizeof(uint8));
+    this->messageSize = 0;
+    this->_frameFlags = 0;
+
+    switch (format) {
+        case WireFormat::V1:
+            memcpy(&this->messageSize, buffer + sizeof(uint8), sizeof(uint8) + sizeof(uint16));
+            break;
+        case WireFormat::V2:
+            memcpy(&this->_frameFlags, buffer + sizeof(uint8), sizeof(uint8));
+            memcpy(&this->messageSize, buffer + sizeof(uint8) + sizeof(uint8), sizeof(uint32));
+            break;
+    }
+
+    return headerSize(format);
+}
+
+DecodeStatus NetworkMessage::decode(uint8 *buffer, uint32 bufferSize, WireFormat format) {
     // Initialise the read index to 0
     uint32 readIndex = 0;
 
     // If we haven't started decoding the message, this should be the first message, and so we should start
     // by retrieving the size
     if (!(messageStateFlags & MESSAGE_DECODING)) {
-        // Copy the first bytes into the messageSize and protocol variables
-        memset(&this->_protocol, 0, sizeof(MessageProtocol));
-        memcpy(&this->_protocol, &buffer[readIndex], sizeof(uint8));
-        readIndex += sizeof(uint8);
-        this->messageSize = 0;
-        memcpy(&this->messageSize, &buffer[readIndex], sizeof(uint8) + sizeof(uint16));
-        readIndex += sizeof(uint8) + sizeof(uint16);
+        // Read the header into the messageSize and protocol variables
+        readIndex = readHeader(buffer, format);
 
         switch (_protocol) {
             case MessageProtocol::KEY_MESSAGE:
@@ -108,6 +162,11 @@ DecodeStatus NetworkMessage::decode(uint8 *buffer, uint32 bufferSize) {
                     return DecodeStatus::DECODE_ERROR;
                 }
                 break;
+            case MessageProtocol::RESUME_MESSAGE:
+                if (messageSize != sizeof(ResumptionTicket)) {
+                    return DecodeStatus::DECODE_ERROR;
+                }
+                break;
             default:
                 // If we didn't receive any protocol type from above, the protocol was invalid.
                 return DecodeStatus::DECODE_ERROR;
@@ -116,7 +175,7 @@ DecodeStatus NetworkMessage::decode(uint8 *buffer, uint32 bufferSize) {
         // Set that we have the entire message left to read
         readLeft = messageSize;
         // Allocate enough memory in the message buffer to write into
-        messageData = malloc(messageSize);
+        messageData = BufferPool::acquire(messageSize);
 
         // Set the decoding flag
         messageStateFlags |= MESSAGE_DECODING;
@@ -137,6 +196,45 @@ DecodeStatus NetworkMessage::decode(uint8 *buffer, uint32 bufferSize) {
     return (readLeft == 0) ? DecodeStatus::DECODED : DecodeStatus::DECODING;
 }
 
+uint32 NetworkMessage::headerSize(WireFormat format) {
+    return format == WireFormat::V1 ? FRAME_HEADER_SIZE : FRAME_HEADER_SIZE_V2;
+}
+
+uint32 NetworkMessage::frameSize(const uint8 *header, WireFormat format) {
+    NetworkMessage message;
+    uint32 headerBytes = message.readHeader(header, format);
+
+    if (message.messageSize > MAX_MESSAGE_LENGTH) {
+        return 0;
+    }
+
+    uint32 payloadBytes;
+
+    switch (message._protocol) {
+        case MessageProtocol::AES_MESSAGE:
+            // Encrypted frames also carry the initialisation vector, and the payload is padded to the AES block size
+            payloadBytes = sizeof(uint64) + PADDED_SIZE(message.messageSize, AES_CHUNK_SIZE);
+            break;
+        case MessageProtocol::KEY_MESSAGE:
+        case MessageProtocol::RSA_MESSAGE:
+        case MessageProtocol::RAW_MESSAGE:
+        case MessageProtocol::CONNECTION_RESPONSE_MESSAGE:
+        case MessageProtocol::DISCONNECT_MESSAGE:
+        case MessageProtocol::HEARTBEAT:
+        case MessageProtocol::RESUME_MESSAGE:
+            payloadBytes = message.messageSize;
+            break;
+        default:
+            return 0;
+    }
+
+    // Only V1 frames are padded
+    if (format == WireFormat::V1) {
+        return BUFFER_PADDED_SIZE(headerBytes + payloadBytes);
+    }
+    return headerBytes + payloadBytes;
+}
+
 const void *NetworkMessage::getMessageData() const {
     return messageData;
 }
@@ -157,6 +255,14 @@ MessageProtocol NetworkMessage::protocol() const {
     return _protocol;
 }
 
+uint8 NetworkMessage::frameFlags() const {
+    return _frameFlags;
+}
+
+void NetworkMessage::setFrameFlags(uint8 flags) {
+    _frameFlags = flags;
+}
+
 __declspec(no_sanitize_address) EncryptedNetworkMessage::EncryptedNetworkMessage(const void *messageData, uint32 messageSize, AESKey encryptionKey) {
     if (messageSize > MAX_MESSAGE_LENGTH) {
         std::cerr << "ERROR: Attempted to create a message longer than the maximum allowable message length (" << MAX_MESSAGE_LENGTH << ")." << std::endl;
@@ -172,7 +278,7 @@ __declspec(no_sanitize_address) EncryptedNetworkMessage::EncryptedNetworkMessage
     uint32 usedBufferSize = sizeof(uint32) + sizeof(uint64) + encryptedMessageSize;
     uint32 paddedBufferSize = BUFFER_PADDED_SIZE(usedBufferSize);
 
-    this->messageData = malloc(paddedBufferSize);
+    this->messageData = BufferPool::acquire(paddedBufferSize);
     memcpy((uint8 *) this->messageData, &this->_protocol, sizeof(uint8));
     memcpy((uint8 *) this->messageData + sizeof(uint8), &messageSize, sizeof(uint8) + sizeof(uint16));
     memcpy((uint8 *) this->messageData + sizeof(uint32), &initialisationVector, sizeof(uint64));
@@ -194,20 +300,19 @@ uint32 EncryptedNetworkMessage::dataStreamSize() const {
     return BUFFER_PADDED_SIZE(sizeof(uint32) + sizeof(uint64) + encryptedMessageSize);
 }
 
-DecodeStatus EncryptedNetworkMessage::decode(uint8 *buffer, uint32 bufferSize) {
+uint32 EncryptedNetworkMessage::payloadSize() const {
+    return sizeof(uint64) + PADDED_SIZE(messageSize, AES_CHUNK_SIZE);
+}
+
+DecodeStatus EncryptedNetworkMessage::decode(uint8 *buffer, uint32 bufferSize, WireFormat format) {
     // Initialise the read index to 0
     uint8 readIndex = 0;
 
     // If we haven't started decoding the message, this should be the first message, and so we should start
     // by retrieving the size
     if (!(messageStateFlags & MESSAGE_DECODING)) {
-        // Copy the first bytes into the messageSize variable
-        memset(&this->_protocol, 0, sizeof(MessageProtocol));
-        memcpy(&this->_protocol, &buffer[readIndex], sizeof(uint8));
-        readIndex += sizeof(uint8);
-        this->messageSize = 0;
-        memcpy(&this->messageSize, &buffer[readIndex], sizeof(uint8) + sizeof(uint16));
-        readIndex += sizeof(uint8) + sizeof(uint16);
+        // Read the header into the messageSize and protocol variables
+        readIndex = readHeader(buffer, format);
 
         switch (_protocol) {
             case MessageProtocol::AES_MESSAGE:
@@ -222,11 +327,12 @@ DecodeStatus EncryptedNetworkMessage::decode(uint8 *buffer, uint32 bufferSize) {
                 }
             case MessageProtocol::DISCONNECT_MESSAGE:
             case MessageProtocol::HEARTBEAT:
-                return NetworkMessage::decode(buffer, bufferSize);
+                return NetworkMessage::decode(buffer, bufferSize, format);
             case MessageProtocol::KEY_MESSAGE:
             case MessageProtocol::RSA_MESSAGE:
             case MessageProtocol::RAW_MESSAGE:
             case MessageProtocol::CONNECTION_RESPONSE_MESSAGE:
+            case MessageProtocol::RESUME_MESSAGE:
             default:
                 // If we received anything other than the AES message protocol, the protocol was invalid, as this is
                 // supposed to be an encrypted message.
@@ -239,7 +345,7 @@ DecodeStatus EncryptedNetworkMessage::decode(uint8 *buffer, uint32 bufferSize) {
         // Set that we have the entire message left to read
         readLeft = PADDED_SIZE(messageSize, AES_CHUNK_SIZE);
         // Allocate enough memory in the message buffer to write into
-        messageData = malloc(readLeft);
+        messageData = BufferPool::acquire(readLeft);
 
         // Set the decoding flag
         messageStateFlags |= MESSAGE_DECODING;
@@ -263,3 +369,17 @@ DecodeStatus EncryptedNetworkMessage::decode(uint8 *buffer, uint32 bufferSize) {
 const void *EncryptedNetworkMessage::decryptMessageData(AESKey decryptionKey) const {
     return decrypt((const uint8 *) messageData, messageSize, initialisationVector, decryptionKey);
 }
+
+const void *EncryptedNetworkMessage::decryptMessageData(AESKey decryptionKey, uint32 &decryptedSize) const {
+    void *decrypted = (void *) decryptMessageData(decryptionKey);
+
+    if (!(_frameFlags & FRAME_FLAG_COMPRESSED)) {
+        decryptedSize = messageSize;
+        return decrypted;
+    }
+
+    void *decompressed = decompressPayload(decrypted, messageSize, decryptedSize);
+    free(decrypted);
+
+    return decompressed;
+}
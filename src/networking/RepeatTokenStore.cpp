@@ -0,0 +1,231 @@
+#include "../../include/networking/RepeatTokenStore.h"
+
+#include <chrono>
+#include <fstream>
+#include <vector>
+
+// Written at the start of the store's file, followed by the format version
+#define REPEAT_TOKEN_FILE_MAGIC 0x4B4F5452u
+#define REPEAT_TOKEN_FILE_VERSION 1u
+
+static unsigned long long unixTime() {
+    return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch())
+        .count();
+}
+
+size_t RepeatTokenStore::TokenHash::operator()(const uint256 &token) const {
+    size_t hash;
+    memcpy(&hash, &token, sizeof(size_t));
+    return hash;
+}
+
+bool RepeatTokenStore::TokenEqual::operator()(const uint256 &a, const uint256 &b) const {
+    return memcmp(&a, &b, sizeof(uint256)) == 0;
+}
+
+RepeatTokenStore::RepeatTokenStore(size_t capacity, unsigned long long lifetimeSeconds)
+    : capacity(capacity), lifetimeSeconds(lifetimeSeconds) {
+}
+
+void RepeatTokenStore::insert(const uint256 &token, const std::string &email, ClientAccess access) {
+    std::lock_guard<std::mutex> guard(storeMutex);
+    insertLocked(token, email, access, unixTime() + lifetimeSeconds);
+}
+
+void RepeatTokenStore::insertLocked(const uint256 &token, const std::string &email, ClientAccess access,
+                                    unsigned long long expiry) {
+    std::unordered_map<uint256, Entry, TokenHash, TokenEqual>::iterator it = tokens.find(token);
+    if (it != tokens.end()) {
+        usageOrder.erase(it->second.usage);
+        tokens.erase(it);
+    }
+
+    while (tokens.size() >= capacity && !usageOrder.empty()) {
+        tokens.erase(usageOrder.front());
+        usageOrder.pop_front();
+    }
+
+    usageOrder.push_back(token);
+    tokens[token] = {email, access, expiry, std::prev(usageOrder.end())};
+    dirty = true;
+}
+
+std::optional<std::pair<std::string, ClientAccess>> RepeatTokenStore::find(const uint256 &token) {
+    std::lock_guard<std::mutex> guard(storeMutex);
+
+    std::unordered_map<uint256, Entry, TokenHash, TokenEqual>::iterator it = tokens.find(token);
+    if (it == tokens.end()) {
+        return std::nullopt;
+    }
+
+    unsigned long long now = unixTime();
+    if (it->second.expiry <= now) {
+        usageOrder.erase(it->second.usage);
+        tokens.erase(it);
+        dirty = true;
+        return std::nullopt;
+    }
+
+    // Using the token restarts its lifetime, and makes it the last to be evicted
+    it->second.expiry = now + lifetimeSeconds;
+    usageOrder.splice(usageOrder.end(), usageOrder, it->second.usage);
+    dirty = true;
+
+    return std::make_pair(it->second.email, it->second.access);
+}
+
+size_t RepeatTokenStore::expire() {
+    std::lock_guard<std::mutex> guard(storeMutex);
+
+    unsigned long long now = unixTime();
+    size_t removed = 0;
+
+    // Tokens expire in usage order, so stop at the first which hasn't
+    while (!usageOrder.empty()) {
+        std::unordered_map<uint256, Entry, TokenHash, TokenEqual>::iterator it = tokens.find(usageOrder.front());
+        if (it->second.expiry > now) {
+            break;
+        }
+        tokens.erase(it);
+        usageOrder.pop_front();
+        removed++;
+    }
+
+    if (removed != 0) {
+        dirty = true;
+    }
+
+    return removed;
+}
+
+size_t RepeatTokenStore::size() {
+    std::lock_guard<std::mutex> guard(storeMutex);
+    return tokens.size();
+}
+
+bool RepeatTokenStore::setPersistencePath(const std::filesystem::path &path) {
+    std::lock_guard<std::mutex> guard(storeMutex);
+    persistencePath = path;
+
+    // An unreadable file is treated as empty, and marked dirty so the next flush replaces it. Any tokens read before
+    // the problem was found are dropped, as the rest of the file can't be trusted.
+    auto discard = [this]() {
+        tokens.clear();
+        usageOrder.clear();
+        dirty = true;
+        return false;
+    };
+
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        // Nothing has been stored yet
+        return !std::filesystem::exists(path) || discard();
+    }
+
+    uint32 magic = 0, version = 0;
+    uint64 count = 0;
+    file.read((char *) &magic, sizeof(uint32));
+    file.read((char *) &version, sizeof(uint32));
+    file.read((char *) &count, sizeof(uint64));
+
+    if (!file || magic != REPEAT_TOKEN_FILE_MAGIC || version != REPEAT_TOKEN_FILE_VERSION) {
+        return discard();
+    }
+
+    unsigned long long now = unixTime();
+
+    // Tokens are stored from least to most recently used, so inserting them in turn restores the usage order
+    for (uint64 i = 0; i < count; i++) {
+        uint256 token;
+        uint64 expiry;
+        uint8 access;
+        uint32 emailLength;
+
+        file.read((char *) &token, sizeof(uint256));
+        file.read((char *) &expiry, sizeof(uint64));
+        file.read((char *) &access, sizeof(uint8));
+        file.read((char *) &emailLength, sizeof(uint32));
+
+        if (!file || emailLength > MAX_MESSAGE_LENGTH) {
+            return discard();
+        }
+
+        std::string email(emailLength, '\0');
+        file.read(email.data(), emailLength);
+
+        if (!file) {
+            return discard();
+        }
+
+        if (expiry > now) {
+            insertLocked(token, email, (ClientAccess) access, expiry);
+        }
+    }
+
+    // Only tokens which expired while the server was down have changed
+    dirty = false;
+
+    return true;
+}
+
+bool RepeatTokenStore::flush() {
+    std::vector<uint8> contents;
+    std::filesystem::path path;
+
+    {
+        std::lock_guard<std::mutex> guard(storeMutex);
+
+        if (!persistencePath.has_value() || !dirty) {
+            return true;
+        }
+        path = *persistencePath;
+
+        auto append = [&contents](const void *data, size_t size) {
+            contents.insert(contents.end(), (const uint8 *) data, (const uint8 *) data + size);
+        };
+
+        uint32 magic = REPEAT_TOKEN_FILE_MAGIC, version = REPEAT_TOKEN_FILE_VERSION;
+        uint64 count = tokens.size();
+        append(&magic, sizeof(uint32));
+        append(&version, sizeof(uint32));
+        append(&count, sizeof(uint64));
+
+        for (const uint256 &token : usageOrder) {
+            const Entry &entry = tokens.at(token);
+            uint64 expiry = entry.expiry;
+            uint8 access = (uint8) entry.access;
+            uint32 emailLength = entry.email.size();
+
+            append(&token, sizeof(uint256));
+            append(&expiry, sizeof(uint64));
+            append(&access, sizeof(uint8));
+            append(&emailLength, sizeof(uint32));
+            append(entry.email.data(), emailLength);
+        }
+
+        dirty = false;
+    }
+
+    // Write to the side and swap the new file in, so the old one is never left half written
+    std::filesystem::path tempPath = path;
+    tempPath += ".tmp";
+
+    std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+    file.write((const char *) contents.data(), contents.size());
+    file.close();
+
+    bool written = !file.fail();
+    if (written) {
+        std::error_code error;
+        std::filesystem::rename(tempPath, path, error);
+        written = !error;
+    }
+
+    if (!written) {
+        std::lock_guard<std::mutex> guard(storeMutex);
+        dirty = true;
+        return false;
+    }
+
+    return true;
+}
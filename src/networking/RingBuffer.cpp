@@ -0,0 +1,108 @@
+#include "../../include/networking/RingBuffer.h"
+
+#include <algorithm>
+#include <cstring>
+
+RingBuffer::RingBuffer(size_t initialCapacity) : initialCapacity(initialCapacity) {
+}
+
+size_t RingBuffer::size() const {
+    return count;
+}
+
+size_t RingBuffer::capacity() const {
+    return storage.size();
+}
+
+unsigned char *RingBuffer::writeRegion(size_t &length) {
+    if (storage.empty()) {
+        storage.resize(initialCapacity);
+    }
+    if (count == storage.size()) {
+        reserve(storage.size() * 2);
+    }
+    if (count == 0) {
+        // Nothing is buffered, so start from the beginning to get the largest region
+        head = 0;
+    }
+
+    size_t tail = (head + count) % storage.size();
+
+    // The free space runs either up to the end of the storage, or up to the head if the buffered bytes wrap
+    if (tail >= head) {
+        length = storage.size() - tail;
+    } else {
+        length = head - tail;
+    }
+
+    return storage.data() + tail;
+}
+
+void RingBuffer::commit(size_t length) {
+    count += length;
+}
+
+void RingBuffer::append(const void *data, size_t length) {
+    reserve(count + length);
+
+    size_t written = 0;
+    while (written < length) {
+        size_t space;
+        unsigned char *region = writeRegion(space);
+        size_t amount = std::min(space, length - written);
+        memcpy(region, (const unsigned char *) data + written, amount);
+        commit(amount);
+        written += amount;
+    }
+}
+
+const unsigned char *RingBuffer::readRegion(size_t &length) const {
+    length = std::min(count, storage.size() - head);
+    return storage.data() + head;
+}
+
+void RingBuffer::copy(void *destination, size_t length) const {
+    size_t first = std::min(length, storage.size() - head);
+    memcpy(destination, storage.data() + head, first);
+    memcpy((unsigned char *) destination + first, storage.data(), length - first);
+}
+
+const unsigned char *RingBuffer::peek(size_t length) {
+    if (head + length > storage.size()) {
+        linearise();
+    }
+    return storage.data() + head;
+}
+
+void RingBuffer::consume(size_t length) {
+    head = (head + length) % storage.size();
+    count -= length;
+
+    // If the buffer grew to fit a large frame, give the memory back once it has been read
+    if (count == 0 && storage.size() > initialCapacity) {
+        storage.resize(initialCapacity);
+        storage.shrink_to_fit();
+        head = 0;
+    }
+}
+
+void RingBuffer::reserve(size_t length) {
+    if (length <= storage.size()) {
+        return;
+    }
+    linearise();
+    storage.resize(length);
+}
+
+void RingBuffer::clear() {
+    head = 0;
+    count = 0;
+}
+
+void RingBuffer::linearise() {
+    if (head == 0) {
+        return;
+    }
+    std::rotate(storage.begin(), storage.begin() + head, storage.end());
+    head = 0;
+}
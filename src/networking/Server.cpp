@@ -4,15 +4,54 @@
 
 #include "../../include/networking/Server.h"
 
+// The event loop key for the listening socket. Client sockets are keyed by
+// their handle ID
+#define LISTEN_SOCKET_KEY (~0ull - 1)
+
+// The most messages, and bytes, read from a single client in one pass of the
+// server loop before moving on to the other clients
+#define CLIENT_READ_MESSAGE_BUDGET 32
+#define CLIENT_READ_BYTE_BUDGET (4u * 1024u * 1024u)
+
+// Once a client has this many bytes waiting to be sent, threads sending it
+// more wait for the backlog to drain. Checked every SEND_SPACE_POLL_MS in case
+// the client disconnects while they wait.
+#define CLIENT_SEND_HIGH_WATER_MARK (8u * 1024u * 1024u)
+#define SEND_SPACE_POLL_MS 100
+
+// How often expired repeat tokens and resumption tickets are cleared out, and
+// the repeat tokens are written to their file
+#define REPEAT_TOKEN_SWEEP_INTERVAL_S 60
+
+// The current time in seconds since the UNIX epoch, as used for resumption
+// ticket expiries
+static uint64 unixTime() {
+  return std::chrono::duration_cast<std::chrono::seconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+// Builds the plaintext of a message to a client which tags its requests: the
+// ID of the request the message answers, followed by the message. The buffer
+// is padded as the whole of the last AES block is encrypted.
+static std::vector<uint8> tagMessage(RequestID requestID, const void *message,
+                                     unsigned messageLength) {
+  std::vector<uint8> tagged(
+      PADDED_SIZE(sizeof(RequestID) + messageLength, AES_CHUNK_SIZE));
+  memcpy(tagged.data(), &requestID, sizeof(RequestID));
+  memcpy(tagged.data() + sizeof(RequestID), message, messageLength);
+  return tagged;
+}
+
 std::string getNonBlockingInput() {
   std::string result;
   std::getline(std::cin, result);
   return result;
 }
 
-ClientHandle::ClientHandle(unsigned id) { this->clientID = id; }
+ClientHandle::ClientHandle(unsigned long long id) { this->clientID = id; }
 
-ClientData::ClientData(unsigned handleID, const TCPSocket &socket,
+ClientData::ClientData(unsigned long long handleID, const TCPSocket &socket,
                        const AESKey &sessionKey, uint64 sessionToken,
                        uint64 authNonce)
     : handle(handleID) {
@@ -22,6 +61,10 @@ ClientData::ClientData(unsigned handleID, const TCPSocket &socket,
   clientAuthNonce = authNonce;
 }
 
+size_t ClientData::sendBacklog() const {
+  return queuedSendBytes + socketSendBytes;
+}
+
 Server::Server(float refreshRate, RSAKeyPair serverKey,
                DigitalSignatureKeyPair serverSignature) {
   this->refreshRate = refreshRate;
@@ -42,161 +85,145 @@ void Server::initialiseServer(unsigned short serverPort) {
 
   guardTCPSocketCode(serverSocket.beginListen(), *errorStream);
 
-  serverSocket.setAcceptCallback([this](TCPSocket &&s) {
-    std::future<void> acceptAsync = std::async(
-        std::launch::async, &Server::acceptClient, this, std::ref(s));
-
-    if (acceptAsync.wait_for(std::chrono::milliseconds(60000)) !=
-        std::future_status::ready) {
-      s.closeSocket();
-    }
-  });
+  serverSocket.setAcceptCallback(
+      [this](TCPSocket &&s) { queueHandshake(std::move(s)); });
 
   Logger::log("Server initialised");
 }
 
 void Server::startServer() {
+  // If the refresh rate is either negative or 0 it is invalid, so raise
+  // an error (otherwise there is the risk of division by 0 when computing
+  // the heartbeat interval)
+  if (refreshRate <= 0) {
+    ERROR_TO("Refresh rate is <= 0. This is not allowed", *errorStream)
+  }
+
+  if (!eventLoop.add(serverSocket, LISTEN_SOCKET_KEY)) {
+    ERROR_TO("Failed to register server socket with event loop", *errorStream)
+  }
+
+  requestPool.start(requestWorkerThreads);
+  handshakePool.start(handshakeWorkerThreads);
+  broadcastPool.start(requestWorkerThreads);
+
+  loopThreadID = std::this_thread::get_id();
+  loopRunning = true;
+
   Logger::log("Server started successfully");
 
-  // Asynchronous call to console read to make console inputs non-blocking
+  // Asynchronous call to console read to make console inputs non-blocking.
+  // The loop is woken once the input is ready so it is handled immediately.
+  auto readInput = [this]() {
+    std::string input = getNonBlockingInput();
+    eventLoop.wake();
+    return input;
+  };
   std::future<std::string> nonBlockingInput =
-      std::async(std::launch::async, getNonBlockingInput);
+      std::async(std::launch::async, readInput);
 
-  // Variables to hold the start and end times of each update frame (for
-  // calculating frame delta time)
-  std::chrono::time_point<std::chrono::system_clock> start, end;
+  // Each client is sent a heartbeat every heartBeatCycles ticks of the
+  // refresh rate, on its own timer
+  heartbeatInterval =
+      std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+          std::chrono::duration<double>(heartBeatCycles / refreshRate));
+  timers.schedule(std::chrono::steady_clock::now() +
+                      std::chrono::seconds(REPEAT_TOKEN_SWEEP_INTERVAL_S),
+                  0, (unsigned)ServerTimer::TOKEN_SWEEP);
 
-  unsigned cycle = 0;
+  std::vector<EventLoop::Event> events;
+  std::vector<TimerWheel::Timer> expiredTimers;
 
   while (true) {
-    // Get the start time of this frame
-    start = std::chrono::system_clock::now();
-
-    // Check if any client is trying to connect to the server
-    switch (serverSocket.tryAccept(true)) {
-      case ERR_ACCEPT:
-        Logger::logError("Failed to accept client", -1, "", false);
-      case SOCKET_SUCCESS:
-        Logger::log("Accepted a new client");
-      case S_NO_DATA:
-      default:
-        break;
-    }
-
-    // For every client waiting for authentication, try to authenticate
-    // them.
-    for (int ic = 0; ic < waitingClients.size(); ic++) {
-      if (tryAuthenticateClient(*waitingClients[ic])) {
-        waitingClients.erase(waitingClients.begin() + ic);
+    // Block until a socket is ready, another thread wakes us or the next
+    // timer is due. The token sweep is always scheduled, so there is always
+    // a next timer.
+    std::chrono::milliseconds untilTimer =
+        std::chrono::duration_cast<std::chrono::milliseconds>(
+            timers.nextDeadline() - std::chrono::steady_clock::now());
+    // If any client still has messages buffered from the last pass, don't
+    // block, so they are handled straight away
+    eventLoop.wait(events,
+                   pendingReadClients.empty()
+                       ? (int)std::max<long long>(untilTimer.count(), 0)
+                       : 0);
+
+    // Pick up any clients which have finished their key exchange
+    adoptAcceptedClients();
+
+    // Continue reading from clients which hit their read budget last pass
+    std::vector<unsigned long long> pending;
+    pending.swap(pendingReadClients);
+    for (unsigned long long clientID : pending) {
+      if (ClientData *client = clients.get(clientID)) {
+        drainClientMessages(*client);
       }
     }
 
-    // Check all connected client channels for incoming messages
-    for (int ic = 0; ic < connectedClients.size(); ic++) {
-      ClientData &connectedClient = *connectedClients[ic];
-
-      // First, check if the client socket connection is dead
-      /*if (connectedClient.clientSocket.dead()) {
-          *logStream << "Client " << connectedClient.clientEmail << "
-      disconnected." << std::endl;
-          connectedClient.clientSocket.closeSocket();
-          connectedClients.erase(connectedClients.begin() + ic);
-          handleMap.erase(connectedClient.handle.clientID);
+    for (const EventLoop::Event &event : events) {
+      if (event.key == LISTEN_SOCKET_KEY) {
+        // Accept every client waiting on the listen socket
+        TCPSocketCode acceptCode;
+        while ((acceptCode = serverSocket.tryAccept()) == SOCKET_SUCCESS) {
+          Logger::log("Accepted a new client");
+        }
+        if (acceptCode == ERR_ACCEPT) {
+          Logger::logError("Failed to accept client", -1, "", false);
+        }
+        continue;
       }
 
-      EncryptedNetworkMessage message;
-      // If we haven't received a message, continue
-      if (connectedClient.clientSocket.receiveMessage(message,
-      MessageProtocol::AES_MESSAGE) != SOCKET_SUCCESS) { continue;
-      }*/
-
-      EncryptedNetworkMessage message;
+      ClientData *client = clients.get(event.key);
+      if (!client) {
+        continue;
+      }
 
-      switch (connectedClient.clientSocket.receiveMessage(
-          message, MessageProtocol::AES_MESSAGE)) {
-        case SOCKET_SUCCESS:
-          break;
-        case ERR_SOCKET_DEAD:
-          lockLog {
-            *ss << "Client " << connectedClient.clientEmail
-                                   << " disconnected (timed out).";
-            Logger::log();
+      if (event.events & EventLoop::EVENT_READABLE) {
+        if (client->authenticated) {
+          if (!drainClientMessages(*client)) {
+            continue;
           }
-
-          connectedClient.clientSocket.closeSocket();
-          delete &connectedClient;
-          connectedClients.erase(connectedClients.begin() + ic);
-          handleMap.erase(connectedClient.handle.clientID);
-          continue;
-        case SOCKET_DISCONNECTED:
-          switch (*((DisconnectCode *)message.getMessageData())) {
-            case DisconnectCode::CLIENT_EXIT:
-              lockLog {
-                *ss
-                    << "Client " << connectedClient.clientEmail
-                    << " disconnected.";
-                Logger::log();
-              }
-              break;
-            default:
-              lockLog {
-                *ss
-                    << "Client " << connectedClient.clientEmail
-                    << " disconnected (with error code).";
-                Logger::log();
-              }
-              break;
+        } else if (tryAuthenticateClient(*client)) {
+          // If the client failed to authenticate, its socket has been closed
+          if (!client->authenticated) {
+            disconnectClient(client);
+            continue;
           }
-          connectedClient.clientSocket.closeSocket();
-          delete &connectedClient;
-          connectedClients.erase(connectedClients.begin() + ic);
-          handleMap.erase(connectedClient.handle.clientID);
-          continue;
-        default:
+          timers.cancel(client->timeoutTimer);
+          client->timeoutTimer = TimerWheel::NO_TIMER;
+          startHeartbeats(*client);
+          // The client may have sent requests straight after authenticating
+          if (!drainClientMessages(*client)) {
+            continue;
+          }
+        }
+      }
+
+      if (event.events & EventLoop::EVENT_WRITABLE) {
+        // The socket has space again, so carry on from where the last send
+        // stopped
+        if (!flushClient(*client)) {
           continue;
+        }
       }
 
-      // If the message received successfully
-      if (!message.error()) {
-        // Get the message and decrypt it with this client's key
-        uint8 *decryptedMessage = (uint8 *)message.decryptMessageData(
-            connectedClient.clientSessionKey);
-        uint64 messageToken = *((uint64 *)decryptedMessage);
-        // We create a rvalue reference to indicate ownership, and we
-        // fill it with the message - the token.
-        void *&&msg = malloc(message.getMessageSize() - sizeof(uint64));
-        std::memmove(msg, decryptedMessage + sizeof(uint64),
-                     message.getMessageSize() - sizeof(uint64));
-        free(decryptedMessage);
-        // If the message starts with the client's secret session token,
-        // the message is valid
-        if (messageToken == connectedClient.clientSessionToken) {
-          // Assuming we have set an appropriate handler, call it with
-          // the decrypted message
-          if (requestHandler) {
-            requestHandler->onMessageReceived(
-                *this, connectedClient.handle, std::move(msg),
-                message.getMessageSize() - sizeof(uint64));
-          }
+      if (event.events & EventLoop::EVENT_HANGUP) {
+        lockLog {
+          *ss << "Client " << client->clientEmail << " disconnected.";
+          Logger::log();
         }
+        disconnectClient(client);
       }
     }
 
     // Send any messages in the send queue
-    sendQueueMutex.lock();
-    while (!sendQueue.empty()) {
-      std::pair<unsigned, NetworkMessage *> message = sendQueue.front();
-      handleMap[message.first]->clientSocket.sendMessage(*message.second);
-      sendQueue.pop();
-      delete message.second;
-    }
-    sendQueueMutex.unlock();
-
-    // Every n cycles
-    if (cycle % heartBeatCycles == 0) {
-      for (ClientData *connectedClient : connectedClients) {
-        connectedClient->clientSocket.heartbeat();
-      }
+    flushSendQueue();
+
+    // Send heartbeats and reap clients whose time is up
+    expiredTimers.clear();
+    timers.advance(std::chrono::steady_clock::now(), expiredTimers);
+    for (const TimerWheel::Timer &timer : expiredTimers) {
+      handleTimer(timer);
     }
 
     if (nonBlockingInput.wait_for(std::chrono::milliseconds(0)) ==
@@ -211,45 +238,528 @@ void Server::startServer() {
         break;
       }
       if (input == "list users") {
-        for (ClientData *connectedClient : connectedClients) {
-          std::cout << "Client: " << connectedClient->clientEmail << std::endl;
+        for (ClientData *connectedClient : clients) {
+          if (connectedClient->authenticated) {
+            std::cout << "Client: " << connectedClient->clientEmail
+                      << std::endl;
+          }
+        }
+      }
+      if (input == "network stats") {
+        TCPSocket::ReceiveCounters counters = TCPSocket::receiveCounters();
+        double megabytes = counters.bytesReceived / 1048576.0;
+        std::cout << "recv calls: " << counters.recvCalls
+                  << ", MB received: " << megabytes << std::endl;
+        std::cout << "recv calls per MB: "
+                  << (megabytes > 0 ? counters.recvCalls / megabytes : 0)
+                  << std::endl;
+        std::cout << "Client read budget hits: " << readBudgetHits
+                  << std::endl;
+        std::cout << "Timers scheduled: " << timers.size() << std::endl;
+        std::cout << "Send backpressure waits: " << backpressureWaits
+                  << std::endl;
+        HandshakeMetrics handshakes = handshakeMetrics();
+        std::cout << "Handshakes queued: " << handshakes.queuedHandshakes
+                  << ", max queued: " << handshakes.maxQueuedHandshakes
+                  << ", rejected: " << handshakes.rejectedHandshakes
+                  << std::endl;
+        std::cout << "Handshakes completed: " << handshakes.completedHandshakes
+                  << ", failed: " << handshakes.failedHandshakes << std::endl;
+        std::cout << "Handshake latency (ms) mean: "
+                  << (handshakes.completedHandshakes +
+                              handshakes.failedHandshakes
+                          ? handshakes.totalLatencyMs /
+                                (handshakes.completedHandshakes +
+                                 handshakes.failedHandshakes)
+                          : 0)
+                  << ", max: " << handshakes.maxLatencyMs << std::endl;
+        BufferPool::Counters pool = BufferPool::counters();
+        std::cout << "Buffer pool hits: " << pool.hits
+                  << ", misses: " << pool.misses
+                  << ", KB held: " << pool.bytesHeld / 1024 << std::endl;
+      }
+      if (input == "compression stats") {
+        std::lock_guard<std::mutex> statsGuard(compressionStatsMutex);
+        for (const std::pair<const RequestType, CompressionStats> &entry :
+             compressionStats) {
+          const CompressionStats &stats = entry.second;
+          std::cout << "Request type " << (unsigned)entry.first << ": "
+                    << stats.compressedMessages << "/" << stats.messages
+                    << " messages compressed, ratio "
+                    << (stats.bytesOut ? (double)stats.bytesIn / stats.bytesOut
+                                       : 0)
+                    << ", mean CPU time (us) "
+                    << stats.compressNanoseconds / 1000.0 / stats.messages
+                    << std::endl;
         }
       }
+      if (input == "handler stats" && requestHandler) {
+        requestHandler->writeStats(std::cout);
+      }
+      if (input == "handler check" && requestHandler) {
+        requestHandler->runChecks(*this, std::cout);
+      }
+      if (input == "database stats" && dbManager) {
+        SessionPool::Metrics metrics = dbManager->sessionPoolMetrics();
+        std::cout << "Sessions active: " << metrics.activeSessions
+                  << ", idle: " << metrics.idleSessions << std::endl;
+        std::cout << "Checkouts: " << metrics.checkouts
+                  << ", failed: " << metrics.failedCheckouts << std::endl;
+        std::cout << "Checkout wait (ms) mean: "
+                  << (metrics.checkouts + metrics.failedCheckouts
+                          ? metrics.totalWaitMs / (metrics.checkouts +
+                                                   metrics.failedCheckouts)
+                          : 0)
+                  << ", max: " << metrics.maxWaitMs << std::endl;
+      }
 
-      nonBlockingInput = std::async(std::launch::async, getNonBlockingInput);
+      nonBlockingInput = std::async(std::launch::async, readInput);
     }
+  }
+
+  eventLoop.remove(serverSocket);
+
+  // Nothing will send for the senders from here on, so stop them waiting
+  loopRunning = false;
+  sendSpaceCondition.notify_all();
+
+  // Let any handshakes and requests which are still being handled finish
+  handshakePool.stop();
+  requestPool.stop();
+  broadcastPool.stop();
+  flushSendQueue();
 
-    // If the refresh rate is either negative or 0 it is invalid, so raise
-    // an error (otherwise there is the risk of division by 0 or running a
-    // while loop at maximum speed causing the process to overload the CPU!)
-    if (refreshRate <= 0) {
-      ERROR_TO("Refresh rate is <= 0. This is not allowed", *errorStream)
+  // Keep any tokens issued since the last sweep
+  repeatTokens.flush();
+}
+
+void Server::adoptAcceptedClients() {
+  std::vector<ClientData *> adopted;
+  {
+    std::lock_guard<std::mutex> guard(acceptedClientsMutex);
+    adopted.swap(acceptedClients);
+  }
+
+  for (ClientData *client : adopted) {
+    {
+      std::unique_lock<std::shared_mutex> clientsLock(clientsMutex);
+      client->handle.clientID = clients.insert(client);
     }
 
-    // Get the end time of this frame
-    end = std::chrono::system_clock::now();
+    // Clients which resumed a session have already authenticated
+    if (client->authenticated) {
+      startHeartbeats(*client);
+    } else {
+      client->timeoutTimer = timers.schedule(
+          std::chrono::steady_clock::now() +
+              std::chrono::seconds(AUTHENTICATION_TIMEOUT_S),
+          client->handle.clientID,
+          (unsigned)ServerTimer::AUTHENTICATION_DEADLINE);
+    }
 
-    // Calculate how long this frame took to execute
-    std::chrono::duration<double> frameElapsed = end - start;
+    if (!eventLoop.add(client->clientSocket, client->handle.clientID)) {
+      Logger::logError("Failed to register client with event loop", __LINE__,
+                       __FILE__);
+      disconnectClient(client);
+    }
+  }
+}
 
-    // Calculate how much extra time must be waited to have the frame take
-    // the correct total time
-    double delta = (1.0 / refreshRate) - frameElapsed.count();
+bool Server::drainClientMessages(ClientData &client) {
+  unsigned messagesRead = 0, bytesRead = 0;
 
-    // If we have time to wait, wait it, otherwise don't (can't wait a
-    // negative time!)
-    if (delta > 0) {
-      // Sleep function in microseconds, so multiply by 1e6
-      // usleep(delta * 1e6);
-      std::this_thread::sleep_for(
-          std::chrono::microseconds((long long)(delta * 1e6)));
+  // Read every message already available from this client, but stop after
+  // the budget so one chatty client can't hold up the rest
+  while (messagesRead < CLIENT_READ_MESSAGE_BUDGET &&
+         bytesRead < CLIENT_READ_BYTE_BUDGET) {
+    switch (receiveClientMessage(client, bytesRead)) {
+      case S_NO_DATA:
+        // Heartbeat responses are sent as they are read, and may not have
+        // gone in full
+        trackPendingSend(client);
+        return true;
+      case ERR_SOCKET_DEAD:
+      case SOCKET_DISCONNECTED:
+        return false;
+      default:
+        messagesRead++;
+        break;
     }
+  }
 
-    cycle++;
+  readBudgetHits++;
+  trackPendingSend(client);
+
+  // Anything left in the kernel will be reported by the event loop again, but
+  // messages which have already been read into the socket's buffer won't, so
+  // the client is revisited on the next pass
+  if (client.clientSocket.hasBufferedMessage() &&
+      std::find(pendingReadClients.begin(), pendingReadClients.end(),
+                client.handle.clientID) == pendingReadClients.end()) {
+    pendingReadClients.push_back(client.handle.clientID);
+  }
+
+  return true;
+}
+
+TCPSocketCode Server::receiveClientMessage(ClientData &connectedClient,
+                                           unsigned &bytesRead) {
+  EncryptedNetworkMessage message;
+
+  TCPSocketCode code = connectedClient.clientSocket.receiveMessage(
+      message, MessageProtocol::AES_MESSAGE);
+
+  switch (code) {
+    case SOCKET_SUCCESS:
+      break;
+    case ERR_SOCKET_DEAD:
+      lockLog {
+        *ss << "Client " << connectedClient.clientEmail
+            << " disconnected (timed out).";
+        Logger::log();
+      }
+      disconnectClient(&connectedClient);
+      return code;
+    case SOCKET_DISCONNECTED:
+      // The client closed its socket without sending a disconnect message
+      if (message.getMessageSize() < sizeof(DisconnectCode)) {
+        lockLog {
+          *ss << "Client " << connectedClient.clientEmail
+              << " disconnected (connection closed).";
+          Logger::log();
+        }
+        disconnectClient(&connectedClient);
+        return code;
+      }
+      switch (*((DisconnectCode *)message.getMessageData())) {
+        case DisconnectCode::CLIENT_EXIT:
+          lockLog {
+            *ss << "Client " << connectedClient.clientEmail
+                << " disconnected.";
+            Logger::log();
+          }
+          break;
+        default:
+          lockLog {
+            *ss << "Client " << connectedClient.clientEmail
+                << " disconnected (with error code).";
+            Logger::log();
+          }
+          break;
+      }
+      disconnectClient(&connectedClient);
+      return code;
+    default:
+      // A failed receive leaves the socket dead, as the stream can't be
+      // trusted after it
+      if (connectedClient.clientSocket.dead()) {
+        lockLog {
+          *ss << "Client " << connectedClient.clientEmail
+              << " disconnected (receive failed).";
+          Logger::log();
+        }
+        disconnectClient(&connectedClient);
+        return ERR_SOCKET_DEAD;
+      }
+      return code;
+  }
+
+  bytesRead += message.getMessageSize();
+
+  // If the message received successfully
+  if (!message.error()) {
+    // Get the message and decrypt it with this client's key. Decryption and
+    // decompression are done separately so a failure reports which failed.
+    uint8 *decryptedMessage = (uint8 *)message.decryptMessageData(
+        connectedClient.clientSessionKey);
+    if (!decryptedMessage) {
+      Logger::logError("Received a message from " +
+                           connectedClient.clientEmail +
+                           " which could not be decrypted",
+                       __LINE__, __FILE__);
+      return code;
+    }
+    uint32 decryptedSize = message.getMessageSize();
+
+    if (message.frameFlags() & FRAME_FLAG_COMPRESSED) {
+      uint8 *compressedMessage = decryptedMessage;
+      decryptedMessage = (uint8 *)decompressPayload(
+          compressedMessage, message.getMessageSize(), decryptedSize);
+      free(compressedMessage);
+      if (!decryptedMessage) {
+        Logger::logError("Received a message from " +
+                             connectedClient.clientEmail +
+                             " which could not be decompressed",
+                         __LINE__, __FILE__);
+        return code;
+      }
+    }
+
+    if (decryptedSize < sizeof(uint64)) {
+      Logger::logError("Received a message from " +
+                           connectedClient.clientEmail +
+                           " which was too short to hold a session token",
+                       __LINE__, __FILE__);
+      free(decryptedMessage);
+      return code;
+    }
+    uint64 messageToken = *((uint64 *)decryptedMessage);
+
+    // Clients which tag their requests send the request's ID after the token
+    ClientHandle handle = connectedClient.handle;
+    unsigned headerSize = sizeof(uint64);
+    if (connectedClient.requestIDs) {
+      headerSize += sizeof(RequestID);
+      if (decryptedSize < headerSize) {
+        free(decryptedMessage);
+        return code;
+      }
+      memcpy(&handle.requestID, decryptedMessage + sizeof(uint64),
+             sizeof(RequestID));
+    }
+
+    // If the message starts with the client's secret session token,
+    // the message is valid
+    if (messageToken == connectedClient.clientSessionToken &&
+        requestHandler) {
+      // Assuming we have set an appropriate handler, hand the decrypted
+      // message to a request worker. Requests are keyed by client so each
+      // client's requests are handled in the order they arrived. A client
+      // which tags its requests matches up the responses itself, so its read
+      // only requests are keyed on their own and can run in parallel.
+      // The handler gets a view of the message past the header, so it is
+      // never copied out of the buffer it was decrypted into.
+      unsigned messageSize = decryptedSize - headerSize;
+      std::function<void()> request = [this, handle, decryptedMessage,
+                                       headerSize, messageSize]() {
+        requestHandler->onMessageReceived(
+            *this, handle,
+            MessageBuffer(decryptedMessage, headerSize, messageSize));
+      };
+
+      if (connectedClient.requestIDs) {
+        bool readOnly = requestHandler->isReadOnly(
+            decryptedMessage + headerSize, messageSize);
+        unsigned long long requestKey =
+            ((unsigned long long)handle.requestID << 32u) |
+            (uint32)handle.clientID;
+        submitOrderedRequest(connectedClient, std::move(request), readOnly,
+                             requestKey);
+      } else {
+        requestPool.submit(handle.clientID, std::move(request));
+      }
+    } else {
+      free(decryptedMessage);
+    }
+  }
+
+  return code;
+}
+
+void Server::submitOrderedRequest(const ClientData &client,
+                                  std::function<void()> &&request,
+                                  bool readOnly,
+                                  unsigned long long requestKey) {
+  std::shared_ptr<RequestOrder> order = client.requestOrder;
+  unsigned long long clientKey = client.handle.clientID;
+
+  std::lock_guard<std::mutex> orderGuard(order->mutex);
+
+  // A read only request with nothing waiting in front of it runs on its own
+  // key, in parallel with the client's other reads
+  if (readOnly && order->pendingWrites == 0 && order->held.empty()) {
+    order->runningReads++;
+    requestPool.submit(requestKey, [this, order, clientKey,
+                                    request = std::move(request)]() {
+      request();
+
+      // Once the last read in front of them has finished, the held requests
+      // go to the client's key in the order they arrived
+      std::lock_guard<std::mutex> orderGuard(order->mutex);
+      if (--order->runningReads == 0) {
+        for (std::function<void()> &held : order->held) {
+          requestPool.submit(clientKey, std::move(held));
+        }
+        order->held.clear();
+      }
+    });
+    return;
+  }
+
+  // Anything else runs on the client's key, after every earlier request on it
+  // and before every later one. While a request which isn't read only is
+  // pending, later reads join it there rather than overtaking it.
+  std::function<void()> task = std::move(request);
+  if (!readOnly) {
+    order->pendingWrites++;
+    task = [order, write = std::move(task)]() {
+      write();
+
+      std::lock_guard<std::mutex> orderGuard(order->mutex);
+      order->pendingWrites--;
+    };
+  }
+
+  // It must also wait for any reads which were handed out before it
+  if (order->runningReads > 0) {
+    order->held.push_back(std::move(task));
+  } else {
+    requestPool.submit(clientKey, std::move(task));
+  }
+}
+
+void Server::startHeartbeats(ClientData &client) {
+  std::uniform_int_distribution<long long> offset(
+      0, std::max<long long>(heartbeatInterval.count() - 1, 0));
+  client.heartbeatTimer =
+      timers.schedule(std::chrono::steady_clock::now() +
+                          std::chrono::steady_clock::duration(
+                              offset(heartbeatJitter)),
+                      client.handle.clientID, (unsigned)ServerTimer::HEARTBEAT);
+}
+
+void Server::handleTimer(const TimerWheel::Timer &timer) {
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+  if ((ServerTimer)timer.kind == ServerTimer::TOKEN_SWEEP) {
+    sweepTokens();
+    timers.schedule(now + std::chrono::seconds(REPEAT_TOKEN_SWEEP_INTERVAL_S),
+                    0, (unsigned)ServerTimer::TOKEN_SWEEP);
+    return;
+  }
+
+  // A client's timers are cancelled when it disconnects, but another timer
+  // fired in the same advance may already have disconnected it
+  ClientData *client = clients.get(timer.key);
+  if (!client) {
+    return;
+  }
+
+  switch ((ServerTimer)timer.kind) {
+    case ServerTimer::HEARTBEAT: {
+      client->clientSocket.heartbeat();
+      trackPendingSend(*client);
+      client->heartbeatTimer =
+          timers.schedule(now + heartbeatInterval, timer.key,
+                          (unsigned)ServerTimer::HEARTBEAT);
+
+      // The client must respond before the connection timeout, which starts
+      // again with each heartbeat. Allow an extra tick, so the heartbeat has
+      // definitely expired when the timer fires.
+      std::chrono::duration<float> timeout(
+          client->clientSocket.getConnectionTimeout());
+      timers.cancel(client->timeoutTimer);
+      client->timeoutTimer = timers.schedule(
+          now +
+              std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                  timeout) +
+              std::chrono::milliseconds(TIMER_WHEEL_TICK_MS),
+          timer.key, (unsigned)ServerTimer::HEARTBEAT_TIMEOUT);
+      break;
+    }
+    case ServerTimer::HEARTBEAT_TIMEOUT:
+      client->timeoutTimer = TimerWheel::NO_TIMER;
+      if (client->clientSocket.heartbeatExpired()) {
+        lockLog {
+          *ss << "Client " << client->clientEmail
+              << " disconnected (timed out).";
+          Logger::log();
+        }
+        disconnectClient(client);
+      }
+      break;
+    case ServerTimer::AUTHENTICATION_DEADLINE:
+      client->timeoutTimer = TimerWheel::NO_TIMER;
+      Logger::log("Client failed to authenticate in time. Terminating "
+                  "connection.");
+      disconnectClient(client);
+      break;
+    case ServerTimer::TOKEN_SWEEP:
+      break;
+  }
+}
+
+void Server::disconnectClient(ClientData *client) {
+  timers.cancel(client->heartbeatTimer);
+  timers.cancel(client->timeoutTimer);
+  eventLoop.remove(client->clientSocket);
+  client->clientSocket.closeSocket();
+
+  // The map owns the client, so this deletes it
+  std::unique_lock<std::shared_mutex> clientsLock(clientsMutex);
+  clients.erase(client->handle.clientID);
+}
+
+void Server::flushSendQueue() {
+  std::vector<ClientData *> written;
+  for (ClientData *client : clients) {
+    if (moveQueuedMessages(*client)) {
+      written.push_back(client);
+    }
+  }
+
+  // Flushing may disconnect a client, so this is done once we have finished
+  // iterating over the clients
+  for (ClientData *client : written) {
+    flushClient(*client);
+  }
+}
+
+bool Server::moveQueuedMessages(ClientData &client) {
+  bool moved = false;
+
+  EncryptedNetworkMessage message;
+  while (client.sendQueue.tryPop(message)) {
+    client.clientSocket.queueMessage(message);
+    client.queuedSendBytes -= message.dataStreamSize();
+    moved = true;
+  }
+
+  return moved;
+}
+
+bool Server::flushClient(ClientData &client) {
+  if (client.clientSocket.flushSendBuffer() == ERR_SOCKET_DEAD) {
+    lockLog {
+      *ss << "Client " << client.clientEmail
+          << " disconnected (send failed).";
+      Logger::log();
+    }
+    disconnectClient(&client);
+    return false;
+  }
+
+  trackPendingSend(client);
+  return true;
+}
+
+void Server::trackPendingSend(ClientData &client) {
+  client.socketSendBytes = client.clientSocket.pendingSendBytes();
+
+  // Only watch for writability while there is something to write, otherwise
+  // the event loop would report the socket every pass
+  bool wantsWrite = client.socketSendBytes > 0;
+  if (wantsWrite != client.writeInterest) {
+    unsigned interest = EventLoop::EVENT_READABLE;
+    if (wantsWrite) {
+      interest |= EventLoop::EVENT_WRITABLE;
+    }
+    if (eventLoop.modify(client.clientSocket, client.handle.clientID,
+                         interest)) {
+      client.writeInterest = wantsWrite;
+    }
+  }
+
+  // Waiting senders check for themselves whether there is now room
+  if (sendSpaceWaiters > 0) {
+    sendSpaceCondition.notify_all();
   }
 }
 
 void Server::closeServer() {
+  handshakePool.stop();
+  requestPool.stop();
+  broadcastPool.stop();
   serverSocket.closeSocket();
   dbManager->closeConnection();
   delete dbManager;
@@ -259,12 +769,172 @@ void Server::closeServer() {
 void Server::addMessageToSendQueue(const ClientHandle &clientHandle,
                                    const void *message,
                                    unsigned messageLength) {
-  sendQueueMutex.lock();
-  sendQueue.emplace(clientHandle.clientID,
-                    new EncryptedNetworkMessage(
-                        message, sizeof(uint64) + messageLength,
-                        handleMap[clientHandle.clientID]->clientSessionKey));
-  sendQueueMutex.unlock();
+  deliverMessage(clientHandle, message, messageLength, true);
+
+  // Wake the server loop so the message is sent straight away
+  eventLoop.wake();
+}
+
+void Server::deliverMessage(const ClientHandle &clientHandle,
+                            const void *message, unsigned messageLength,
+                            bool applyBackpressure) {
+  AESKey sessionKey;
+  bool compression, requestIDs;
+  {
+    // The server loop is the only thread which modifies the client lists, so
+    // it can read them without locking
+    std::shared_lock<std::shared_mutex> clientsLock(clientsMutex,
+                                                    std::defer_lock);
+    if (std::this_thread::get_id() != loopThreadID) {
+      clientsLock.lock();
+    }
+
+    const ClientData *client = clients.get(clientHandle.clientID);
+    // The client may have disconnected while its request was being handled
+    if (!client) {
+      return;
+    }
+    sessionKey = client->clientSessionKey;
+    compression = client->compression;
+    requestIDs = client->requestIDs;
+  }
+
+  // Encrypting is the expensive part, so it is done without holding the
+  // clients lock
+  enqueueMessage(clientHandle,
+                 encodeMessage(sessionKey, compression, requestIDs,
+                               clientHandle.requestID, message, messageLength),
+                 applyBackpressure);
+}
+
+void Server::enqueueMessage(const ClientHandle &clientHandle,
+                            EncryptedNetworkMessage &&encrypted,
+                            bool applyBackpressure) {
+  if (std::this_thread::get_id() == loopThreadID) {
+    // The server loop owns the client lists and empties the send queues, so
+    // it hands the message straight to the socket, after anything already
+    // queued so the messages stay in order
+    if (ClientData *client = clients.get(clientHandle.clientID)) {
+      moveQueuedMessages(*client);
+      client->clientSocket.queueMessage(encrypted);
+      flushClient(*client);
+    }
+    return;
+  }
+
+  size_t messageSize = encrypted.dataStreamSize();
+  bool waited = false;
+
+  while (true) {
+    {
+      std::shared_lock<std::shared_mutex> clientsLock(clientsMutex);
+
+      ClientData *found = clients.get(clientHandle.clientID);
+      // The client may have disconnected while we were waiting for it to
+      // catch up
+      if (!found) {
+        return;
+      }
+      ClientData &client = *found;
+
+      if (!applyBackpressure || !loopRunning ||
+          client.sendBacklog() < CLIENT_SEND_HIGH_WATER_MARK) {
+        // Counted before the push so the server loop never takes away bytes
+        // which haven't been added yet
+        client.queuedSendBytes += messageSize;
+        if (client.sendQueue.tryPush(std::move(encrypted))) {
+          return;
+        }
+        client.queuedSendBytes -= messageSize;
+
+        if (!loopRunning) {
+          // Nothing is going to empty the queue any more
+          Logger::logError("Dropped a message for " + client.clientEmail +
+                               " as its send queue is full",
+                           __LINE__, __FILE__);
+          return;
+        }
+      }
+    }
+
+    if (!waited) {
+      backpressureWaits++;
+      waited = true;
+    }
+
+    // Make sure the loop is sending what has already been queued, then wait
+    // for it to make room
+    eventLoop.wake();
+    sendSpaceWaiters++;
+    {
+      std::unique_lock<std::mutex> sendSpaceLock(sendSpaceMutex);
+      sendSpaceCondition.wait_for(
+          sendSpaceLock, std::chrono::milliseconds(SEND_SPACE_POLL_MS));
+    }
+    sendSpaceWaiters--;
+  }
+}
+
+bool Server::compressMessage(RequestType type, const void *payload,
+                             unsigned payloadSize,
+                             std::vector<uint8> &compressed) {
+  if (payloadSize < COMPRESSION_THRESHOLD) {
+    return false;
+  }
+
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  bool wasCompressed = compressPayload(payload, payloadSize, compressed);
+  std::chrono::nanoseconds elapsed = std::chrono::steady_clock::now() - start;
+
+  {
+    std::lock_guard<std::mutex> statsGuard(compressionStatsMutex);
+    CompressionStats &stats = compressionStats[type];
+    stats.messages++;
+    stats.bytesIn += payloadSize;
+    stats.compressNanoseconds += elapsed.count();
+    if (wasCompressed) {
+      stats.compressedMessages++;
+      stats.bytesOut += compressed.size();
+    } else {
+      stats.bytesOut += payloadSize;
+    }
+  }
+
+  return wasCompressed;
+}
+
+EncryptedNetworkMessage Server::encodeMessage(const AESKey &sessionKey,
+                                              bool compression, bool requestIDs,
+                                              RequestID requestID,
+                                              const void *message,
+                                              unsigned messageLength) {
+  // Responses start with the type of request they answer
+  RequestType type;
+  memcpy(&type, message, sizeof(RequestType));
+
+  // The token's worth of bytes after the message are sent as well, so they are
+  // compressed too to keep the message the client receives the same. Clients
+  // which tag requests are sent exactly the message, after its request ID.
+  const void *payload = message;
+  unsigned payloadSize = sizeof(uint64) + messageLength;
+  std::vector<uint8> tagged;
+  if (requestIDs) {
+    tagged = tagMessage(requestID, message, messageLength);
+    payload = tagged.data();
+    payloadSize = sizeof(RequestID) + messageLength;
+  }
+
+  std::vector<uint8> compressed;
+  if (!compression ||
+      !compressMessage(type, payload, payloadSize, compressed)) {
+    return EncryptedNetworkMessage(payload, payloadSize, sessionKey);
+  }
+
+  EncryptedNetworkMessage encrypted(compressed.data(), compressed.size(),
+                                    sessionKey);
+  encrypted.setFrameFlags(FRAME_FLAG_COMPRESSED);
+  return encrypted;
 }
 
 void Server::addMessageToSendQueue(const ClientHandle &clientHandle,
@@ -273,8 +943,118 @@ void Server::addMessageToSendQueue(const ClientHandle &clientHandle,
 }
 
 void Server::broadcastMessage(const void *message, unsigned messageLength) {
-  for (const ClientData *client : connectedClients) {
-    addMessageToSendQueue(client->handle, message, messageLength);
+  struct BroadcastTarget {
+    ClientHandle handle;
+    AESKey sessionKey;
+    bool compression;
+    bool requestIDs;
+  };
+
+  // The plaintext sent to each kind of client: those which don't tag
+  // requests, and those which do. It is copied out of the caller's buffer
+  // once, and shared by every task which encrypts it, the last of which frees
+  // it.
+  struct BroadcastPayload {
+    RequestType type;
+    std::vector<uint8> data[2];
+    unsigned size[2] = {0, 0};
+    bool compress[2] = {false, false};
+    bool wasCompressed[2] = {false, false};
+    std::vector<uint8> compressed[2];
+    std::once_flag compressOnce;
+  };
+  std::shared_ptr<BroadcastPayload> payload =
+      std::make_shared<BroadcastPayload>();
+
+  // Each client is always handed to the same broadcast worker, so its
+  // broadcasts are encrypted and queued in the order they were made
+  size_t strands = std::max<size_t>(broadcastPool.threadCount(), 1);
+  std::vector<std::vector<BroadcastTarget>> shares(strands);
+  bool anyTagged = false;
+
+  // Take what we need to encrypt for each client so we aren't holding the
+  // clients lock while encrypting, or if we have to wait for a client's send
+  // queue to empty
+  {
+    std::shared_lock<std::shared_mutex> clientsLock(clientsMutex,
+                                                    std::defer_lock);
+    if (std::this_thread::get_id() != loopThreadID) {
+      clientsLock.lock();
+    }
+
+    for (const ClientData *client : clients) {
+      if (!client->authenticated) {
+        continue;
+      }
+      shares[client->handle.clientID % strands].push_back(
+          {client->handle, client->clientSessionKey, client->compression,
+           client->requestIDs});
+      payload->compress[client->requestIDs] |= client->compression;
+      anyTagged |= client->requestIDs;
+    }
+  }
+
+  memcpy(&payload->type, message, sizeof(RequestType));
+
+  // The token's worth of bytes after the message are sent to clients which
+  // don't tag requests, as in encodeMessage, so the copy is padded with zeros
+  // to hold them
+  payload->size[0] = sizeof(uint64) + messageLength;
+  payload->data[0].resize(payload->size[0]);
+  memcpy(payload->data[0].data(), message, messageLength);
+
+  // A broadcast doesn't answer any request, so clients which tag requests
+  // are sent it with NO_REQUEST_ID
+  if (anyTagged) {
+    payload->size[1] = sizeof(RequestID) + messageLength;
+    payload->data[1] = tagMessage(NO_REQUEST_ID, message, messageLength);
+  }
+
+  for (size_t strand = 0; strand < strands; strand++) {
+    if (shares[strand].empty()) {
+      continue;
+    }
+
+    std::function<void()> task = [this, payload,
+                                  share = std::move(shares[strand])]() {
+      // Every client of a kind is sent the same plaintext, so it is
+      // compressed at most once, by whichever task gets here first, and only
+      // the encryption is done per client
+      std::call_once(payload->compressOnce, [this, &payload]() {
+        for (unsigned kind = 0; kind < 2; kind++) {
+          payload->wasCompressed[kind] =
+              payload->compress[kind] &&
+              compressMessage(payload->type, payload->data[kind].data(),
+                              payload->size[kind], payload->compressed[kind]);
+        }
+      });
+
+      for (const BroadcastTarget &target : share) {
+        unsigned kind = target.requestIDs;
+        EncryptedNetworkMessage encrypted;
+        if (target.compression && payload->wasCompressed[kind]) {
+          encrypted = EncryptedNetworkMessage(
+              payload->compressed[kind].data(),
+              payload->compressed[kind].size(), target.sessionKey);
+          encrypted.setFrameFlags(FRAME_FLAG_COMPRESSED);
+        } else {
+          encrypted = EncryptedNetworkMessage(
+              payload->data[kind].data(), payload->size[kind],
+              target.sessionKey);
+        }
+        enqueueMessage(target.handle, std::move(encrypted), false);
+      }
+
+      eventLoop.wake();
+    };
+
+    // The workers only run while the server does. Outside of that there is
+    // nothing else to keep in order with, so the share is sent straight away.
+    if (broadcastPool.threadCount() == 0) {
+      task();
+    } else {
+      broadcastPool.submit(strand, std::move(task));
+    }
   }
 }
 
@@ -287,8 +1067,15 @@ void Server::sendRepeatToken(const ClientHandle &clientHandle,
   uint256 token;
   CryptoSafeRandom::random(&token, sizeof(uint256));
 
-  ClientData *data = handleMap[clientHandle.clientID];
-  repeatTokenMap[token] = {data->clientEmail, data->access};
+  {
+    std::shared_lock<std::shared_mutex> clientsLock(clientsMutex);
+    const ClientData *client = clients.get(clientHandle.clientID);
+    if (!client) {
+      return;
+    }
+
+    repeatTokens.insert(token, client->clientEmail, client->access);
+  }
 
   uint8 *buffer = (uint8 *)alloca(sizeof(unsigned) + sizeof(uint256));
   *((unsigned *)buffer) = responseCode;
@@ -300,7 +1087,15 @@ void Server::sendRepeatToken(const ClientHandle &clientHandle,
 
 void Server::sendEmailAddress(const ClientHandle &clientHandle,
                               unsigned int responseCode) {
-  std::string email = handleMap[clientHandle.clientID]->clientEmail;
+  std::string email;
+  {
+    std::shared_lock<std::shared_mutex> clientsLock(clientsMutex);
+    const ClientData *client = clients.get(clientHandle.clientID);
+    if (!client) {
+      return;
+    }
+    email = client->clientEmail;
+  }
   void *buffer =
       (uint8 *)alloca(sizeof(unsigned) + sizeof(unsigned char) + email.size());
   unsigned char *buff = (unsigned char *)buffer;
@@ -320,7 +1115,8 @@ void Server::connectToDatabaseServer(const std::string &database,
                                      const std::string &host) {
   try {
     delete dbManager;
-    dbManager = new DatabaseManager(database, user, password, host);
+    dbManager = new DatabaseManager(database, user, password, host,
+                                    databaseMinSessions, databaseMaxSessions);
   } catch (mysqlx::Error &e) {
     SQL_ERROR(e, *errorStream);
   }
@@ -344,37 +1140,137 @@ void Server::setLoggingStream(std::ostream *errStream) {
 
 void Server::changelogMessage(const ClientHandle &clientHandle,
                               const std::string &message) {
+  std::string email;
+  {
+    std::shared_lock<std::shared_mutex> clientsLock(clientsMutex);
+    const ClientData *client = clients.get(clientHandle.clientID);
+    if (!client) {
+      return;
+    }
+    email = client->clientEmail;
+  }
+
   lockLog {
-    *ss << handleMap[clientHandle.clientID]->clientEmail
-                           << " " << message << std::endl;
+    *ss << email << " " << message << std::endl;
     Logger::changelog();
   }
 }
 
 void Server::setHeartBeatCycles(int cycles) { heartBeatCycles = cycles; }
 
+void Server::setCompressionEnabled(bool enabled) {
+  compressionEnabled = enabled;
+}
+
+void Server::setSessionResumptionEnabled(bool enabled) {
+  resumptionEnabled = enabled;
+}
+
+void Server::setRepeatTokenStorePath(const std::filesystem::path &path) {
+  if (!repeatTokens.setPersistencePath(path)) {
+    // The tokens are only a cache of logins, so the server carries on with an
+    // empty store, and clients log in again
+    Logger::logError("Failed to load the repeat token store. Starting with "
+                     "no repeat tokens.",
+                     __LINE__, __FILE__);
+  }
+}
+
+void Server::sweepTokens() {
+  size_t expiredTokens = repeatTokens.expire();
+  if (expiredTokens != 0) {
+    lockLog {
+      *ss << "Removed " << expiredTokens << " expired repeat tokens.";
+      Logger::log();
+    }
+  }
+
+  if (!repeatTokens.flush()) {
+    // The tokens are still held in memory, and the write is tried again on the
+    // next sweep
+    Logger::logError("Failed to write the repeat token store", __LINE__,
+                     __FILE__);
+  }
+
+  uint64 now = unixTime();
+  std::lock_guard<std::mutex> guard(resumableSessionsMutex);
+  eraseExpiredResumableSessions(now);
+}
+
+void Server::setHandshakeWorkerThreads(unsigned threads) {
+  handshakeWorkerThreads = threads;
+}
+
+void Server::setRequestWorkerThreads(unsigned threads) {
+  requestWorkerThreads = threads;
+}
+
+void Server::setDatabaseSessionPoolSize(unsigned minSessions,
+                                        unsigned maxSessions) {
+  databaseMinSessions = minSessions;
+  databaseMaxSessions = std::max(maxSessions, 1u);
+}
+
 DatabaseManager &Server::databaseManager() {
   if (!dbManager) {
     ERROR_TO("Database manager not set up. No connection to database.",
              *errorStream)
   }
 
-  if (!dbManager->testConnection()) {
-    delete dbManager;
+  // The manager's session pool reconnects when an operation finds its
+  // connection broken, so there is no need to check the connection here
+  return *dbManager;
+}
 
-    try {
-      dbManager = new DatabaseManager(databaseSchema, databaseUsername,
-                                      databasePassword, databaseHost);
-    } catch (mysqlx::Error &e) {
-      SQL_ERROR(e, *errorStream);
+void Server::queueHandshake(TCPSocket &&clientSocket) {
+  size_t queued = handshakePool.queuedTasks();
+
+  {
+    std::lock_guard<std::mutex> guard(handshakeMetricsMutex);
+    // Under a reconnect storm, turn clients away rather than letting the queue
+    // (and the time the last client waits) grow without bound. They retry.
+    if (queued >= HANDSHAKE_QUEUE_LIMIT) {
+      handshakeStats.rejectedHandshakes++;
+      clientSocket.closeSocket();
+      Logger::logError("Rejected a client as the handshake queue is full");
+      return;
     }
-    Logger::log("Re-connected to database");
+    handshakeStats.maxQueuedHandshakes =
+        std::max(handshakeStats.maxQueuedHandshakes, queued + 1);
   }
 
-  return *dbManager;
+  std::chrono::steady_clock::time_point acceptedAt =
+      std::chrono::steady_clock::now();
+
+  // Each handshake gets its own key, so they run in parallel across the pool
+  handshakePool.submit(
+      nextHandshakeKey++,
+      [this, socket = std::move(clientSocket), acceptedAt]() mutable {
+        bool completed = acceptClient(socket);
+
+        std::chrono::duration<double, std::milli> latency =
+            std::chrono::steady_clock::now() - acceptedAt;
+
+        std::lock_guard<std::mutex> guard(handshakeMetricsMutex);
+        if (completed) {
+          handshakeStats.completedHandshakes++;
+        } else {
+          handshakeStats.failedHandshakes++;
+        }
+        handshakeStats.totalLatencyMs += latency.count();
+        handshakeStats.maxLatencyMs =
+            std::max(handshakeStats.maxLatencyMs, latency.count());
+      });
+}
+
+Server::HandshakeMetrics Server::handshakeMetrics() {
+  std::lock_guard<std::mutex> guard(handshakeMetricsMutex);
+  HandshakeMetrics metrics = handshakeStats;
+  metrics.queuedHandshakes = handshakePool.queuedTasks();
+  return metrics;
 }
 
-void Server::acceptClient(TCPSocket &clientSocket) {
+bool Server::acceptClient(TCPSocket &clientSocket) {
   // PROTOCOL:
   // Client and server send each other their respective public keys
   // Client sends a random challenge to the server, encrypted under the
@@ -427,6 +1323,32 @@ void Server::acceptClient(TCPSocket &clientSocket) {
   //
   // Both communicate with AES key from here, with messages starting with
   // token
+  //
+  // Newer servers also advertise the newest wire format they support in step
+  // 4, after T. A client which supports it sends its choice in the upper bits
+  // of its auth mode in step 5, and both switch to that format once the
+  // server has responded. Everything up to that point is sent in V1.
+
+  // The handshake runs on a blocking socket, and each stage waits at most
+  // HANDSHAKE_STAGE_TIMEOUT_MS for the client. A receive which times out
+  // returns S_NO_DATA, and one which finds the client has gone returns
+  // SOCKET_DISCONNECTED. Either ends the handshake.
+  if (clientSocket.setBlocking() != SOCKET_SUCCESS ||
+      clientSocket.setTimeout(HANDSHAKE_STAGE_TIMEOUT_MS) != SOCKET_SUCCESS) {
+    clientSocket.closeSocket();
+    return false;
+  }
+
+  // A returning client may send a resumption ticket in place of its public
+  // key, and skip the key exchange entirely
+  MessageProtocol firstProtocol;
+  if (clientSocket.peekProtocol(firstProtocol) != SOCKET_SUCCESS) {
+    clientSocket.closeSocket();
+    return false;
+  }
+  if (firstProtocol == MessageProtocol::RESUME_MESSAGE) {
+    return resumeClient(clientSocket);
+  }
 
   // 1: Receive client's public key
   RSAKeyPair::Public clientKey;
@@ -442,7 +1364,7 @@ void Server::acceptClient(TCPSocket &clientSocket) {
     clientSocket.sendMessage(failedMessage);
 
     clientSocket.closeSocket();
-    return;
+    return false;
   }
 
   // If this message was in any way erroneous, close the connection and return
@@ -453,7 +1375,7 @@ void Server::acceptClient(TCPSocket &clientSocket) {
     clientSocket.sendMessage(failedMessage);
 
     clientSocket.closeSocket();
-    return;
+    return false;
   }
 
   memcpy(&clientKey, clientKeyMessage.getMessageData(),
@@ -469,7 +1391,7 @@ void Server::acceptClient(TCPSocket &clientSocket) {
     clientSocket.sendMessage(failedMessage);
 
     clientSocket.closeSocket();
-    return;
+    return false;
   }
 
   // 3: Receive the client's random challenge, encrypted under server's public
@@ -477,7 +1399,7 @@ void Server::acceptClient(TCPSocket &clientSocket) {
   uint2048 encryptedChallenge;
   NetworkMessage challengeMessage;
 
-  if (clientSocket.waitForMessage(
+  if (clientSocket.receiveMessage(
           challengeMessage, MessageProtocol::RSA_MESSAGE) != SOCKET_SUCCESS) {
     ConnectionResponse failResponse = ConnectionResponse::FAILED;
     NetworkMessage failedMessage(&failResponse, sizeof(ConnectionResponse),
@@ -485,7 +1407,7 @@ void Server::acceptClient(TCPSocket &clientSocket) {
     clientSocket.sendMessage(failedMessage);
 
     clientSocket.closeSocket();
-    return;
+    return false;
   }
 
   // If this message was in any way erroneous, close the connection and return
@@ -496,7 +1418,7 @@ void Server::acceptClient(TCPSocket &clientSocket) {
     clientSocket.sendMessage(failedMessage);
 
     clientSocket.closeSocket();
-    return;
+    return false;
   }
 
   memcpy(&encryptedChallenge, challengeMessage.getMessageData(),
@@ -516,7 +1438,7 @@ void Server::acceptClient(TCPSocket &clientSocket) {
     clientSocket.sendMessage(failedMessage);
 
     clientSocket.closeSocket();
-    return;
+    return false;
   }
 
   // 4: Send signed challenge, nonce, session key and token
@@ -535,6 +1457,24 @@ void Server::acceptClient(TCPSocket &clientSocket) {
   memcpy(responseBuffer + sizeof(uint64) + sizeof(uint32) + sizeof(AESKey),
          &clientSessionToken, sizeof(uint64));
 
+  // Advertise the newest wire format we support, and the features we offer
+  // with it, after the token. Older clients ignore anything past the token
+  uint8 *advert = responseBuffer + sizeof(uint64) + sizeof(uint32) +
+                  sizeof(AESKey) + sizeof(uint64);
+  uint32 advertMagic = WIRE_FORMAT_ADVERT_MAGIC;
+  WireFormat latestFormat = LATEST_WIRE_FORMAT;
+  uint8 features = WIRE_FEATURE_REQUEST_IDS;
+  if (compressionEnabled) {
+    features |= WIRE_FEATURE_COMPRESSION;
+  }
+  if (resumptionEnabled) {
+    features |= WIRE_FEATURE_RESUMPTION;
+  }
+  memcpy(advert, &advertMagic, sizeof(uint32));
+  memcpy(advert + sizeof(uint32), &latestFormat, sizeof(WireFormat));
+  memcpy(advert + sizeof(uint32) + sizeof(WireFormat), &features,
+         sizeof(uint8));
+
   uint2048 signedEncryptedResponse =
       encrypt(sign(response, serverSignature.privateKey), clientKey);
 
@@ -547,61 +1487,313 @@ void Server::acceptClient(TCPSocket &clientSocket) {
     clientSocket.sendMessage(failedMessage);
 
     clientSocket.closeSocket();
-    return;
+    return false;
   }
 
   // After we have received all the protocol data, set this socket to be non
   // blocking
+  clientSocket.setTimeout(0);
   clientSocket.setNonBlocking();
 
-  std::vector<unsigned> handles;
+  // The handle ID is assigned by the server loop when it adopts the client
+  ClientData *client = new ClientData(0, clientSocket, clientSessionKey,
+                                      clientSessionToken, clientNonce);
 
-  for (std::pair<unsigned, ClientData *> handle : handleMap) {
-    handles.push_back(handle.first);
+  {
+    std::lock_guard<std::mutex> guard(acceptedClientsMutex);
+    acceptedClients.push_back(client);
   }
-  for (unsigned i = 0; i < handles.size(); i++) {
-    unsigned target = handles[i];
-    while (target < handles.size() && target != handles[target]) {
-      unsigned temp = handles[target];
-      handles[target] = target;
-      target = temp;
+
+  eventLoop.wake();
+
+  return true;
+}
+
+bool Server::resumeClient(TCPSocket &clientSocket) {
+  // PROTOCOL:
+  // A client which authenticated on an earlier connection, and was issued a
+  // resumption ticket TK on it, sends the ticket in place of its public key,
+  // followed by a random challenge and the ticket ID encrypted under the
+  // session key R of that connection. Only the server knows which session a
+  // ticket belongs to, and only the client (and the server) know R, so if the
+  // proof decrypts to the ticket ID under R the client is the one the ticket
+  // was issued to. The server then generates a fresh session key and token,
+  // and sends them back with the challenge under R. Seeing its challenge tells
+  // the client that the server knew R, so it is talking to the right server.
+  // The ticket can't be used again, so a new one is sent for the new session.
+  //
+  // 1. C -> S: TK, {NC, TK, F}_R
+  //    if TK unknown or expired, or the proof is invalid:
+  //      S -> C: ERROR
+  //      server terminates connection
+  // 2. S -> C: {NC, K, T, response, F}_R, TK'
+  //
+  // F is the wire format and features the client wants, and then those the
+  // server has chosen. Both switch to the chosen format once TK' is sent.
+
+  ConnectionResponse failResponse = ConnectionResponse::FAILED;
+  NetworkMessage failedMessage(&failResponse, sizeof(ConnectionResponse),
+                               MessageProtocol::CONNECTION_RESPONSE_MESSAGE);
+
+  // 1: Receive the ticket, then the proof that the client knows its key
+  NetworkMessage ticketMessage;
+  EncryptedNetworkMessage proofMessage;
+
+  if (clientSocket.receiveMessage(ticketMessage,
+                                  MessageProtocol::RESUME_MESSAGE) !=
+          SOCKET_SUCCESS ||
+      ticketMessage.error() ||
+      clientSocket.receiveMessage(proofMessage,
+                                  MessageProtocol::AES_MESSAGE) !=
+          SOCKET_SUCCESS ||
+      proofMessage.error()) {
+    clientSocket.sendMessage(failedMessage);
+    clientSocket.closeSocket();
+    return false;
+  }
+
+  ResumptionTicket ticket;
+  memcpy(&ticket, ticketMessage.getMessageData(), sizeof(ResumptionTicket));
+
+  std::optional<ResumableSession> session;
+  {
+    std::lock_guard<std::mutex> guard(resumableSessionsMutex);
+    std::map<uint256, ResumableSession>::const_iterator it =
+        resumableSessions.find(ticket.id);
+    if (it != resumableSessions.end() && it->second.expiry > unixTime()) {
+      session = it->second;
     }
   }
-  unsigned handleID = handles.size();
-  for (unsigned i = 0; i < handles.size(); i++) {
-    if (handles[i] != i) {
-      handleID = i;
-      break;
+
+  if (!session.has_value()) {
+    lockLog {
+      *ss << "Client failed to resume a session: Unknown or expired ticket. "
+             "Terminating connection.";
+      Logger::log();
     }
+    clientSocket.sendMessage(failedMessage);
+    clientSocket.closeSocket();
+    return false;
   }
 
-  ClientData *client = new ClientData(handleID, clientSocket, clientSessionKey,
-                                      clientSessionToken, clientNonce);
+  uint32 proofSize;
+  uint8 *proof =
+      (uint8 *)proofMessage.decryptMessageData(session->sessionKey, proofSize);
+
+  uint64 challenge = 0;
+  WireFormat requestedFormat = WireFormat::V1;
+  uint8 requestedFeatures = 0;
+  bool proven =
+      proof != nullptr &&
+      proofSize == sizeof(uint64) + sizeof(uint256) + sizeof(WireFormat) +
+                       sizeof(uint8) &&
+      memcmp(proof + sizeof(uint64), &ticket.id, sizeof(uint256)) == 0;
+  if (proven) {
+    memcpy(&challenge, proof, sizeof(uint64));
+    memcpy(&requestedFormat, proof + sizeof(uint64) + sizeof(uint256),
+           sizeof(WireFormat));
+    memcpy(&requestedFeatures,
+           proof + sizeof(uint64) + sizeof(uint256) + sizeof(WireFormat),
+           sizeof(uint8));
+  }
+  free(proof);
+
+  // Only now that the client has proven it holds the ticket is it used up. If
+  // it has already gone, the same ticket was resumed on another connection.
+  if (proven) {
+    std::lock_guard<std::mutex> guard(resumableSessionsMutex);
+    proven = eraseResumableSession(ticket.id);
+  }
+
+  if (!proven) {
+    lockLog {
+      *ss << "Client failed to resume a session: Invalid proof of ticket. "
+             "Terminating connection.";
+      Logger::log();
+    }
+    clientSocket.sendMessage(failedMessage);
+    clientSocket.closeSocket();
+    return false;
+  }
+
+  // Use the newest format both of us support, and only the features we offer
+  WireFormat wireFormat =
+      (WireFormat)std::clamp((uint8)requestedFormat, (uint8)WireFormat::V1,
+                             (uint8)LATEST_WIRE_FORMAT);
+  uint8 features = 0;
+  if (wireFormat != WireFormat::V1) {
+    features |= requestedFeatures & WIRE_FEATURE_REQUEST_IDS;
+    if (compressionEnabled) {
+      features |= requestedFeatures & WIRE_FEATURE_COMPRESSION;
+    }
+    if (resumptionEnabled) {
+      features |= requestedFeatures & WIRE_FEATURE_RESUMPTION;
+    }
+  }
+
+  // 2: Send the challenge back with a fresh session key and token
+  AESKey clientSessionKey = generateAESKey();
+  uint64 clientSessionToken;
+  CryptoSafeRandom::random(&clientSessionToken, sizeof(uint64));
+
+  ConnectionResponse successResponse = session->access == ClientAccess::FULL
+                                           ? ConnectionResponse::SUCCESS_ADMIN
+                                           : ConnectionResponse::SUCCESS;
+
+  // The buffer is padded as the whole of the last AES block is encrypted
+  constexpr uint32 responseSize = sizeof(uint64) + sizeof(AESKey) +
+                                  sizeof(uint64) + sizeof(ConnectionResponse) +
+                                  sizeof(WireFormat) + sizeof(uint8);
+  uint8 response[PADDED_SIZE(responseSize, AES_CHUNK_SIZE)]{};
+  uint8 *responseEnd = response;
+  memcpy(responseEnd, &challenge, sizeof(uint64));
+  responseEnd += sizeof(uint64);
+  memcpy(responseEnd, &clientSessionKey, sizeof(AESKey));
+  responseEnd += sizeof(AESKey);
+  memcpy(responseEnd, &clientSessionToken, sizeof(uint64));
+  responseEnd += sizeof(uint64);
+  memcpy(responseEnd, &successResponse, sizeof(ConnectionResponse));
+  responseEnd += sizeof(ConnectionResponse);
+  memcpy(responseEnd, &wireFormat, sizeof(WireFormat));
+  responseEnd += sizeof(WireFormat);
+  memcpy(responseEnd, &features, sizeof(uint8));
+
+  if (clientSocket.sendMessage(EncryptedNetworkMessage(
+          response, responseSize, session->sessionKey)) !=
+      SOCKET_SUCCESS) {
+    clientSocket.closeSocket();
+    return false;
+  }
+
+  if (features & WIRE_FEATURE_RESUMPTION) {
+    issueResumptionTicket(clientSocket, clientSessionKey, session->email,
+                          session->access);
+  }
 
-  waitingClients.push_back(client);
+  clientSocket.setWireFormat(wireFormat);
+  clientSocket.setTimeout(0);
+  clientSocket.setNonBlocking();
+
+  // The client never sends a JWT, so has no use for an auth nonce
+  ClientData *client =
+      new ClientData(0, clientSocket, clientSessionKey, clientSessionToken, 0);
+  client->clientEmail = session->email;
+  client->access = session->access;
+  client->compression = features & WIRE_FEATURE_COMPRESSION;
+  client->requestIDs = features & WIRE_FEATURE_REQUEST_IDS;
+  client->authenticated = true;
+
+  lockLog {
+    *ss << "Client " << client->clientEmail << " resumed their session.";
+    Logger::log();
+  }
+
+  {
+    std::lock_guard<std::mutex> guard(acceptedClientsMutex);
+    acceptedClients.push_back(client);
+  }
 
-  handleMap[handleID] = client;
+  eventLoop.wake();
+
+  return true;
+}
+
+void Server::issueResumptionTicket(TCPSocket &clientSocket,
+                                   const AESKey &sessionKey,
+                                   const std::string &email,
+                                   ClientAccess access) {
+  ResumptionTicket ticket;
+  CryptoSafeRandom::random(&ticket.id, sizeof(uint256));
+  uint64 now = unixTime();
+  ticket.expiry = now + RESUMPTION_TICKET_LIFETIME_S;
+
+  {
+    std::lock_guard<std::mutex> guard(resumableSessionsMutex);
+
+    if (resumableSessions.size() >= RESUMPTION_TICKET_LIMIT) {
+      eraseExpiredResumableSessions(now);
+    }
+    // If none had expired, drop the one closest to expiring, which is the one
+    // issued longest ago
+    if (resumableSessions.size() >= RESUMPTION_TICKET_LIMIT) {
+      eraseResumableSession(resumableSessionExpiries.begin()->second);
+    }
+
+    std::multimap<uint64, uint256>::iterator expiryEntry =
+        resumableSessionExpiries.emplace(ticket.expiry, ticket.id);
+    resumableSessions[ticket.id] = {sessionKey, email, access, ticket.expiry,
+                                    expiryEntry};
+  }
+
+  clientSocket.sendMessage(NetworkMessage(&ticket, sizeof(ResumptionTicket),
+                                          MessageProtocol::RESUME_MESSAGE));
+}
+
+bool Server::eraseResumableSession(const uint256 &ticketID) {
+  std::map<uint256, ResumableSession>::iterator it =
+      resumableSessions.find(ticketID);
+  if (it == resumableSessions.end()) {
+    return false;
+  }
+  resumableSessionExpiries.erase(it->second.expiryEntry);
+  resumableSessions.erase(it);
+  return true;
+}
+
+void Server::eraseExpiredResumableSessions(uint64 now) {
+  while (!resumableSessionExpiries.empty() &&
+         resumableSessionExpiries.begin()->first <= now) {
+    resumableSessions.erase(resumableSessionExpiries.begin()->second);
+    resumableSessionExpiries.erase(resumableSessionExpiries.begin());
+  }
 }
 
 bool Server::tryAuthenticateClient(ClientData &clientData) {
   // Attempt to receive a message from the client. If they aren't sending
   // anything, or they send an erroneous message, just return false.
   EncryptedNetworkMessage authMessage;
-  if (clientData.clientSocket.receiveMessage(
-          authMessage, MessageProtocol::AES_MESSAGE) == S_NO_DATA) {
+  TCPSocketCode code = clientData.clientSocket.receiveMessage(
+      authMessage, MessageProtocol::AES_MESSAGE);
+  if (code == S_NO_DATA) {
     return false;
   }
 
-  if (authMessage.error()) {
+  // A client which has gone before authenticating is dropped by the caller,
+  // as it is still unauthenticated
+  if (code == SOCKET_DISCONNECTED || clientData.clientSocket.dead()) {
+    return true;
+  }
+
+  if (code != SOCKET_SUCCESS || authMessage.error()) {
     return false;
   }
 
   unsigned char *authMessageBuff =
       (unsigned char *)authMessage.decryptMessageData(
           clientData.clientSessionKey);
-  AuthMode authMode = *((AuthMode *)authMessageBuff);
+  uint32 authModeValue = 0;
+  memcpy(&authModeValue, authMessageBuff, sizeof(AuthMode));
   authMessageBuff += sizeof(AuthMode);
 
+  // A client which supports a newer wire format than V1 says which one it has
+  // chosen, and which features it wants, alongside its auth mode. Both ends
+  // switch once we have responded.
+  AuthMode authMode = (AuthMode)(authModeValue & AUTH_MODE_MASK);
+  WireFormat wireFormat = WireFormat::V1;
+  if (((authModeValue >> AUTH_MODE_WIRE_FORMAT_SHIFT) &
+       AUTH_MODE_WIRE_FORMAT_MASK) == (uint32)WireFormat::V2) {
+    wireFormat = WireFormat::V2;
+  }
+  // Compression is flagged in the frame header, which V1 doesn't have
+  uint32 features = authModeValue >> AUTH_MODE_FEATURES_SHIFT;
+  clientData.compression = compressionEnabled &&
+                           wireFormat != WireFormat::V1 &&
+                           (features & WIRE_FEATURE_COMPRESSION);
+  bool resumption = resumptionEnabled && wireFormat != WireFormat::V1 &&
+                    (features & WIRE_FEATURE_RESUMPTION);
+  clientData.requestIDs =
+      wireFormat != WireFormat::V1 && (features & WIRE_FEATURE_REQUEST_IDS);
+
   switch (authMode) {
     case AuthMode::JWT: {
       // Get a string of the response
@@ -623,7 +1815,10 @@ bool Server::tryAuthenticateClient(ClientData &clientData) {
           // add them to the connected clients vector.
           // They may now access server resources
           clientData.clientEmail = claims["email"];
-          connectedClients.push_back(&clientData);
+          {
+            std::unique_lock<std::shared_mutex> clientsLock(clientsMutex);
+            clientData.authenticated = true;
+          }
           lockLog {
             *ss << "Client " << clientData.clientEmail
                                    << " successfully authenticated themselves.";
@@ -646,6 +1841,12 @@ bool Server::tryAuthenticateClient(ClientData &clientData) {
               &successResponse, sizeof(ConnectionResponse),
               MessageProtocol::CONNECTION_RESPONSE_MESSAGE);
           clientData.clientSocket.sendMessage(succeededMessage);
+          if (resumption) {
+            issueResumptionTicket(clientData.clientSocket,
+                                  clientData.clientSessionKey,
+                                  clientData.clientEmail, clientData.access);
+          }
+          clientData.clientSocket.setWireFormat(wireFormat);
 
           return true;
         }
@@ -698,33 +1899,37 @@ bool Server::tryAuthenticateClient(ClientData &clientData) {
 
       memcpy(&repeatToken, authMessageBuff, sizeof(uint256));
 
-      for (std::map<uint256,
-                    std::pair<std::string, ClientAccess>>::const_iterator it =
-               repeatTokenMap.begin();
-           it != repeatTokenMap.end(); it++) {
-        if (it->first == repeatToken) {
-          std::pair<std::string, ClientAccess> info =
-              repeatTokenMap[repeatToken];
-          clientData.clientEmail = info.first;
-          clientData.access = info.second;
-          connectedClients.push_back(&clientData);
-          lockLog {
-            *ss
-                << "Client " << clientData.clientEmail
-                << " successfully authenticated themselves." << std::endl;
-            Logger::log();
-          }
-          ConnectionResponse successResponse = ConnectionResponse::SUCCESS;
-          if (clientData.access == ClientAccess::FULL) {
-            successResponse = ConnectionResponse::SUCCESS_ADMIN;
-          }
-          NetworkMessage succeededMessage(
-              &successResponse, sizeof(ConnectionResponse),
-              MessageProtocol::CONNECTION_RESPONSE_MESSAGE);
-          clientData.clientSocket.sendMessage(succeededMessage);
+      std::optional<std::pair<std::string, ClientAccess>> info =
+          repeatTokens.find(repeatToken);
 
-          return true;
+      if (info.has_value()) {
+        clientData.clientEmail = info->first;
+        clientData.access = info->second;
+        {
+          std::unique_lock<std::shared_mutex> clientsLock(clientsMutex);
+          clientData.authenticated = true;
         }
+        lockLog {
+          *ss << "Client " << clientData.clientEmail
+              << " successfully authenticated themselves." << std::endl;
+          Logger::log();
+        }
+        ConnectionResponse successResponse = ConnectionResponse::SUCCESS;
+        if (clientData.access == ClientAccess::FULL) {
+          successResponse = ConnectionResponse::SUCCESS_ADMIN;
+        }
+        NetworkMessage succeededMessage(
+            &successResponse, sizeof(ConnectionResponse),
+            MessageProtocol::CONNECTION_RESPONSE_MESSAGE);
+        clientData.clientSocket.sendMessage(succeededMessage);
+        if (resumption) {
+          issueResumptionTicket(clientData.clientSocket,
+                                clientData.clientSessionKey,
+                                clientData.clientEmail, clientData.access);
+        }
+        clientData.clientSocket.setWireFormat(wireFormat);
+
+        return true;
       }
 
       // There is no client with this repeat token
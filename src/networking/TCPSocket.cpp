@@ -4,6 +4,8 @@
 
 #include "../../include/networking/TCPSocket.h"
 
+#include <atomic>
+
 // Set the SIGPIPE signal to ignore
 #ifdef _WIN32
 
@@ -11,11 +13,15 @@
 void (*SIG_PIPE_HANDLER)(int) = signal(SIGPIPE, SIG_IGN);
 #endif
 
+// Totals across every socket, reported through TCPSocket::receiveCounters
+static std::atomic<unsigned long long> totalRecvCalls = 0, totalBytesReceived = 0;
+
 void guardTCPSocketCode(TCPSocketCode code, std::ostream &errorStream) {
     switch (code) {
         case ERR_SOCKET_DEAD:
         case ERR_SEND_FAILED:
         case S_NO_DATA:
+        case S_SEND_PENDING:
         case WAS_HEARTBEAT:
         case SOCKET_SUCCESS:
             return;
@@ -37,6 +43,7 @@ bool safeGuardTCPSocketCode(TCPSocketCode code, std::ostream &errorStream) {
         case ERR_SOCKET_DEAD:
         case ERR_SEND_FAILED:
         case S_NO_DATA:
+        case S_SEND_PENDING:
         case WAS_HEARTBEAT:
         case SOCKET_SUCCESS:
             return true;
@@ -100,6 +107,11 @@ TCPSocketCode TCPSocket::create() {
 
     flags |= SOCKET_OPEN;
 
+    // A socket object may be reused for a new connection, which always starts out in V1 with nothing buffered
+    format = WireFormat::V1;
+    receiveBuffer.clear();
+    sendBuffer.clear();
+
     return SOCKET_SUCCESS;
 }
 
@@ -235,6 +247,58 @@ TCPSocketCode TCPSocket::setNonBlocking() {
     return SOCKET_SUCCESS;
 }
 
+TCPSocketCode TCPSocket::setBlocking() {
+    unsigned int socketFlags;
+
+#ifdef _WIN32
+
+    unsigned long nonBlocking = 0;
+
+    if (ioctlsocket(sock, FIONBIO, (unsigned long *) &nonBlocking) == SOCKET_ERROR) {
+        return ERR_SET_NON_BLOCKING;
+    }
+
+#else
+
+    // Get the current flags from the file descriptor
+    if ((socketFlags = fcntl(fd, F_GETFL)) < 0) {
+        return ERR_GET_FD_FLAGS;
+    }
+
+    // Set the flags to the original flags with the O_NONBLOCK bit cleared
+    if ((fcntl(fd, F_SETFL, socketFlags & ~O_NONBLOCK)) < 0) {
+        return ERR_SET_NON_BLOCKING;
+    }
+
+#endif
+
+    flags |= SOCKET_BLOCKING;
+
+    return SOCKET_SUCCESS;
+}
+
+TCPSocketCode TCPSocket::setTimeout(unsigned milliseconds) {
+#ifdef _WIN32
+    DWORD timeout = milliseconds;
+
+    if (setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (char *) &timeout, sizeof(DWORD)) != 0 ||
+        setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, (char *) &timeout, sizeof(DWORD)) != 0) {
+        return ERR_SET_SOCKET_OPTIONS;
+    }
+#else
+    timeval timeout{};
+    timeout.tv_sec = milliseconds / 1000;
+    timeout.tv_usec = (milliseconds % 1000) * 1000;
+
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeval)) < 0 ||
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeval)) < 0) {
+        return ERR_SET_SOCKET_OPTIONS;
+    }
+#endif
+
+    return SOCKET_SUCCESS;
+}
+
 void TCPSocket::closeSocket() {
     if (open()) {
 
@@ -332,42 +396,83 @@ TCPSocketCode TCPSocket::sendMessage(const NetworkMessage &message) {
         return ERR_SOCKET_DEAD;
     }
 
-#ifdef _WIN32
-    FD_SET writeSet;
-    FD_ZERO(&writeSet);
+    queueMessage(message);
 
-    unsigned total;
+    TCPSocketCode code = flushSendBuffer();
 
-    FD_SET(sock, &writeSet);
+    // Anything the socket couldn't take stays buffered, and goes with the next send or flush
+    return code == S_SEND_PENDING ? SOCKET_SUCCESS : code;
+}
 
-    if ((total = select(0, nullptr, &writeSet, nullptr, nullptr)) == SOCKET_ERROR) {
-        return ERR_SEND_FAILED;
-    }
-    if (!FD_ISSET(sock, &writeSet)) {
-        return ERR_SEND_FAILED;
+void TCPSocket::queueMessage(const NetworkMessage &message) {
+    if (format == WireFormat::V1) {
+        sendBuffer.append(message.dataStream(), message.dataStreamSize());
+        return;
     }
 
-    bool success = send(sock, (const char *) message.dataStream(), message.dataStreamSize(), 0) != SOCKET_ERROR;
+    // Newer formats have a different header, but the payload is the same, just without the padding
+    uint8 header[FRAME_HEADER_SIZE_V2];
+    message.writeHeader(header, format);
+    sendBuffer.append(header, NetworkMessage::headerSize(format));
+    sendBuffer.append((const uint8 *) message.dataStream() + FRAME_HEADER_SIZE, message.payloadSize());
+}
 
-    if (sock_errno == WSAECONNRESET) {
-        flags |= SOCKET_DEAD;
+TCPSocketCode TCPSocket::flushSendBuffer() {
+    if (flags & SOCKET_DEAD) {
         return ERR_SOCKET_DEAD;
     }
+
+    while (sendBuffer.size() > 0) {
+        size_t length;
+        const unsigned char *data = sendBuffer.readRegion(length);
+
+#ifdef _WIN32
+        int sent = send(sock, (const char *) data, (int) length, 0);
+
+        if (sent == SOCKET_ERROR) {
+            int error = sock_errno;
+            if (error == WSAEWOULDBLOCK) {
+                return S_SEND_PENDING;
+            }
+            if (error == WSAECONNRESET || error == WSAECONNABORTED) {
+                flags |= SOCKET_DEAD;
+                return ERR_SOCKET_DEAD;
+            }
+            // The stream can't be resumed part way through a frame, so drop what is left
+            sendBuffer.clear();
+            return ERR_SEND_FAILED;
+        }
 #else
-    bool success = send(fd, message.dataStream(), message.dataStreamSize(), 0) >= 0;
+        ssize_t sent = send(fd, data, length, 0);
 
-    if (errno == EPIPE) {
-        flags |= SOCKET_DEAD;
-        return ERR_SOCKET_DEAD;
-    }
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return S_SEND_PENDING;
+            }
+            if (errno == EPIPE || errno == ECONNRESET) {
+                flags |= SOCKET_DEAD;
+                return ERR_SOCKET_DEAD;
+            }
+            // The stream can't be resumed part way through a frame, so drop what is left
+            sendBuffer.clear();
+            return ERR_SEND_FAILED;
+        }
 #endif
 
-    return success ? SOCKET_SUCCESS : ERR_SEND_FAILED;
+        sendBuffer.consume(sent);
+    }
+
+    return SOCKET_SUCCESS;
 }
 
-TCPSocketCode TCPSocket::receiveMessage(NetworkMessage &message, MessageProtocol expectedProtocol) {
-    unsigned char readBuffer[BUFFER_CHUNK_SIZE];
+size_t TCPSocket::pendingSendBytes() const {
+    return sendBuffer.size();
+}
 
+TCPSocketCode TCPSocket::receiveMessage(NetworkMessage &message, MessageProtocol expectedProtocol) {
     if (flags & SOCKET_WAITING) {
         std::chrono::duration<double> elapsed = std::chrono::system_clock::now() - lastHeard;
 
@@ -381,74 +486,170 @@ TCPSocketCode TCPSocket::receiveMessage(NetworkMessage &message, MessageProtocol
         return ERR_SOCKET_DEAD;
     }
 
-#ifdef _WIN32
-    if (recv(sock, (char *) readBuffer, BUFFER_CHUNK_SIZE, 0) <= 0) {
-        return S_NO_DATA;
-    }
-#else
-    if (recv(fd, readBuffer, BUFFER_CHUNK_SIZE, 0) <= 0) {
-        return S_NO_DATA;
+    // Read until there is a whole frame buffered. If the socket runs out of data part way through a frame,
+    // the bytes we have are kept in the buffer and the rest is picked up on a later call.
+    while (!hasBufferedMessage()) {
+        TCPSocketCode code = fillReceiveBuffer();
+        if (code != SOCKET_SUCCESS) {
+            return code;
+        }
     }
-#endif
 
     message.clear();
 
-    while (true) {
-        DecodeStatus status = message.decode(readBuffer, BUFFER_CHUNK_SIZE);
-
-        if (message.protocol() == MessageProtocol::HEARTBEAT && status == DecodeStatus::DECODED) {
-            switch (*((HeartbeatMode *)message.getMessageData())) {
-                case HeartbeatMode::REQUEST: {
-                    HeartbeatMode response = HeartbeatMode::RESPONSE;
-                    sendMessage(NetworkMessage(&response, sizeof(HeartbeatMode), MessageProtocol::HEARTBEAT));
-                    return WAS_HEARTBEAT;
-                }
-                case HeartbeatMode::RESPONSE:
-                    flags &= (unsigned char)(~SOCKET_WAITING);
-                    return WAS_HEARTBEAT;
+    uint8 header[FRAME_HEADER_SIZE_V2];
+    receiveBuffer.copy(header, NetworkMessage::headerSize(format));
+    uint32 frameSize = NetworkMessage::frameSize(header, format);
+
+    if (frameSize == 0) {
+        // If the header is invalid, there is no way to find where the next frame starts, so everything
+        // buffered is discarded. We also avoid attacks which flood the server's memory by sending messages
+        // with large sized headers but no content
+        receiveBuffer.clear();
+        message.setError();
+        return ERR_RECEIVE_FAILED;
+    }
+
+    DecodeStatus status = message.decode((uint8 *) receiveBuffer.peek(frameSize), frameSize, format);
+    receiveBuffer.consume(frameSize);
+
+    if (message.protocol() == MessageProtocol::HEARTBEAT && status == DecodeStatus::DECODED) {
+        switch (*((HeartbeatMode *)message.getMessageData())) {
+            case HeartbeatMode::REQUEST: {
+                HeartbeatMode response = HeartbeatMode::RESPONSE;
+                sendMessage(NetworkMessage(&response, sizeof(HeartbeatMode), MessageProtocol::HEARTBEAT));
+                return WAS_HEARTBEAT;
             }
+            case HeartbeatMode::RESPONSE:
+                flags &= (unsigned char)(~SOCKET_WAITING);
+                return WAS_HEARTBEAT;
         }
-        if (message.protocol() == MessageProtocol::DISCONNECT_MESSAGE && status == DecodeStatus::DECODED) {
-            flags &= ~(SOCKET_CONNECTED);
-            return SOCKET_DISCONNECTED;
-        }
+    }
+    if (message.protocol() == MessageProtocol::DISCONNECT_MESSAGE && status == DecodeStatus::DECODED) {
+        flags &= ~(SOCKET_CONNECTED);
+        return SOCKET_DISCONNECTED;
+    }
 
-        if (message.protocol() != expectedProtocol) {
-            // If the message we are receiving isn't using the correct protocol, then there is an error
-            message.clear();
-            message.setError();
-            return ERR_RECEIVE_FAILED;
+    if (message.protocol() != expectedProtocol || status != DecodeStatus::DECODED) {
+        // If the message we are receiving isn't using the correct protocol, or the decoding was erroneous,
+        // then there is an error
+        message.clear();
+        message.setError();
+        return ERR_RECEIVE_FAILED;
+    }
+
+    return SOCKET_SUCCESS;
+}
+
+bool TCPSocket::hasBufferedMessage() const {
+    uint32 headerSize = NetworkMessage::headerSize(format);
+    if (receiveBuffer.size() < headerSize) {
+        return false;
+    }
+
+    uint8 header[FRAME_HEADER_SIZE_V2];
+    receiveBuffer.copy(header, headerSize);
+    uint32 frameSize = NetworkMessage::frameSize(header, format);
+
+    // An invalid header counts as buffered, so that receiveMessage reports the error
+    return frameSize == 0 || receiveBuffer.size() >= frameSize;
+}
+
+TCPSocketCode TCPSocket::peekProtocol(MessageProtocol &protocol) {
+    if (dead()) {
+        return ERR_SOCKET_DEAD;
+    }
+
+    while (!hasBufferedMessage()) {
+        TCPSocketCode code = fillReceiveBuffer();
+        if (code != SOCKET_SUCCESS) {
+            return code;
         }
+    }
+
+    // The protocol is the first byte of the header in every wire format
+    uint8 header[FRAME_HEADER_SIZE_V2];
+    receiveBuffer.copy(header, NetworkMessage::headerSize(format));
+    protocol = (MessageProtocol) header[0];
+
+    return SOCKET_SUCCESS;
+}
+
+TCPSocketCode TCPSocket::fillReceiveBuffer() {
+    bool receivedAny = false;
 
-        if (status == DecodeStatus::DECODED) {
+    while (true) {
+        // The buffer is only grown once the bytes already received have filled it, so a header claiming a large
+        // frame costs nothing until that much data has actually arrived. A full buffer which already holds a whole
+        // frame isn't grown at all, and anything further is left in the socket until the frame has been taken out.
+        if (receiveBuffer.capacity() != 0 && receiveBuffer.size() == receiveBuffer.capacity() &&
+            hasBufferedMessage()) {
             break;
         }
-        if (status == DecodeStatus::DECODE_ERROR) {
-            // If the decoding was erroneous, clear the message and set the error bit. We clear the message
-            // to avoid attacks which flood the server's memory by sending messages with large sized headers
-            // but no content
-            message.clear();
-            message.setError();
-            return ERR_RECEIVE_FAILED;
-        }
 
+        size_t space;
+        unsigned char *region = receiveBuffer.writeRegion(space);
+
+#ifdef _WIN32
+        int received = recv(sock, (char *) region, (int) space, 0);
+#else
+        ssize_t received = recv(fd, region, space, 0);
+#endif
+        totalRecvCalls.fetch_add(1, std::memory_order_relaxed);
+
+        if (received == 0) {
+            // The peer has closed the connection. Anything read before the close is handed out first, and the close
+            // is reported by the next call, as recv keeps returning 0 from here on
+            if (receivedAny) {
+                break;
+            }
+            flags &= ~(SOCKET_CONNECTED);
+            return SOCKET_DISCONNECTED;
+        }
 #ifdef _WIN32
-        if (recv(sock, (char *) readBuffer, BUFFER_CHUNK_SIZE, 0) <= 0) {
-            message.clear();
-            message.setError();
+        if (received == SOCKET_ERROR) {
+            int error = sock_errno;
+            if (error == WSAEINTR) {
+                continue;
+            }
+            // A handshake socket reports a timeout the same way as a non blocking socket with nothing to read
+            if (error == WSAEWOULDBLOCK || error == WSAETIMEDOUT) {
+                break;
+            }
+            if (receivedAny) {
+                break;
+            }
+            flags |= SOCKET_DEAD;
             return ERR_RECEIVE_FAILED;
         }
 #else
-        if (recv(fd, readBuffer, BUFFER_CHUNK_SIZE, 0) <= 0) {
-            // If we are expecting to receive more data, but there is no more data, then there is an error.
-            message.clear();
-            message.setError();
+        if (received < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // This also covers a blocking socket whose receive timeout has expired
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            if (receivedAny) {
+                break;
+            }
+            flags |= SOCKET_DEAD;
             return ERR_RECEIVE_FAILED;
         }
 #endif
+
+        receiveBuffer.commit(received);
+        totalBytesReceived.fetch_add(received, std::memory_order_relaxed);
+        receivedAny = true;
+
+        // A blocking socket would wait here for more data, and a short read means the socket has been drained
+        if (blocking() || (size_t) received < space) {
+            break;
+        }
     }
 
-    return SOCKET_SUCCESS;
+    return receivedAny ? SOCKET_SUCCESS : S_NO_DATA;
 }
 
 TCPSocketCode TCPSocket::waitForMessage(NetworkMessage &message, MessageProtocol expectedProtocol) {
@@ -521,6 +722,40 @@ void TCPSocket::setConnectionTimeout(float timeout) {
     connectionTimeout = timeout;
 }
 
+float TCPSocket::getConnectionTimeout() const {
+    return connectionTimeout;
+}
+
+NativeSocketHandle TCPSocket::nativeHandle() const {
+#ifdef _WIN32
+    return sock;
+#else
+    return fd;
+#endif
+}
+
+void TCPSocket::setWireFormat(WireFormat format) {
+    this->format = format;
+}
+
+WireFormat TCPSocket::wireFormat() const {
+    return format;
+}
+
+TCPSocket::ReceiveCounters TCPSocket::receiveCounters() {
+    return { totalRecvCalls.load(std::memory_order_relaxed), totalBytesReceived.load(std::memory_order_relaxed) };
+}
+
+bool TCPSocket::heartbeatExpired() const {
+    if (!(flags & SOCKET_WAITING)) {
+        return false;
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::system_clock::now() - lastHeard;
+
+    return elapsed.count() > connectionTimeout;
+}
+
 #ifdef _WIN32
 
 WSADATA TCPSocket::wsaData;
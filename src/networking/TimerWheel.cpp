@@ -0,0 +1,160 @@
+#include "../../include/networking/TimerWheel.h"
+
+#include <algorithm>
+
+static constexpr std::chrono::steady_clock::duration tickLength = std::chrono::milliseconds(TIMER_WHEEL_TICK_MS);
+
+TimerWheel::TimerWheel()
+    : slots(SLOTS_PER_LEVEL * TIMER_WHEEL_LEVELS, NO_NODE), startTime(std::chrono::steady_clock::now()) {
+}
+
+TimerWheel::TimerID TimerWheel::schedule(std::chrono::steady_clock::time_point deadline, unsigned long long key,
+                                         unsigned kind) {
+    // Round up, so the timer never fires before its deadline
+    uint64_t deadlineTick = 0;
+    if (deadline > startTime) {
+        deadlineTick = (deadline - startTime + tickLength - std::chrono::steady_clock::duration(1)) / tickLength;
+    }
+
+    uint32_t node;
+    if (freeNodes != NO_NODE) {
+        node = freeNodes;
+        freeNodes = nodes[node].next;
+    } else {
+        node = nodes.size();
+        nodes.push_back({});
+        nodes[node].generation = 1;
+    }
+
+    Node &timer = nodes[node];
+    timer.key = key;
+    timer.kind = kind;
+    timer.expiryTick = std::max(deadlineTick, currentTick + 1);
+    place(node);
+    timerCount++;
+
+    return ((TimerID) timer.generation << 32u) | node;
+}
+
+void TimerWheel::cancel(TimerID timer) {
+    uint32_t node = (uint32_t) timer;
+    uint32_t generation = (uint32_t) (timer >> 32u);
+
+    // Freed nodes have moved on to a new generation, so a timer which has already gone doesn't match
+    if (timer == NO_TIMER || node >= nodes.size() || nodes[node].generation != generation ||
+        nodes[node].slot == NO_NODE) {
+        return;
+    }
+
+    unlink(node);
+
+    nodes[node].slot = NO_NODE;
+    if (++nodes[node].generation == 0) {
+        nodes[node].generation = 1;
+    }
+    nodes[node].next = freeNodes;
+    freeNodes = node;
+    timerCount--;
+}
+
+void TimerWheel::advance(std::chrono::steady_clock::time_point now, std::vector<Timer> &expired) {
+    uint64_t targetTick = now > startTime ? (now - startTime) / tickLength : 0;
+
+    while (currentTick < targetTick) {
+        currentTick++;
+
+        // Whenever a level finishes a turn, the next slot of the level above has come within its reach. Higher levels
+        // go first, so their timers can carry on down through the lower levels in the same tick.
+        for (uint32_t level = TIMER_WHEEL_LEVELS - 1; level > 0; level--) {
+            if ((currentTick & ((1ull << (TIMER_WHEEL_LEVEL_BITS * level)) - 1)) == 0) {
+                cascade(level);
+            }
+        }
+
+        // Everything in this tick's slot of the bottom level is due
+        uint32_t &head = slots[currentTick & (SLOTS_PER_LEVEL - 1)];
+        while (head != NO_NODE) {
+            uint32_t node = head;
+            expired.push_back({nodes[node].key, nodes[node].kind});
+            cancel(((TimerID) nodes[node].generation << 32u) | node);
+        }
+    }
+}
+
+std::chrono::steady_clock::time_point TimerWheel::nextDeadline() const {
+    if (timerCount == 0) {
+        return std::chrono::steady_clock::time_point::max();
+    }
+
+    // Timers due within a turn of the bottom level are in their own slot there
+    for (uint64_t tick = currentTick + 1; tick <= currentTick + SLOTS_PER_LEVEL; tick++) {
+        if (slots[tick & (SLOTS_PER_LEVEL - 1)] != NO_NODE) {
+            return startTime + tick * tickLength;
+        }
+    }
+
+    // Otherwise nothing can happen until the next level is cascaded, at the end of the bottom level's turn
+    uint64_t nextTurn = ((currentTick >> TIMER_WHEEL_LEVEL_BITS) + 1) << TIMER_WHEEL_LEVEL_BITS;
+    return startTime + nextTurn * tickLength;
+}
+
+size_t TimerWheel::size() const {
+    return timerCount;
+}
+
+void TimerWheel::place(uint32_t node) {
+    Node &timer = nodes[node];
+
+    uint64_t delta = timer.expiryTick > currentTick ? timer.expiryTick - currentTick : 0;
+    uint64_t placementTick = timer.expiryTick;
+
+    uint32_t level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 && delta >= (1ull << (TIMER_WHEEL_LEVEL_BITS * (level + 1)))) {
+        level++;
+    }
+
+    // Timers beyond the reach of the top level wait at its far end. They are placed again, by their real expiry, when
+    // that slot is cascaded.
+    uint64_t reach = 1ull << (TIMER_WHEEL_LEVEL_BITS * TIMER_WHEEL_LEVELS);
+    if (delta >= reach) {
+        placementTick = currentTick + reach - 1;
+    }
+
+    uint32_t slot =
+        level * SLOTS_PER_LEVEL + ((placementTick >> (TIMER_WHEEL_LEVEL_BITS * level)) & (SLOTS_PER_LEVEL - 1));
+
+    timer.slot = slot;
+    timer.previous = NO_NODE;
+    timer.next = slots[slot];
+    if (slots[slot] != NO_NODE) {
+        nodes[slots[slot]].previous = node;
+    }
+    slots[slot] = node;
+}
+
+void TimerWheel::unlink(uint32_t node) {
+    Node &timer = nodes[node];
+
+    if (timer.previous != NO_NODE) {
+        nodes[timer.previous].next = timer.next;
+    } else {
+        slots[timer.slot] = timer.next;
+    }
+    if (timer.next != NO_NODE) {
+        nodes[timer.next].previous = timer.previous;
+    }
+}
+
+void TimerWheel::cascade(uint32_t level) {
+    uint32_t slot =
+        level * SLOTS_PER_LEVEL + ((currentTick >> (TIMER_WHEEL_LEVEL_BITS * level)) & (SLOTS_PER_LEVEL - 1));
+
+    uint32_t node = slots[slot];
+    slots[slot] = NO_NODE;
+
+    while (node != NO_NODE) {
+        uint32_t next = nodes[node].next;
+        place(node);
+        node = next;
+    }
+}
@@ -0,0 +1,113 @@
+#include "../../include/networking/WorkerPool.h"
+
+#include <algorithm>
+
+#include "../../include/database/Logger.h"
+
+WorkerPool::~WorkerPool() {
+    stop();
+}
+
+void WorkerPool::start(unsigned threadCount) {
+    std::lock_guard<std::mutex> guard(poolMutex);
+
+    if (running) {
+        return;
+    }
+
+    if (threadCount == 0) {
+        threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
+    running = true;
+
+    for (unsigned i = 0; i < threadCount; i++) {
+        workers.emplace_back(&WorkerPool::workerLoop, this);
+    }
+}
+
+void WorkerPool::stop() {
+    {
+        std::lock_guard<std::mutex> guard(poolMutex);
+        if (!running) {
+            return;
+        }
+        running = false;
+    }
+    poolCondition.notify_all();
+
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+    workers.clear();
+}
+
+void WorkerPool::submit(unsigned long long key, std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> guard(poolMutex);
+
+        std::unordered_map<unsigned long long, std::deque<std::function<void()>>>::iterator strand = strands.find(key);
+
+        // If the key has no strand, nothing is queued or running for it, so it is immediately ready. Otherwise, the
+        // worker which holds the key will pick this task up when it finishes.
+        if (strand == strands.end()) {
+            strands[key].push_back(std::move(task));
+            readyKeys.push_back(key);
+        } else {
+            strand->second.push_back(std::move(task));
+        }
+
+        pendingTasks++;
+    }
+    poolCondition.notify_one();
+}
+
+size_t WorkerPool::queuedTasks() {
+    std::lock_guard<std::mutex> guard(poolMutex);
+    return pendingTasks;
+}
+
+size_t WorkerPool::threadCount() const {
+    return workers.size();
+}
+
+void WorkerPool::workerLoop() {
+    std::unique_lock<std::mutex> lock(poolMutex);
+
+    while (true) {
+        poolCondition.wait(lock, [this]() { return !readyKeys.empty() || !running; });
+
+        if (readyKeys.empty()) {
+            // Stopped with no work left
+            return;
+        }
+
+        unsigned long long key = readyKeys.front();
+        readyKeys.pop_front();
+
+        std::deque<std::function<void()>> &strand = strands[key];
+        std::function<void()> task = std::move(strand.front());
+        strand.pop_front();
+        pendingTasks--;
+
+        lock.unlock();
+
+        try {
+            task();
+        } catch (std::exception &e) {
+            Logger::logError(e.what(), __LINE__, __FILE__);
+        }
+
+        lock.lock();
+
+        // Either hand the key back to the ready queue so the next task for it runs (behind any other ready keys, so one
+        // busy key can't starve the rest), or release the strand entirely
+        std::unordered_map<unsigned long long, std::deque<std::function<void()>>>::iterator it = strands.find(key);
+        if (it->second.empty()) {
+            strands.erase(it);
+        } else {
+            readyKeys.push_back(key);
+            poolCondition.notify_one();
+        }
+    }
+}
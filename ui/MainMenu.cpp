@@ -173,7 +173,29 @@ MainMenu::MainMenu(const std::filesystem::path &clientMetaFilePath,
     repeatTokenFile.read((char *)&repeatToken, sizeof(uint256));
     repeatTokenFile.close();
 
-    switch (client->connectWithToken(serverIP, serverPort, repeatToken)) {
+    // The ticket from the last session is kept next to the repeat token.
+    // Resuming with it skips the key exchange, so try that first.
+    std::filesystem::path resumptionPath = repeatTokenPath;
+    resumptionPath.replace_extension(".ticket");
+
+    Client::ConnectionStatus status = Client::ConnectionStatus::NO_CONNECTION;
+    SessionResumption resumption;
+
+    std::ifstream resumptionFile(resumptionPath, std::ios::binary);
+    if (resumptionFile.read((char *)&resumption, sizeof(SessionResumption))) {
+      status = client->resumeSession(serverIP, serverPort, resumption);
+      // A failed resume closes the connection, so start again
+      if (status != Client::ConnectionStatus::SUCCESS) {
+        client->initialiseClient();
+      }
+    }
+    resumptionFile.close();
+
+    if (status != Client::ConnectionStatus::SUCCESS) {
+      status = client->connectWithToken(serverIP, serverPort, repeatToken);
+    }
+
+    switch (status) {
       case Client::ConnectionStatus::NO_CONNECTION:
         QMessageBox::about(
             this, "Connection to Server Failed",
@@ -218,6 +240,18 @@ MainMenu::MainMenu(const std::filesystem::path &clientMetaFilePath,
       case Client::ConnectionStatus::SUCCESS:
         break;
     }
+
+    // Each ticket can only be used once, so keep the one issued this time
+    std::optional<SessionResumption> nextResumption =
+        client->sessionResumption();
+    if (nextResumption.has_value()) {
+      std::ofstream nextResumptionFile(resumptionPath, std::ios::binary);
+      nextResumptionFile.write((const char *)&*nextResumption,
+                               sizeof(SessionResumption));
+      nextResumptionFile.close();
+    } else {
+      std::filesystem::remove(resumptionPath);
+    }
   } else {
     connectToServerWithJWT(serverIP, serverPort);
 
@@ -403,16 +437,6 @@ MainMenu::MainMenu(const std::filesystem::path &clientMetaFilePath,
   ui->mainTabs->tabBar()->setTabButton(0, QTabBar::RightSide, nullptr);
   ui->mainTabs->tabBar()->setTabButton(0, QTabBar::LeftSide, nullptr);
 
-  handler->setDrawingReceivedHandler([this](DrawingRequest &drawingRequest) {
-    onReceiveDrawing(drawingRequest);
-  });
-
-  handler->setDrawingInsertResponseHandler(
-      [this](DrawingInsert::InsertResponseCode responseType,
-             unsigned responseCode) {
-        emit insertDrawingResponseReceived(responseType, responseCode);
-      });
-
   handler->setNextDrawingNumberCallback([this](const NextDrawing &nextDrawing) {
     std::basic_regex rx("^[a-zA-Z]{2}[0-9]$");
     switch (nextDrawing.drawingType) {
@@ -752,56 +776,30 @@ void MainMenu::requestNextDrawingNumbers() const {
   client->addMessageToSendQueue(manualBuffer, manualBufferSize);
 }
 
-void MainMenu::onReceiveDrawing(DrawingRequest &drawingRequest) {
-  drawingReceivedQueueMutex.lock();
-  drawingReceivedQueue.push(&drawingRequest);
-  drawingReceivedQueueMutex.unlock();
-
-  emit itemAddedToDrawingQueue();
-}
-
-unsigned MainMenu::getValidRequestCode() const {
-  std::vector<unsigned> codes;
-
-  for (std::pair<unsigned, DrawingResponseMode> code : drawingResponseActions) {
-    codes.push_back(code.first);
-  }
-  for (unsigned i = 0; i < codes.size(); i++) {
-    unsigned target = codes[i];
-    while (target < codes.size() && target != codes[target]) {
-      unsigned temp = codes[target];
-      codes[target] = target;
-      target = temp;
-    }
-  }
-  for (unsigned i = 0; i < codes.size(); i++) {
-    if (codes[i] != i) {
-      return i;
-    }
-  }
-  return codes.size();
-}
-
-unsigned MainMenu::getValidInsertCode() const {
-  std::vector<unsigned> codes;
-
-  for (std::pair<unsigned, const Drawing *> code : drawingInserts) {
-    codes.push_back(code.first);
-  }
-  for (unsigned i = 0; i < codes.size(); i++) {
-    unsigned target = codes[i];
-    while (target < codes.size() && target != codes[target]) {
-      unsigned temp = codes[target];
-      codes[target] = target;
-      target = temp;
-    }
-  }
-  for (unsigned i = 0; i < codes.size(); i++) {
-    if (codes[i] != i) {
-      return i;
-    }
-  }
-  return codes.size();
+void MainMenu::sendDrawingInsert(const Drawing &drawing, bool force) {
+  DrawingInsert insert;
+  insert.drawingData = drawing;
+  insert.setForce(force);
+
+  // Keep the drawing in case the server asks whether to overwrite it
+  unsigned insertID = nextDrawingInsertID++;
+  drawingInserts[insertID] = drawing;
+
+  // The response comes back on the client loop, so is handed to the UI
+  // thread by the signal. A slow insert may still succeed, so it isn't given
+  // up on while the connection lasts, and only fails if the connection drops.
+  client->request<DrawingInsert>(
+      insert,
+      [this, insertID](std::future<DrawingInsert> &&response) {
+        DrawingInsert::InsertResponseCode responseType;
+        try {
+          responseType = response.get().insertResponseCode;
+        } catch (const RequestError &) {
+          responseType = DrawingInsert::NONE;
+        }
+        emit insertDrawingResponseReceived(responseType, insertID);
+      },
+      std::chrono::milliseconds(NO_REQUEST_TIMEOUT));
 }
 
 void MainMenu::connectToServerWithJWT(const std::string &serverIP,
@@ -949,7 +947,23 @@ void MainMenu::searchButtonPressed() {
 
   unsigned bufferSize;
   void *queryBuffer = query.createBuffer(bufferSize);
-  client->addMessageToSendQueue(queryBuffer, bufferSize);
+
+  // Searches may finish out of order, so only the latest one's results are
+  // shown. The one before it is no longer wanted, so stop waiting for it.
+  client->cancelRequest(searchRequest);
+  unsigned search = ++latestSearch;
+  searchRequest = client->request(
+      queryBuffer, bufferSize,
+      [this, search](std::future<MessageBuffer> &&response) {
+        try {
+          MessageBuffer results = response.get();
+          if (latestSearch == search) {
+            searchResultsModel->sourceDataFromBuffer(results.release());
+          }
+        } catch (const RequestError &) {
+          // Cancelled by a newer search, or the server never answered
+        }
+      });
   free(queryBuffer);
 }
 
@@ -970,21 +984,94 @@ void MainMenu::handleSearchElementContextMenu(const QPoint &pos) {
       menu->addAction(
           ("Open drawing " + summary.drawingNumber + " in new tab").c_str(),
           [this, summary]() { openDrawingView(summary.matID); }, Qt::Key_Enter);
+
+      // If the clicked drawing is one of several selected, they can all be
+      // opened together
+      std::set<int> selectedRows;
+      for (const QModelIndex &index :
+           ui->searchResultsTable->selectionModel()->selectedIndexes()) {
+        selectedRows.insert(index.row());
+      }
+      if (selectedRows.size() > 1 && selectedRows.count(item.row())) {
+        std::vector<unsigned> matIDs;
+        for (int row : selectedRows) {
+          matIDs.push_back(searchResultsModel->summaryAtRow(row).matID);
+        }
+        menu->addAction(("Open " + std::to_string(matIDs.size()) +
+                         " selected drawings in new tabs")
+                            .c_str(),
+                        [this, matIDs]() { openDrawingViews(matIDs); });
+      }
       menu->popup(ui->searchResultsTable->viewport()->mapToGlobal(pos));
     }
   }
 }
 
 void MainMenu::openDrawingView(unsigned matID) {
-  unsigned responseEchoCode = getValidRequestCode();
-  drawingResponseActions[responseEchoCode] = OPEN_DRAWING_VIEW_TAB;
+  std::unique_ptr<DrawingRequest> request(
+      &DrawingRequest::makeRequest(matID, 0));
+
+  // The drawing comes back on the client loop, so is queued for the UI thread
+  client->request<DrawingRequest>(
+      *request, [this, matID](std::future<DrawingRequest> &&response) {
+        std::unique_ptr<DrawingRequest> drawingRequest;
+        try {
+          drawingRequest = std::make_unique<DrawingRequest>(response.get());
+        } catch (const RequestError &) {
+          drawingRequest.reset(&DrawingRequest::makeRequest(matID, 0));
+          drawingRequest->drawingData = Drawing();
+          drawingRequest->drawingData->setLoadWarning(Drawing::LOAD_FAILED);
+        }
 
-  DrawingRequest request = DrawingRequest::makeRequest(matID, responseEchoCode);
+        drawingReceivedQueueMutex.lock();
+        drawingReceivedQueue.push(std::move(drawingRequest));
+        drawingReceivedQueueMutex.unlock();
 
-  unsigned bufferSize;
-  void *requestBuffer = request.createBuffer(bufferSize);
-  client->addMessageToSendQueue(requestBuffer, bufferSize);
-  free(requestBuffer);
+        emit itemAddedToDrawingQueue();
+      });
+}
+
+void MainMenu::openDrawingViews(const std::vector<unsigned> &matIDs) {
+  // The drawings are fetched in as few requests as the server allows, rather
+  // than one request each
+  for (size_t first = 0; first < matIDs.size(); first += DRAWING_BATCH_LIMIT) {
+    DrawingBatchRequest request;
+    request.matIDs.assign(
+        matIDs.begin() + first,
+        matIDs.begin() + MIN(first + DRAWING_BATCH_LIMIT, matIDs.size()));
+
+    // The drawings come back on the client loop, so are queued for the UI
+    // thread one at a time, as if each had been requested on its own
+    client->request<DrawingBatchRequest>(
+        request, [this, batchMatIDs = request.matIDs](
+                     std::future<DrawingBatchRequest> &&response) {
+          std::vector<Drawing> drawings;
+          try {
+            DrawingBatchRequest batch = response.get();
+            if (batch.drawingData.has_value()) {
+              drawings = std::move(batch.drawingData.value());
+            }
+          } catch (const std::exception &) {
+            // Every drawing in the batch is reported as failing to load
+          }
+
+          drawingReceivedQueueMutex.lock();
+          for (size_t i = 0; i < batchMatIDs.size(); i++) {
+            std::unique_ptr<DrawingRequest> drawingRequest(
+                &DrawingRequest::makeRequest(batchMatIDs[i], 0));
+            if (i < drawings.size()) {
+              drawingRequest->drawingData = std::move(drawings[i]);
+            } else {
+              drawingRequest->drawingData = Drawing();
+              drawingRequest->drawingData->setLoadWarning(Drawing::LOAD_FAILED);
+            }
+            drawingReceivedQueue.push(std::move(drawingRequest));
+          }
+          drawingReceivedQueueMutex.unlock();
+
+          emit itemAddedToDrawingQueue();
+        });
+  }
 }
 
 void MainMenu::closeTab(int index) {
@@ -1011,19 +1098,7 @@ void MainMenu::openAddDrawingTab(NextDrawing::DrawingType type) {
   }
   addDrawingPage->setConfirmationCallback(
       [this](const Drawing &drawing, bool force) {
-        std::unique_ptr<DrawingInsert> insert(new DrawingInsert);
-        insert->drawingData = drawing;
-
-        insert->setForce(force);
-
-        insert->responseEchoCode = getValidInsertCode();
-        drawingInserts[insert->responseEchoCode] = &drawing;
-
-        unsigned bufferSize = insert->serialisedSize() + 1;
-        void *buffer = malloc(bufferSize);
-        insert->serialise(buffer);
-
-        client->addMessageToSendQueue(buffer, bufferSize);
+        sendDrawingInsert(drawing, force);
       });
   ui->mainTabs->addTab(addDrawingPage, tr("Add Drawing"));
   ui->mainTabs->setCurrentWidget(addDrawingPage);
@@ -1032,99 +1107,89 @@ void MainMenu::openAddDrawingTab(NextDrawing::DrawingType type) {
 void MainMenu::processDrawings() {
   drawingReceivedQueueMutex.lock();
   while (!drawingReceivedQueue.empty()) {
-    DrawingRequest *request = drawingReceivedQueue.front();
+    std::unique_ptr<DrawingRequest> request =
+        std::move(drawingReceivedQueue.front());
     drawingReceivedQueue.pop();
 
-    switch (drawingResponseActions[request->responseEchoCode]) {
-      case OPEN_DRAWING_VIEW_TAB:
-        if (request->drawingData->loadWarning(
-                Drawing::LoadWarning::LOAD_FAILED)) {
-          QMessageBox::about(this, "Drawing Load Failed",
-                             "Attempt to load this drawing from "
-                             "the database failed.");
-        } else {
-          DrawingViewWidget *drawingView =
-              new DrawingViewWidget(request->drawingData.value(), ui->mainTabs);
-          Drawing &drawing = request->drawingData.value();
-
-          drawingView->setChangeDrawingCallback(
-              [this,
-               drawing](AddDrawingPageWidget::AddDrawingMode mode) mutable {
-                bool automatic;
-                if (drawing.drawingNumber().front() != 'M') {
-                  automatic = true;
-                } else {
-                  automatic = false;
-                }
-                if (mode == AddDrawingPageWidget::CLONE_DRAWING) {
-                  if (automatic)
-                    drawing.setDrawingNumber(nextAutomaticDrawingNumber);
-                  else
-                    drawing.setDrawingNumber(nextManualDrawingNumber);
-                  drawing.setDate(Date::today());
-                }
-                AddDrawingPageWidget *addDrawingPage = new AddDrawingPageWidget(
-                    drawing, mode, automatic, ui->mainTabs);
-                addDrawingPage->setUserEmail(clientEmailAddress);
-                addDrawingPage->setConfirmationCallback(
-                    [this](const Drawing &drawing, bool force) {
-                      std::unique_ptr<DrawingInsert> insert(
-                          new DrawingInsert());
-                      insert->drawingData = drawing;
-
-                      insert->setForce(force);
-
-                      insert->responseEchoCode = getValidInsertCode();
-                      drawingInserts[insert->responseEchoCode] = &drawing;
-
-                      unsigned bufferSize = insert->serialisedSize() + 1;
-                      void *buffer = malloc(bufferSize);
-                      insert->serialise(buffer);
-
-                      client->addMessageToSendQueue(buffer, bufferSize);
-                      free(buffer);
-                    });
-                switch (mode) {
-                  case AddDrawingPageWidget::CLONE_DRAWING:
-                    ui->mainTabs->addTab(addDrawingPage, tr("Clone Drawing"));
-                    break;
-                  case AddDrawingPageWidget::EDIT_DRAWING:
-                    ui->mainTabs->addTab(addDrawingPage, tr("Edit Drawing"));
-                    break;
-                  default:
-                    break;
-                }
-                ui->mainTabs->setCurrentWidget(addDrawingPage);
-              });
+    if (request->drawingData->loadWarning(Drawing::LoadWarning::LOAD_FAILED)) {
+      QMessageBox::about(this, "Drawing Load Failed",
+                         "Attempt to load this drawing from "
+                         "the database failed.");
+    } else {
+      DrawingViewWidget *drawingView =
+          new DrawingViewWidget(request->drawingData.value(), ui->mainTabs);
+      Drawing &drawing = request->drawingData.value();
+
+      drawingView->setChangeDrawingCallback(
+          [this, drawing](AddDrawingPageWidget::AddDrawingMode mode) mutable {
+            bool automatic;
+            if (drawing.drawingNumber().front() != 'M') {
+              automatic = true;
+            } else {
+              automatic = false;
+            }
+            if (mode == AddDrawingPageWidget::CLONE_DRAWING) {
+              if (automatic)
+                drawing.setDrawingNumber(nextAutomaticDrawingNumber);
+              else
+                drawing.setDrawingNumber(nextManualDrawingNumber);
+              drawing.setDate(Date::today());
+            }
+            AddDrawingPageWidget *addDrawingPage = new AddDrawingPageWidget(
+                drawing, mode, automatic, ui->mainTabs);
+            addDrawingPage->setUserEmail(clientEmailAddress);
+            addDrawingPage->setConfirmationCallback(
+                [this](const Drawing &drawing, bool force) {
+                  sendDrawingInsert(drawing, force);
+                });
+            switch (mode) {
+              case AddDrawingPageWidget::CLONE_DRAWING:
+                ui->mainTabs->addTab(addDrawingPage, tr("Clone Drawing"));
+                break;
+              case AddDrawingPageWidget::EDIT_DRAWING:
+                ui->mainTabs->addTab(addDrawingPage, tr("Edit Drawing"));
+                break;
+              default:
+                break;
+            }
+            ui->mainTabs->setCurrentWidget(addDrawingPage);
+          });
 
-          ui->mainTabs->addTab(
-              drawingView,
-              tr((request->drawingData->drawingNumber() + " Details").c_str()));
-          ui->mainTabs->setCurrentWidget(drawingView);
-        }
-        break;
+      ui->mainTabs->addTab(
+          drawingView,
+          tr((request->drawingData->drawingNumber() + " Details").c_str()));
+      ui->mainTabs->setCurrentWidget(drawingView);
     }
-
-    drawingResponseActions.erase(request->responseEchoCode);
   }
   drawingReceivedQueueMutex.unlock();
 }
 
 void MainMenu::insertDrawingResponse(
-    DrawingInsert::InsertResponseCode responseType, unsigned responseCode) {
+    DrawingInsert::InsertResponseCode responseType, unsigned insertID) {
+  std::unordered_map<unsigned, Drawing>::iterator insert =
+      drawingInserts.find(insertID);
+  if (insert == drawingInserts.end()) {
+    return;
+  }
+  Drawing drawing = std::move(insert->second);
+  drawingInserts.erase(insert);
+
   switch (responseType) {
     case DrawingInsert::NONE:
+      QMessageBox::about(this, "Insert Drawing",
+                         "The connection to the server was lost before it "
+                         "answered the request to add the drawing, so the "
+                         "drawing may or may not have been added. Search for "
+                         "it before trying again.");
       break;
     case DrawingInsert::SUCCESS:
       QMessageBox::about(this, "Insert Drawing",
                          "Drawing successfully added to database.");
-      drawingInserts.erase(responseCode);
       break;
     case DrawingInsert::FAILED:
       QMessageBox::about(this, "Insert Drawing",
                          "The attempt to add the drawing to the database "
                          "was unsuccessful.");
-      drawingInserts.erase(responseCode);
       break;
     case DrawingInsert::DRAWING_EXISTS:
       QMessageBox::StandardButton questionResponse =
@@ -1133,18 +1198,7 @@ void MainMenu::insertDrawingResponse(
                                 "database. Would you like "
                                 "to update it?");
       if (questionResponse == QMessageBox::Yes) {
-        std::unique_ptr<DrawingInsert> insert(new DrawingInsert);
-        insert->responseEchoCode = responseCode;
-        insert->insertResponseCode = DrawingInsert::NONE;
-        insert->drawingData = *drawingInserts[responseCode];
-        insert->setForce(true);
-
-        unsigned bufferSize = insert->serialisedSize() + 1;
-        void *buffer = malloc(bufferSize);
-        insert->serialise(buffer);
-
-        client->addMessageToSendQueue(buffer, bufferSize);
-        free(buffer);
+        sendDrawingInsert(drawing, true);
       }
       break;
   }
@@ -16,6 +16,7 @@
 #include <regex>
 #include <QShortcut>
 #include <memory>
+#include <set>
 
 #include "../include/networking/Client.h"
 #include "../include/database/DatabaseQuery.h"
@@ -62,10 +63,6 @@ public:
     ~MainMenu() override;
 
 private:
-    enum DrawingResponseMode {
-        OPEN_DRAWING_VIEW_TAB
-    };
-
     Ui::MainMenu *ui = nullptr;
 
     Client *client = nullptr;
@@ -91,11 +88,7 @@ private:
 
     void requestNextDrawingNumbers() const;
 
-    void onReceiveDrawing(DrawingRequest &drawingRequest);
-
-    unsigned getValidRequestCode() const;
-
-    unsigned getValidInsertCode() const;
+    void sendDrawingInsert(const Drawing &drawing, bool force);
 
     void openAddDrawingTab(NextDrawing::DrawingType type);
 
@@ -112,12 +105,17 @@ private:
     MachineModelFilter *machineModelFilter = nullptr;
 
     DrawingSearchResultsModel *searchResultsModel = nullptr;
+    // The number of the most recent search, and its request. Searches may finish out of order, so only its
+    // results are shown.
+    std::atomic<unsigned> latestSearch = 0;
+    RequestID searchRequest = NO_REQUEST_ID;
 
-    std::unordered_map<unsigned, DrawingResponseMode> drawingResponseActions;
-    std::queue<DrawingRequest *> drawingReceivedQueue;
+    std::queue<std::unique_ptr<DrawingRequest>> drawingReceivedQueue;
     std::mutex drawingReceivedQueueMutex;
 
-    std::unordered_map<unsigned, const Drawing *> drawingInserts;
+    // The drawings sent to be inserted which haven't been answered yet, by the number they were sent with
+    std::unordered_map<unsigned, Drawing> drawingInserts;
+    unsigned nextDrawingInsertID = 0;
 
     std::string nextAutomaticDrawingNumber, nextManualDrawingNumber;
 
@@ -132,11 +130,13 @@ private slots:
 
     void openDrawingView(unsigned matID);
 
+    void openDrawingViews(const std::vector<unsigned> &matIDs);
+
     void closeTab(int index);
 
     void processDrawings();
 
-    void insertDrawingResponse(DrawingInsert::InsertResponseCode responseType, unsigned responseCode);
+    void insertDrawingResponse(DrawingInsert::InsertResponseCode responseType, unsigned insertID);
 
     void insertComponentResponse(ComponentInsert::ComponentInsertResponse responseCode);
 
@@ -149,13 +149,11 @@ signals:
     void itemAddedToDrawingQueue();
 
     /// <summary>
-    /// This singal is emitted when the \ref DatabaseResponseHandler recieves a \ref DrawingInsert.
+    /// This singal is emitted when the \ref Client recieves the response to a \ref DrawingInsert.
     /// </summary>
-    /// <param name="insertResponseType">The response code of the insert.</param>
-    /// <param name="echoResponseCode">Currently unsed, however this code links to DrawingResponseCode,
-    /// and is kept the same across the lifespan of a drawing insert, so when it is returned, the
-    /// relevant DrawingResponseCode can be selected.</param>
-    void insertDrawingResponseReceived(DrawingInsert::InsertResponseCode insertResponseType, unsigned echoResponseCode);
+    /// <param name="insertResponseType">The response code of the insert, or NONE if there was no response.</param>
+    /// <param name="insertID">The number the insert was sent with, which identifies the drawing it was for.</param>
+    void insertDrawingResponseReceived(DrawingInsert::InsertResponseCode insertResponseType, unsigned insertID);
 
     /// <summary>
     /// This signal is emitted when the \ref DatabaseResponseHandler recieves a \ref ComponentInsert.
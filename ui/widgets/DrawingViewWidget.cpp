@@ -12,7 +12,7 @@ DrawingViewWidget::DrawingViewWidget(const Drawing &drawing, QWidget *parent)
     ui->rebatedCheckbox->setAttribute(Qt::WA_TransparentForMouseEvents);
     ui->rebatedCheckbox->setFocusPolicy(Qt::NoFocus);
 
-    this->drawing = &drawing;
+    this->drawing = std::make_unique<const Drawing>(drawing);
 
     this->pdfDocument = new QPdfDocument();
     this->pdfViewer = new QPdfView(this);
@@ -11,6 +11,7 @@
 #include <QPdfView>
 #include <QDesktopServices>
 #include <limits>
+#include <memory>
 #include <tuple>
 #include <variant>
 #include "../../pricing-package/include/PricingPackage.h"
@@ -41,7 +42,7 @@ class DrawingViewWidget : public QWidget {
 
 public:
     /// <summary>
-    /// Creates a new widget with an assigned drawing.
+    /// Creates a new widget with a copy of the given drawing.
     /// </summary>
     /// <param name="drawing"></param>
     /// <param name="parent"></param>
@@ -66,7 +67,7 @@ public:
 private:
     Ui::DrawingViewWidget *ui;
 
-    const Drawing *drawing;
+    std::unique_ptr<const Drawing> drawing;
 
     std::function<void(AddDrawingPageWidget::AddDrawingMode)> changeDrawingCallback = nullptr;
 